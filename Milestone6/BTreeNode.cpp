@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <cstring>
 #include "BTreeNode.h"
 using namespace std;
@@ -26,55 +27,78 @@ void BTreeNode::save() {
     this->file.put(this->block);
 }
 
-// Get the record and turn it into a block ID.
+// Get the record and turn it into a block ID (read in place).
 BlockID BTreeNode::get_block_id(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID block_id = *(BlockID *)dbt->get_data();
-    delete dbt;
-    return block_id;
+    RecordView record = this->block->view(record_id);
+    return *(const BlockID *)record.data();
 }
 
-// Get the record and turn it into a Handle.
+// Get the record and turn it into a Handle (read in place).
 Handle BTreeNode::get_handle(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID handle_block_id = *(BlockID *)dbt->get_data();
-    RecordID handle_record_id = *(RecordID *)((char*)dbt->get_data() + sizeof(BlockID));
-    delete dbt;
+    RecordView record = this->block->view(record_id);
+    BlockID handle_block_id = *(const BlockID *)record.data();
+    RecordID handle_record_id = *(const RecordID *)(record.data() + sizeof(BlockID));
     return Handle(handle_block_id, handle_record_id);
 }
 
-// Get the record and turn it into a KeyValue.
+// Get the record and turn it into a KeyValue (read in place).
 KeyValue *BTreeNode::get_key(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char*)dbt->get_data();
+    RecordView record = this->block->view(record_id);
     KeyValue *key_value = new KeyValue();
     Value value;
-    uint offset = 0;
+    uint16_t offset = 0;
     for (auto const& data_type: this->key_profile) {
         value.data_type = data_type;
         if (data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t*)(bytes + offset);
+            value.n = record.int_at(offset);
             offset += sizeof(int32_t);
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *)(bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes+offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
+            TextView text = record.text_at(offset);
+            value.s = text.str();  // assume ascii for now
+            offset += sizeof(uint16_t) + text.size();
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t*)(bytes + offset);
+            value.n = record.boolean_at(offset);
             offset += sizeof(uint8_t);
         } else {
             throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
         }
         key_value->push_back(value);
     }
-    delete dbt;
     return key_value;
 }
 
+// Compare the key in the record to the given key without decoding it: negative if the record's
+// key is lower, zero if equal, positive if higher. If key has fewer values than the profile, only
+// that many leading columns are compared (so a prefix compares equal to every key that starts with it).
+int BTreeNode::compare_key(RecordID record_id, const KeyValue* key) const {
+    RecordView record = this->block->view(record_id);
+    uint16_t offset = 0;
+    for (uint i = 0; i < key->size() && i < this->key_profile.size(); i++) {
+        ColumnAttribute::DataType data_type = this->key_profile[i];
+        const Value &value = (*key)[i];
+        if (data_type == ColumnAttribute::DataType::INT) {
+            int32_t n = record.int_at(offset);
+            if (n != value.n)
+                return n < value.n ? -1 : 1;
+            offset += sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            TextView text = record.text_at(offset);
+            int c = text.compare(value.s);
+            if (c != 0)
+                return c;
+            offset += sizeof(uint16_t) + text.size();
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            int32_t n = record.boolean_at(offset) ? 1 : 0;
+            if (n != value.n)
+                return n < value.n ? -1 : 1;
+            offset += sizeof(uint8_t);
+        } else {
+            throw DbRelationError("Only know how to compare INT, TEXT, or BOOLEAN");
+        }
+    }
+    return 0;
+}
+
 // Convert block_id into bytes.
 Dbt *BTreeNode::marshal_block_id(BlockID block_id) {
     char *bytes = new char[sizeof(BlockID)];
@@ -98,7 +122,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
     uint offset = 0;
     uint col_num = 0;
     for (auto const& data_type: this->key_profile) {
-        Value value = (*key)[col_num];
+        Value value = (*key)[col_num++];
 
         if (data_type == ColumnAttribute::DataType::INT) {
             if (offset + 4 > DbBlock::BLOCK_SZ - 4)
@@ -178,26 +202,7 @@ void BTreeStat::save() {
  *****************/
 
 BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create)
-        : BTreeNode(file, block_id, key_profile, create), first(0), pointers(), boundaries() {
-    if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == 1) {
-                // first pointer
-                this->first = get_block_id(i);
-            } else if (i%2 != 0) {
-                // pointer
-                this->pointers.push_back(get_block_id(i));
-            } else {
-                // key
-                KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
-            }
-            i++;
-        }
-        delete record_id_list;
-    }
+        : BTreeNode(file, block_id, key_profile, create), loaded(create), first(0), pointers(), boundaries() {
 }
 
 BTreeInterior::~BTreeInterior() {
@@ -206,19 +211,51 @@ BTreeInterior::~BTreeInterior() {
     this->boundaries.clear();
 }
 
+// Decode the page into first, pointers, and boundaries (only needed to change the node).
+void BTreeInterior::load() {
+    if (this->loaded)
+        return;
+    this->first = get_block_id(1);
+    for (uint i = 0; i < boundary_count(); i++) {
+        this->boundaries.push_back(get_key(2*i + 2));
+        this->pointers.push_back(get_block_id(2*i + 3));
+    }
+    this->loaded = true;
+}
+
 // Get next block down in tree where key must be.
+// Binary search for the first boundary greater than key: we want the pointer just before it
+// (first if it is the very first boundary, the last pointer if there isn't one).
 BTreeNode *BTreeInterior::find(const KeyValue* key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
-        }
+    uint lo = 0, hi = boundary_count();
+    while (lo < hi) {
+        uint mid = (lo + hi) / 2;
+        if (compare_key(2*mid + 2, key) > 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return child(lo, depth);
+}
+
+// Get next block down in tree where the first key not less than key must be. Unlike find(), a boundary
+// equal to key sends us to its left, since with a prefix key the matches can start there. The caller
+// follows the leaf chain from wherever this ends up.
+BTreeNode *BTreeInterior::find_lower(const KeyValue* key, uint depth) const {
+    uint lo = 0, hi = key == nullptr ? 0 : boundary_count();
+    while (lo < hi) {
+        uint mid = (lo + hi) / 2;
+        if (compare_key(2*mid + 2, key) >= 0)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
+    return child(lo, depth);
+}
+
+// The node under the pointer before boundary i (first for i == 0).
+BTreeNode *BTreeInterior::child(uint i, uint depth) const {
+    BlockID down = get_block_id(i == 0 ? 1 : 2*i + 1);
     if (depth == 2)
         return new BTreeLeaf(this->file, down, this->key_profile, false);
     else
@@ -256,10 +293,11 @@ Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
 
     Dbt *dbt;
 
+    load();
     bool inserted = false;
     for (uint i = 0; i < this->boundaries.size(); i++) {
         KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
+        if (*boundary < *check) {  // keep the boundaries in order
             this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
             this->pointers.insert(this->pointers.begin() + i, block_id);
             inserted = true;
@@ -317,10 +355,45 @@ Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
         // save everything
         nnode->save();
         this->save();
+        delete nnode;
         return ret;
     }
 }
 
+// Bulk-load helper: add the boundary and block_id after the entries already here (which must
+// all be lower). Returns false, adding nothing, if that would fill the block past fill_percent
+// (but a node always gets at least one boundary if it fits at all).
+bool BTreeInterior::append(const KeyValue* boundary, BlockID block_id, uint fill_percent) {
+    Dbt *dbt = marshal_key(boundary);
+    uint needed = dbt->get_size() + 4 + sizeof(BlockID) + 4;  // both records and their headers
+    if (this->boundaries.empty())
+        needed += sizeof(BlockID) + 4;  // first pointer, too
+    uint unused = this->block->unused_bytes();
+    uint used = DbBlock::BLOCK_SZ - unused;
+    bool fits = needed <= unused && (this->boundaries.empty() || used + needed <= DbBlock::BLOCK_SZ * fill_percent / 100);
+    if (fits) {
+        // (save will redo these in the same order)
+        if (this->boundaries.empty()) {
+            Dbt *first_dbt = marshal_block_id(this->first);
+            this->block->add(first_dbt);
+            delete[] (char *) first_dbt->get_data();
+            delete first_dbt;
+        }
+        this->block->add(dbt);
+        this->boundaries.push_back(new KeyValue(*boundary));
+        this->pointers.push_back(block_id);
+    }
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    if (fits) {
+        dbt = marshal_block_id(block_id);
+        this->block->add(dbt);
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+    }
+    return fits;
+}
+
 
 ostream &operator<<(ostream &out, const BTreeInterior &node) {
     out << "(interior block " << node.id << "): " << node.first;
@@ -339,31 +412,53 @@ ostream &operator<<(ostream &out, const BTreeInterior &node) {
  *************/
 
 BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create)
-        : BTreeNode(file, block_id, key_profile, create), next_leaf(0), key_map() {
-    if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == record_id_list->size()) {
-                // next leaf block
-                this->next_leaf = get_block_id(i);
-            } else if (i%2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i-1);
-            }
-            i++;
-        }
-        delete record_id_list;
-    }
+        : BTreeNode(file, block_id, key_profile, create), loaded(create), next_leaf(0), key_map() {
+    if (!create)
+        this->next_leaf = get_block_id(this->block->last_record_id());
 }
 
 BTreeLeaf::~BTreeLeaf() {
 }
 
-// Find the handle for a given key
-Handle BTreeLeaf::find_eq(const KeyValue* key) const {
-    return this->key_map.at(*key);
+// Decode the page into key_map (only needed to change the leaf).
+void BTreeLeaf::load() {
+    if (this->loaded)
+        return;
+    for (uint i = 0; i < entry_count(); i++) {
+        KeyValue *key_value = get_key(2*i + 2);
+        RecordView handles = this->block->view(2*i + 1);
+        this->key_map[*key_value] = string(handles.data(), handles.size());
+        delete key_value;
+    }
+    this->loaded = true;
+}
+
+BTreeLeaf *BTreeLeaf::get_next() const {
+    if (this->next_leaf == 0)
+        return nullptr;
+    return new BTreeLeaf(this->file, this->next_leaf, this->key_profile, false);
+}
+
+// Binary search for the first entry whose key is not less than key (entry_count() if there isn't one).
+uint BTreeLeaf::lower_bound(const KeyValue* key) const {
+    uint lo = 0, hi = entry_count();
+    while (lo < hi) {
+        uint mid = (lo + hi) / 2;
+        if (compare_key(2*mid + 2, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+BlockID BTreeLeaf::get_entry_handles(uint entry, Handles &handles) const {
+    RecordView record = this->block->view(2*entry + 1);
+    return BTreePostings::decode(record.data(), record.size(), handles);
+}
+
+BlockID BTreeLeaf::get_overflow_handles(BlockID block_id, Handles &handles) const {
+    return BTreePostings::read_overflow(this->file, block_id, handles);
 }
 
 // Save the key_map and next_leaf data in the correct order
@@ -371,11 +466,9 @@ void BTreeLeaf::save() {
     Dbt *dbt;
     this->block->clear();
     for (auto const& item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        // handles
+        Dbt handles((void *) item.second.data(), (u_int32_t) item.second.size());
+        this->block->add(&handles);
 
         // key
         dbt = marshal_key(&item.first);
@@ -392,34 +485,25 @@ void BTreeLeaf::save() {
     BTreeNode::save();
 }
 
-// Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue* key, Handle handle) {
+// Insert key, handle pair into block. For a key that's already here (in a non-unique index), the
+// handle goes into its posting list.
+Insertion BTreeLeaf::insert(const KeyValue* key, Handle handle, bool unique) {
     // cout << "inserting " << (*key)[0] << " into leaf " << id << endl; // DEBUG
-    // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
-        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    load();
+    auto found = this->key_map.find(*key);
+    if (found != this->key_map.end()) {
+        if (unique)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        found->second = BTreePostings::add(this->file, found->second, handle);
+    } else {
+        this->key_map[*key] = BTreePostings::build(this->file, Handles(1, handle));
+    }
 
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
     try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
         save();
         return BTreeNode::insertion_none();
 
     } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
         // too big, so split
 
         // create the sister and put her to the right
@@ -428,8 +512,7 @@ Insertion BTreeLeaf::insert(const KeyValue* key, Handle handle) {
         this->next_leaf = nleaf->id;
 
         // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
+        auto key_list = this->key_map;       // make a copy of my key_map (with the new handle in it)
         u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
         this->key_map.clear();               // empty my list
         u_long i = 0;
@@ -450,7 +533,200 @@ Insertion BTreeLeaf::insert(const KeyValue* key, Handle handle) {
 
         nleaf->save();
         this->save();
-        return Insertion(nleaf->id, boundary);
+        BlockID nleaf_id = nleaf->id;
+        delete nleaf;
+        return Insertion(nleaf_id, boundary);
+    }
+}
+
+// Bulk-load helper: add the key and its handles record after the entries already here (which must
+// all be lower). Returns false, adding nothing, if that would fill the block past fill_percent (but a
+// leaf always gets at least one entry if it fits at all). Room is kept for the next_leaf record.
+bool BTreeLeaf::append(const KeyValue* key, const string &postings, uint fill_percent) {
+    Dbt *key_dbt = marshal_key(key);
+    Dbt handles_dbt((void *) postings.data(), (u_int32_t) postings.size());
+    uint needed = handles_dbt.get_size() + 4 + key_dbt->get_size() + 4;  // both records and their headers
+    uint reserve = sizeof(BlockID) + 4;  // next_leaf record
+    uint unused = this->block->unused_bytes();
+    uint used = DbBlock::BLOCK_SZ - unused;
+    bool fits = needed + reserve <= unused
+                && (this->key_map.empty() || used + needed + reserve <= DbBlock::BLOCK_SZ * fill_percent / 100);
+    if (fits) {
+        // (save will redo these in the same order)
+        this->block->add(&handles_dbt);
+        this->block->add(key_dbt);
+        this->key_map[*key] = postings;
     }
+    delete[] (char *) key_dbt->get_data();
+    delete key_dbt;
+    return fits;
+}
+
+
+/*****************
+ * BTreePostings *
+ *****************/
+
+static const uint SINGLE = sizeof(BlockID) + sizeof(RecordID);  // size of a record with just one handle
+
+static void put_varint(string &bytes, uint32_t n) {
+    while (n >= 0x80) {
+        bytes.push_back((char) (n | 0x80));
+        n >>= 7;
+    }
+    bytes.push_back((char) n);
+}
+
+static size_t varint_size(uint32_t n) {
+    size_t size = 1;
+    for (; n >= 0x80; n >>= 7)
+        size++;
+    return size;
 }
 
+// Bytes handles[i] takes in a chunk, depending on whether it's first there (see encode).
+static size_t handle_size(const Handles &handles, size_t i, bool first) {
+    const Handle &handle = handles[i];
+    if (first)
+        return varint_size(handle.first) + varint_size(handle.second);
+    const Handle &prev = handles[i - 1];
+    uint32_t block_delta = handle.first - prev.first;
+    return varint_size(block_delta) + varint_size(block_delta == 0 ? handle.second - prev.second : handle.second);
+}
+
+static uint32_t get_varint(const uint8_t *&p) {
+    uint32_t n = 0;
+    for (uint shift = 0; ; shift += 7) {
+        uint8_t byte = *p++;
+        n |= (uint32_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return n;
+    }
+}
+
+// One chunk at a time: as many handles as fit inline on the leaf, then full overflow blocks.
+string BTreePostings::build(HeapFile &file, const Handles &handles) {
+    if (handles.size() == 1)
+        return single(handles[0]);
+
+    // where each chunk starts
+    vector<size_t> starts(1, 0);
+    size_t size = HEADER;
+    for (size_t i = 0; i < handles.size(); i++) {
+        bool first = i == starts.back();
+        size_t needed = handle_size(handles, i, first);
+        if (!first && size + needed > (starts.size() == 1 ? MAX_INLINE : MAX_OVERFLOW)) {
+            starts.push_back(i);
+            size = HEADER + handle_size(handles, i, true);
+        } else {
+            size += needed;
+        }
+    }
+    starts.push_back(handles.size());
+
+    vector<BlockID> blocks(starts.size() - 1, 0);
+    for (size_t k = 1; k < blocks.size(); k++) {
+        SlottedPage *block = file.get_new();
+        blocks[k] = block->get_block_id();
+        delete block;
+    }
+    for (size_t k = 1; k < blocks.size(); k++)
+        write_overflow(file, blocks[k], encode(k + 1 < blocks.size() ? blocks[k + 1] : 0, handles, starts[k], starts[k + 1]));
+    return encode(blocks.size() > 1 ? blocks[1] : 0, handles, 0, starts[1]);
+}
+
+// The handle goes in the last chunk whose first handle isn't greater. If that makes the chunk too big,
+// its tail moves to a new overflow block right after it: just the new handle if it went on the very
+// end (rows mostly come in handle order, so chunks stay full), otherwise half of the chunk.
+string BTreePostings::add(HeapFile &file, const string &record, Handle handle) {
+    Handles chunk;
+    BlockID next = decode(record.data(), record.size(), chunk);
+    BlockID at = 0;  // where chunk is (0 for the leaf record)
+    while (next != 0) {
+        Handles following;
+        read_overflow(file, next, following, true);
+        if (handle < following[0])
+            break;
+        at = next;
+        chunk.clear();
+        next = read_overflow(file, at, chunk);
+    }
+    auto pos = lower_bound(chunk.begin(), chunk.end(), handle);
+    if (pos != chunk.end() && *pos == handle)
+        return record;
+    chunk.insert(pos, handle);
+
+    string encoded = encode(next, chunk, 0, chunk.size());
+    if (encoded.size() > (at == 0 ? MAX_INLINE : MAX_OVERFLOW)) {
+        size_t keep = next == 0 && chunk.back() == handle ? chunk.size() - 1 : chunk.size() / 2;
+        BlockID tail = write_overflow(file, 0, encode(next, chunk, keep, chunk.size()));
+        encoded = encode(tail, chunk, 0, keep);
+    }
+    if (at == 0)
+        return encoded;
+    write_overflow(file, at, encoded);
+    return record;
+}
+
+BlockID BTreePostings::decode(const char *data, size_t size, Handles &handles, bool first_only) {
+    if (size == SINGLE) {
+        handles.push_back(Handle(*(const BlockID *) data, *(const RecordID *) (data + sizeof(BlockID))));
+        return 0;
+    }
+    BlockID next = *(const BlockID *) data;
+    uint16_t count = *(const uint16_t *) (data + sizeof(BlockID));
+    if (first_only)
+        count = min(count, (uint16_t) 1);
+    const uint8_t *p = (const uint8_t *) data + HEADER;
+    Handle prev(0, 0);
+    for (uint i = 0; i < count; i++) {
+        uint32_t block_delta = get_varint(p);
+        uint32_t record = get_varint(p);
+        if (i > 0 && block_delta == 0)
+            record += prev.second;
+        prev = Handle(prev.first + block_delta, (RecordID) record);
+        handles.push_back(prev);
+    }
+    return next;
+}
+
+BlockID BTreePostings::read_overflow(HeapFile &file, BlockID block_id, Handles &handles, bool first_only) {
+    SlottedPage *block = file.get(block_id);
+    RecordView chunk = block->view(1);
+    BlockID next = decode(chunk.data(), chunk.size(), handles, first_only);
+    delete block;
+    return next;
+}
+
+string BTreePostings::single(Handle handle) {
+    string record((const char *) &handle.first, sizeof(BlockID));
+    record.append((const char *) &handle.second, sizeof(RecordID));
+    return record;
+}
+
+// A chunk of handles[begin:end]. (The first handle's block id is a difference from 0.)
+string BTreePostings::encode(BlockID next, const Handles &handles, size_t begin, size_t end) {
+    string chunk((const char *) &next, sizeof(BlockID));
+    uint16_t count = (uint16_t) (end - begin);
+    chunk.append((const char *) &count, sizeof(uint16_t));
+    Handle prev(0, 0);
+    for (size_t i = begin; i < end; i++) {
+        const Handle &handle = handles[i];
+        put_varint(chunk, handle.first - prev.first);
+        put_varint(chunk, i > begin && handle.first == prev.first ? handle.second - prev.second : handle.second);
+        prev = handle;
+    }
+    return chunk;
+}
+
+// Write a chunk as the only record of an overflow block (a new one if block_id is 0).
+BlockID BTreePostings::write_overflow(HeapFile &file, BlockID block_id, const string &chunk) {
+    SlottedPage *block = block_id == 0 ? file.get_new() : file.get(block_id);
+    block->clear();
+    Dbt dbt((void *) chunk.data(), (u_int32_t) chunk.size());
+    block->add(&dbt);
+    file.put(block);
+    block_id = block->get_block_id();
+    delete block;
+    return block_id;
+}
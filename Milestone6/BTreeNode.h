@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include "storage_engine.h"
 #include "heap_storage.h"
 
@@ -34,6 +35,7 @@ protected:
     virtual BlockID get_block_id(RecordID record_id) const;
     virtual Handle get_handle(RecordID record_id) const;
     virtual KeyValue* get_key(RecordID record_id) const;
+    virtual int compare_key(RecordID record_id, const KeyValue* key) const;
 };
 
 class BTreeStat : public BTreeNode {
@@ -58,13 +60,21 @@ protected:
 
 };
 
+/**
+ * Interior node. On the page, record 1 is the first pointer, and then the sorted boundaries and
+ * their pointers alternate: boundary i (from 0) is record 2i+2 and its pointer is record 2i+3.
+ * find() binary-searches the boundaries right on the page; the in-memory vectors are only
+ * decoded (load) when the node is going to be changed.
+ */
 class BTreeInterior : public BTreeNode {
 public:
     BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
     virtual ~BTreeInterior();
 
     BTreeNode *find(const KeyValue* key, uint depth) const;
+    BTreeNode *find_lower(const KeyValue* key, uint depth) const;  // key may be a prefix, or nullptr for leftmost
     Insertion insert(const KeyValue* boundary, BlockID block_id);
+    bool append(const KeyValue* boundary, BlockID block_id, uint fill_percent);
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
@@ -72,22 +82,81 @@ public:
     friend std::ostream &operator<<(std::ostream &out, const BTreeInterior &node);
 
 protected:
+    bool loaded;
     BlockID first;
     BlockPointers pointers;
     KeyValues boundaries;
+
+    void load();
+    uint boundary_count() const { return (this->block->last_record_id() - 1) / 2; }
+    BTreeNode *child(uint i, uint depth) const;
 };
 
+/**
+ * Leaf node. On the page the entries are sorted by key, with entry i (from 0) having its
+ * handles in record 2i+1 (see BTreePostings) and its key in record 2i+2. The last record is next_leaf.
+ * Lookups binary-search the keys right on the page; key_map is only decoded (load) when the
+ * leaf is going to be changed.
+ */
 class BTreeLeaf : public BTreeNode {
 public:
     BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
     virtual ~BTreeLeaf();
 
-    Handle find_eq(const KeyValue* key) const;  // throws if not found
-    Insertion insert(const KeyValue* key, Handle handle);
+    Insertion insert(const KeyValue* key, Handle handle, bool unique);  // throws on a duplicate key if unique
+    bool append(const KeyValue* key, const std::string &postings, uint fill_percent);
     virtual void save();
 
+    void set_next_leaf(BlockID next_leaf) { this->next_leaf = next_leaf; }
+    BTreeLeaf *get_next() const;  // next leaf in key order (freed by caller), nullptr at the end
+
+    // reading the entries right on the page (for range scans)
+    uint entry_count() const { return this->block->last_record_id() / 2; }
+    uint lower_bound(const KeyValue* key) const;
+    int compare_entry(uint entry, const KeyValue* key) const { return compare_key(2*entry + 2, key); }
+    // add an entry's handles (or those of the overflow block it goes on to) to handles, returning the
+    // overflow block to go on to next (0 if there's no more)
+    BlockID get_entry_handles(uint entry, Handles &handles) const;
+    BlockID get_overflow_handles(BlockID block_id, Handles &handles) const;
+
 protected:
+    bool loaded;
     BlockID next_leaf;
-    std::map<KeyValue,Handle> key_map;
+    std::map<KeyValue,std::string> key_map;  // each key's handles record
+
+    void load();
 };
 
+/**
+ * The handles record of a leaf entry. A single handle is stored as is (so the leaves of a unique
+ * index are just key/handle pairs). More than one handle (a non-unique index) makes a posting list:
+ * the handles in order, delta-encoded, in a chain of chunks. The first chunk is the leaf record
+ * itself, up to MAX_INLINE bytes; the rest are on overflow blocks, one chunk each, so a hot key
+ * doesn't crowd its leaf. Walking the list reads the chunks in turn.
+ *
+ * A chunk is the next overflow block (0 at the end), a u16 count of handles, and the handles as
+ * varints: the first as its block id and record id, each one after that as the difference in block
+ * id and then the record id (also as a difference if the block id is the same).
+ */
+class BTreePostings {
+public:
+    static const uint MAX_INLINE = 256;
+    static const uint MAX_OVERFLOW = DbBlock::BLOCK_SZ - 16;  // one record in the block, with its header
+
+    // A record for some handles, writing any overflow blocks it needs (handles sorted, no duplicates).
+    static std::string build(HeapFile &file, const Handles &handles);
+
+    // The record with handle added (in place in the overflow blocks, splitting any chunk that gets too big).
+    static std::string add(HeapFile &file, const std::string &record, Handle handle);
+
+    // Add a record's or an overflow block's handles to handles, returning the next overflow block (or 0).
+    static BlockID decode(const char *data, size_t size, Handles &handles, bool first_only=false);
+    static BlockID read_overflow(HeapFile &file, BlockID block_id, Handles &handles, bool first_only=false);
+
+protected:
+    static const uint HEADER = sizeof(BlockID) + sizeof(uint16_t);
+
+    static std::string single(Handle handle);
+    static std::string encode(BlockID next, const Handles &handles, size_t begin, size_t end);
+    static BlockID write_overflow(HeapFile &file, BlockID block_id, const std::string &chunk);
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdint>
 #include "EvalPlan.h"
 
 
@@ -20,82 +22,819 @@ public:
     virtual ValueDict* project(Handle handle, const ColumnNames* column_names) {return nullptr;}
 };
 
-EvalPlan::EvalPlan(PlanType type, EvalPlan *relation)
-        : type(type), relation(relation), projection(nullptr), select_conjunction(nullptr), table(Dummy::one()) {
+DbRelation &EvalPlan::no_table() {
+    return Dummy::one();
+}
+
+EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation) {
 }
 
 EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation)
-        : type(Project), relation(relation), projection(projection), select_conjunction(nullptr), table(Dummy::one()) {
+        : type(Project), relation(relation), projection(projection) {
 }
 
 EvalPlan::EvalPlan(ValueDict* conjunction, EvalPlan *relation)
-        : type(Select), relation(relation), projection(nullptr), select_conjunction(conjunction), table(Dummy::one()) {
+        : type(Select), relation(relation), select_conjunction(conjunction) {
+}
+
+EvalPlan::EvalPlan(ValueDict* conjunction, Predicate *predicate, EvalPlan *relation)
+        : type(Select), relation(relation), select_conjunction(conjunction), select_predicate(predicate) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), table(table) {
+}
+
+EvalPlan::EvalPlan(SortKeys *sort_keys, EvalPlan *relation) : type(Sort), relation(relation), sort_keys(sort_keys) {
+}
+
+EvalPlan::EvalPlan(ColumnNames *group_by, Aggregates *aggregates, EvalPlan *relation)
+        : type(Aggregate), relation(relation), group_by(group_by), aggregates(aggregates) {
+}
+
+EvalPlan::EvalPlan(size_t limit, size_t offset, EvalPlan *relation)
+        : type(Limit), relation(relation), limit(limit), offset(offset) {
+}
+
+EvalPlan::EvalPlan(PlanType type, DbIndex *index, ValueDict *key, DbRelation &table)
+        : type(type), table(table), index(index), index_key(key),
+          index_max_key(type == IndexRange ? new ValueDict(*key) : nullptr) {
+}
+
+EvalPlan::EvalPlan(DbIndex *index, ValueDict *min_key, ValueDict *max_key, DbRelation &table)
+        : type(IndexRange), table(table), index(index), index_key(min_key), index_max_key(max_key) {
 }
 
-EvalPlan::EvalPlan(DbRelation &table)
-        : type(TableScan), relation(nullptr), projection(nullptr), select_conjunction(nullptr), table(table) {
+EvalPlan::EvalPlan(PlanType type, EvalPlan *left, Identifier left_name, EvalPlan *right, Identifier right_name,
+                   ColumnNames *left_keys, ColumnNames *right_keys)
+        : type(type), relation(left), right(right), left_name(left_name), right_name(right_name),
+          left_keys(left_keys), right_keys(right_keys) {
+}
+
+EvalPlan::EvalPlan(EvalPlan *outer, Identifier outer_name, DbIndex *index, EvalPlan *inner, Identifier inner_name,
+                   ColumnNames *outer_keys, ColumnNames *inner_keys)
+        : type(IndexJoin), relation(outer), table(inner->type == TableScan ? inner->table : inner->relation->table),
+          index(index), right(inner), left_name(outer_name), right_name(inner_name), left_keys(outer_keys),
+          right_keys(inner_keys) {
 }
 
 EvalPlan::EvalPlan(const EvalPlan *other)
-        : type(other->type), table(other->table) {
+        : type(other->type), limit(other->limit), offset(other->offset), table(other->table), index(other->index),
+          left_name(other->left_name), right_name(other->right_name) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
-    else
-        relation = nullptr;
     if (other->projection != nullptr)
         projection = new ColumnNames(*other->projection);
-    else
-        projection = nullptr;
     if (other->select_conjunction != nullptr)
         select_conjunction = new ValueDict(*other->select_conjunction);
-    else
-        select_conjunction = nullptr;
+    if (other->select_order != nullptr)
+        select_order = new ColumnNames(*other->select_order);
+    if (other->select_predicate != nullptr)
+        select_predicate = new Predicate(*other->select_predicate);
+    if (other->sort_keys != nullptr)
+        sort_keys = new SortKeys(*other->sort_keys);
+    if (other->group_by != nullptr)
+        group_by = new ColumnNames(*other->group_by);
+    if (other->aggregates != nullptr)
+        aggregates = new Aggregates(*other->aggregates);
+    if (other->index_key != nullptr)
+        index_key = new ValueDict(*other->index_key);
+    if (other->index_max_key != nullptr)
+        index_max_key = new ValueDict(*other->index_max_key);
+    if (other->right != nullptr)
+        right = new EvalPlan(other->right);
+    if (other->left_keys != nullptr)
+        left_keys = new ColumnNames(*other->left_keys);
+    if (other->right_keys != nullptr)
+        right_keys = new ColumnNames(*other->right_keys);
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
     delete projection;
     delete select_conjunction;
+    delete select_order;
+    delete select_predicate;
+    delete sort_keys;
+    delete group_by;
+    delete aggregates;
+    delete index_key;
+    delete index_max_key;
+    delete right;
+    delete left_keys;
+    delete right_keys;
+}
+
+
+// Rewrite Select over TableScan to use an index where one pays off; leave everything else alone.
+EvalPlan *EvalPlan::optimize(Indices &indices, Statistics &statistics) {
+    if (this->type == Select && this->relation->type == TableScan)
+        return optimize_select(indices, statistics);
+    if (this->type == HashJoin)
+        return optimize_join(indices, statistics);
+    EvalPlan *ret = new EvalPlan(this);
+    if (this->relation != nullptr) {
+        delete ret->relation;
+        ret->relation = this->relation->optimize(indices, statistics);
+    }
+    if (this->right != nullptr) {
+        delete ret->right;
+        ret->right = this->right->optimize(indices, statistics);
+    }
+    return ret;
+}
+
+void EvalPlan::bind(const std::vector<Value> &parameters) {
+    for (auto keys: {this->select_conjunction, this->index_key, this->index_max_key})
+        if (keys != nullptr)
+            for (auto &column: *keys)
+                Predicate::bind(column.second, parameters);
+    if (this->select_predicate != nullptr)
+        this->select_predicate->bind(parameters);
+    if (this->relation != nullptr)
+        this->relation->bind(parameters);
+    if (this->right != nullptr)
+        this->right->bind(parameters);
+}
+
+// What a comparison with a placeholder is taken to keep, not knowing the value: an even share of the
+// distinct values for equality, and a third of the rows for each end of a range
+static double eq_selectivity(const ColumnStatistics &stats, const Value &value) {
+    if (Predicate::is_placeholder(value))
+        return stats.row_count == 0 ? 0.0 : 1.0 / std::max(stats.distinct_count, (uint32_t) 1);
+    return stats.eq_selectivity(value);
+}
+
+static double range_selectivity(const ColumnStatistics &stats, const Value *low, const Value *high) {
+    double fraction = 1.0;
+    if (low != nullptr && Predicate::is_placeholder(*low)) {
+        low = nullptr;
+        fraction /= 3.0;
+    }
+    if (high != nullptr && Predicate::is_placeholder(*high)) {
+        high = nullptr;
+        fraction /= 3.0;
+    }
+    return std::min(stats.range_selectivity(low, high), fraction);
+}
+
+// Estimated fraction of a table's rows that pass a predicate (1.0 for whatever we have no statistics on)
+static double predicate_selectivity(const Predicate *predicate, const Identifier &table_name, Statistics &statistics) {
+    if (!predicate->is_leaf()) {
+        double ret = predicate->get_op() == PredicateOp::AND ? 1.0 : 0.0;
+        for (auto child: predicate->get_children()) {
+            double child_selectivity = predicate_selectivity(child, table_name, statistics);
+            if (predicate->get_op() == PredicateOp::AND)
+                ret *= child_selectivity;
+            else
+                ret = ret + child_selectivity - ret * child_selectivity;
+        }
+        return ret;
+    }
+    ColumnStatistics stats;
+    if (!statistics.get_statistics(table_name, predicate->get_column_name(), stats))
+        return 1.0;
+    const std::vector<Value> &values = predicate->get_values();
+    double in = 0.0;
+    switch (predicate->get_op()) {
+        case PredicateOp::EQ:
+            return eq_selectivity(stats, values[0]);
+        case PredicateOp::NE:
+            return 1.0 - eq_selectivity(stats, values[0]);
+        case PredicateOp::LT:
+        case PredicateOp::LE:
+            return range_selectivity(stats, nullptr, &values[0]);
+        case PredicateOp::GT:
+        case PredicateOp::GE:
+            return range_selectivity(stats, &values[0], nullptr);
+        case PredicateOp::BETWEEN:
+            return range_selectivity(stats, &values[0], &values[1]);
+        case PredicateOp::IN:
+        case PredicateOp::NOT_IN:
+            for (auto const& value: values)
+                in += eq_selectivity(stats, value);
+            in = std::min(in, 1.0);
+            return predicate->get_op() == PredicateOp::IN ? in : 1.0 - in;
+        default:
+            return 1.0;
+    }
+}
+
+// The tightest (lowest, highest) bounds that the top-level conjuncts of a predicate put on each column
+// (where a bound is a placeholder there's no telling which is tighter, so the first one found stays)
+typedef std::map<Identifier, std::pair<const Value*, const Value*>> ColumnRanges;
+
+static void column_ranges(const Predicate *predicate, ColumnRanges &ranges) {
+    if (predicate->get_op() == PredicateOp::AND) {
+        for (auto child: predicate->get_children())
+            column_ranges(child, ranges);
+        return;
+    }
+    const Value *low = nullptr, *high = nullptr;
+    const std::vector<Value> &values = predicate->get_values();
+    switch (predicate->get_op()) {
+        case PredicateOp::LT:
+        case PredicateOp::LE:
+            high = &values[0];
+            break;
+        case PredicateOp::GT:
+        case PredicateOp::GE:
+            low = &values[0];
+            break;
+        case PredicateOp::BETWEEN:
+            low = &values[0];
+            high = &values[1];
+            break;
+        default:
+            return;
+    }
+    auto it = ranges.find(predicate->get_column_name());
+    if (it == ranges.end()) {
+        ranges[predicate->get_column_name()] = std::pair<const Value*, const Value*>(low, high);
+        return;
+    }
+    const Value *&old_low = it->second.first, *&old_high = it->second.second;
+    if (low != nullptr && (old_low == nullptr || (!Predicate::is_placeholder(*old_low) &&
+                                                  !Predicate::is_placeholder(*low) && *old_low < *low)))
+        old_low = low;
+    if (high != nullptr && (old_high == nullptr || (!Predicate::is_placeholder(*old_high) &&
+                                                    !Predicate::is_placeholder(*high) && *high < *old_high)))
+        old_high = high;
+}
+
+// Consider each index whose leading key columns have equalities in the conjunction: an IndexLookup
+// if all of its key is there, otherwise an IndexRange over the key prefix (BTREE only; a HASH index
+// can only do the IndexLookup). If the predicate puts bounds (<, <=, >, >=, BETWEEN) on the key
+// column after the prefix, the IndexRange starts and stops at those.
+// If the table has been analyzed, costs are estimated in block reads: a table scan reads every block,
+// an index path reads INDEX_PROBE_BLOCKS (HASH_PROBE_BLOCKS for a hash index) plus a block for each
+// row it finds (the rows aren't stored in key order). The cheapest wins. Without statistics, the
+// index covering the most columns with equalities wins (and a range alone isn't reason enough to use
+// an index).
+// Whatever the index doesn't cover is left for a Select on top, checking the most selective
+// predicates first. The predicate is always checked in full, bounds included.
+EvalPlan *EvalPlan::optimize_select(Indices &indices, Statistics &statistics) const {
+    DbRelation &table = this->relation->table;
+    Identifier table_name = table.get_table_name();
+
+    std::map<Identifier,double> selectivity;
+    bool analyzed = false;
+    double row_count = 0.0, block_count = 0.0;
+    for (auto const& column: *this->select_conjunction) {
+        ColumnStatistics stats;
+        if (statistics.get_statistics(table_name, column.first, stats)) {
+            analyzed = true;
+            row_count = stats.row_count;
+            block_count = stats.block_count;
+            selectivity[column.first] = eq_selectivity(stats, column.second);
+        } else {
+            selectivity[column.first] = 1.0;
+        }
+    }
+    ColumnRanges ranges;
+    if (this->select_predicate != nullptr)
+        column_ranges(this->select_predicate, ranges);
+    std::map<Identifier,double> range_selectivity;
+    for (auto const& range: ranges) {
+        ColumnStatistics stats;
+        if (statistics.get_statistics(table_name, range.first, stats)) {
+            analyzed = true;
+            row_count = stats.row_count;
+            block_count = stats.block_count;
+            range_selectivity[range.first] = ::range_selectivity(stats, range.second.first, range.second.second);
+        } else {
+            range_selectivity[range.first] = 1.0;
+        }
+    }
+
+    DbIndex *best = nullptr;
+    uint best_count = 0;
+    bool best_whole = false, best_ranged = false;
+    double best_cost = std::max(block_count, 1.0);  // table scan
+    for (auto const& index_name: indices.get_index_names(table_name)) {
+        ColumnNames key_columns;
+        bool is_hash, is_unique;
+        indices.get_columns(table_name, index_name, key_columns, is_hash, is_unique);
+        uint count = 0;
+        double fraction = 1.0;
+        while (count < key_columns.size() && this->select_conjunction->count(key_columns[count]) > 0)
+            fraction *= selectivity[key_columns[count++]];
+        bool whole = count == key_columns.size();
+        if (is_hash && !whole)
+            continue;
+        bool ranged = !whole && ranges.count(key_columns[count]) > 0;
+        if (ranged)
+            fraction *= range_selectivity[key_columns[count]];
+        if (count == 0 && (!ranged || !analyzed))
+            continue;
+        double cost = (is_hash ? HASH_PROBE_BLOCKS : INDEX_PROBE_BLOCKS) + fraction * row_count;
+        if (analyzed ? cost < best_cost : (count > best_count || (count == best_count && !best_whole &&
+                                                                   (whole || (ranged && !best_ranged))))) {
+            best = &indices.get_index(table_name, index_name);
+            best_count = count;
+            best_whole = whole;
+            best_ranged = ranged;
+            best_cost = cost;
+        }
+    }
+
+    EvalPlan *plan;
+    ValueDict *residual = new ValueDict(*this->select_conjunction);
+    if (best == nullptr) {
+        plan = new EvalPlan(table);
+    } else {
+        ValueDict *key = new ValueDict();
+        for (uint i = 0; i < best_count; i++) {
+            Identifier column_name = best->get_key_columns()[i];
+            (*key)[column_name] = residual->at(column_name);
+            residual->erase(column_name);
+        }
+        if (best_ranged) {
+            Identifier column_name = best->get_key_columns()[best_count];
+            const std::pair<const Value*, const Value*> &range = ranges[column_name];
+            ValueDict *min_key = nullptr, *max_key = nullptr;
+            if (range.first != nullptr || best_count > 0) {
+                min_key = new ValueDict(*key);
+                if (range.first != nullptr)
+                    (*min_key)[column_name] = *range.first;
+            }
+            if (range.second != nullptr || best_count > 0) {
+                max_key = new ValueDict(*key);
+                if (range.second != nullptr)
+                    (*max_key)[column_name] = *range.second;
+            }
+            delete key;
+            plan = new EvalPlan(best, min_key, max_key, table);
+        } else {
+            plan = new EvalPlan(best_whole ? IndexLookup : IndexRange, best, key, table);
+        }
+    }
+    if (residual->empty() && this->select_predicate == nullptr) {
+        delete residual;
+        return plan;
+    }
+
+    // most selective first, and INT before TEXT since it's cheaper to compare
+    ColumnNames *order = new ColumnNames();
+    for (auto const& column: *residual)
+        order->push_back(column.first);
+    std::stable_sort(order->begin(), order->end(), [&](const Identifier &a, const Identifier &b) {
+        if (selectivity[a] != selectivity[b])
+            return selectivity[a] < selectivity[b];
+        return residual->at(a).data_type == ColumnAttribute::INT && residual->at(b).data_type != ColumnAttribute::INT;
+    });
+    Predicate *predicate = nullptr;
+    if (this->select_predicate != nullptr) {
+        predicate = new Predicate(*this->select_predicate);
+        if (predicate->get_op() == PredicateOp::AND)
+            std::stable_sort(predicate->get_children().begin(), predicate->get_children().end(),
+                             [&](const Predicate *a, const Predicate *b) {
+                return predicate_selectivity(a, table_name, statistics) < predicate_selectivity(b, table_name, statistics);
+            });
+    }
+    plan = new EvalPlan(residual, predicate, plan);
+    plan->select_order = order;
+    return plan;
+}
+
+// If even the smaller side of a join looks too big for the hash table to fit in memory, sorting
+// both sides and merging them does as well as a spilling hash join and doesn't care how skewed
+// the keys are.
+EvalPlan::PlanType EvalPlan::merge_or_hash() const {
+    double smaller = std::min(this->relation->estimated_blocks(), this->right->estimated_blocks());
+    return smaller * DbBlock::BLOCK_SZ > HashJoinBatchCursor::DEFAULT_MEMORY_BUDGET ? MergeJoin : HashJoin;
 }
 
+// A join where one side is a scan (maybe with a Select) of a table with an index (BTREE or HASH) on exactly
+// that side's join columns becomes an IndexJoin, looking up each row of the other side in the index,
+// so its cost goes with the size of the other side rather than of the indexed table. If both sides
+// have such an index, the bigger side is the one looked up in. Otherwise it's a HashJoin or MergeJoin.
+EvalPlan *EvalPlan::optimize_join(Indices &indices, Statistics &statistics) const {
+    DbIndex *left_index = this->relation->join_index(*this->left_keys, indices);
+    DbIndex *right_index = this->right->join_index(*this->right_keys, indices);
+    bool inner_is_right;
+    if (right_index != nullptr && (left_index == nullptr || this->right->estimated_blocks() >= this->relation->estimated_blocks()))
+        inner_is_right = true;
+    else if (left_index != nullptr)
+        inner_is_right = false;
+    else
+        return new EvalPlan(merge_or_hash(), this->relation->optimize(indices, statistics), this->left_name,
+                            this->right->optimize(indices, statistics), this->right_name,
+                            new ColumnNames(*this->left_keys), new ColumnNames(*this->right_keys));
+
+    EvalPlan *outer = inner_is_right ? this->relation : this->right;
+    EvalPlan *inner = inner_is_right ? this->right : this->relation;
+    const ColumnNames &outer_keys = inner_is_right ? *this->left_keys : *this->right_keys;
+    const ColumnNames &inner_keys = inner_is_right ? *this->right_keys : *this->left_keys;
+    DbIndex *index = inner_is_right ? right_index : left_index;
+
+    // the outer side's join columns go in the order of the index's key
+    ColumnNames *outer_index_keys = new ColumnNames();
+    for (auto const& column_name: index->get_key_columns()) {
+        auto it = std::find(inner_keys.begin(), inner_keys.end(), column_name);
+        outer_index_keys->push_back(outer_keys[it - inner_keys.begin()]);
+    }
+    return new EvalPlan(outer->optimize(indices, statistics), inner_is_right ? this->left_name : this->right_name,
+                        index, new EvalPlan(inner), inner_is_right ? this->right_name : this->left_name,
+                        outer_index_keys, new ColumnNames(index->get_key_columns()));
+}
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+// An index (BTREE or HASH) on exactly the given columns of the table this plan scans (nullptr if it isn't a
+// [selected] table scan or there is no such index).
+DbIndex *EvalPlan::join_index(const ColumnNames &keys, Indices &indices) const {
+    const DbRelation *scanned;
+    if (this->type == TableScan)
+        scanned = &this->table;
+    else if (this->type == Select && this->relation->type == TableScan && this->select_predicate == nullptr)
+        scanned = &this->relation->table;  // (the index join only checks the equalities)
+    else
+        return nullptr;
+    Identifier table_name = scanned->get_table_name();
+    for (auto const& index_name: indices.get_index_names(table_name)) {
+        ColumnNames key_columns;
+        bool is_hash, is_unique;
+        indices.get_columns(table_name, index_name, key_columns, is_hash, is_unique);
+        if (key_columns.size() != keys.size())
+            continue;
+        bool covered = true;
+        for (auto const& column_name: key_columns)
+            if (std::find(keys.begin(), keys.end(), column_name) == keys.end())
+                covered = false;
+        if (covered)
+            return &indices.get_index(table_name, index_name);
+    }
+    return nullptr;
 }
 
-ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
+// The rows are pulled through the plan a ColumnBatch at a time; the Rows are only
+// built here at the end, for the rows that are still selected.
+Rows *EvalPlan::evaluate() {
+    Rows *ret = nullptr;
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
+    const ColumnNames *column_names = this->type == ProjectAll ? nullptr : this->projection;
+    BatchCursor *cursor = this->relation->batches(column_names);
+    ret = new Rows();
+    ColumnBatch *batch;
+    while ((batch = cursor->next()) != nullptr) {
+        // any columns past the projection were only wanted for a Select
+        size_t n_columns = column_names == nullptr ? batch->get_column_names().size() : column_names->size();
+        for (uint16_t row: batch->selection())
+            ret->push_back(batch->get_row(row, n_columns));
+    }
+    delete cursor;
     return ret;
 }
 
 EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
-        return EvalPipeline(&this->table, this->table.select());
-    if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        return EvalPipeline(&this->table, this->table.cursor());
+    if (this->type == Select && this->relation->type == TableScan) {
+        DbRelationCursor *cursor = this->relation->table.cursor(this->select_conjunction, this->select_order);
+        if (this->select_predicate != nullptr)
+            cursor = new SelectCursor(cursor, nullptr, this->select_predicate);
+        return EvalPipeline(&this->relation->table, cursor);
+    }
+    if (this->type == IndexLookup) {
+        this->index->open();
+        return EvalPipeline(&this->table, new IndexCursor(this->table, this->index->lookup_cursor(this->index_key)));
+    }
+    if (this->type == IndexRange) {
+        this->index->open();
+        return EvalPipeline(&this->table, new IndexCursor(this->table, this->index->cursor(this->index_key, this->index_max_key)));
+    }
 
     // recursive case
     if (this->type == Select) {
         EvalPipeline pipeline = this->relation->pipeline();
         DbRelation *temp_table = pipeline.first;
-        Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
-        delete handles;
-        return ret;
+        return EvalPipeline(temp_table, new SelectCursor(pipeline.second, this->select_conjunction,
+                                                         this->select_predicate));
     }
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+    throw DbRelationError("Not implemented: pipeline other than Select, TableScan, IndexLookup, or IndexRange");
 }
 
+
+BatchCursor *EvalPlan::batches(const ColumnNames *column_names) {
+    // base cases
+    if (this->type == TableScan)
+        return this->table.batch_cursor(column_names);
+    if (this->type == Select && this->relation->type == TableScan) {
+        if (this->select_predicate == nullptr)
+            return this->relation->table.batch_cursor(column_names, this->select_conjunction, this->select_order);
+        // the scan checks the equalities, the predicate is checked on its batches
+        ColumnNames scan_columns;
+        if (column_names != nullptr) {
+            scan_columns = *column_names;
+            this->select_predicate->get_columns(scan_columns);
+        }
+        BatchCursor *scan = this->relation->table.batch_cursor(column_names == nullptr ? nullptr : &scan_columns,
+                                                               this->select_conjunction, this->select_order);
+        return new SelectBatchCursor(scan, nullptr, nullptr, this->select_predicate);
+    }
+    if (this->type == IndexLookup)
+        return this->table.batch_cursor(this->index->lookup_cursor(this->index_key), column_names, nullptr);
+    if (this->type == IndexRange)
+        return this->table.batch_cursor(this->index->cursor(this->index_key, this->index_max_key), column_names,
+                                        nullptr);
+
+    // recursive case: the input has to carry the columns we filter on, too
+    if (this->type == Select) {
+        if (column_names == nullptr)
+            return new SelectBatchCursor(this->relation->batches(nullptr), this->select_conjunction, this->select_order,
+                                         this->select_predicate);
+        ColumnNames input_columns(*column_names);
+        for (auto const& column: *this->select_conjunction)
+            if (std::find(input_columns.begin(), input_columns.end(), column.first) == input_columns.end())
+                input_columns.push_back(column.first);
+        if (this->select_predicate != nullptr)
+            this->select_predicate->get_columns(input_columns);
+        return new SelectBatchCursor(this->relation->batches(&input_columns), this->select_conjunction,
+                                     this->select_order, this->select_predicate);
+    }
+
+    if (this->type == HashJoin || this->type == IndexJoin || this->type == MergeJoin)
+        return join_batches(column_names);
+    if (this->type == Sort || this->type == Distinct)
+        return sort_batches(column_names);
+    if (this->type == Aggregate)
+        return aggregate_batches(column_names);
+    if (this->type == Limit) {
+        // ORDER BY ... LIMIT only has to keep the first offset + limit rows of the sort
+        if (this->relation->type == Sort && this->limit <= SIZE_MAX - this->offset)
+            return new LimitBatchCursor(this->relation->sort_batches(column_names, this->offset + this->limit),
+                                        this->limit, this->offset);
+        return new LimitBatchCursor(this->relation->batches(column_names), this->limit, this->offset);
+    }
+
+    throw DbRelationError("Not implemented: batches other than Select, TableScan, IndexLookup, IndexRange, a join, Sort, Distinct, Aggregate, or Limit");
+}
+
+static Identifier qualify(const Identifier &name, const Identifier &column_name) {
+    return name.empty() ? column_name : name + "." + column_name;
+}
+
+// Ask each side for its join columns followed by whatever else of it is wanted. A HashJoin builds
+// its hash table from whichever side looks smaller; an IndexJoin fetches the inner side's columns
+// itself, so that side only needs the wanted ones; a MergeJoin sorts both sides on the join columns.
+BatchCursor *EvalPlan::join_batches(const ColumnNames *column_names) {
+    ColumnNames all_names = get_column_names();
+    ColumnAttributes all_attributes = get_column_attributes();
+    ColumnNames output_names = column_names == nullptr ? all_names : *column_names;
+
+    EvalPlan *sides[2] = {this->relation, this->right};
+    ColumnNames side_names[2] = {*this->left_keys, this->type == IndexJoin ? ColumnNames() : *this->right_keys};
+    ColumnNames child_names[2] = {this->relation->get_column_names(), this->right->get_column_names()};
+    ColumnAttributes child_attributes[2] = {this->relation->get_column_attributes(), this->right->get_column_attributes()};
+    Identifier qualifiers[2] = {this->left_name, this->right_name};
+
+    std::vector<std::pair<uint, uint>> output_sides;  // (side, position in its batches)
+    ColumnAttributes output_attributes;
+    for (auto const& output_name: output_names) {
+        auto it = std::find(all_names.begin(), all_names.end(), output_name);
+        if (it == all_names.end())
+            throw DbRelationError("unknown column " + output_name);
+        output_attributes.push_back(all_attributes[it - all_names.begin()]);
+        uint side = (uint)(it - all_names.begin()) < child_names[0].size() ? 0 : 1;
+        Identifier child_name;
+        for (auto const& name: child_names[side])
+            if (qualify(qualifiers[side], name) == output_name)
+                child_name = name;
+        auto pos = std::find(side_names[side].begin(), side_names[side].end(), child_name);
+        if (pos == side_names[side].end())
+            pos = side_names[side].insert(side_names[side].end(), child_name);
+        output_sides.push_back(std::pair<uint, uint>(side, (uint)(pos - side_names[side].begin())));
+    }
+    if (this->type == IndexJoin) {
+        JoinOutput output;
+        for (auto const& output_side: output_sides)
+            output.push_back(std::pair<bool, uint>(output_side.first == 1, output_side.second));
+        const ValueDict *inner_where = this->right->type == Select ? this->right->select_conjunction : nullptr;
+        return new IndexJoinBatchCursor(this->relation->batches(&side_names[0]), (uint)this->left_keys->size(),
+                                        this->table, this->index, side_names[1], inner_where, output, output_names,
+                                        output_attributes);
+    }
+
+    ColumnAttributes side_attributes[2];
+    for (uint side = 0; side < 2; side++) {
+        for (auto const& name: side_names[side]) {
+            auto it = std::find(child_names[side].begin(), child_names[side].end(), name);
+            if (it == child_names[side].end())
+                throw DbRelationError("unknown join column " + name);
+            side_attributes[side].push_back(child_attributes[side][it - child_names[side].begin()]);
+        }
+    }
+
+    if (this->type == MergeJoin) {
+        JoinOutput output;
+        for (auto const& output_side: output_sides)
+            output.push_back(std::pair<bool, uint>(output_side.first == 1, output_side.second));
+        SortOrder key_order;
+        for (uint col_num = 0; col_num < this->left_keys->size(); col_num++)
+            key_order.push_back(std::pair<uint, bool>(col_num, false));
+        BatchCursor *sorted[2];
+        for (uint side = 0; side < 2; side++)
+            sorted[side] = new SortBatchCursor(sides[side]->batches(&side_names[side]), side_names[side],
+                                               side_attributes[side], key_order);
+        return new MergeJoinBatchCursor(sorted[0], sorted[1], side_names[1].size(), (uint)this->left_keys->size(),
+                                        output, output_names, output_attributes);
+    }
+
+    uint build = this->relation->estimated_blocks() < this->right->estimated_blocks() ? 0 : 1;
+    uint probe = 1 - build;
+    JoinOutput output;
+    for (auto const& output_side: output_sides)
+        output.push_back(std::pair<bool, uint>(output_side.first == build, output_side.second));
+    BatchCursor *build_batches = sides[build]->batches(&side_names[build]);
+    BatchCursor *probe_batches = sides[probe]->batches(&side_names[probe]);
+    return new HashJoinBatchCursor(build_batches, side_names[build], side_attributes[build],
+                                   probe_batches, side_names[probe], side_attributes[probe],
+                                   (uint)this->left_keys->size(), output, output_names, output_attributes);
+}
+
+// Sort: ask for the wanted columns plus any sort columns that aren't among them (at the end).
+// Distinct: sort on all of the wanted columns, dropping repeats.
+// With top_n, only that many of the first rows are wanted (for a Limit on top).
+BatchCursor *EvalPlan::sort_batches(const ColumnNames *column_names, size_t top_n) {
+    ColumnNames input_names = column_names == nullptr ? get_column_names() : *column_names;
+    SortOrder sort_order;
+    if (this->type == Sort) {
+        for (auto const& sort_key: *this->sort_keys) {
+            auto it = std::find(input_names.begin(), input_names.end(), sort_key.first);
+            if (it == input_names.end())
+                it = input_names.insert(input_names.end(), sort_key.first);
+            sort_order.push_back(std::pair<uint, bool>((uint)(it - input_names.begin()), sort_key.second));
+        }
+    } else {
+        for (uint col_num = 0; col_num < input_names.size(); col_num++)
+            sort_order.push_back(std::pair<uint, bool>(col_num, false));
+    }
+
+    ColumnNames all_names = this->relation->get_column_names();
+    ColumnAttributes all_attributes = this->relation->get_column_attributes();
+    ColumnAttributes input_attributes;
+    for (auto const& name: input_names) {
+        auto it = std::find(all_names.begin(), all_names.end(), name);
+        if (it == all_names.end())
+            throw DbRelationError("unknown column " + name);
+        input_attributes.push_back(all_attributes[it - all_names.begin()]);
+    }
+    return new SortBatchCursor(this->relation->batches(&input_names), input_names, input_attributes, sort_order,
+                               this->type == Distinct, ExternalSort::DEFAULT_MEMORY_BUDGET, top_n);
+}
+
+// COUNT(*) of a whole table is just its row count. Otherwise ask for the group-by columns followed by
+// the columns the aggregates are of, and hash them into groups.
+BatchCursor *EvalPlan::aggregate_batches(const ColumnNames *column_names) {
+    ColumnNames all_names = get_column_names();
+    ColumnAttributes all_attributes = get_column_attributes();
+    ColumnNames output_names = column_names == nullptr ? all_names : *column_names;
+
+    ColumnNumbers output;
+    ColumnAttributes output_attributes;
+    for (auto const& output_name: output_names) {
+        auto it = std::find(all_names.begin(), all_names.end(), output_name);
+        if (it == all_names.end())
+            throw DbRelationError("unknown column " + output_name);
+        output.push_back((uint)(it - all_names.begin()));
+        output_attributes.push_back(all_attributes[it - all_names.begin()]);
+    }
+
+    bool count_only = this->relation->type == TableScan && this->group_by->empty();
+    for (auto const& aggregate: *this->aggregates)
+        if (aggregate.first != AggregateFunction::COUNT_STAR)
+            count_only = false;
+    if (count_only)
+        return new CountBatchCursor(this->relation->table, output_names);
+
+    ColumnNames input_names(*this->group_by);
+    AggregateInputs inputs;
+    for (auto const& aggregate: *this->aggregates) {
+        uint col_num = 0;
+        if (aggregate.first != AggregateFunction::COUNT_STAR) {
+            auto it = std::find(input_names.begin(), input_names.end(), aggregate.second);
+            if (it == input_names.end())
+                it = input_names.insert(input_names.end(), aggregate.second);
+            col_num = (uint)(it - input_names.begin());
+        }
+        inputs.push_back(std::pair<AggregateFunction, uint>(aggregate.first, col_num));
+    }
+
+    ColumnNames child_names = this->relation->get_column_names();
+    ColumnAttributes child_attributes = this->relation->get_column_attributes();
+    ColumnAttributes input_attributes;
+    for (auto const& name: input_names) {
+        auto it = std::find(child_names.begin(), child_names.end(), name);
+        if (it == child_names.end())
+            throw DbRelationError("unknown column " + name);
+        input_attributes.push_back(child_attributes[it - child_names.begin()]);
+    }
+    return new HashAggregateBatchCursor(this->relation->batches(&input_names), input_attributes,
+                                        (uint)this->group_by->size(), inputs, output, output_names, output_attributes);
+}
+
+ColumnNames EvalPlan::get_column_names() const {
+    switch (this->type) {
+        case ProjectAll:
+        case Select:
+        case Sort:
+        case Distinct:
+        case Limit:
+            return this->relation->get_column_names();
+        case Project:
+            return *this->projection;
+        case HashJoin:
+        case IndexJoin:
+        case MergeJoin: {
+            ColumnNames ret;
+            for (auto const& column_name: this->relation->get_column_names())
+                ret.push_back(qualify(this->left_name, column_name));
+            for (auto const& column_name: this->right->get_column_names())
+                ret.push_back(qualify(this->right_name, column_name));
+            return ret;
+        }
+        case Aggregate: {
+            ColumnNames ret(*this->group_by);
+            for (auto const& aggregate: *this->aggregates)
+                ret.push_back(aggregate_name(aggregate.first, aggregate.second));
+            return ret;
+        }
+        default:
+            return this->table.get_column_names();
+    }
+}
+
+ColumnAttributes EvalPlan::get_column_attributes() const {
+    switch (this->type) {
+        case ProjectAll:
+        case Select:
+        case Sort:
+        case Distinct:
+        case Limit:
+            return this->relation->get_column_attributes();
+        case Project: {
+            ColumnNames names = this->relation->get_column_names();
+            ColumnAttributes attributes = this->relation->get_column_attributes();
+            ColumnAttributes ret;
+            for (auto const& column_name: *this->projection) {
+                auto it = std::find(names.begin(), names.end(), column_name);
+                if (it == names.end())
+                    throw DbRelationError("unknown column " + column_name);
+                ret.push_back(attributes[it - names.begin()]);
+            }
+            return ret;
+        }
+        case HashJoin:
+        case IndexJoin:
+        case MergeJoin: {
+            ColumnAttributes ret = this->relation->get_column_attributes();
+            ColumnAttributes right_attributes = this->right->get_column_attributes();
+            ret.insert(ret.end(), right_attributes.begin(), right_attributes.end());
+            return ret;
+        }
+        case Aggregate: {
+            ColumnNames names = this->relation->get_column_names();
+            ColumnAttributes attributes = this->relation->get_column_attributes();
+            ColumnAttributes ret;
+            for (auto const& column_name: *this->group_by) {
+                auto it = std::find(names.begin(), names.end(), column_name);
+                if (it == names.end())
+                    throw DbRelationError("unknown column " + column_name);
+                ret.push_back(attributes[it - names.begin()]);
+            }
+            for (auto const& aggregate: *this->aggregates) {
+                if (aggregate.first == AggregateFunction::MIN || aggregate.first == AggregateFunction::MAX) {
+                    auto it = std::find(names.begin(), names.end(), aggregate.second);
+                    if (it == names.end())
+                        throw DbRelationError("unknown column " + aggregate.second);
+                    ret.push_back(attributes[it - names.begin()]);
+                } else {
+                    ret.push_back(ColumnAttribute(ColumnAttribute::INT));
+                }
+            }
+            return ret;
+        }
+        default:
+            return this->table.get_column_attributes();
+    }
+}
+
+double EvalPlan::estimated_blocks() const {
+    switch (this->type) {
+        case TableScan:
+            return std::max((double)this->table.get_block_count(), 1.0);
+        case IndexLookup:
+            return 1.0;
+        case IndexRange:
+            return INDEX_PROBE_BLOCKS;
+        case HashJoin:
+        case MergeJoin:
+            return this->relation->estimated_blocks() + this->right->estimated_blocks();
+        case IndexJoin:
+            return 2.0 * this->relation->estimated_blocks();  // about a row of the inner table for each outer row
+        default:
+            return this->relation->estimated_blocks();
+    }
+}
@@ -1,9 +1,18 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "schema_tables.h"
+#include "hash_join.h"
+#include "index_join.h"
+#include "merge_join.h"
+#include "sort_batch.h"
+#include "aggregate.h"
+#include "predicate.h"
 
 
-typedef std::pair<DbRelation*,Handles*> EvalPipeline;
+typedef std::pair<DbRelation*,DbRelationCursor*> EvalPipeline;
+typedef std::vector<std::pair<Identifier, bool>> SortKeys;  // (column, descending?), most significant first
+typedef std::vector<std::pair<AggregateFunction, Identifier>> Aggregates;  // (function, column; "" for COUNT(*))
 
 class EvalPlan {
 public:
@@ -11,29 +20,93 @@ public:
         ProjectAll,
         Project,
         Select,
-        TableScan
+        TableScan,
+        IndexLookup,
+        IndexRange,
+        HashJoin,
+        IndexJoin,
+        MergeJoin,
+        Sort,
+        Distinct,
+        Aggregate,
+        Limit
     };
 
-    EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
+    EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table); or Distinct
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
     EvalPlan(ValueDict* conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(ValueDict* conjunction, Predicate *predicate, EvalPlan *relation);  // use for Select with more than equalities
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(SortKeys *sort_keys, EvalPlan *relation);  // use for Sort
+    EvalPlan(ColumnNames *group_by, Aggregates *aggregates, EvalPlan *relation);  // use for Aggregate
+    EvalPlan(size_t limit, size_t offset, EvalPlan *relation);  // use for Limit
+    EvalPlan(PlanType type, DbIndex *index, ValueDict *key, DbRelation &table);  // use for IndexLookup, IndexRange
+    EvalPlan(DbIndex *index, ValueDict *min_key, ValueDict *max_key, DbRelation &table);  // use for IndexRange with bounds
+    EvalPlan(PlanType type, EvalPlan *left, Identifier left_name, EvalPlan *right, Identifier right_name,
+             ColumnNames *left_keys, ColumnNames *right_keys);  // use for HashJoin, MergeJoin
+    EvalPlan(EvalPlan *outer, Identifier outer_name, DbIndex *index, EvalPlan *inner, Identifier inner_name,
+             ColumnNames *outer_keys, ColumnNames *inner_keys);  // use for IndexJoin
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // Attempt to get the best equivalent evaluation plan, using any of the indices on the tables
+    // (and the statistics from ANALYZE, if there are any, to decide whether they are worth it)
+    EvalPlan *optimize(Indices &indices, Statistics &statistics);
 
-    // Evaluate the plan: evaluate gets values, pipeline gets handles
-    ValueDicts *evaluate();
+    // Put the values of a prepared statement's parameters in place of its placeholders (see
+    // Predicate::placeholder), throughout the plan
+    void bind(const std::vector<Value> &parameters);
+
+    // Estimated blocks read to get down an index to the first match
+    static constexpr double INDEX_PROBE_BLOCKS = 3.0;
+    static constexpr double HASH_PROBE_BLOCKS = 1.0;  // just the key's bucket
+
+    // Evaluate the plan: evaluate gets values, pipeline gets a cursor over the handles (freed by caller)
+    // The rows from evaluate go by position in the projection (or the table's columns for ProjectAll).
+    Rows *evaluate();
     EvalPipeline pipeline();
 
+    // Column-at-a-time evaluation of everything below the projection: batches of the given
+    // columns (nullptr for all the columns of the table) for the qualifying rows (freed by caller)
+    BatchCursor *batches(const ColumnNames *column_names);
+
+    // The columns this node produces. A join's columns are qualified with the name of the table
+    // they came from, e.g., "emp.id".
+    ColumnNames get_column_names() const;
+    ColumnAttributes get_column_attributes() const;
+
+    // Rough size of what this node produces, in blocks (for picking a join's build side)
+    double estimated_blocks() const;
+
 protected:
 
+    // each constructor sets just what its kind of plan uses; the rest stay empty
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan
-    ColumnNames *projection;  // for Project
-    ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    EvalPlan *relation = nullptr;  // for everything except TableScan
+    ColumnNames *projection = nullptr;  // for Project
+    ValueDict *select_conjunction = nullptr;  // for Select
+    ColumnNames *select_order = nullptr;  // for Select: order to check the conjunction in (nullptr for any)
+    Predicate *select_predicate = nullptr;  // for Select: the rest of the where clause (nullptr if it's all equalities)
+    SortKeys *sort_keys = nullptr;  // for Sort
+    ColumnNames *group_by = nullptr;  // for Aggregate
+    Aggregates *aggregates = nullptr;  // for Aggregate
+    size_t limit = 0, offset = 0;  // for Limit
+    DbRelation &table = no_table();  // for TableScan, IndexLookup, IndexRange, IndexJoin (the inner table)
+    DbIndex *index = nullptr;  // for IndexLookup, IndexRange, IndexJoin
+    ValueDict *index_key = nullptr;  // for IndexLookup (whole key), IndexRange (lowest key, maybe just leading columns; nullptr for none)
+    ValueDict *index_max_key = nullptr;  // for IndexRange: highest key, maybe just leading columns (nullptr for none)
+    EvalPlan *right = nullptr;  // for HashJoin, MergeJoin (relation is the left side), IndexJoin (relation is the outer side)
+    Identifier left_name, right_name;  // for joins: what to qualify each side's columns with ("" if they already are)
+    ColumnNames *left_keys = nullptr, *right_keys = nullptr;  // for joins: each side's join columns, in matching order
+
+    static DbRelation &no_table();  // stands in for table in the plans that don't have one
+
+    EvalPlan *optimize_select(Indices &indices, Statistics &statistics) const;
+    EvalPlan *optimize_join(Indices &indices, Statistics &statistics) const;
+    PlanType merge_or_hash() const;
+    DbIndex *join_index(const ColumnNames &keys, Indices &indices) const;
+    BatchCursor *join_batches(const ColumnNames *column_names);
+    BatchCursor *sort_batches(const ColumnNames *column_names, size_t top_n=0);
+    BatchCursor *aggregate_batches(const ColumnNames *column_names);
 };
 
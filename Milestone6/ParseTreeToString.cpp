@@ -61,14 +61,33 @@ string ParseTreeToString::operator_expression(const Expr *expr) {
             ret += "OR";
             break;
         case Expr::NONE:break;
-        case Expr::BETWEEN:break;
+        case Expr::BETWEEN:
+            ret += "BETWEEN " + expression(expr->exprList->at(0)) + " AND " + expression(expr->exprList->at(1));
+            break;
         case Expr::CASE:break;
-        case Expr::NOT_EQUALS:break;
-        case Expr::LESS_EQ:break;
-        case Expr::GREATER_EQ:break;
+        case Expr::NOT_EQUALS:
+            ret += "<>";
+            break;
+        case Expr::LESS_EQ:
+            ret += "<=";
+            break;
+        case Expr::GREATER_EQ:
+            ret += ">=";
+            break;
         case Expr::LIKE:break;
         case Expr::NOT_LIKE:break;
-        case Expr::IN:break;
+        case Expr::IN: {
+            ret += "IN (";
+            bool first = true;
+            for (auto const item: *expr->exprList) {
+                if (!first)
+                    ret += ", ";
+                ret += expression(item);
+                first = false;
+            }
+            ret += ")";
+            break;
+        }
         case Expr::NOT:break;
         case Expr::UMINUS:break;
         case Expr::ISNULL:break;
@@ -102,8 +121,11 @@ string ParseTreeToString::expression(const Expr *expr) {
         case kExprLiteralInt:
             ret += to_string(expr->ival);
             break;
+        case kExprPlaceholder:
+            ret += "?";
+            break;
         case kExprFunctionRef:
-            ret += string(expr->name) + "?" + expr->expr->name;
+            ret += string(expr->name) + "(" + (expr->distinct ? "DISTINCT " : "") + expression(expr->expr) + ")";
             break;
         case kExprOperator:
             ret += operator_expression(expr);
@@ -186,6 +208,8 @@ string ParseTreeToString::column_definition(const ColumnDefinition *col) {
 
 string ParseTreeToString::select(const SelectStatement *stmt) {
     string ret("SELECT ");
+    if (stmt->selectDistinct)
+        ret += "DISTINCT ";
     bool doComma = false;
     for (Expr *expr : *stmt->selectList) {
         if (doComma)
@@ -196,14 +220,42 @@ string ParseTreeToString::select(const SelectStatement *stmt) {
     ret += " FROM " + table_ref(stmt->fromTable);
     if (stmt->whereClause != NULL)
         ret += " WHERE " + expression(stmt->whereClause);
+    if (stmt->groupBy != NULL) {
+        ret += " GROUP BY ";
+        doComma = false;
+        for (Expr *expr : *stmt->groupBy->columns) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(expr);
+            doComma = true;
+        }
+        if (stmt->groupBy->having != NULL)
+            ret += " HAVING " + expression(stmt->groupBy->having);
+    }
+    if (stmt->order != NULL) {
+        ret += " ORDER BY ";
+        doComma = false;
+        for (auto const &order : *stmt->order) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(order->expr);
+            if (order->type == kOrderDesc)
+                ret += " DESC";
+            doComma = true;
+        }
+    }
+    if (stmt->limit != NULL) {
+        if (stmt->limit->limit >= 0)
+            ret += " LIMIT " + to_string(stmt->limit->limit);
+        if (stmt->limit->offset > 0)
+            ret += " OFFSET " + to_string(stmt->limit->offset);
+    }
     return ret;
 }
 
 string ParseTreeToString::insert(const InsertStatement *stmt) {
     string ret("INSERT INTO ");
     ret += stmt->tableName;
-    if (stmt->type == InsertStatement::kInsertSelect)
-        return ret + "SELECT ...";
 
     bool doComma = false;
     if (stmt->columns != NULL) {
@@ -216,6 +268,8 @@ string ParseTreeToString::insert(const InsertStatement *stmt) {
         }
         ret += ")";
     }
+    if (stmt->type == InsertStatement::kInsertSelect)
+        return ret + " " + select(stmt->select);
     ret += " VALUES (";
     doComma = false;
     for (Expr *expr : *stmt->values) {
@@ -270,6 +324,8 @@ string ParseTreeToString::drop(const DropStatement *stmt) {
         case DropStatement::kIndex:
             ret += string("INDEX ") + stmt->indexName + " FROM ";
             break;
+        case DropStatement::kPreparedStatement:
+            return string("DEALLOCATE PREPARE ") + stmt->name;
         default:
             ret += "? ";
     }
@@ -306,6 +362,32 @@ string ParseTreeToString::del(const DeleteStatement *stmt) {
     return ret;
 }
 
+string ParseTreeToString::prepare(const PrepareStatement *stmt) {
+    string ret("PREPARE ");
+    ret += stmt->name;
+    ret += ":";
+    for (uint i = 0; i < stmt->query->size(); i++)
+        ret += " " + statement(stmt->query->getStatement(i));
+    return ret;
+}
+
+string ParseTreeToString::execute(const ExecuteStatement *stmt) {
+    string ret("EXECUTE ");
+    ret += stmt->name;
+    if (stmt->parameters != NULL) {
+        ret += "(";
+        bool doComma = false;
+        for (Expr *expr : *stmt->parameters) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(expr);
+            doComma = true;
+        }
+        ret += ")";
+    }
+    return ret;
+}
+
 string ParseTreeToString::statement(const SQLStatement *stmt) {
     switch (stmt->type()) {
         case kStmtSelect:
@@ -320,12 +402,14 @@ string ParseTreeToString::statement(const SQLStatement *stmt) {
             return drop((const DropStatement *) stmt);
         case kStmtShow:
             return show((const ShowStatement *) stmt);
+        case kStmtPrepare:
+            return prepare((const PrepareStatement *) stmt);
+        case kStmtExecute:
+            return execute((const ExecuteStatement *) stmt);
 
         case kStmtError:
         case kStmtImport:
         case kStmtUpdate:
-        case kStmtPrepare:
-        case kStmtExecute:
         case kStmtExport:
         case kStmtRename:
         case kStmtAlter:
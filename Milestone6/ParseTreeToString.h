@@ -40,5 +40,7 @@ private:
     static std::string create(const hsql::CreateStatement *stmt);
     static std::string drop(const hsql::DropStatement *stmt);
     static std::string show(const hsql::ShowStatement *stmt);
+    static std::string prepare(const hsql::PrepareStatement *stmt);
+    static std::string execute(const hsql::ExecuteStatement *stmt);
 };
 
@@ -7,12 +7,23 @@
 #include "SQLExec.h"
 #include "EvalPlan.h"
 #include "ParseTreeToString.h"
+#include "predicate.h"
 
 using namespace std;
 using namespace hsql;
 
 Tables* SQLExec::tables = nullptr;
 Indices* SQLExec::indices = nullptr;
+Statistics* SQLExec::statistics = nullptr;
+uint64_t SQLExec::statistics_version = 0;
+map<Identifier, pair<const PrepareStatement*, CachedPlan*>> SQLExec::prepared;
+
+// values for the placeholders (?) of the statement being executed (nullptr outside of EXECUTE)
+static const vector<Value> *bound_parameters = nullptr;
+
+// set while planning a SELECT under EXECUTE: its placeholders are left in the plan (as
+// Predicate::placeholder values) for each execution to bind to its own values
+static bool planning_placeholders = false;
 
 ostream &operator<<(ostream &out, const QueryResult &qres) {
     if (qres.column_names != nullptr) {
@@ -23,8 +34,12 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
             out << "----------+";
         out << endl;
         for (auto const &row: *qres.rows) {
-            for (auto const &column_name: *qres.column_names) {
-                Value value = row->at(column_name);
+            for (uint col_num = 0; col_num < qres.column_names->size(); col_num++) {
+                if (row->is_null(col_num)) {
+                    out << "NULL ";
+                    continue;
+                }
+                const Value &value = (*row)[col_num];
                 switch (value.data_type) {
                     case ColumnAttribute::INT:
                         out << value.n;
@@ -47,6 +62,16 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
     return out;
 }
 
+QueryResult::QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows,
+                         string message)
+        : column_names(column_names), column_attributes(column_attributes), rows(new Rows()), message(message) {
+    for (auto row: *rows) {
+        this->rows->push_back(new Row(*row, *column_names));
+        delete row;
+    }
+    delete rows;
+}
+
 QueryResult::~QueryResult() {
     if (column_names != nullptr)
         delete column_names;
@@ -59,57 +84,187 @@ QueryResult::~QueryResult() {
     }
 }
 
-//Pull out conjunctions of equality predicates from parse tree
-ValueDict* SQLExec::get_where_conjunction(const hsql::Expr *expr, const ColumnNames *col_names){
+CachedPlan::CachedPlan(EvalPlan *plan, ColumnNames *column_names, uint64_t catalog_version,
+                       uint64_t statistics_version)
+        : plan(plan), column_names(column_names), catalog_version(catalog_version),
+          statistics_version(statistics_version) {
+}
+
+CachedPlan::~CachedPlan() {
+    delete plan;
+    delete column_names;
+}
+
+//A literal in a WHERE clause or VALUES list (or a placeholder for one)
+static Value literal(const Expr *expr) {
+    switch (expr->type) {
+        case kExprLiteralString:
+            return Value(expr->name);
+        case kExprLiteralInt:
+            return Value(expr->ival);
+        case kExprPlaceholder:
+            if (planning_placeholders)
+                return Predicate::placeholder((uint)expr->ival);
+            if (bound_parameters == nullptr || expr->ival < 0 || (size_t)expr->ival >= bound_parameters->size())
+                throw SQLExecError("no value for placeholder " + to_string(expr->ival + 1));
+            return bound_parameters->at((size_t)expr->ival);
+        default:
+            throw DbRelationError("Not valid data type");
+    }
+}
+
+//Is this a column = literal predicate?
+static bool is_equality(const Expr *expr) {
+    return expr->type == kExprOperator && expr->opType == Expr::SIMPLE_OP && expr->opChar == '=' &&
+           expr->expr->type == kExprColumnRef &&
+           (expr->expr2->type == kExprLiteralString || expr->expr2->type == kExprLiteralInt ||
+            expr->expr2->type == kExprPlaceholder);
+}
+
+//Pull out the equality predicates (column = literal) of the top-level conjunction of a WHERE clause;
+//its other conjuncts are compiled into others
+ValueDict* SQLExec::get_where_conjunction(const hsql::Expr *expr, const ColumnNames *col_names, Predicates &others){
+    auto column = [col_names](const Expr *expr) -> Identifier {
+        if (expr->type != kExprColumnRef)
+            throw DbRelationError("expected a column name");
+        Identifier col = expr->name;
+        if(find(col_names->begin(), col_names->end(), col) == col_names->end()){//look for column
+            throw DbRelationError("unknown column '" + col + "'");
+        }
+        return col;
+    };
     ValueDict* rows = new ValueDict;
-    if (expr->type == kExprOperator){ //check for WHERE clause
-        if(expr->opType == Expr::AND){
-            ValueDict* sub = get_where_conjunction(expr->expr, col_names); //recursively get left
-            if (sub != nullptr){
-                rows->insert(sub->begin(), sub->end());
+    if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+        for (auto const sub_expr: {expr->expr, expr->expr2}) {
+            ValueDict* sub = get_where_conjunction(sub_expr, col_names, others); //recursively get each side
+            for (auto const& column: *sub) {
+                auto it = rows->find(column.first);
+                if (it == rows->end())
+                    rows->insert(column);
+                else if (it->second != column.second) // a = 1 AND a = 2
+                    others.push_back(new Predicate(PredicateOp::EQ, column.first, vector<Value>(1, column.second)));
             }
-            sub = get_where_conjunction(expr->expr2, col_names);
-            rows->insert(sub->begin(), sub->end());
+            delete sub;
         }
-        else if(expr->opType == Expr::SIMPLE_OP){
-            if(expr->opChar == '='){//handles equality in statement
-                Identifier col = expr->expr->name;
-                if(find(col_names->begin(), col_names->end(), col) == col_names->end()){//look for column
-                    throw DbRelationError("unknown column '" + col + "'");
-                }
-                switch(expr->expr2->type){
-                    case kExprLiteralString: {
-                        rows->insert(pair<Identifier, Value>(col, Value(expr->expr2->name)));
-                        break;
-                    }
-                    case kExprLiteralInt: {
-                        rows->insert(pair<Identifier, Value>(col, Value(expr->expr2->ival)));
-                        break;
+    } else if (is_equality(expr)) {
+        rows->insert(pair<Identifier, Value>(column(expr->expr), literal(expr->expr2)));
+    } else {
+        others.push_back(compile_predicate(expr, column));
+    }
+    return rows;
+}
+
+//Compile a WHERE clause (or part of one) into a Predicate: columns compared with literals (=, <>, <, <=, >, >=,
+//BETWEEN, IN) combined with AND, OR, and NOT. column gives the name of the column an expression refers to.
+Predicate *SQLExec::compile_predicate(const Expr *expr, const function<Identifier(const Expr*)> &column) {
+    if (expr->type != kExprOperator)
+        throw DbRelationError("Invalid Operator");
+    switch (expr->opType) {
+        case Expr::AND:
+        case Expr::OR: {
+            PredicateOp op = expr->opType == Expr::AND ? PredicateOp::AND : PredicateOp::OR;
+            Predicates children;
+            try {
+                for (auto const sub_expr: {expr->expr, expr->expr2}) {
+                    Predicate *child = compile_predicate(sub_expr, column);
+                    if (child->get_op() == op) { // flatten a AND (b AND c)
+                        children.insert(children.end(), child->get_children().begin(), child->get_children().end());
+                        child->get_children().clear();
+                        delete child;
+                    } else {
+                        children.push_back(child);
                     }
-                    default:
-                        throw DbRelationError("Not valid data type");
                 }
+            } catch (...) {
+                for (auto child: children)
+                    delete child;
+                throw;
             }
-            else {
-                throw DbRelationError("only equality predicates currently supported");
-            }
+            return new Predicate(op, children);
         }
-        else {
-            throw DbRelationError("only support AND conjunctions");
+        case Expr::NOT: {
+            Predicate *predicate = compile_predicate(expr->expr, column);
+            Predicate *ret = predicate->negated();
+            delete predicate;
+            return ret;
         }
-        return rows;
-    } else {
-        throw DbRelationError("Invalid Operator");
+        case Expr::BETWEEN:
+        case Expr::IN: {
+            Identifier column_name = column(expr->expr);
+            vector<Value> values;
+            for (auto const item: *expr->exprList)
+                values.push_back(literal(item));
+            return new Predicate(expr->opType == Expr::BETWEEN ? PredicateOp::BETWEEN : PredicateOp::IN,
+                                 column_name, values);
+        }
+        default:
+            break;
     }
+
+    PredicateOp op, flipped;  // flipped: the same comparison with the literal on the left
+    if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '=')
+        op = flipped = PredicateOp::EQ;
+    else if (expr->opType == Expr::NOT_EQUALS)
+        op = flipped = PredicateOp::NE;
+    else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '<')
+        op = PredicateOp::LT, flipped = PredicateOp::GT;
+    else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '>')
+        op = PredicateOp::GT, flipped = PredicateOp::LT;
+    else if (expr->opType == Expr::LESS_EQ)
+        op = PredicateOp::LE, flipped = PredicateOp::GE;
+    else if (expr->opType == Expr::GREATER_EQ)
+        op = PredicateOp::GE, flipped = PredicateOp::LE;
+    else
+        throw DbRelationError("unsupported operator in WHERE clause");
+    if (expr->expr->type == kExprColumnRef)
+        return new Predicate(op, column(expr->expr), vector<Value>(1, literal(expr->expr2)));
+    return new Predicate(flipped, column(expr->expr2), vector<Value>(1, literal(expr->expr)));
 }
 
-QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError) {
-    // initialize _tables table, if not yet present
+// initialize _tables table (and the other schema tables), if not yet present
+void SQLExec::initialize_schema() {
     if (SQLExec::tables == nullptr) {
         SQLExec::tables = new Tables();
 		SQLExec::indices = new Indices();
+		SQLExec::statistics = new Statistics();
 	}
+}
 
+QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError) {
+    CachedPlan *plan = nullptr;
+    QueryResult *result;
+    try {
+        result = execute(statement, plan);
+    } catch (...) {
+        delete plan;
+        throw;
+    }
+    delete plan;
+    return result;
+}
+
+QueryResult *SQLExec::execute(const SQLStatement *statement, CachedPlan *&plan) throw(SQLExecError) {
+    initialize_schema();
+    QueryResult *result;
+    try {
+        result = execute_statement(statement, plan);
+    } catch (...) {
+        write_schema();
+        throw;
+    }
+    write_schema();
+    return result;
+}
+
+// The schema tables are written back at the end of each statement (even one that failed part way),
+// so a crash can't lose DDL that has been reported done. Other tables wait for the buffer pool.
+void SQLExec::write_schema() {
+    SQLExec::tables->flush();
+    SQLExec::indices->flush();
+    SQLExec::statistics->flush();
+}
+
+QueryResult *SQLExec::execute_statement(const SQLStatement *statement, CachedPlan *&plan) {
     try {
         switch (statement->type()) {
             case kStmtCreate:
@@ -123,7 +278,11 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError)
             case kStmtDelete:
                 return del((const DeleteStatement *) statement);
             case kStmtSelect:
-                return select((const SelectStatement *) statement);
+                return select((const SelectStatement *) statement, plan);
+            case kStmtPrepare:
+                return prepare((const PrepareStatement *) statement);
+            case kStmtExecute:
+                return execute_prepared((const ExecuteStatement *) statement);
             default:
                 return new QueryResult("not implemented");
         }
@@ -132,16 +291,28 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError)
     }
 }
 
+QueryResult *SQLExec::analyze(Identifier table_name) throw(SQLExecError) {
+    initialize_schema();
+    if (table_name == Statistics::TABLE_NAME)
+        throw SQLExecError("cannot analyze " + table_name);
+    try {
+        SQLExec::statistics_version++;  // the cached plans were costed with the old statistics
+        uint32_t n = SQLExec::statistics->analyze(table_name);
+        write_schema();
+        return new QueryResult("analyzed " + table_name + ": " + to_string(n) + " rows");
+    } catch (DbRelationError& e) {
+        write_schema();
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    }
+}
+
 //Milestone5 - Nina
-//Construct ValueDict row to insert then insert it. Add indices as well
+//Construct ValueDict rows to insert then insert them (in bulk). Add indices as well
 QueryResult *SQLExec::insert(const InsertStatement *statement) {
     Identifier table_name = statement->tableName; //get table name
     DbRelation& table = SQLExec::tables->get_table(table_name); //get table
     ColumnNames column_names;
-    ColumnAttributes column_attributes;
-    ValueDict row;
-    Handle insertHandle;
-    unsigned int index = 0;
+    ValueDicts rows;
 
     //get column info
     if(statement->columns != nullptr){
@@ -155,33 +326,68 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
         }
     }
 
-    //insert statement into row
-    for (auto const& col : *statement->values){
-        switch(col->type){
-            case kExprLiteralString:
-                //row[col[index]] = Value(col->name);
-                row[column_names[index]] = Value(col->name);
-                index++;
-                break;
-            case kExprLiteralInt:
-                row[column_names[index]] = Value(col->ival);
-                index++;
-                break;
-            default:
-            //Don't add to table
-                throw SQLExecError("Insert can only handle INT or Text");
+    try {
+        if (statement->type == InsertStatement::kInsertSelect) {
+            //INSERT ... SELECT: the selected columns go into column_names in order
+            QueryResult *selected = select(statement->select);
+            ColumnNames *selected_names = selected->get_column_names();
+            if (selected_names == nullptr || selected_names->size() != column_names.size()) {
+                delete selected;
+                throw SQLExecError("INSERT ... SELECT must select one column for each column inserted");
+            }
+            for (auto const selected_row : *selected->get_rows()) {
+                ValueDict *row = new ValueDict();
+                for (unsigned int i = 0; i < column_names.size(); i++)
+                    if (!selected_row->is_null(i))
+                        (*row)[column_names[i]] = (*selected_row)[i];
+                rows.push_back(row);
+            }
+            delete selected;
+        } else {
+            //insert statement into row
+            ValueDict *row = new ValueDict();
+            rows.push_back(row);
+            unsigned int index = 0;
+            for (auto const& col : *statement->values){
+                switch(col->type){
+                    case kExprLiteralString:
+                    case kExprLiteralInt:
+                    case kExprPlaceholder:
+                        (*row)[column_names[index]] = literal(col);
+                        index++;
+                        break;
+                    default:
+                    //Don't add to table
+                        throw SQLExecError("Insert can only handle INT or Text");
+                }
+            }
         }
+    } catch (...) {
+        for (auto row : rows)
+            delete row;
+        throw;
     }
 
-    insertHandle = table.insert(&row); //add insert to handle
+    //add all the rows, then all their index entries, as one batch
+    Handles *handles;
+    try {
+        handles = table.insert(&rows);
+    } catch (...) {
+        for (auto row : rows)
+            delete row;
+        throw;
+    }
+    for (auto row : rows)
+        delete row;
     IndexNames index_names = SQLExec::indices->get_index_names(table_name); //get index names
     for(Identifier i_name : index_names){
         DbIndex& index = SQLExec::indices->get_index(table_name, i_name);
-        index.insert(insertHandle);
+        index.insert(handles);
     }
-    //get query index info
-    return new QueryResult("Successfully inserted 1 row into " 
-    + table_name + " and " + to_string(index_names.size()) + " indices"); //FIXME
+    size_t n = handles->size();
+    delete handles;
+    return new QueryResult("Successfully inserted " + to_string(n) + (n == 1 ? " row" : " rows") + " into "
+    + table_name + " and " + to_string(index_names.size()) + " indices");
 }
 
 //Milestone5 - NINA
@@ -191,6 +397,12 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     DbRelation& table = SQLExec::tables->get_table(table_name); //get table using tablename, and where clause
     ColumnNames col_names;
 
+    //Every index has to be able to drop its entries, or a row could end up gone from some and not others
+    auto index_names = SQLExec::indices->get_index_names(table_name);
+    for (auto const& index_name: index_names)
+        if (!SQLExec::indices->get_index(table_name, index_name).can_delete())
+            throw SQLExecError("cannot delete from " + table_name + ": index " + index_name + " does not support deletes");
+
     for (auto const col: table.get_column_names()){
         col_names.push_back(col);
     }
@@ -199,51 +411,98 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     EvalPlan *plan = new EvalPlan(table); 
 
     //This is to delete with or without where clause
-    ValueDict* where = new ValueDict;
     if (statement->expr != NULL){
-        try{
-            where = get_where_conjunction(statement->expr, &col_names);
-        }
-        catch (exception &e){
-            throw;
-        }
-        plan = new EvalPlan(where, plan);// define eval plan with where clause
+        Predicates others;
+        ValueDict* where = get_where_conjunction(statement->expr, &col_names, others);
+        plan = new EvalPlan(where, Predicate::conjunction(others), plan);// define eval plan with where clause (plan owns where)
     }
     
-    //execute evalutation plan to get list of handles
-    EvalPlan *opt = plan->optimize();
+    //execute evalutation plan to get a cursor over the handles
+    EvalPlan *opt = plan->optimize(*SQLExec::indices, *SQLExec::statistics);
     EvalPipeline pipeline = opt->pipeline();
-    //EvalPipeline t = optimized->pipeline();
-    //Handles *handles = pipeline;
-    Handles *handles = pipeline.second;
+    DbRelationCursor *cursor = pipeline.second;
 
-    //Remove from indices
-    auto index_names = SQLExec::indices->get_index_names(table_name);
-    unsigned int handle_size = handles->size();
+    //Remove from indices and table as the rows stream by
+    unsigned int handle_size = 0;
     unsigned int index_size = index_names.size();
-    for( auto const &handle: *handles){
-        for (unsigned int i = 0; i < index_names.size(); i++){
-            DbIndex &index = SQLExec::indices->get_index(table_name, index_names[i]);
-            index.del(handle);
+    Handle handle;
+    try {
+        while (cursor->next(handle)) {
+            for (unsigned int i = 0; i < index_names.size(); i++){
+                DbIndex &index = SQLExec::indices->get_index(table_name, index_names[i]);
+                index.del(handle);
+            }
+            table.del(handle);
+            handle_size++;
         }
+    } catch (...) {
+        delete cursor;
+        delete opt;
+        delete plan;
+        throw;
     }
-
-    //removing from table
-    for (auto const& handle: *handles){
-        table.del(handle);
-    }
-    delete where; //clear up memory
+    delete cursor; //clear up memory
+    delete opt;
+    delete plan;
     return new QueryResult("successfully deleted " + to_string(handle_size) 
     + " rows from " + table_name + " and " + to_string(index_size) + " indices");
-    
-    //return new QueryResult("DELETE statement not yet implemented");  // FIXME Nina
 }
 
 //Milestone 5 - MAGGIE
 QueryResult *SQLExec::select(const SelectStatement *statement) {
+    CachedPlan *plan = nullptr;
+    QueryResult *result;
+    try {
+        result = select(statement, plan);
+    } catch (...) {
+        delete plan;
+        throw;
+    }
+    delete plan;
+    return result;
+}
+
+// A plan from before is used again if nothing has changed since; otherwise a new one is planned and
+// optimized in its place. Under EXECUTE the plan keeps its placeholders, and a copy of it is bound to
+// the values each time, so it's good whatever the values are.
+QueryResult *SQLExec::select(const SelectStatement *statement, CachedPlan *&plan) {
+    if (plan == nullptr || plan->catalog_version != Catalog::get_version() ||
+        plan->statistics_version != SQLExec::statistics_version) {
+        ColumnNames *col_names = nullptr;
+        EvalPlan *optimized;
+        planning_placeholders = bound_parameters != nullptr;
+        try {
+            optimized = statement->fromTable->type == kTableJoin ? select_join_plan(statement, col_names)
+                                                                 : select_plan(statement, col_names);
+        } catch (...) {
+            planning_placeholders = false;
+            throw;
+        }
+        planning_placeholders = false;
+        if (optimized == nullptr)
+            return new QueryResult("Invalid select statement");
+        delete plan;
+        plan = new CachedPlan(optimized, col_names, Catalog::get_version(), SQLExec::statistics_version);
+    }
+
+    //evaluate the optimized plan
+    Rows* rows;
+    if (bound_parameters == nullptr || bound_parameters->empty()) {
+        rows = plan->plan->evaluate();
+    } else {
+        EvalPlan bound(plan->plan);
+        bound.bind(*bound_parameters);
+        rows = bound.evaluate();
+    }
+    return new QueryResult(new ColumnNames(*plan->column_names), NULL,
+    rows, "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+//Plan and optimize a SELECT from a single table (nullptr if it isn't valid)
+EvalPlan *SQLExec::select_plan(const SelectStatement *statement, ColumnNames *&col_names) {
     Identifier tbname = statement->fromTable->name;//get table name
     DbRelation& table = SQLExec::tables->get_table(tbname);
-    ColumnNames* col_names = new ColumnNames;
+    col_names = new ColumnNames;
 
     //get column names
     for (auto const &expr : *statement->selectList) {
@@ -253,8 +512,17 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
             case kExprColumnRef:
                 col_names->push_back(expr->name);
                 break;
+            case kExprFunctionRef: {
+                AggregateFunction function;
+                Identifier col;
+                aggregate(expr, nullptr, function, col);
+                col_names->push_back(aggregate_name(function, col));
+                break;
+            }
             default:
-                return new QueryResult("Invalid select statement");
+                delete col_names;
+                col_names = nullptr;
+                return nullptr;
         }
     }
 
@@ -269,26 +537,361 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
     //Start base of plan at a TableScan
     EvalPlan *plan = new EvalPlan(table);
 
-    //Enclose that in a Select if we have a where clause
-    ValueDict* where = new ValueDict;
+    //Enclose that in a Select if we have a where clause (plan owns where)
     if (statement->whereClause != NULL) {
-        where = get_where_conjunction(statement->whereClause, &table.get_column_names());
-        plan = new EvalPlan(where, plan);
+        Predicates others;
+        ValueDict* where = get_where_conjunction(statement->whereClause, &table.get_column_names(), others);
+        plan = new EvalPlan(where, Predicate::conjunction(others), plan);
     }
 
-    //ProjectAll or a Project
-    plan = new EvalPlan(col_names, plan);
+    //GROUP BY and aggregates
+    plan = aggregate_plan(statement, plan, nullptr);
 
-    //Optimize the plan and evaluate the optimized plan
-    EvalPlan *optimized = plan->optimize();
-    ValueDicts* rows = optimized->evaluate();
+    //DISTINCT and ORDER BY
+    plan = sort_plan(statement, plan, *col_names, nullptr);
 
-    //Handle memory
-    delete where;
+    //LIMIT and OFFSET
+    plan = limit_plan(statement, plan);
 
-    return new QueryResult(col_names, NULL,
-    rows, "successfully returned " + to_string(rows->size()) + " rows");  
-   //return new QueryResult("SELECT statement not yet implemented");  // FIXME Maggie
+    //ProjectAll or a Project (plan owns its own copy of the column names)
+    plan = new EvalPlan(new ColumnNames(*col_names), plan);
+
+    //Optimize the plan
+    EvalPlan *optimized = plan->optimize(*SQLExec::indices, *SQLExec::statistics);
+    delete plan;
+    return optimized;
+}
+
+// Put a SELECT's DISTINCT and ORDER BY on top of its plan, under the projection. The ORDER BY
+// columns (or aggregates) are looked up in the plan's columns, or by join_column if there is a join.
+EvalPlan *SQLExec::sort_plan(const SelectStatement *statement, EvalPlan *plan, const ColumnNames &projection,
+                             const FromTables *from) {
+    if (statement->selectDistinct)
+        plan = new EvalPlan(EvalPlan::Distinct, plan);
+    if (statement->order == nullptr)
+        return plan;
+
+    SortKeys *sort_keys = new SortKeys;
+    ColumnNames plan_columns = plan->get_column_names();
+    try {
+        for (auto const &order : *statement->order) {
+            Identifier col;
+            if (order->expr->type == kExprFunctionRef) {
+                AggregateFunction function;
+                Identifier column;
+                aggregate(order->expr, from, function, column);
+                col = aggregate_name(function, column);
+            } else if (order->expr->type != kExprColumnRef) {
+                throw SQLExecError("only columns and aggregates are supported in ORDER BY");
+            } else {
+                col = column_name(order->expr, from);
+            }
+            if (find(plan_columns.begin(), plan_columns.end(), col) == plan_columns.end())
+                throw DbRelationError("unknown column '" + col + "'");
+            if (statement->selectDistinct && find(projection.begin(), projection.end(), col) == projection.end())
+                throw SQLExecError("ORDER BY columns must be in the select list for SELECT DISTINCT");
+            sort_keys->push_back(pair<Identifier, bool>(col, order->type == kOrderDesc));
+        }
+    } catch (...) {
+        delete sort_keys;
+        delete plan;
+        throw;
+    }
+    return new EvalPlan(sort_keys, plan);
+}
+
+// Put a SELECT's LIMIT and OFFSET on top of its plan, under the projection. The Limit stops pulling
+// from the plan below it once it has enough rows, and over a Sort it makes the sort a top-N sort.
+EvalPlan *SQLExec::limit_plan(const SelectStatement *statement, EvalPlan *plan) {
+    if (statement->limit == nullptr)
+        return plan;
+    size_t limit = statement->limit->limit < 0 ? SIZE_MAX : (size_t)statement->limit->limit;
+    size_t offset = statement->limit->offset < 0 ? 0 : (size_t)statement->limit->offset;
+    return new EvalPlan(limit, offset, plan);
+}
+
+// Put a SELECT's GROUP BY and aggregates (if it has any) on top of its plan, under any DISTINCT or
+// ORDER BY. Every plain column in the select list then has to be one of the GROUP BY columns.
+EvalPlan *SQLExec::aggregate_plan(const SelectStatement *statement, EvalPlan *plan, const FromTables *from) {
+    bool grouped = statement->groupBy != nullptr;
+    for (auto const &expr : *statement->selectList)
+        if (expr->type == kExprFunctionRef)
+            grouped = true;
+    if (!grouped)
+        return plan;
+
+    ColumnNames plan_columns = plan->get_column_names();
+    ColumnNames *group_by = new ColumnNames;
+    Aggregates *aggregates = new Aggregates;
+    try {
+        auto check = [&](const Identifier &col) {
+            if (find(plan_columns.begin(), plan_columns.end(), col) == plan_columns.end())
+                throw DbRelationError("unknown column '" + col + "'");
+        };
+        auto add = [&](const Expr *expr) {
+            pair<AggregateFunction, Identifier> agg;
+            aggregate(expr, from, agg.first, agg.second);
+            if (agg.first != AggregateFunction::COUNT_STAR)
+                check(agg.second);
+            if (find(aggregates->begin(), aggregates->end(), agg) == aggregates->end())
+                aggregates->push_back(agg);
+        };
+        if (statement->groupBy != nullptr) {
+            if (statement->groupBy->having != nullptr)
+                throw SQLExecError("HAVING is not supported");
+            for (auto const &expr : *statement->groupBy->columns) {
+                Identifier col = column_name(expr, from);
+                check(col);
+                group_by->push_back(col);
+            }
+        }
+        for (auto const &expr : *statement->selectList) {
+            switch (expr->type) {
+                case kExprFunctionRef:
+                    add(expr);
+                    break;
+                case kExprColumnRef: {
+                    Identifier col = column_name(expr, from);
+                    if (find(group_by->begin(), group_by->end(), col) == group_by->end())
+                        throw SQLExecError("column '" + col + "' must be in GROUP BY or in an aggregate");
+                    break;
+                }
+                default:
+                    throw SQLExecError("SELECT * can't be used with GROUP BY or aggregates");
+            }
+        }
+        if (statement->order != nullptr)
+            for (auto const &order : *statement->order)
+                if (order->expr->type == kExprFunctionRef)
+                    add(order->expr);
+    } catch (...) {
+        delete group_by;
+        delete aggregates;
+        delete plan;
+        throw;
+    }
+    return new EvalPlan(group_by, aggregates, plan);
+}
+
+// A column reference's name in the plan: qualified by its table if there is a join
+Identifier SQLExec::column_name(const Expr *expr, const FromTables *from) {
+    if (expr->type != kExprColumnRef)
+        throw SQLExecError("expected a column name");
+    if (from == nullptr)
+        return expr->name;
+    pair<uint, Identifier> column = join_column(expr, *from);
+    return (*from)[column.first].first + "." + column.second;
+}
+
+// COUNT(*), COUNT(col), SUM(col), MIN(col), or MAX(col)
+void SQLExec::aggregate(const Expr *expr, const FromTables *from, AggregateFunction &function,
+                        Identifier &column_name) {
+    string name = expr->name;
+    transform(name.begin(), name.end(), name.begin(), ::toupper);
+    if (expr->distinct)
+        throw SQLExecError("DISTINCT is not supported in " + name);
+    if (expr->expr == nullptr)
+        throw SQLExecError(name + " needs an argument");
+    if (name == "COUNT" && expr->expr->type == kExprStar) {
+        function = AggregateFunction::COUNT_STAR;
+        column_name = "";
+        return;
+    }
+    if (name == "COUNT")
+        function = AggregateFunction::COUNT;
+    else if (name == "SUM")
+        function = AggregateFunction::SUM;
+    else if (name == "MIN")
+        function = AggregateFunction::MIN;
+    else if (name == "MAX")
+        function = AggregateFunction::MAX;
+    else
+        throw SQLExecError("unknown function " + string(expr->name));
+    column_name = SQLExec::column_name(expr->expr, from);
+}
+
+// Joins are inner equi-joins, planned as written (left to right) as HashJoins. The WHERE clause's
+// conjuncts each look at a single table and are pushed down onto the scan of their table.
+EvalPlan *SQLExec::select_join_plan(const SelectStatement *statement, ColumnNames *&col_names) {
+    FromTables from;
+    join_tables(statement->fromTable, from);
+    vector<ValueDict*> wheres(from.size(), nullptr);
+    vector<Predicates> others(from.size());
+    if (statement->whereClause != nullptr)
+        join_where(statement->whereClause, from, wheres, others);
+    uint next = 0;
+    EvalPlan *plan = join_plan(statement->fromTable, from, wheres, others, next);
+
+    //get column names: shown as written, looked up qualified by their table
+    col_names = new ColumnNames;
+    ColumnNames* projection = new ColumnNames;
+    for (auto const &expr : *statement->selectList) {
+        switch (expr->type) {
+            case kExprStar:
+                for (auto const &table : from) {
+                    for (auto const &col : table.second->get_column_names()) {
+                        col_names->push_back(table.first + "." + col);
+                        projection->push_back(table.first + "." + col);
+                    }
+                }
+                break;
+            case kExprColumnRef: {
+                pair<uint, Identifier> column = join_column(expr, from);
+                col_names->push_back(expr->table != nullptr ? string(expr->table) + "." + expr->name : expr->name);
+                projection->push_back(from[column.first].first + "." + column.second);
+                break;
+            }
+            case kExprFunctionRef: {
+                AggregateFunction function;
+                Identifier col;
+                aggregate(expr, &from, function, col);
+                const Expr *arg = expr->expr;
+                Identifier written = arg->type != kExprColumnRef ? "" :
+                        (arg->table != nullptr ? string(arg->table) + "." + arg->name : arg->name);
+                col_names->push_back(aggregate_name(function, written));
+                projection->push_back(aggregate_name(function, col));
+                break;
+            }
+            default:
+                delete col_names;
+                col_names = nullptr;
+                delete projection;
+                delete plan;
+                return nullptr;
+        }
+    }
+    plan = aggregate_plan(statement, plan, &from);
+    plan = sort_plan(statement, plan, *projection, &from);
+    plan = limit_plan(statement, plan);
+    plan = new EvalPlan(projection, plan);
+
+    //Optimize the plan
+    EvalPlan *optimized = plan->optimize(*SQLExec::indices, *SQLExec::statistics);
+    delete plan;
+    return optimized;
+}
+
+//Collect the tables of a FROM clause, left to right, by alias (or name)
+void SQLExec::join_tables(const TableRef *table_ref, FromTables &from) {
+    switch (table_ref->type) {
+        case kTableName: {
+            Identifier name = table_ref->alias != nullptr ? table_ref->alias : table_ref->name;
+            for (auto const &table : from)
+                if (table.first == name)
+                    throw SQLExecError("table name '" + name + "' used more than once");
+            from.push_back(pair<Identifier, DbRelation*>(name, &SQLExec::tables->get_table(table_ref->name)));
+            break;
+        }
+        case kTableJoin:
+            if (table_ref->join->type != kJoinInner || table_ref->join->condition == nullptr)
+                throw SQLExecError("only inner joins with an ON condition are supported");
+            join_tables(table_ref->join->left, from);
+            join_tables(table_ref->join->right, from);
+            break;
+        default:
+            throw SQLExecError("only tables and joins are supported in FROM");
+    }
+}
+
+//Find which table a (possibly qualified) column reference is in: (its position in from, column name)
+pair<uint, Identifier> SQLExec::join_column(const Expr *expr, const FromTables &from) {
+    if (expr->type != kExprColumnRef)
+        throw SQLExecError("expected a column name");
+    Identifier col = expr->name;
+    int found = -1;
+    for (uint i = 0; i < from.size(); i++) {
+        if (expr->table != nullptr && from[i].first != expr->table)
+            continue;
+        const ColumnNames &names = from[i].second->get_column_names();
+        if (find(names.begin(), names.end(), col) != names.end()) {
+            if (found >= 0)
+                throw SQLExecError("column '" + col + "' is ambiguous");
+            found = (int)i;
+        }
+    }
+    if (found < 0)
+        throw DbRelationError("unknown column '" + (expr->table != nullptr ? string(expr->table) + "." : "") + col + "'");
+    return pair<uint, Identifier>((uint)found, col);
+}
+
+//Sort the conjuncts of a WHERE clause out by table: equalities (col = literal) into wheres, anything
+//else (which must only look at one table) compiled into others
+void SQLExec::join_where(const Expr *expr, const FromTables &from, vector<ValueDict*> &wheres,
+                         vector<Predicates> &others) {
+    if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+        join_where(expr->expr, from, wheres, others);
+        join_where(expr->expr2, from, wheres, others);
+        return;
+    }
+    if (!is_equality(expr)) {
+        int table = -1;
+        Predicate *predicate = compile_predicate(expr, [&](const Expr *column_expr) -> Identifier {
+            pair<uint, Identifier> column = join_column(column_expr, from);
+            if (table >= 0 && (uint)table != column.first)
+                throw SQLExecError("a WHERE predicate can only compare columns of one table with literals");
+            table = (int)column.first;
+            return column.second;
+        });
+        others[table].push_back(predicate);
+        return;
+    }
+    pair<uint, Identifier> column = join_column(expr->expr, from);
+    Value value = literal(expr->expr2);
+    if (wheres[column.first] == nullptr)
+        wheres[column.first] = new ValueDict;
+    auto it = wheres[column.first]->find(column.second);
+    if (it == wheres[column.first]->end())
+        (*wheres[column.first])[column.second] = value;
+    else if (it->second != value) // a = 1 AND a = 2
+        others[column.first].push_back(new Predicate(PredicateOp::EQ, column.second, vector<Value>(1, value)));
+}
+
+//Plan the tables of from[next..] that table_ref covers (plan owns the where clauses it uses)
+EvalPlan *SQLExec::join_plan(const TableRef *table_ref, const FromTables &from, vector<ValueDict*> &wheres,
+                             vector<Predicates> &others, uint &next) {
+    if (table_ref->type == kTableName) {
+        uint i = next++;
+        EvalPlan *plan = new EvalPlan(*from[i].second);
+        if (wheres[i] != nullptr || !others[i].empty()) {
+            plan = new EvalPlan(wheres[i] != nullptr ? wheres[i] : new ValueDict, Predicate::conjunction(others[i]), plan);
+            wheres[i] = nullptr;
+        }
+        return plan;
+    }
+    const JoinDefinition *join = table_ref->join;
+    uint left_first = next;
+    EvalPlan *left = join_plan(join->left, from, wheres, others, next);
+    uint right_first = next;
+    EvalPlan *right = join_plan(join->right, from, wheres, others, next);
+
+    //a side that is a join already has qualified column names
+    Identifier left_name = join->left->type == kTableName ? from[left_first].first : "";
+    Identifier right_name = join->right->type == kTableName ? from[right_first].first : "";
+    ColumnNames *left_keys = new ColumnNames;
+    ColumnNames *right_keys = new ColumnNames;
+    join_keys(join->condition, from, left_first, right_first, next, left_name, right_name, left_keys, right_keys);
+    return new EvalPlan(EvalPlan::HashJoin, left, left_name, right, right_name, left_keys, right_keys);
+}
+
+//Pull the column pairs out of an ON condition (a conjunction of column = column, one from each side)
+void SQLExec::join_keys(const Expr *expr, const FromTables &from, uint left_first, uint right_first, uint right_last,
+                        const Identifier &left_name, const Identifier &right_name,
+                        ColumnNames *left_keys, ColumnNames *right_keys) {
+    if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+        join_keys(expr->expr, from, left_first, right_first, right_last, left_name, right_name, left_keys, right_keys);
+        join_keys(expr->expr2, from, left_first, right_first, right_last, left_name, right_name, left_keys, right_keys);
+        return;
+    }
+    if (expr->type != kExprOperator || expr->opType != Expr::SIMPLE_OP || expr->opChar != '=')
+        throw SQLExecError("only equality join conditions are supported");
+    pair<uint, Identifier> a = join_column(expr->expr, from);
+    pair<uint, Identifier> b = join_column(expr->expr2, from);
+    if (a.first >= right_first)
+        swap(a, b);
+    if (a.first < left_first || a.first >= right_first || b.first < right_first || b.first >= right_last)
+        throw SQLExecError("join condition must compare a column from each side of the join");
+    left_keys->push_back(left_name.empty() ? from[a.first].first + "." + a.second : a.second);
+    right_keys->push_back(right_name.empty() ? from[b.first].first + "." + b.second : b.second);
 }
 
 void SQLExec::column_definition(const ColumnDefinition *col, Identifier& column_name,
@@ -344,12 +947,18 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
                 c_handles.push_back(columns.insert(&row));  // Insert into _columns
             }
 
-            // Finally, actually create the relation
-            DbRelation& table = SQLExec::tables->get_table(table_name);
-            if (statement->ifNotExists)
-                table.create_if_not_exists();
-            else
-                table.create();
+            // Finally, put it in the catalog and actually create the relation
+            Catalog::add_table(table_name, column_names, column_attributes);
+            try {
+                DbRelation& table = SQLExec::tables->get_table(table_name);
+                if (statement->ifNotExists)
+                    table.create_if_not_exists();
+                else
+                    table.create();
+            } catch (...) {
+                Catalog::drop_table(table_name);
+                throw;
+            }
 
         } catch (...) {
             // attempt to remove from _columns
@@ -388,7 +997,7 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
     row["table_name"] = Value(table_name);
     row["index_name"] = Value(index_name);
     row["index_type"] = Value(statement->indexType);
-    row["is_unique"] = Value(string(statement->indexType) == "BTREE"); // assume HASH is non-unique --
+    row["is_unique"] = Value(false);  // no CREATE UNIQUE INDEX in the parser, so neither kind is unique
     int seq = 0;
     Handles i_handles;
     try {
@@ -398,8 +1007,16 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
             i_handles.push_back(SQLExec::indices->insert(&row));
         }
 
-        DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
-        index.create();
+        Catalog::add_index(table_name, index_name,
+                           ColumnNames(statement->indexColumns->begin(), statement->indexColumns->end()),
+                           string(statement->indexType) == "HASH", row["is_unique"].n != 0);
+        try {
+            DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+            index.create();
+        } catch (...) {
+            Catalog::drop_index(table_name, index_name);
+            throw;
+        }
 
     } catch (...) {
         // attempt to remove from _indices
@@ -414,6 +1031,8 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
 
 // DROP ...
 QueryResult *SQLExec::drop(const DropStatement *statement) {
+    if (statement->type == DropStatement::kPreparedStatement)
+        return deallocate(statement);
     switch(statement->type) {
         case DropStatement::kTable:
             return drop_table(statement);
@@ -426,7 +1045,8 @@ QueryResult *SQLExec::drop(const DropStatement *statement) {
  
 QueryResult *SQLExec::drop_table(const DropStatement *statement) {
     Identifier table_name = statement->name;
-    if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME)
+    if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME
+        || table_name == Statistics::TABLE_NAME)
         throw SQLExecError("cannot drop a schema table");
 
     ValueDict where;
@@ -435,6 +1055,9 @@ QueryResult *SQLExec::drop_table(const DropStatement *statement) {
     // get the table
     DbRelation& table = SQLExec::tables->get_table(table_name);
 
+    // remove any statistics
+    SQLExec::statistics->forget(table_name);
+
     // remove any indices
     for (auto const& index_name: SQLExec::indices->get_index_names(table_name)) {
         DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
@@ -455,8 +1078,9 @@ QueryResult *SQLExec::drop_table(const DropStatement *statement) {
     // remove table
     table.drop();
 
-    // finally, remove from _tables schema
+    // finally, remove from _tables schema and the catalog
     SQLExec::tables->del(*SQLExec::tables->select(&where)->begin()); // expect only one row from select
+    Catalog::drop_table(table_name);
 
     return new QueryResult(string("dropped ") + table_name);
 }
@@ -477,10 +1101,74 @@ QueryResult *SQLExec::drop_index(const DropStatement *statement) {
     for (auto const& handle: *handles)
         SQLExec::indices->del(handle);
     delete handles;
+    Catalog::drop_index(table_name, index_name);
 
     return new QueryResult("dropped index " + index_name);
 }
 
+// PREPARE name: statement -- the statement's placeholders (?) are numbered by the parser
+QueryResult *SQLExec::prepare(const PrepareStatement *statement) {
+    if (statement->query->size() != 1)
+        throw SQLExecError("can only prepare a single statement");
+    StatementType type = statement->query->getStatement(0)->type();
+    if (type == kStmtPrepare || type == kStmtExecute)
+        throw SQLExecError("cannot prepare a PREPARE or EXECUTE");
+    Identifier name = statement->name;
+    auto it = SQLExec::prepared.find(name);
+    if (it != SQLExec::prepared.end()) {
+        delete it->second.second;
+        SQLExec::prepared.erase(it);
+    }
+    SQLExec::prepared[name] = pair<const PrepareStatement*, CachedPlan*>(statement, nullptr);
+    return new QueryResult("prepared " + name);
+}
+
+// EXECUTE name(value, ...) -- a SELECT's plan is kept between executions, whatever their values
+QueryResult *SQLExec::execute_prepared(const ExecuteStatement *statement) {
+    Identifier name = statement->name;
+    auto it = SQLExec::prepared.find(name);
+    if (it == SQLExec::prepared.end())
+        throw SQLExecError("no prepared statement named " + name);
+    const PrepareStatement *prepare = it->second.first;
+    vector<Value> parameters;
+    if (statement->parameters != nullptr)
+        for (auto const expr: *statement->parameters)
+            parameters.push_back(literal(expr));
+    if (parameters.size() != prepare->placeholders.size())
+        throw SQLExecError(name + " takes " + to_string(prepare->placeholders.size()) + " parameters, not " +
+                           to_string(parameters.size()));
+
+    const vector<Value> *outer = bound_parameters;
+    bound_parameters = &parameters;
+    QueryResult *result;
+    try {
+        result = execute(prepare->query->getStatement(0), it->second.second);
+    } catch (...) {
+        bound_parameters = outer;
+        throw;
+    }
+    bound_parameters = outer;
+    return result;
+}
+
+bool SQLExec::is_prepared(const PrepareStatement *statement) {
+    for (auto const& entry: SQLExec::prepared)
+        if (entry.second.first == statement)
+            return true;
+    return false;
+}
+
+// DEALLOCATE PREPARE name
+QueryResult *SQLExec::deallocate(const DropStatement *statement) {
+    Identifier name = statement->name;
+    auto it = SQLExec::prepared.find(name);
+    if (it == SQLExec::prepared.end())
+        throw SQLExecError("no prepared statement named " + name);
+    delete it->second.second;
+    SQLExec::prepared.erase(it);
+    return new QueryResult("deallocated " + name);
+}
+
 QueryResult *SQLExec::show(const ShowStatement *statement) {
     switch (statement->type) {
         case ShowStatement::kTables:
@@ -538,7 +1226,7 @@ QueryResult *SQLExec::show_tables() {
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
 
     Handles* handles = SQLExec::tables->select();
-    u_long n = handles->size() - 3;
+    u_long n = handles->size() - 4;
 
     ValueDicts* rows = new ValueDicts;
     for (auto const& handle: *handles) {
@@ -546,7 +1234,8 @@ QueryResult *SQLExec::show_tables() {
         Identifier table_name = row->at("table_name").s;
         if (table_name != Tables::TABLE_NAME
             && table_name != Columns::TABLE_NAME
-            && table_name != Indices::TABLE_NAME) {
+            && table_name != Indices::TABLE_NAME
+            && table_name != Statistics::TABLE_NAME) {
 
              	rows->push_back(row);
         }
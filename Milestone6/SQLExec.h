@@ -6,10 +6,22 @@
 #pragma once
 
 #include <exception>
+#include <functional>
+#include <map>
 #include <string>
 #include "SQLParser.h"
 #include "schema_tables.h"
 
+class EvalPlan;
+class Predicate;
+typedef std::vector<Predicate*> Predicates;
+enum class AggregateFunction;
+
+/**
+ * The tables of a FROM clause with joins: (the name the query uses for it, the table), left to right
+ */
+typedef std::vector<std::pair<Identifier, DbRelation*>> FromTables;
+
 /**
  * @class SQLExecError - exception for SQLExec methods
  */
@@ -29,25 +41,49 @@ public:
     QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
                                        message(message) {}
 
-    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, Rows *rows, std::string message)
             : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
 
+    // takes the rows by name, converting them (and freeing them)
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message);
+
     virtual ~QueryResult();
 
     ColumnNames *get_column_names() const { return column_names; }
     ColumnAttributes *get_column_attributes() const { return column_attributes; }
-    ValueDicts *get_rows() const { return rows; }
+    Rows *get_rows() const { return rows; }  // by position in get_column_names()
     const std::string &get_message() const { return message; }
     friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
 
 protected:
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
-    ValueDicts *rows;
+    Rows *rows;
     std::string message;
 };
 
 
+/**
+ * @class CachedPlan - an optimized SELECT plan kept to be run again
+ *
+ * Good for as long as the catalog and statistics stay as they were when it was built (see
+ * Catalog::get_version). A prepared SELECT's plan keeps its placeholders, to be bound to the values
+ * of each EXECUTE (see EvalPlan::bind).
+ */
+class CachedPlan {
+public:
+    CachedPlan(EvalPlan *plan, ColumnNames *column_names, uint64_t catalog_version, uint64_t statistics_version);
+    virtual ~CachedPlan();
+    CachedPlan(const CachedPlan &other) = delete;
+    CachedPlan &operator=(const CachedPlan &other) = delete;
+
+    EvalPlan *plan;  // optimized, ready to evaluate
+    ColumnNames *column_names;  // as the query shows them
+    uint64_t catalog_version;  // Catalog::get_version() when it was built
+    uint64_t statistics_version;  // SQLExec::statistics_version when it was built
+};
+
+
 /**
  * @class SQLExec - execution engine
  */
@@ -60,10 +96,45 @@ public:
 	 */
     static QueryResult *execute(const hsql::SQLStatement *statement) throw(SQLExecError);
 
+	/**
+	 * Execute the given SQL statement, reusing the plan from the last time it was executed if that's
+	 * still good.
+	 * @param statement   the Hyrise AST of the SQL statement to execute
+	 * @param plan        the SELECT plan from the last time (or nullptr); replaced if it had to be
+	 *                    rebuilt (freed by caller)
+	 * @returns           the query result (freed by caller)
+	 */
+    static QueryResult *execute(const hsql::SQLStatement *statement, CachedPlan *&plan) throw(SQLExecError);
+
+	/**
+	 * Execute ANALYZE <table_name>: gather the optimizer statistics for a table.
+	 * (Not part of the SQL the parser knows, so the shell calls this directly.)
+	 * @param table_name  table to analyze
+	 * @returns           the query result (freed by caller)
+	 */
+    static QueryResult *analyze(Identifier table_name) throw(SQLExecError);
+
+	/**
+	 * Is this statement still PREPAREd (not since deallocated or replaced by another of the same name)?
+	 * Until it isn't, its parse tree has to be kept.
+	 */
+    static bool is_prepared(const hsql::PrepareStatement *statement);
+
 protected:
-	// the one place in the system that holds the _tables table and _indices table
+	// the one place in the system that holds the _tables, _indices, and _statistics tables
     static Tables *tables;
 	static Indices *indices;
+	static Statistics *statistics;
+
+	// bumped by every ANALYZE, so any plan built before is stale
+	static uint64_t statistics_version;
+
+	// PREPAREd statements by name (the statements belong to the caller's parse trees), with their plans
+	static std::map<Identifier, std::pair<const hsql::PrepareStatement*, CachedPlan*>> prepared;
+
+	static void initialize_schema();
+	static QueryResult *execute_statement(const hsql::SQLStatement *statement, CachedPlan *&plan);
+	static void write_schema();
 
 	// recursive decent into the AST
     static QueryResult *create(const hsql::CreateStatement *statement);
@@ -82,7 +153,38 @@ protected:
     static QueryResult *insert(const hsql::InsertStatement *statement);
     static QueryResult *del(const hsql::DeleteStatement *statement);
     static QueryResult *select(const hsql::SelectStatement *statement);
-    static ValueDict *get_where_conjunction(const hsql::Expr *expr, const ColumnNames *col_names);
+    static QueryResult *select(const hsql::SelectStatement *statement, CachedPlan *&plan);
+    static EvalPlan *select_plan(const hsql::SelectStatement *statement, ColumnNames *&col_names);
+    static ValueDict *get_where_conjunction(const hsql::Expr *expr, const ColumnNames *col_names, Predicates &others);
+    static Predicate *compile_predicate(const hsql::Expr *expr,
+                                        const std::function<Identifier(const hsql::Expr*)> &column);
+    static EvalPlan *sort_plan(const hsql::SelectStatement *statement, EvalPlan *plan, const ColumnNames &projection,
+                               const FromTables *from);
+
+    static EvalPlan *limit_plan(const hsql::SelectStatement *statement, EvalPlan *plan);
+
+    // GROUP BY and COUNT, SUM, MIN, MAX
+    static EvalPlan *aggregate_plan(const hsql::SelectStatement *statement, EvalPlan *plan, const FromTables *from);
+    static Identifier column_name(const hsql::Expr *expr, const FromTables *from);
+    static void aggregate(const hsql::Expr *expr, const FromTables *from, AggregateFunction &function,
+                          Identifier &column_name);
+
+    // SELECT ... FROM a JOIN b ON ...
+    static EvalPlan *select_join_plan(const hsql::SelectStatement *statement, ColumnNames *&col_names);
+    static void join_tables(const hsql::TableRef *table_ref, FromTables &from);
+    static std::pair<uint, Identifier> join_column(const hsql::Expr *expr, const FromTables &from);
+    static void join_where(const hsql::Expr *expr, const FromTables &from, std::vector<ValueDict*> &wheres,
+                           std::vector<Predicates> &others);
+    static EvalPlan *join_plan(const hsql::TableRef *table_ref, const FromTables &from,
+                               std::vector<ValueDict*> &wheres, std::vector<Predicates> &others, uint &next);
+    static void join_keys(const hsql::Expr *expr, const FromTables &from, uint left_first, uint right_first,
+                          uint right_last, const Identifier &left_name, const Identifier &right_name,
+                          ColumnNames *left_keys, ColumnNames *right_keys);
+
+    // PREPARE, EXECUTE, DEALLOCATE PREPARE
+    static QueryResult *prepare(const hsql::PrepareStatement *statement);
+    static QueryResult *execute_prepared(const hsql::ExecuteStatement *statement);
+    static QueryResult *deallocate(const hsql::DropStatement *statement);
 
 	/**
 	 * Pull out column name and attributes from AST's column definition clause
@@ -0,0 +1,405 @@
+/**
+ * @file aggregate.cpp - implementation of:
+ * HashAggregateBatchCursor
+ * CountBatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <climits>
+#include <functional>
+#include <unistd.h>
+#include "aggregate.h"
+using namespace std;
+
+static uint aggregate_count = 0;  // for naming the partitions
+static const uint STATE_COLUMNS = 4;  // count, high and low halves of sum, value: for each aggregate in a partition
+
+Identifier aggregate_name(AggregateFunction function, const Identifier &column_name) {
+	switch (function) {
+		case AggregateFunction::COUNT_STAR:
+			return "COUNT(*)";
+		case AggregateFunction::COUNT:
+			return "COUNT(" + column_name + ")";
+		case AggregateFunction::SUM:
+			return "SUM(" + column_name + ")";
+		case AggregateFunction::MIN:
+			return "MIN(" + column_name + ")";
+		case AggregateFunction::MAX:
+			return "MAX(" + column_name + ")";
+	}
+	return "";
+}
+
+// Group-by columns are compared as byte strings: for each column a NULL marker or its value
+// (4 bytes of int, or a u16 length and the text).
+static void group_key(const ColumnBatch *batch, uint16_t row, uint group_count, string &key) {
+	key.clear();
+	for (uint col_num = 0; col_num < group_count; col_num++) {
+		const ColumnVector &column = batch->column(col_num);
+		if (column.is_null(row)) {
+			key += '\0';
+			continue;
+		}
+		key += '\1';
+		if (column.get_data_type() == ColumnAttribute::DataType::TEXT) {
+			TextView text = column.get_text(row);
+			uint16_t len = text.size();
+			key.append((const char*)&len, sizeof(len));
+			key.append(text.data(), len);
+		} else {
+			int32_t n = column.get_int(row);
+			key.append((const char*)&n, sizeof(n));
+		}
+	}
+}
+
+// Which partition a group's partial states go to. Uses the high bits of the hash, since the
+// slots come from the low ones.
+static uint partition_of(size_t hash) {
+	return (uint)((hash >> 20) % HashAggregateBatchCursor::PARTITIONS);
+}
+
+// Should value replace the current MIN (or MAX)?
+static bool better(AggregateFunction function, const Value &value, const Value &current) {
+	return function == AggregateFunction::MIN ? value < current : current < value;
+}
+
+HashAggregateBatchCursor::HashAggregateBatchCursor(BatchCursor *input, const ColumnAttributes &input_attributes,
+												   uint group_count, const AggregateInputs &aggregates,
+												   const ColumnNumbers &output, const ColumnNames &column_names,
+												   const ColumnAttributes &column_attributes, size_t memory_budget)
+		: BatchCursor(), input(input), input_attributes(input_attributes), group_count(group_count),
+		  aggregates(aggregates), output(output), memory_budget(memory_budget), batch(column_names, column_attributes),
+		  slots(), group_hashes(), group_keys(), group_values(), states(), group_bytes(0), row_groups(),
+		  aggregate_number(++aggregate_count), partitions(), pending(), next_partition(0), aggregated(false),
+		  next_group(0) {
+}
+
+HashAggregateBatchCursor::~HashAggregateBatchCursor() {
+	clear_table();
+	for (auto &rows: this->pending)
+		for (auto row: rows)
+			delete row;
+	delete this->input;
+	for (auto partition: this->partitions) {
+		partition->drop();
+		delete partition;
+	}
+}
+
+ColumnBatch* HashAggregateBatchCursor::next() {
+	if (!this->aggregated)
+		aggregate_input();
+	this->batch.clear();
+	while (!this->batch.full()) {
+		if (this->next_group < this->group_keys.size()) {
+			emit((uint32_t)this->next_group++);
+			continue;
+		}
+		if (!load_next_partition())
+			break;
+	}
+	if (this->batch.size() == 0)
+		return nullptr;
+	this->batch.select_all();
+	return &this->batch;
+}
+
+// Run all of the input through the hash table, spilling partial states whenever it gets too big.
+void HashAggregateBatchCursor::aggregate_input() {
+	this->aggregated = true;
+	ColumnBatch *input_batch;
+	while ((input_batch = this->input->next()) != nullptr) {
+		update(input_batch);
+		if (this->group_bytes > this->memory_budget)
+			spill();
+	}
+	if (!this->partitions.empty()) {
+		spill();
+		flush();
+		return;  // next() goes through the partitions
+	}
+	if (this->group_count == 0 && this->group_keys.empty()) {
+		// no rows at all: still one (empty) group
+		bool added;
+		find_group(hash<string>()(""), "", added);
+		this->group_values.push_back(new Row());
+		this->states.resize(this->aggregates.size(), State{0, 0, Value()});
+	}
+}
+
+// Find the group with the given key, adding it if it's new.
+uint32_t HashAggregateBatchCursor::find_group(size_t hash, const string &key, bool &added) {
+	if ((this->group_keys.size() + 1) * 2 > this->slots.size())
+		grow();
+	size_t mask = this->slots.size() - 1;
+	for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+		uint32_t group = this->slots[slot];
+		if (group == 0) {
+			group = (uint32_t)this->group_keys.size();
+			this->slots[slot] = group + 1;
+			this->group_hashes.push_back(hash);
+			this->group_keys.push_back(key);
+			added = true;
+			return group;
+		}
+		if (this->group_hashes[group - 1] == hash && this->group_keys[group - 1] == key) {
+			added = false;
+			return group - 1;
+		}
+	}
+}
+
+// Double the number of slots (keeping them at most half full) and put the groups back in.
+void HashAggregateBatchCursor::grow() {
+	size_t n_slots = this->slots.empty() ? 1024 : this->slots.size() * 2;
+	this->slots.assign(n_slots, 0);
+	size_t mask = n_slots - 1;
+	for (uint32_t group = 0; group < this->group_hashes.size(); group++) {
+		size_t slot = this->group_hashes[group] & mask;
+		while (this->slots[slot] != 0)
+			slot = (slot + 1) & mask;
+		this->slots[slot] = group + 1;
+	}
+}
+
+// Bring the groups up to date with an input batch: find each row's group, then go through the
+// batch once for each aggregate.
+void HashAggregateBatchCursor::update(const ColumnBatch *batch) {
+	size_t n_aggregates = this->aggregates.size();
+	this->row_groups.resize(batch->size());
+	string key;
+	for (uint16_t row: batch->selection()) {
+		group_key(batch, row, this->group_count, key);
+		bool added;
+		uint32_t group = find_group(hash<string>()(key), key, added);
+		if (added) {
+			Row *values = batch->get_row(row, this->group_count);
+			this->group_values.push_back(values);
+			this->states.resize(this->states.size() + n_aggregates, State{0, 0, Value()});
+			this->group_bytes += values->footprint() + 2 * key.size() + n_aggregates * sizeof(State) + 64;
+		}
+		this->row_groups[row] = group;
+	}
+
+	for (size_t j = 0; j < n_aggregates; j++) {
+		AggregateFunction function = this->aggregates[j].first;
+		if (function == AggregateFunction::COUNT_STAR) {
+			for (uint16_t row: batch->selection())
+				this->states[this->row_groups[row] * n_aggregates + j].count++;
+			continue;
+		}
+		const ColumnVector &column = batch->column(this->aggregates[j].second);
+		bool text = column.get_data_type() == ColumnAttribute::DataType::TEXT;
+		for (uint16_t row: batch->selection()) {
+			if (column.is_null(row))
+				continue;
+			State &state = this->states[this->row_groups[row] * n_aggregates + j];
+			if (function == AggregateFunction::SUM) {
+				state.sum += column.get_int(row);
+			} else if (function != AggregateFunction::COUNT) {
+				if (text) {
+					TextView value = column.get_text(row);
+					int order = value.compare(state.value.s);
+					if (state.count == 0 || (function == AggregateFunction::MIN ? order < 0 : order > 0))
+						state.value = Value(value.str());
+				} else {
+					int32_t value = column.get_int(row);
+					if (state.count == 0 || (function == AggregateFunction::MIN ? value < state.value.n : value > state.value.n)) {
+						state.value.data_type = column.get_data_type();
+						state.value.n = value;
+					}
+				}
+			}
+			state.count++;
+		}
+	}
+}
+
+// Fold a batch of spilled partial states into the groups.
+void HashAggregateBatchCursor::combine(const ColumnBatch *batch) {
+	size_t n_aggregates = this->aggregates.size();
+	string key;
+	for (uint16_t row: batch->selection()) {
+		group_key(batch, row, this->group_count, key);
+		bool added;
+		uint32_t group = find_group(hash<string>()(key), key, added);
+		if (added) {
+			this->group_values.push_back(batch->get_row(row, this->group_count));
+			this->states.resize(this->states.size() + n_aggregates, State{0, 0, Value()});
+		}
+		for (size_t j = 0; j < n_aggregates; j++) {
+			uint base = this->group_count + (uint)j * STATE_COLUMNS;
+			int64_t count = batch->column(base).get_int(row);
+			if (count == 0)
+				continue;
+			State &state = this->states[group * n_aggregates + j];
+			AggregateFunction function = this->aggregates[j].first;
+			if (function == AggregateFunction::SUM) {
+				state.sum += (int64_t)((uint64_t)(uint32_t)batch->column(base + 1).get_int(row) << 32 |
+									   (uint32_t)batch->column(base + 2).get_int(row));
+			} else if (function == AggregateFunction::MIN || function == AggregateFunction::MAX) {
+				Value value = batch->column(base + 3).get_value(row);
+				if (state.count == 0 || better(function, value, state.value))
+					state.value = value;
+			}
+			state.count += count;
+		}
+	}
+}
+
+void HashAggregateBatchCursor::clear_table() {
+	this->slots.clear();
+	this->group_hashes.clear();
+	this->group_keys.clear();
+	for (auto values: this->group_values)
+		delete values;
+	this->group_values.clear();
+	this->states.clear();
+	this->group_bytes = 0;
+	this->next_group = 0;
+}
+
+// Write the partial state of every group out to its partition and empty the table.
+void HashAggregateBatchCursor::spill() {
+	size_t n_aggregates = this->aggregates.size();
+	if (this->partitions.empty()) {
+		ColumnNames column_names;
+		ColumnAttributes column_attributes;
+		for (uint col_num = 0; col_num < this->group_count; col_num++) {
+			column_names.push_back("_group" + to_string(col_num));
+			column_attributes.push_back(this->input_attributes[col_num]);
+		}
+		for (size_t j = 0; j < n_aggregates; j++) {
+			column_names.push_back("_count" + to_string(j));
+			column_names.push_back("_sum_high" + to_string(j));
+			column_names.push_back("_sum_low" + to_string(j));
+			column_names.push_back("_value" + to_string(j));
+			for (uint k = 0; k < STATE_COLUMNS - 1; k++)
+				column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+			AggregateFunction function = this->aggregates[j].first;
+			if (function == AggregateFunction::MIN || function == AggregateFunction::MAX)
+				column_attributes.push_back(this->input_attributes[this->aggregates[j].second]);
+			else
+				column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+		}
+		// named for the process too, so that partitions left behind by a crash don't get in the way
+		string prefix = "_aggregate_" + to_string(getpid()) + "_" + to_string(this->aggregate_number) + "_";
+		for (uint p = 0; p < PARTITIONS; p++) {
+			HeapTable *partition = new HeapTable(prefix + to_string(p), column_names, column_attributes);
+			this->partitions.push_back(partition);
+			partition->create();
+		}
+		this->pending.assign(PARTITIONS, Rows());
+	}
+
+	for (uint32_t group = 0; group < this->group_keys.size(); group++) {
+		Row *row = new Row(this->group_count + n_aggregates * STATE_COLUMNS);
+		const Row *values = this->group_values[group];
+		for (uint col_num = 0; col_num < this->group_count; col_num++)
+			if (!values->is_null(col_num))
+				row->set(col_num, (*values)[col_num]);
+		for (size_t j = 0; j < n_aggregates; j++) {
+			const State &state = this->states[group * n_aggregates + j];
+			uint base = this->group_count + (uint)j * STATE_COLUMNS;
+			row->set(base, Value((int32_t)state.count));
+			row->set(base + 1, Value((int32_t)((uint64_t)state.sum >> 32)));
+			row->set(base + 2, Value((int32_t)(uint32_t)state.sum));
+			AggregateFunction function = this->aggregates[j].first;
+			if (state.count > 0 && (function == AggregateFunction::MIN || function == AggregateFunction::MAX))
+				row->set(base + 3, state.value);
+		}
+		uint p = partition_of(this->group_hashes[group]);
+		this->pending[p].push_back(row);
+		if (this->pending[p].size() >= ColumnBatch::CAPACITY) {
+			delete this->partitions[p]->insert(&this->pending[p]);
+			for (auto pending_row: this->pending[p])
+				delete pending_row;
+			this->pending[p].clear();
+		}
+	}
+	clear_table();
+}
+
+// Write out everything still queued for the partitions.
+void HashAggregateBatchCursor::flush() {
+	for (uint p = 0; p < PARTITIONS; p++) {
+		if (this->pending[p].empty())
+			continue;
+		delete this->partitions[p]->insert(&this->pending[p]);
+		for (auto row: this->pending[p])
+			delete row;
+		this->pending[p].clear();
+	}
+}
+
+// Combine the partial states in the next partition into the (emptied) table.
+bool HashAggregateBatchCursor::load_next_partition() {
+	if (this->next_partition >= this->partitions.size())
+		return false;
+	clear_table();
+	BatchCursor *partial_states = this->partitions[this->next_partition++]->batch_cursor(nullptr);
+	ColumnBatch *partial_batch;
+	while ((partial_batch = partial_states->next()) != nullptr)
+		combine(partial_batch);
+	delete partial_states;
+	return true;
+}
+
+// Add the output row for a group.
+void HashAggregateBatchCursor::emit(uint32_t group) {
+	size_t n_aggregates = this->aggregates.size();
+	this->batch.add_row(Handle());
+	for (uint col_num = 0; col_num < this->output.size(); col_num++) {
+		ColumnVector &column = this->batch.column(col_num);
+		uint from = this->output[col_num];
+		if (from < this->group_count) {
+			const Row *values = this->group_values[group];
+			if (values->is_null(from))
+				column.push_null();
+			else
+				column.push_value((*values)[from]);
+			continue;
+		}
+		const State &state = this->states[group * n_aggregates + (from - this->group_count)];
+		switch (this->aggregates[from - this->group_count].first) {
+			case AggregateFunction::COUNT_STAR:
+			case AggregateFunction::COUNT:
+				column.push_int((int32_t)state.count);
+				break;
+			case AggregateFunction::SUM:
+				if (state.count == 0)
+					column.push_null();
+				else if (state.sum < INT_MIN || state.sum > INT_MAX)
+					throw DbRelationError("SUM is out of range for INT");
+				else
+					column.push_int((int32_t)state.sum);
+				break;
+			case AggregateFunction::MIN:
+			case AggregateFunction::MAX:
+				if (state.count == 0)
+					column.push_null();
+				else
+					column.push_value(state.value);
+				break;
+		}
+	}
+}
+
+CountBatchCursor::CountBatchCursor(DbRelation &relation, const ColumnNames &column_names)
+		: BatchCursor(), relation(relation),
+		  batch(column_names, ColumnAttributes(column_names.size(), ColumnAttribute(ColumnAttribute::INT))), done(false) {
+}
+
+ColumnBatch* CountBatchCursor::next() {
+	if (this->done)
+		return nullptr;
+	this->done = true;
+	int32_t count = (int32_t)this->relation.count();
+	this->batch.clear();
+	this->batch.add_row(Handle());
+	for (uint col_num = 0; col_num < this->batch.get_column_names().size(); col_num++)
+		this->batch.column(col_num).push_int(count);
+	this->batch.select_all();
+	return &this->batch;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file aggregate.h - GROUP BY and aggregate functions.
+ * HashAggregateBatchCursor: BatchCursor
+ * CountBatchCursor: BatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "column_batch.h"
+
+/**
+ * The aggregate functions: COUNT(*), COUNT(col), SUM(col), MIN(col), MAX(col).
+ * COUNT(col), SUM, MIN, and MAX skip NULLs; SUM, MIN, and MAX of no values are NULL.
+ */
+enum class AggregateFunction {
+	COUNT_STAR,
+	COUNT,
+	SUM,
+	MIN,
+	MAX
+};
+
+/**
+ * For each aggregate: (function, position of its column in the input batches; ignored for COUNT(*))
+ */
+typedef std::vector<std::pair<AggregateFunction, uint>> AggregateInputs;
+
+/**
+ * Column name for an aggregate's result, e.g., "COUNT(*)", "SUM(price)".
+ * @param function     the function
+ * @param column_name  the column it's of (ignored for COUNT(*))
+ */
+Identifier aggregate_name(AggregateFunction function, const Identifier &column_name);
+
+/**
+ * @class HashAggregateBatchCursor - groups the rows of a BatchCursor and works out aggregates for each group
+ *
+ * The group-by columns come first in the input batches (group_count of them). Groups are found
+ * through an open-addressing (linear probing) hash table of group numbers; the aggregates' running
+ * states sit in one flat array, group by group. Each input batch is done a column at a time: the
+ * group of every row is found first, then each aggregate is brought up to date in one pass
+ * over its column.
+ *
+ * If the groups outgrow memory_budget, the partial states are written out, split by a hash of the
+ * group into PARTITIONS temporary HeapTables, and the table starts over empty. At the end each
+ * partition's partial states are combined in memory in turn. The temporary tables are dropped
+ * when the cursor is deleted.
+ *
+ * With no group-by columns there is always exactly one output row, even for no input.
+ * The output batches' handles are all (0, 0).
+ */
+class HashAggregateBatchCursor : public BatchCursor {
+public:
+	/**
+	 * Bytes of groups (roughly) held in memory before the partial states are spilled, unless told otherwise.
+	 */
+	static const size_t DEFAULT_MEMORY_BUDGET = 32 * 1024 * 1024;
+
+	/**
+	 * How many ways the partial states are split when they spill.
+	 */
+	static const uint PARTITIONS = 16;
+
+	/**
+	 * @param input              batches to aggregate (owned by this cursor)
+	 * @param input_attributes   attributes of the input's columns
+	 * @param group_count        how many group-by columns lead the input's batches
+	 * @param aggregates         the aggregates to work out
+	 * @param output             for each output column: < group_count for that group-by column, otherwise
+	 *                           group_count + the position of the aggregate in aggregates
+	 * @param column_names       names of the output columns
+	 * @param column_attributes  their attributes
+	 * @param memory_budget      how much to hold in memory before spilling
+	 */
+	HashAggregateBatchCursor(BatchCursor *input, const ColumnAttributes &input_attributes, uint group_count,
+							 const AggregateInputs &aggregates, const ColumnNumbers &output,
+							 const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+							 size_t memory_budget=DEFAULT_MEMORY_BUDGET);
+	virtual ~HashAggregateBatchCursor();
+
+	virtual ColumnBatch* next();
+
+	/**
+	 * @returns  how many partitions the partial states were spilled into (0 if they fit in memory)
+	 */
+	virtual size_t get_partition_count() const { return partitions.size(); }
+
+protected:
+	// running state of one aggregate for one group
+	struct State {
+		int64_t count;  // rows counted (non-NULL values, except for COUNT(*))
+		int64_t sum;    // SUM
+		Value value;    // MIN, MAX (good once count > 0)
+	};
+
+	BatchCursor *input;
+	ColumnAttributes input_attributes;
+	uint group_count;
+	AggregateInputs aggregates;
+	ColumnNumbers output;
+	size_t memory_budget;
+	ColumnBatch batch;
+
+	// the hash table
+	std::vector<uint32_t> slots;  // group number + 1 (0 for an empty slot)
+	std::vector<size_t> group_hashes;
+	std::vector<std::string> group_keys;
+	Rows group_values;
+	std::vector<State> states;  // aggregates.size() of them for each group
+	size_t group_bytes;
+	std::vector<uint32_t> row_groups;  // scratch: group of each row of the input batch
+
+	// spilling
+	uint aggregate_number;
+	std::vector<HeapTable*> partitions;
+	std::vector<Rows> pending;  // partial states on their way to each partition
+	size_t next_partition;
+
+	// output
+	bool aggregated;
+	size_t next_group;
+
+	virtual void aggregate_input();
+	virtual uint32_t find_group(size_t hash, const std::string &key, bool &added);
+	virtual void grow();
+	virtual void update(const ColumnBatch *batch);
+	virtual void combine(const ColumnBatch *batch);
+	virtual void clear_table();
+	virtual void spill();
+	virtual void flush();
+	virtual bool load_next_partition();
+	virtual void emit(uint32_t group);
+};
+
+/**
+ * @class CountBatchCursor - a single row of a relation's row count (for SELECT COUNT(*) with no
+ * WHERE or GROUP BY), in as many columns as asked for
+ *
+ * Uses DbRelation::count(), which for a HeapTable counts the records in each block's slot
+ * directory without looking at any of them.
+ */
+class CountBatchCursor : public BatchCursor {
+public:
+	CountBatchCursor(DbRelation &relation, const ColumnNames &column_names);
+	virtual ~CountBatchCursor() {}
+
+	virtual ColumnBatch* next();
+
+protected:
+	DbRelation &relation;
+	ColumnBatch batch;
+	bool done;
+};
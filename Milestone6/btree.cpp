@@ -14,12 +14,11 @@ using namespace std;
 BTreeIndex::BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
         : DbIndex(relation, name, key_columns, unique),
           closed(true),
-          stat(nullptr),
-          root(nullptr),
+          root_id(0),
+          height(0),
           file(relation.get_table_name() + "-" + name),
-          key_profile() {
-    if (!unique)
-        throw DbRelationError("BTree index must have unique key");
+          key_profile(),
+          fill_percent(DEFAULT_FILL_PERCENT) {
 	// FIXME - what else?! NINA
 	build_key_profile();
 }
@@ -34,32 +33,148 @@ void BTreeIndex::build_key_profile(){
 
 //Destructor
 BTreeIndex::~BTreeIndex() {
-	// FIXME - free up stuff NINA
-	delete this->stat;
-	delete this->root;
-	this->stat = nullptr;
-	this->root = nullptr;
+	// nothing is held between operations
 }
 
 //Milestone 6 - NINA
 // Create the index.
 void BTreeIndex::create() {
 	this->file.create();
-	this->stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
-	this->root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
+	{
+		BTreeStat stat(file, STAT, STAT + 1, key_profile);  // lays out the stat block's records
+	}
 	this->closed = false;
 
-	//now build the index! -- add every row from relation into index
-	Handles* handles = relation.select();
-	Handles* n_handles = new Handles();
+	//now build the index! -- bulk load it from the relation
+	build();
+}
+
+// Only sensible between 10% and 100%.
+void BTreeIndex::set_fill_percent(uint fill_percent) {
+	this->fill_percent = min(max(fill_percent, 10U), 100U);
+}
+
+// Bulk load the (empty) index from every row of the relation: sort the (key, handle) pairs
+// (externally, if there are too many for memory) and then build the tree bottom up in one
+// sequential pass, packing each leaf and then each level of interior nodes to fill_percent.
+// Each node is written once. In a non-unique index, the pairs are sorted by handle, too, so each
+// key's posting list comes out in order.
+void BTreeIndex::build() {
+	static const Identifier HANDLE_BLOCK = "_handle_block";
+	static const Identifier HANDLE_RECORD = "_handle_record";
+	ColumnNames column_names = this->key_columns;
+	column_names.push_back(HANDLE_BLOCK);
+	column_names.push_back(HANDLE_RECORD);
+	ColumnAttributes *column_attributes = this->relation.get_column_attributes(this->key_columns);
+	column_attributes->push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes->push_back(ColumnAttribute(ColumnAttribute::INT));
+	ExternalSort sort(column_names, *column_attributes, this->unique ? this->key_columns : column_names);
+	delete column_attributes;
 
-	for (auto const handle : *handles){
-		insert(handle);
-		n_handles->push_back(handle);
+	DbRelationCursor* rows = this->relation.cursor();
+	Handle handle;
+	while (rows->next(handle)) {
+		ValueDict *row = rows->project(&this->key_columns);
+		(*row)[HANDLE_BLOCK] = Value((int32_t)handle.first);
+		(*row)[HANDLE_RECORD] = Value((int32_t)handle.second);
+		sort.add(row);
 	}
+	delete rows;
 
-	delete handles;
-	delete n_handles;
+	// leaves (the first one is block STAT + 1, where the stat block expects the root to be)
+	vector<Insertion> level;  // (block id, lowest key) of each node in the level just built
+	BTreeLeaf *leaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+	level.push_back(Insertion(leaf->get_id(), KeyValue()));
+	ValueDict *row;
+	KeyValue *key = nullptr, *next_key = nullptr;
+	if (sort.next(row)) {
+		next_key = tkey(row);
+		handle = Handle((*row)[HANDLE_BLOCK].n, (*row)[HANDLE_RECORD].n);
+		delete row;
+	}
+	try {
+		while (next_key != nullptr) {
+			// gather this key's handles
+			key = next_key;
+			next_key = nullptr;
+			Handles handles(1, handle);
+			while (sort.next(row)) {
+				next_key = tkey(row);
+				handle = Handle((*row)[HANDLE_BLOCK].n, (*row)[HANDLE_RECORD].n);
+				delete row;
+				if (*next_key != *key)
+					break;
+				delete next_key;
+				next_key = nullptr;
+				if (this->unique)
+					throw DbRelationError("Duplicate keys are not allowed in unique index");
+				handles.push_back(handle);
+			}
+
+			string postings = BTreePostings::build(this->file, handles);
+			if (!leaf->append(key, postings, this->fill_percent)) {
+				BTreeLeaf *next = new BTreeLeaf(this->file, 0, this->key_profile, true);
+				leaf->set_next_leaf(next->get_id());
+				leaf->save();
+				delete leaf;
+				leaf = next;
+				level.push_back(Insertion(leaf->get_id(), *key));
+				if (!leaf->append(key, postings, this->fill_percent))
+					throw DbRelationError("index key too big to fit in a block");
+			}
+			delete key;
+			key = nullptr;
+		}
+	} catch (...) {
+		delete leaf;
+		delete key;
+		delete next_key;
+		throw;
+	}
+	leaf->save();
+	delete leaf;
+
+	// interior levels, until one node is left at the top
+	uint height = 1;
+	while (level.size() > 1) {
+		vector<Insertion> parents;
+		BTreeInterior *node = new BTreeInterior(this->file, 0, this->key_profile, true);
+		node->set_first(level[0].first);
+		parents.push_back(Insertion(node->get_id(), level[0].second));
+		for (size_t i = 1; i < level.size(); i++) {
+			if (!node->append(&level[i].second, level[i].first, this->fill_percent)) {
+				// this child starts a new node, and its key goes up as that node's boundary
+				node->save();
+				delete node;
+				node = new BTreeInterior(this->file, 0, this->key_profile, true);
+				node->set_first(level[i].first);
+				parents.push_back(Insertion(node->get_id(), level[i].second));
+			}
+		}
+		node->save();
+		delete node;
+		level = parents;
+		height++;
+	}
+
+	this->root_id = level[0].first;
+	this->height = height;
+	save_stat();
+}
+
+// Write root_id and height to the stat block.
+void BTreeIndex::save_stat() {
+	BTreeStat stat(this->file, STAT, this->key_profile);
+	stat.set_root_id(this->root_id);
+	stat.set_height(this->height);
+	stat.save();
+}
+
+// Read in (and pin) the root node. The caller deletes it when the operation is done.
+BTreeNode *BTreeIndex::get_root() const {
+	if (this->height == 1)
+		return new BTreeLeaf(this->file, this->root_id, this->key_profile, false);
+	return new BTreeInterior(this->file, this->root_id, this->key_profile, false);
 }
 
 //Milestone 6 - NINA
@@ -73,12 +188,9 @@ void BTreeIndex::drop() {
 void BTreeIndex::open() {
 	if(this->closed){
 		file.open();
-		this->stat = new BTreeStat(file, STAT, key_profile);
-		if (this->stat->get_height() == 1){
-			this->root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
-		} else {
-			this->root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-		}
+		BTreeStat stat(file, STAT, key_profile);
+		this->root_id = stat.get_root_id();
+		this->height = stat.get_height();
 		this->closed = false;
 	}
 }
@@ -87,8 +199,6 @@ void BTreeIndex::open() {
 // Closes the index. Disables: lookup, range, insert, delete, update.
 void BTreeIndex::close() {
 	file.close();
-	this->stat = nullptr;
-	this->root = nullptr;
 	this->closed = true;
 }
 
@@ -96,66 +206,70 @@ void BTreeIndex::close() {
 // Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
 // names in the index. Returns a list of row handles.
 Handles* BTreeIndex::lookup(ValueDict* key_dict) const {
-    KeyValue* keyValue = this->tkey(key_dict);
-    Handles* handles = this->_lookup(this->root, this->stat->get_height(), keyValue);
-    delete keyValue;
-    return handles;
+    return this->range(key_dict, key_dict);
 }
 
-//Milestone 6 - MAGGIE
-// Helper for lookup, uses recursion to find the rows for the key.
-// Returns list of found rows (empty if not found).
-Handles* BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue* key) const {
-    if (dynamic_cast<BTreeLeaf*>(node)) {
-        // if at a tree leaf, can't go further down. Return the row if found or 
-        // empty list if not found.
-		Handle handle;
-		Handles* handles = new Handles;
-        try {
-			handle = ((BTreeLeaf*) node)->find_eq(key);
-        } catch (exception &e) {
-            return handles; 
-        }
-		handles->push_back(handle);
-        return handles;
-    } else {
-        // go down the tree by one layer to continue finding.
-        return this->_lookup(((BTreeInterior*) node)->find(key, height), height - 1, key);
-    }
+// Walk the rows whose columns are equal to key, a chunk of the key's posting list at a time.
+DbIndexCursor* BTreeIndex::lookup_cursor(ValueDict* key_dict) const {
+    return this->cursor(key_dict, key_dict);
 }
 
-Handles* BTreeIndex::range(ValueDict* min_key, ValueDict* max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
-    // FIXME: Not in scope for M6
+// Start a cursor at the first entry not less than min_key and stopping after the last not greater
+// than max_key. Either may be missing or give just the leading key columns.
+DbIndexCursor* BTreeIndex::cursor(const ValueDict* min_key, const ValueDict* max_key) const {
+    const_cast<BTreeIndex*>(this)->open();  // only reads in the stat block, if it hasn't been yet
+    KeyValue* min = min_key == nullptr ? nullptr : this->tkey_prefix(min_key);
+    KeyValue* max = max_key == nullptr ? nullptr : this->tkey_prefix(max_key);
+
+    // go down the tree to the leaf where min would be
+    BTreeNode *node = get_root();
+    for (uint height = this->height; height > 1; height--) {
+        BTreeNode *child = ((BTreeInterior*) node)->find_lower(min, height);
+        delete node;
+        node = child;
+    }
+    BTreeLeaf *leaf = (BTreeLeaf*) node;
+    uint entry = min == nullptr ? 0 : leaf->lower_bound(min);
+    delete min;
+    return new BTreeCursor(leaf, entry, max);
 }
 
 //Milestone 6 - MAGGIE
 // Insert a row with the given handle. Row must exist in relation already.
 void BTreeIndex::insert(Handle handle) {
+    open();
 	// Get value to insert
     ValueDict *value_dict = this->relation.project(handle);
     KeyValue* tkey = this->tkey(value_dict);
     delete value_dict;
 
     // insert in index, if root split then add 1 to tree height
-    Insertion split_root = this->_insert(this->root, this->stat->get_height(), tkey, handle);
+    BTreeNode *root = get_root();
+    Insertion split_root;
+    try {
+        split_root = this->_insert(root, this->height, tkey, handle);
+    } catch (...) {
+        delete root;
+        delete tkey;
+        throw;
+    }
     if (!BTreeNode::insertion_is_none(split_root)) {
         BlockID rroot = split_root.first;
         KeyValue boundary = split_root.second;
 
         // setup new root for tree
         BTreeInterior *newroot = new BTreeInterior(this->file, 0, this->key_profile, true);
-        newroot->set_first(this->root->get_id());
+        newroot->set_first(root->get_id());
         newroot->insert(&boundary, rroot);
         newroot->save();
 
         // set this tree root to the new root
-        this->stat->set_root_id(newroot->get_id());
-        this->stat->set_height(this->stat->get_height() + 1);
-        this->stat->save();
-        delete this->root;
-        this->root = newroot;
+        this->root_id = newroot->get_id();
+        this->height++;
+        save_stat();
+        delete newroot;
     }
+    delete root;
     delete tkey;
 }
 
@@ -164,11 +278,13 @@ void BTreeIndex::insert(Handle handle) {
 Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue* key, Handle handle) {
     Insertion result;
     if (dynamic_cast<BTreeLeaf*>(node)) {
-        result = ((BTreeLeaf*) node)->insert(key, handle);
+        result = ((BTreeLeaf*) node)->insert(key, handle, this->unique);
         ((BTreeLeaf*) node)->save();
         return result;
     } else {
-        Insertion new_kid = this->_insert(((BTreeInterior*) node)->find(key, height), height - 1, key, handle);
+        BTreeNode *child = ((BTreeInterior*) node)->find(key, height);
+        Insertion new_kid = this->_insert(child, height - 1, key, handle);
+        delete child;
         if (!BTreeNode::insertion_is_none(new_kid)) {
             result = ((BTreeInterior*) node)->insert(&new_kid.second, new_kid.first);
         }
@@ -189,6 +305,56 @@ KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
 	return keyvalue;
 }
 
+KeyValue *BTreeIndex::tkey_prefix(const ValueDict *key) const {
+	KeyValue* keyvalue = new KeyValue;
+    for (u_int i = 0; i < this->key_columns.size(); i++) {
+        auto found = key->find(key_columns[i]);
+        if (found == key->end())
+            break;
+        keyvalue->push_back(found->second);
+    }
+	return keyvalue;
+}
+
+BTreeCursor::BTreeCursor(BTreeLeaf *leaf, uint entry, KeyValue *max_key)
+        : leaf(leaf), entry(entry), max_key(max_key), handles(), next_handle(0), overflow(0) {
+}
+
+BTreeCursor::~BTreeCursor() {
+    delete this->leaf;
+    delete this->max_key;
+}
+
+// Next handle of this entry (reading on along its posting list), then of the next entry in this leaf,
+// or on along the chain. Stops for good once past max_key.
+bool BTreeCursor::next(Handle &handle) {
+    while (this->leaf != nullptr) {
+        if (this->next_handle < this->handles.size()) {
+            handle = this->handles[this->next_handle++];
+            return true;
+        }
+        this->handles.clear();
+        this->next_handle = 0;
+        if (this->overflow != 0) {
+            this->overflow = this->leaf->get_overflow_handles(this->overflow, this->handles);
+            continue;
+        }
+        if (this->entry < this->leaf->entry_count()) {
+            if (this->max_key != nullptr && this->leaf->compare_entry(this->entry, this->max_key) > 0)
+                break;
+            this->overflow = this->leaf->get_entry_handles(this->entry++, this->handles);
+            continue;
+        }
+        BTreeLeaf *next = this->leaf->get_next();
+        delete this->leaf;
+        this->leaf = next;
+        this->entry = 0;
+    }
+    delete this->leaf;
+    this->leaf = nullptr;
+    return false;
+}
+
 //Milestone 6 - NINA
 //Helper function to compare expect and returned results
 bool test_btree(){
@@ -305,6 +471,61 @@ bool test_btree(){
 		}
 		delete handles4;
 	}
+
+	//Test 5: range scan, in key order, and a cursor stopped early
+	ValueDict low, high;
+	low["a"] = Value(500);
+	high["a"] = Value(749);
+	Handles* handles5 = index->range(&low, &high);
+	if (handles5->size() != 250)
+		result = false;
+	int32_t expect = 500;
+	for (auto const& handle: *handles5) {
+		ValueDict* result_row = table.project(handle);
+		if ((*result_row)["a"].n != expect++)
+			result = false;
+		delete result_row;
+	}
+	delete handles5;
+	DbIndexCursor* cursor = index->cursor(nullptr, nullptr);
+	Handle handle5;
+	for (int i = 0; i < 3; i++)
+		if (!cursor->next(handle5))
+			result = false;
+	ValueDict* third = table.project(handle5);
+	if ((*third)["a"].n != 100)
+		result = false;
+	delete third;
+	delete cursor;
+
+	//Test 6: non-unique index, with a key whose posting list spills onto overflow blocks
+	for (int32_t i = 0; i < 600; i++) {
+		ValueDict dup_row;
+		dup_row["a"] = Value(2000 + i);
+		dup_row["b"] = Value(7);
+		table.insert(&dup_row);
+	}
+	DbIndex* dup_index = new BTreeIndex(table, "testDupIndex", ColumnNames(1, "b"), false);
+	dup_index->create();
+	ValueDict dup_row;
+	dup_row["a"] = Value(3000);
+	dup_row["b"] = Value(7);
+	dup_index->insert(table.insert(&dup_row));
+	ValueDict test6;
+	test6["b"] = Value(7);
+	Handles* handles6 = dup_index->lookup(&test6);
+	if (handles6->size() != 601)
+		result = false;
+	for (auto const& handle: *handles6) {
+		ValueDict* result_row = table.project(handle);
+		if ((*result_row)["b"].n != 7)
+			result = false;
+		delete result_row;
+	}
+	delete handles6;
+	dup_index->drop();
+	delete dup_index;
+
 	index->drop();
 	delete index;
 	table.drop();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "BTreeNode.h"
+#include "external_sort.h"
 
 class BTreeIndex : public DbIndex {
 public:
@@ -14,25 +15,69 @@ public:
     virtual void close();
 
     virtual Handles* lookup(ValueDict* key) const;
-    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+    virtual DbIndexCursor* lookup_cursor(ValueDict* key) const;
+    virtual DbIndexCursor* cursor(const ValueDict* min_key, const ValueDict* max_key) const;
 
     virtual void insert(Handle handle);
     virtual void del(Handle handle);
+    virtual bool can_delete() const { return false; }
 
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
+    virtual KeyValue *tkey_prefix(const ValueDict *key) const; // same, but stop at the first key column missing
+
+    /**
+     * How full create() packs each node (as a percentage of a block). Leaving some room
+     * means later inserts don't immediately split every node.
+     */
+    static const uint DEFAULT_FILL_PERCENT = 90;
+    virtual void set_fill_percent(uint fill_percent);
+    virtual uint get_fill_percent() const { return fill_percent; }
 
 protected:
     static const BlockID STAT = 1;
     bool closed;
-    BTreeStat *stat;
-    BTreeNode *root;
-    HeapFile file;
+    BlockID root_id;  // copied from the stat block, which (like the root) is only pinned while in use
+    uint height;
+    mutable HeapFile file;  // lookups and cursors read blocks through it
     KeyProfile key_profile;
+    uint fill_percent;
 
     void build_key_profile();
-    Handles* _lookup(BTreeNode *node, uint height, const KeyValue* key) const;
+    void build();
+    void save_stat();
+    BTreeNode *get_root() const;
     Insertion _insert(BTreeNode *node, uint height, const KeyValue* key, Handle handle);
 };
 
+/**
+ * @class BTreeCursor - walks the leaf entries of a BTreeIndex in key order, up to a max key
+ *
+ * Only one leaf is held (and pinned) at a time; it moves along the next_leaf chain as it goes.
+ * Each entry's handles are decoded a chunk of its posting list at a time.
+ * Must be deleted before its index is closed.
+ */
+class BTreeCursor : public DbIndexCursor {
+public:
+    /**
+     * @param leaf     where to start (the cursor takes ownership of it)
+     * @param entry    first entry in leaf to return
+     * @param max_key  stop after the entries matching this (cursor takes ownership), nullptr for no limit
+     */
+    BTreeCursor(BTreeLeaf *leaf, uint entry, KeyValue *max_key);
+    virtual ~BTreeCursor();
+    BTreeCursor(const BTreeCursor& other) = delete;
+    BTreeCursor& operator=(const BTreeCursor& other) = delete;
+
+    virtual bool next(Handle &handle);
+
+protected:
+    BTreeLeaf *leaf;    // nullptr once we're done
+    uint entry;
+    KeyValue *max_key;
+    Handles handles;  // the chunk of the current entry's handles being returned
+    size_t next_handle;
+    BlockID overflow;  // where the rest of the current entry's handles are (0 if there are no more)
+};
+
 bool test_btree();
 
@@ -0,0 +1,171 @@
+/**
+ * @file buffer_pool.cpp - implementation of:
+ * BufferPool
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <memory.h>
+#include "buffer_pool.h"
+#include "heap_storage.h"
+using namespace std;
+
+// The one pool for the whole engine.
+BufferPool& BufferPool::pool() {
+	static BufferPool the_pool;
+	return the_pool;
+}
+
+BufferPool::BufferPool(uint frame_budget) : frame_budget(frame_budget), hand(0), frames(), lookup(), file_ids() {
+	if (this->frame_budget == 0)
+		this->frame_budget = 1;
+}
+
+// Frames still dirty at this point have lost their files, so there is nothing to write them back through.
+BufferPool::~BufferPool() {
+	for (auto frame: this->frames)
+		delete frame;
+}
+
+void BufferPool::set_frame_budget(uint frame_budget) {
+	this->frame_budget = frame_budget == 0 ? 1 : frame_budget;
+}
+
+uint32_t BufferPool::file_id(const string &name) {
+	auto it = this->file_ids.find(name);
+	if (it != this->file_ids.end())
+		return it->second;
+	uint32_t id = (uint32_t)this->file_ids.size() + 1;
+	this->file_ids[name] = id;
+	return id;
+}
+
+// Pin the block's frame, reading it in on a miss.
+BufferFrame* BufferPool::pin(HeapFile *file, BlockID block_id, bool fetch) {
+	uint64_t key = frame_key(file->get_file_id(), block_id);
+	auto it = this->lookup.find(key);
+	if (it != this->lookup.end()) {
+		BufferFrame *frame = it->second;
+		frame->pin_count++;
+		frame->referenced = true;
+		return frame;
+	}
+
+	BufferFrame *frame = victim();
+	if (fetch)
+		file->read_block(block_id, frame->data);
+	else
+		memset(frame->data, 0, DbBlock::BLOCK_SZ);
+	frame->key = key;
+	frame->file = file;
+	frame->pin_count = 1;
+	frame->dirty = false;
+	frame->referenced = true;
+	frame->resident = true;
+	this->lookup[key] = frame;
+	return frame;
+}
+
+void BufferPool::unpin(BufferFrame *frame) {
+	if (frame->pin_count > 0)
+		frame->pin_count--;
+	if (frame->pin_count == 0 && this->frames.size() > this->frame_budget)
+		release(frame);
+}
+
+// Mark the block dirty; the write to the file happens later.
+void BufferPool::put(HeapFile *file, BlockID block_id, const void *data) {
+	auto it = this->lookup.find(frame_key(file->get_file_id(), block_id));
+	if (it == this->lookup.end()) {
+		file->write_block(block_id, data);  // not resident, so nothing to defer
+		return;
+	}
+	BufferFrame *frame = it->second;
+	if (frame->data != data)
+		memcpy(frame->data, data, DbBlock::BLOCK_SZ);
+	frame->file = file;
+	frame->dirty = true;
+}
+
+void BufferPool::flush(HeapFile *file) {
+	uint32_t id = file->get_file_id();
+	for (auto frame: this->frames) {
+		if (frame->resident && (uint32_t)(frame->key >> 32) == id) {
+			if (frame->dirty) {
+				frame->file = file;
+				write_back(frame);
+			}
+			if (frame->file == file)
+				frame->file = nullptr;  // clean now, so we won't need file again
+		}
+	}
+}
+
+void BufferPool::discard(HeapFile *file) {
+	uint32_t id = file->get_file_id();
+	for (auto frame: this->frames) {
+		if (frame->resident && (uint32_t)(frame->key >> 32) == id) {
+			this->lookup.erase(frame->key);
+			frame->resident = false;
+			frame->dirty = false;
+			frame->file = nullptr;
+		}
+	}
+}
+
+void BufferPool::checkpoint() {
+	for (auto frame: this->frames)
+		if (frame->resident && frame->dirty)
+			write_back(frame);
+}
+
+// Find a frame to use: a new one if we are under budget, otherwise run the CLOCK
+// hand around (at most twice, clearing reference bits the first time) to find an
+// unpinned one.
+BufferFrame* BufferPool::victim() {
+	if (this->frames.size() < this->frame_budget) {
+		BufferFrame *frame = new BufferFrame();
+		this->frames.push_back(frame);
+		return frame;
+	}
+	for (size_t sweep = 0; sweep < 2 * this->frames.size(); sweep++) {
+		BufferFrame *frame = this->frames[this->hand];
+		this->hand = (this->hand + 1) % this->frames.size();
+		if (frame->pin_count > 0)
+			continue;
+		if (frame->resident && frame->referenced) {
+			frame->referenced = false;
+			continue;
+		}
+		if (frame->resident) {
+			if (frame->dirty)
+				write_back(frame);
+			this->lookup.erase(frame->key);
+			frame->resident = false;
+		}
+		return frame;
+	}
+	throw DbRelationError("buffer pool exhausted: all " + to_string(this->frames.size()) + " frames are pinned");
+}
+
+void BufferPool::write_back(BufferFrame *frame) {
+	frame->file->write_block((BlockID)(frame->key & 0xFFFFFFFF), frame->data);
+	frame->dirty = false;
+}
+
+// Give an unpinned frame back when we are over budget.
+void BufferPool::release(BufferFrame *frame) {
+	if (frame->resident) {
+		if (frame->dirty)
+			write_back(frame);
+		this->lookup.erase(frame->key);
+	}
+	for (size_t i = 0; i < this->frames.size(); i++) {
+		if (this->frames[i] == frame) {
+			this->frames.erase(this->frames.begin() + i);
+			break;
+		}
+	}
+	if (this->hand >= this->frames.size())
+		this->hand = 0;
+	delete frame;
+}
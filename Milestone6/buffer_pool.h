@@ -0,0 +1,135 @@
+/**
+ * @file buffer_pool.h - Buffer pool of pinned block frames above HeapFile.
+ * BufferFrame
+ * BufferPool
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "storage_engine.h"
+
+class HeapFile; // forward declare
+
+/**
+ * @class BufferFrame - one block-sized frame in the buffer pool
+ */
+class BufferFrame {
+public:
+	BufferFrame() : data(new char[DbBlock::BLOCK_SZ]), key(0), file(nullptr), pin_count(0), dirty(false),
+					referenced(false), resident(false) {}
+	~BufferFrame() { delete[] data; }
+	BufferFrame(const BufferFrame& other) = delete;
+	BufferFrame& operator=(const BufferFrame& other) = delete;
+
+	char *data;        // the block's bytes
+	uint64_t key;      // (file id, block id) this frame is holding
+	HeapFile *file;    // file to write the block back through when dirty
+	uint pin_count;    // number of outstanding SlottedPages on this frame
+	bool dirty;        // changed since it was read or last written back
+	bool referenced;   // CLOCK reference bit
+	bool resident;     // in the lookup table (false for free or discarded frames)
+};
+
+/**
+ * @class BufferPool - engine-owned cache of DbBlock::BLOCK_SZ frames
+ *
+ * HeapFile::get pins the block's frame (reading it from Berkeley DB on a miss) and
+ * the SlottedPage unpins it when it is deleted. HeapFile::put just marks the frame
+ * dirty; the write to Berkeley DB is deferred until the frame is evicted, the file is
+ * closed, or checkpoint() is called. Victims are chosen with the CLOCK algorithm among
+ * unpinned frames, so hot blocks (e.g., index roots and interior nodes) stay resident.
+ *
+ * Frames are keyed by file name, so every HeapFile open on the same file shares them.
+ */
+class BufferPool {
+public:
+	/**
+	 * Number of frames used unless set_frame_budget says otherwise.
+	 */
+	static const uint DEFAULT_FRAME_BUDGET = 1024;
+
+	/**
+	 * The one buffer pool used by all the heap files.
+	 */
+	static BufferPool& pool();
+
+	BufferPool(uint frame_budget=DEFAULT_FRAME_BUDGET);
+	virtual ~BufferPool();
+	BufferPool(const BufferPool& other) = delete;
+	BufferPool& operator=(const BufferPool& other) = delete;
+
+	/**
+	 * Set the maximum number of frames. Shrinking takes effect as frames are unpinned.
+	 * @param frame_budget  maximum number of frames (at least 1)
+	 */
+	virtual void set_frame_budget(uint frame_budget);
+	virtual uint get_frame_budget() const { return frame_budget; }
+
+	/**
+	 * Get the id the pool uses for the given file name.
+	 * @param name  name of file
+	 * @returns     small integer identifying name in the pool
+	 */
+	virtual uint32_t file_id(const std::string &name);
+
+	/**
+	 * Pin the frame for a block, reading it in if it is not resident.
+	 * @param file      the file the block belongs to
+	 * @param block_id  which block
+	 * @param fetch     if false, the block is brand new and is just zeroed instead of read
+	 * @returns         the pinned frame
+	 * @throws          DbRelationError if every frame is pinned
+	 */
+	virtual BufferFrame* pin(HeapFile *file, BlockID block_id, bool fetch=true);
+
+	/**
+	 * Release one pin on a frame.
+	 * @param frame  frame returned by pin()
+	 */
+	virtual void unpin(BufferFrame *frame);
+
+	/**
+	 * Note that a block has been changed. If the block is resident (and data is not
+	 * already the frame's memory), data is copied into the frame; otherwise it is
+	 * written straight through.
+	 * @param file      the file the block belongs to
+	 * @param block_id  which block
+	 * @param data      the block's bytes
+	 */
+	virtual void put(HeapFile *file, BlockID block_id, const void *data);
+
+	/**
+	 * Write back all the dirty frames for a file.
+	 * @param file  which file
+	 */
+	virtual void flush(HeapFile *file);
+
+	/**
+	 * Forget all the frames for a file without writing them back (used when dropping it).
+	 * @param file  which file
+	 */
+	virtual void discard(HeapFile *file);
+
+	/**
+	 * Write back every dirty frame in the pool.
+	 */
+	virtual void checkpoint();
+
+protected:
+	uint frame_budget;
+	uint hand;  // CLOCK hand
+	std::vector<BufferFrame*> frames;
+	std::unordered_map<uint64_t, BufferFrame*> lookup;
+	std::unordered_map<std::string, uint32_t> file_ids;
+
+	static uint64_t frame_key(uint32_t file_id, BlockID block_id) {
+		return ((uint64_t)file_id << 32) | block_id;
+	}
+	virtual BufferFrame* victim();
+	virtual void write_back(BufferFrame *frame);
+	virtual void release(BufferFrame *frame);
+};
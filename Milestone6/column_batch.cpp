@@ -0,0 +1,504 @@
+/**
+ * @file column_batch.cpp - implementation of:
+ * ColumnVector
+ * ColumnBatch
+ * RowBatchCursor
+ * SelectBatchCursor
+ * LimitBatchCursor
+ * HeapTableBatchCursor
+ * and the default DbRelation::batch_cursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <algorithm>
+#include "column_batch.h"
+#include "predicate.h"
+#include "filter_kernels.h"
+using namespace std;
+
+
+/*
+ * *******************
+ * ColumnVector class
+ * *******************
+ */
+
+void ColumnVector::clear() {
+	this->nulls.clear();
+	this->ints.clear();
+	this->slices.clear();
+	this->text.clear();
+}
+
+void ColumnVector::push_null() {
+	this->nulls.push_back(1);
+	if (this->data_type == ColumnAttribute::DataType::TEXT)
+		this->slices.push_back(pair<uint32_t, uint16_t>(this->text.size(), 0));
+	else
+		this->ints.push_back(0);
+}
+
+void ColumnVector::push_int(int32_t n) {
+	this->nulls.push_back(0);
+	this->ints.push_back(n);
+}
+
+void ColumnVector::push_text(const TextView &s) {
+	this->nulls.push_back(0);
+	this->slices.push_back(pair<uint32_t, uint16_t>(this->text.size(), s.size()));
+	this->text.append(s.data(), s.size());
+}
+
+void ColumnVector::push_value(const Value &value) {
+	if (value.data_type != this->data_type)
+		throw DbRelationError("value does not match column type");
+	if (this->data_type == ColumnAttribute::DataType::TEXT)
+		push_text(TextView(value.s.data(), (uint16_t)value.s.size()));
+	else if (this->data_type == ColumnAttribute::DataType::BOOLEAN)
+		push_int(value.n != 0);
+	else
+		push_int(value.n);
+}
+
+void ColumnVector::push_from(const ColumnVector &other, size_t i) {
+	if (other.is_null(i))
+		push_null();
+	else if (this->data_type == ColumnAttribute::DataType::TEXT)
+		push_text(other.get_text(i));
+	else
+		push_int(other.get_int(i));
+}
+
+Value ColumnVector::get_value(size_t i) const {
+	Value value;
+	value.data_type = this->data_type;
+	switch (this->data_type) {
+		case ColumnAttribute::DataType::INT:
+		case ColumnAttribute::DataType::BOOLEAN:
+			value.n = get_int(i);
+			break;
+		case ColumnAttribute::DataType::TEXT:
+			value.s = get_text(i).str();
+			break;
+		default:
+			throw DbRelationError("Only know how to get INT, TEXT, and BOOLEAN");
+	}
+	return value;
+}
+
+
+/*
+ * *******************
+ * ColumnBatch class
+ * *******************
+ */
+
+ColumnBatch::ColumnBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes)
+		: column_names(column_names), columns(), handles(), selected_rows() {
+	for (auto ca: column_attributes)
+		this->columns.push_back(ColumnVector(ca.get_data_type()));
+	this->handles.reserve(CAPACITY);
+	this->selected_rows.reserve(CAPACITY);
+}
+
+int ColumnBatch::column_number(const Identifier &column_name) const {
+	auto it = find(this->column_names.begin(), this->column_names.end(), column_name);
+	if (it == this->column_names.end())
+		return -1;
+	return (int)(it - this->column_names.begin());
+}
+
+void ColumnBatch::clear() {
+	for (auto& column: this->columns)
+		column.clear();
+	this->handles.clear();
+	this->selected_rows.clear();
+}
+
+void ColumnBatch::select_all() {
+	this->selected_rows.resize(size());
+	for (uint16_t row = 0; row < size(); row++)
+		this->selected_rows[row] = row;
+}
+
+ValueDict* ColumnBatch::project(uint16_t row, const ColumnNames* column_names) const {
+	ValueDict *ret = new ValueDict();
+	if (column_names == nullptr) {
+		for (uint col_num = 0; col_num < this->columns.size(); col_num++)
+			if (!this->columns[col_num].is_null(row))
+				(*ret)[this->column_names[col_num]] = this->columns[col_num].get_value(row);
+		return ret;
+	}
+	for (auto const& column_name: *column_names) {
+		int col_num = column_number(column_name);
+		if (col_num < 0) {
+			delete ret;
+			throw DbRelationError("batch does not have column named '" + column_name + "'");
+		}
+		if (!this->columns[col_num].is_null(row))
+			(*ret)[column_name] = this->columns[col_num].get_value(row);
+	}
+	return ret;
+}
+
+Row* ColumnBatch::get_row(uint16_t row, size_t n_columns) const {
+	Row *ret = new Row(n_columns);
+	for (uint col_num = 0; col_num < n_columns; col_num++)
+		if (!this->columns[col_num].is_null(row))
+			ret->set(col_num, this->columns[col_num].get_value(row));
+	return ret;
+}
+
+
+/*
+ * *******************
+ * RowBatchCursor class
+ * *******************
+ */
+
+RowBatchCursor::RowBatchCursor(DbRelationCursor* input, const ColumnNames &column_names,
+							   const ColumnAttributes &column_attributes)
+		: BatchCursor(), input(input), batch(column_names, column_attributes) {
+}
+
+RowBatchCursor::~RowBatchCursor() {
+	delete this->input;
+}
+
+ColumnBatch* RowBatchCursor::next() {
+	this->batch.clear();
+	const ColumnNames &column_names = this->batch.get_column_names();
+	Handle handle;
+	while (!this->batch.full() && this->input->next(handle)) {
+		ValueDict *row = this->input->project(&column_names);
+		this->batch.add_row(handle);
+		for (uint col_num = 0; col_num < column_names.size(); col_num++) {
+			auto it = row->find(column_names[col_num]);
+			if (it == row->end())
+				this->batch.column(col_num).push_null();
+			else
+				this->batch.column(col_num).push_value(it->second);
+		}
+		delete row;
+	}
+	if (this->batch.size() == 0)
+		return nullptr;
+	this->batch.select_all();
+	return &this->batch;
+}
+
+
+/*
+ * *******************
+ * SelectBatchCursor class
+ * *******************
+ */
+
+SelectBatchCursor::SelectBatchCursor(BatchCursor* input, const ValueDict* where, const ColumnNames* where_order,
+									 const Predicate* predicate)
+		: BatchCursor(), input(input), where(where), where_order(nullptr), predicate(nullptr), resolved(false) {
+	if (where_order != nullptr)
+		this->where_order = new ColumnNames(*where_order);
+	if (predicate != nullptr)
+		this->predicate = new Predicate(*predicate);
+}
+
+SelectBatchCursor::~SelectBatchCursor() {
+	delete this->input;
+	delete this->where_order;
+	delete this->predicate;
+}
+
+// Next batch from the input that still has some rows selected after our predicates.
+ColumnBatch* SelectBatchCursor::next() {
+	ColumnBatch *batch;
+	while ((batch = this->input->next()) != nullptr) {
+		if (this->where != nullptr) {
+			if (this->where_order != nullptr) {
+				for (auto const& column_name: *this->where_order)
+					filter(batch, column_name, this->where->at(column_name));
+			} else {
+				for (auto const& column: *this->where)
+					filter(batch, column.first, column.second);
+			}
+		}
+		if (this->predicate != nullptr && !batch->selection().empty()) {
+			if (!this->resolved) {
+				this->predicate->resolve(batch->get_column_names());
+				this->resolved = true;
+			}
+			this->predicate->filter(batch);
+		}
+		if (!batch->selection().empty())
+			return batch;
+	}
+	return nullptr;
+}
+
+// Drop the selected rows of batch whose column_name isn't equal to value (or is NULL).
+// INT and BOOLEAN columns are compared all at once by a filter kernel.
+void SelectBatchCursor::filter(ColumnBatch *batch, const Identifier &column_name, const Value &value) {
+	int col_num = batch->column_number(column_name);
+	if (col_num < 0)
+		throw DbRelationError("batch does not have column named '" + column_name + "'");
+	const ColumnVector &column = batch->column(col_num);
+	vector<uint16_t> &selection = batch->selection();
+	if (value.data_type != column.get_data_type()) {
+		selection.clear();
+		return;
+	}
+	size_t kept = 0;
+	switch (column.get_data_type()) {
+		case ColumnAttribute::DataType::INT:
+		case ColumnAttribute::DataType::BOOLEAN: {
+			int32_t n = column.get_data_type() == ColumnAttribute::DataType::BOOLEAN ? value.n != 0 : value.n;
+			this->mask.assign(filter_mask_words(batch->size()), ~0ULL);
+			filter_int32(column.int_data(), batch->size(), FilterOp::EQ, n, n, this->mask.data());
+			for (uint16_t row: selection)
+				if (((this->mask[row / 64] >> (row % 64)) & 1) && !column.is_null(row))
+					selection[kept++] = row;
+			break;
+		}
+		case ColumnAttribute::DataType::TEXT:
+			for (uint16_t row: selection)
+				if (column.get_text(row) == value.s && !column.is_null(row))
+					selection[kept++] = row;
+			break;
+		default:
+			kept = selection.size();
+	}
+	selection.resize(kept);
+}
+
+
+/*
+ * *******************
+ * LimitBatchCursor class
+ * *******************
+ */
+
+LimitBatchCursor::LimitBatchCursor(BatchCursor* input, size_t limit, size_t offset)
+		: BatchCursor(), input(input), limit(limit), offset(offset), passed(0) {
+}
+
+LimitBatchCursor::~LimitBatchCursor() {
+	delete this->input;
+}
+
+// Next input batch with its selection cut down to the rows past the offset and within the limit.
+ColumnBatch* LimitBatchCursor::next() {
+	ColumnBatch *batch;
+	while (this->passed < this->limit && (batch = this->input->next()) != nullptr) {
+		vector<uint16_t> &selection = batch->selection();
+		size_t skip = min(this->offset, selection.size());
+		this->offset -= skip;
+		size_t keep = min(selection.size() - skip, this->limit - this->passed);
+		if (skip > 0)
+			selection.erase(selection.begin(), selection.begin() + skip);
+		selection.resize(keep);
+		this->passed += keep;
+		if (!selection.empty())
+			return batch;
+	}
+	return nullptr;
+}
+
+
+/*
+ * *******************
+ * HeapTableBatchCursor class
+ * *******************
+ */
+
+HeapTableBatchCursor::HeapTableBatchCursor(HeapTable &table, const ColumnNames* column_names, const ValueDict* where,
+										   const ColumnNames* where_order)
+		: BatchCursor(), table(table), int_predicates(nullptr), predicates(nullptr), col_nums(nullptr), batch(nullptr),
+		  block_cursor(nullptr), handles(nullptr), block(nullptr), record_ids(nullptr), i(0), views(), values(), mask() {
+	init(column_names, where, where_order);
+	this->block_cursor = table.file.cursor();
+}
+
+HeapTableBatchCursor::HeapTableBatchCursor(HeapTable &table, DbIndexCursor* handles, const ColumnNames* column_names,
+										   const ValueDict* where)
+		: BatchCursor(), table(table), int_predicates(nullptr), predicates(nullptr), col_nums(nullptr), batch(nullptr),
+		  block_cursor(nullptr), handles(handles), block(nullptr), record_ids(nullptr), i(0), views(), values(), mask() {
+	init(column_names, where, nullptr);
+}
+
+// Resolve the columns and the where clause, splitting off the predicates for the filter kernels.
+void HeapTableBatchCursor::init(const ColumnNames* column_names, const ValueDict* where, const ColumnNames* where_order) {
+	if (column_names == nullptr)
+		column_names = &this->table.get_column_names();
+	this->col_nums = this->table.column_numbers(column_names);
+	ColumnAttributes column_attributes;
+	for (auto col_num: *this->col_nums)
+		column_attributes.push_back(this->table.column_attributes[col_num]);
+	RowPredicates *all_predicates = this->table.resolve_where(where, where_order);
+	this->int_predicates = new RowPredicates();
+	this->predicates = new RowPredicates();
+	for (auto const& predicate: *all_predicates) {
+		ColumnAttribute::DataType data_type = this->table.column_attributes[predicate.first].get_data_type();
+		if ((data_type == ColumnAttribute::DataType::INT || data_type == ColumnAttribute::DataType::BOOLEAN)
+				&& predicate.second.data_type == data_type)
+			this->int_predicates->push_back(predicate);
+		else
+			this->predicates->push_back(predicate);
+	}
+	delete all_predicates;
+	this->batch = new ColumnBatch(*column_names, column_attributes);
+}
+
+HeapTableBatchCursor::~HeapTableBatchCursor() {
+	delete this->block_cursor;
+	delete this->handles;
+	delete this->record_ids;
+	delete this->block;
+	delete this->batch;
+	delete this->int_predicates;
+	delete this->predicates;
+	delete this->col_nums;
+}
+
+// Fill the next batch with qualifying rows, picking up in the block where the last batch stopped.
+ColumnBatch* HeapTableBatchCursor::next() {
+	this->batch->clear();
+	if (this->handles != nullptr)
+		add_handles();
+	while (this->handles == nullptr && !this->batch->full()) {
+		if (this->record_ids != nullptr && this->i < this->record_ids->size()) {
+			size_t n = min(this->record_ids->size() - this->i, ColumnBatch::CAPACITY - this->batch->size());
+			add_records(n);
+			this->i += n;
+			continue;
+		}
+		delete this->record_ids;
+		this->record_ids = nullptr;
+		delete this->block;
+		this->block = nullptr;
+
+		BlockID block_id;
+		if (!this->block_cursor->next(block_id))
+			break;
+		this->block = this->table.file.get(block_id);
+		this->record_ids = this->block->ids();
+		this->i = 0;
+	}
+	if (this->batch->size() == 0)
+		return nullptr;
+	this->batch->select_all();
+	return this->batch;
+}
+
+// Add the qualifying records among the next n of the current block.
+void HeapTableBatchCursor::add_records(size_t n) {
+	this->views.resize(n);
+	this->mask.assign(filter_mask_words(n), ~0ULL);
+	if (n % 64 != 0)
+		this->mask.back() = (1ULL << (n % 64)) - 1;
+	for (size_t k = 0; k < n; k++) {
+		this->views[k] = this->block->view((*this->record_ids)[this->i + k]);
+		this->views[k].set_column_attributes(&this->table.column_attributes);
+	}
+
+	// the INT and BOOLEAN equalities: one kernel call per predicate for all n records
+	this->values.resize(n);
+	for (auto const& predicate: *this->int_predicates) {
+		uint col_num = predicate.first;
+		bool is_boolean = predicate.second.data_type == ColumnAttribute::DataType::BOOLEAN;
+		for (size_t k = 0; k < n; k++) {
+			const RecordView &view = this->views[k];
+			if (view.is_null() || view.is_null_column(col_num)) {
+				this->values[k] = 0;
+				this->mask[k / 64] &= ~(1ULL << (k % 64));
+			} else {
+				this->values[k] = is_boolean ? view.get_boolean(col_num) : view.get_int(col_num);
+			}
+		}
+		int32_t value = is_boolean ? predicate.second.n != 0 : predicate.second.n;
+		filter_int32(this->values.data(), n, FilterOp::EQ, value, value, this->mask.data());
+	}
+
+	// whatever is left of the where clause, on just the records that got this far
+	for (size_t w = 0; w < this->mask.size(); w++) {
+		for (uint64_t bits = this->mask[w]; bits != 0; bits &= bits - 1) {
+			size_t k = w * 64 + __builtin_ctzll(bits);
+			if (this->table.selected(this->views[k], this->predicates))
+				add_record(this->views[k], (*this->record_ids)[this->i + k]);
+		}
+	}
+}
+
+// Add the qualifying records among the next ones the index cursor points at, until the batch is
+// full. A run of them in the same block shares one fetch of it.
+void HeapTableBatchCursor::add_handles() {
+	Handle handle;
+	while (!this->batch->full() && this->handles->next(handle)) {
+		if (this->block == nullptr || this->block->get_block_id() != handle.first) {
+			delete this->block;
+			this->block = nullptr;
+			this->block = this->table.file.get(handle.first);
+		}
+		RecordView view = this->block->view(handle.second);
+		if (this->table.selected(view, this->int_predicates) && this->table.selected(view, this->predicates))
+			add_record(view, handle.second);
+	}
+}
+
+// Copy the batch's columns out of the record (in the current block) onto the column vectors.
+void HeapTableBatchCursor::add_record(const RecordView &record, RecordID record_id) {
+	RecordView view(record);
+	view.set_column_attributes(&this->table.column_attributes);
+	this->batch->add_row(Handle(this->block->get_block_id(), record_id));
+	for (uint i = 0; i < this->col_nums->size(); i++) {
+		uint col_num = (*this->col_nums)[i];
+		ColumnVector &column = this->batch->column(i);
+		if (view.is_null_column(col_num)) {
+			column.push_null();
+			continue;
+		}
+		switch (column.get_data_type()) {
+			case ColumnAttribute::DataType::INT:
+				column.push_int(view.get_int(col_num));
+				break;
+			case ColumnAttribute::DataType::BOOLEAN:
+				column.push_int(view.get_boolean(col_num));
+				break;
+			case ColumnAttribute::DataType::TEXT:
+				column.push_text(view.get_text(col_num));
+				break;
+			default:
+				throw DbRelationError("Only know how to get INT, TEXT, and BOOLEAN");
+		}
+	}
+}
+
+
+/*
+ * *******************
+ * DbRelation::batch_cursor
+ * *******************
+ */
+
+// By default, batch up the rows from the row-at-a-time cursor.
+BatchCursor* DbRelation::batch_cursor(const ColumnNames* column_names, const ValueDict* where,
+									  const ColumnNames* where_order) {
+	if (column_names == nullptr)
+		column_names = &this->column_names;
+	ColumnAttributes *column_attributes = get_column_attributes(*column_names);
+	BatchCursor *ret = new RowBatchCursor(cursor(where, where_order), *column_names, *column_attributes);
+	delete column_attributes;
+	return ret;
+}
+
+// By default, batch up the rows from the index cursor, fetched a row at a time.
+BatchCursor* DbRelation::batch_cursor(DbIndexCursor* handles, const ColumnNames* column_names, const ValueDict* where) {
+	if (column_names == nullptr)
+		column_names = &this->column_names;
+	ColumnAttributes *column_attributes = get_column_attributes(*column_names);
+	DbRelationCursor *input = new IndexCursor(*this, handles);
+	if (where != nullptr)
+		input = new SelectCursor(input, where);
+	BatchCursor *ret = new RowBatchCursor(input, *column_names, *column_attributes);
+	delete column_attributes;
+	return ret;
+}
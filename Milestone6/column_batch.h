@@ -0,0 +1,271 @@
+/**
+ * @file column_batch.h - Column-at-a-time query evaluation.
+ * ColumnVector
+ * ColumnBatch
+ * BatchCursor
+ * RowBatchCursor: BatchCursor
+ * SelectBatchCursor: BatchCursor
+ * LimitBatchCursor: BatchCursor
+ * HeapTableBatchCursor: BatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class ColumnVector - the values of one column for each row of a ColumnBatch
+ *
+ * INT and BOOLEAN values are kept in a flat vector of int32_t. TEXT values are copied
+ * back-to-back into one character arena and found by (offset, length) slices, so a batch of
+ * text costs a couple of allocations instead of one std::string per value.
+ * A NULL takes a slot like any other value (so row i is always at position i) and is flagged.
+ */
+class ColumnVector {
+public:
+	ColumnVector(ColumnAttribute::DataType data_type) : data_type(data_type), nulls(), ints(), slices(), text() {}
+	virtual ~ColumnVector() {}
+
+	ColumnAttribute::DataType get_data_type() const { return data_type; }
+	size_t size() const { return nulls.size(); }
+	void clear();
+
+	void push_null();
+	void push_int(int32_t n);  // INT or BOOLEAN
+	void push_text(const TextView &s);
+	void push_value(const Value &value);
+	void push_from(const ColumnVector &other, size_t i);  // copy other's value for row i
+
+	bool is_null(size_t i) const { return nulls[i] != 0; }
+	int32_t get_int(size_t i) const { return ints[i]; }
+	const int32_t *int_data() const { return ints.data(); }  // INT, BOOLEAN: all the values, for the filter kernels
+	TextView get_text(size_t i) const {
+		return TextView(text.data() + slices[i].first, slices[i].second);
+	}
+	Value get_value(size_t i) const;
+
+protected:
+	ColumnAttribute::DataType data_type;
+	std::vector<uint8_t> nulls;
+	std::vector<int32_t> ints;  // INT, BOOLEAN
+	std::vector<std::pair<uint32_t, uint16_t>> slices;  // TEXT: (offset into text, length)
+	std::string text;  // TEXT: the characters of all the values
+};
+
+/**
+ * @class ColumnBatch - up to CAPACITY rows of some columns, stored column by column
+ *
+ * Along with the columns, a batch carries the handle of each row and a selection vector: the
+ * (ascending) positions of the rows that still qualify. Filters shrink the selection vector
+ * rather than moving any column data.
+ */
+class ColumnBatch {
+public:
+	static const size_t CAPACITY = 1024;
+
+	ColumnBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+	virtual ~ColumnBatch() {}
+
+	const ColumnNames& get_column_names() const { return column_names; }
+	int column_number(const Identifier &column_name) const;
+	ColumnVector& column(uint col_num) { return columns[col_num]; }
+	const ColumnVector& column(uint col_num) const { return columns[col_num]; }
+
+	// rows in the batch (selected or not)
+	size_t size() const { return handles.size(); }
+	bool full() const { return size() >= CAPACITY; }
+	Handle get_handle(uint16_t row) const { return handles[row]; }
+
+	// Start a new row; the producer then pushes one value onto each column
+	void add_row(Handle handle) { handles.push_back(handle); }
+
+	// Empty out the batch (keeping the allocations for the next batch)
+	void clear();
+
+	std::vector<uint16_t>& selection() { return selected_rows; }
+	const std::vector<uint16_t>& selection() const { return selected_rows; }
+	void select_all();
+
+	/**
+	 * Build the ValueDict for one row (NULL columns are left out, as with DbRelation::project).
+	 * @param row           position of the row in the batch
+	 * @param column_names  columns to include (nullptr for all of the batch's columns)
+	 * @returns             the row (freed by caller)
+	 */
+	ValueDict* project(uint16_t row, const ColumnNames* column_names=nullptr) const;
+
+	/**
+	 * Get one row by column position.
+	 * @param row        position of the row in the batch
+	 * @param n_columns  how many of the batch's columns to include (from the first)
+	 * @returns          the row (freed by caller)
+	 */
+	Row* get_row(uint16_t row, size_t n_columns) const;
+
+protected:
+	ColumnNames column_names;
+	std::vector<ColumnVector> columns;
+	Handles handles;
+	std::vector<uint16_t> selected_rows;
+};
+
+/**
+ * @class BatchCursor - iterator over the rows of a relation a ColumnBatch at a time
+ */
+class BatchCursor {
+public:
+	BatchCursor() {}
+	virtual ~BatchCursor() {}
+	BatchCursor(const BatchCursor& other) = delete;
+	BatchCursor& operator=(const BatchCursor& other) = delete;
+
+	/**
+	 * Get the next batch that has at least one selected row.
+	 * @returns  the batch (owned by the cursor and only good until the next call), or nullptr at the end
+	 */
+	virtual ColumnBatch* next() = 0;
+};
+
+/**
+ * @class RowBatchCursor - gathers the rows of a DbRelationCursor up into batches
+ *
+ * For relations (or plan nodes) that only know how to produce a row at a time.
+ */
+class RowBatchCursor : public BatchCursor {
+public:
+	/**
+	 * @param input              cursor to read from (owned by this cursor)
+	 * @param column_names       columns to put in the batches
+	 * @param column_attributes  their attributes
+	 */
+	RowBatchCursor(DbRelationCursor* input, const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+	virtual ~RowBatchCursor();
+
+	virtual ColumnBatch* next();
+
+protected:
+	DbRelationCursor* input;
+	ColumnBatch batch;
+};
+
+class Predicate;  // see predicate.h
+
+/**
+ * @class SelectBatchCursor - restricts the selection vectors of another BatchCursor to the rows
+ * satisfying an equality conjunction and/or a compiled Predicate
+ *
+ * Each predicate is checked for all of the still-selected rows before going on to the next, a
+ * tight loop over one column vector. The Predicate's columns are resolved against the first batch.
+ */
+class SelectBatchCursor : public BatchCursor {
+public:
+	/**
+	 * @param input        batches to filter (owned by this cursor; must have the columns of where)
+	 * @param where        predicates
+	 * @param where_order  the columns of where, in the order to check them (nullptr for any)
+	 * @param predicate    the rest of the where clause, checked after where (nullptr for none; copied)
+	 */
+	SelectBatchCursor(BatchCursor* input, const ValueDict* where, const ColumnNames* where_order=nullptr,
+					  const Predicate* predicate=nullptr);
+	virtual ~SelectBatchCursor();
+
+	virtual ColumnBatch* next();
+
+protected:
+	BatchCursor* input;
+	const ValueDict* where;
+	ColumnNames* where_order;
+	Predicate* predicate;
+	bool resolved;
+
+	std::vector<uint64_t> mask;
+
+	virtual void filter(ColumnBatch *batch, const Identifier &column_name, const Value &value);
+};
+
+/**
+ * @class LimitBatchCursor - skips the first offset selected rows of another BatchCursor and passes
+ * on at most limit of the rest (LIMIT ... OFFSET ...)
+ *
+ * Rows are dropped by trimming the selection vectors. Once limit rows have gone by, the input
+ * isn't asked for anything more, so a scan (or join, etc.) under it stops right there.
+ */
+class LimitBatchCursor : public BatchCursor {
+public:
+	/**
+	 * @param input   batches to take the rows from (owned by this cursor)
+	 * @param limit   most rows to pass on
+	 * @param offset  rows to skip first
+	 */
+	LimitBatchCursor(BatchCursor* input, size_t limit, size_t offset=0);
+	virtual ~LimitBatchCursor();
+
+	virtual ColumnBatch* next();
+
+protected:
+	BatchCursor* input;
+	size_t limit;
+	size_t offset;  // rows still to skip
+	size_t passed;  // rows passed on so far
+};
+
+/**
+ * @class HeapTableBatchCursor - heap table implementation of BatchCursor
+ *
+ * Walks the blocks like HeapTableCursor, checking the where clause against each record in place,
+ * and copies the wanted columns of the qualifying records straight from the record bytes into
+ * the column vectors. No ValueDict is built. A block can span batches; the cursor holds on to
+ * it until it has been used up.
+ *
+ * The INT and BOOLEAN equality predicates are checked for a run of a block's records at a time:
+ * their column is pulled out into a scratch vector and compared with a filter kernel. Only the
+ * records that pass those get the rest of the where clause checked (in place) and are copied out.
+ *
+ * Given an index cursor, it goes through just the records the cursor points at instead (in its
+ * order), fetching a block again only when the next record is in a different one.
+ */
+class HeapTableBatchCursor : public BatchCursor {
+public:
+	/**
+	 * @param table         table to scan
+	 * @param column_names  columns to put in the batches (nullptr for all)
+	 * @param where         predicates (nullptr for all rows)
+	 * @param where_order   the columns of where, in the order to check them (nullptr for any)
+	 */
+	HeapTableBatchCursor(HeapTable &table, const ColumnNames* column_names, const ValueDict* where,
+						 const ColumnNames* where_order=nullptr);
+
+	/**
+	 * @param table         table the rows are in
+	 * @param handles       the rows, e.g., from an index (owned by this cursor)
+	 * @param column_names  columns to put in the batches (nullptr for all)
+	 * @param where         predicates the rows must also satisfy (nullptr for all of them)
+	 */
+	HeapTableBatchCursor(HeapTable &table, DbIndexCursor* handles, const ColumnNames* column_names,
+						 const ValueDict* where);
+	virtual ~HeapTableBatchCursor();
+
+	virtual ColumnBatch* next();
+
+protected:
+	HeapTable &table;
+	RowPredicates* int_predicates;  // INT and BOOLEAN equalities, for the filter kernels
+	RowPredicates* predicates;  // the rest of the where clause, checked a record at a time
+	ColumnNumbers* col_nums;  // for each batch column, its position in the table
+	ColumnBatch* batch;
+	DbFileCursor* block_cursor;  // for a scan
+	DbIndexCursor* handles;  // instead of block_cursor, for the rows of an index
+	SlottedPage* block;
+	RecordIDs* record_ids;
+	size_t i;
+	std::vector<RecordView> views;  // scratch for add_records
+	std::vector<int32_t> values;
+	std::vector<uint64_t> mask;
+
+	void init(const ColumnNames* column_names, const ValueDict* where, const ColumnNames* where_order);
+	virtual void add_records(size_t n);
+	virtual void add_handles();
+	virtual void add_record(const RecordView &record, RecordID record_id);
+};
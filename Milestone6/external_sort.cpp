@@ -0,0 +1,245 @@
+/**
+ * @file external_sort.cpp - implementation of:
+ * ExternalSort
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <algorithm>
+#include <unistd.h>
+#include "external_sort.h"
+#include "column_batch.h"
+using namespace std;
+
+static uint sort_count = 0;  // for naming the spilled runs
+
+static SortOrder ascending(const ColumnNames &column_names, const ColumnNames &sort_columns) {
+	SortOrder ret;
+	for (auto const& column_name: sort_columns) {
+		auto it = find(column_names.begin(), column_names.end(), column_name);
+		if (it == column_names.end())
+			throw DbRelationError("unknown sort column " + column_name);
+		ret.push_back(pair<uint, bool>((uint)(it - column_names.begin()), false));
+	}
+	return ret;
+}
+
+ExternalSort::ExternalSort(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+						   const ColumnNames &sort_columns, size_t memory_budget)
+		: ExternalSort(column_names, column_attributes, ascending(column_names, sort_columns), memory_budget) {
+}
+
+ExternalSort::ExternalSort(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+						   const SortOrder &sort_order, size_t memory_budget)
+		: column_names(column_names), column_attributes(column_attributes), sort_order(sort_order),
+		  memory_budget(memory_budget), sort_number(++sort_count), run_number(0), spill_count(0), rows(), row_bytes(0),
+		  next_row(0), sorting(true), runs(), run_cursors(), run_batches(), run_positions(), heads(), heap() {
+}
+
+ExternalSort::~ExternalSort() {
+	for (size_t i = this->next_row; i < this->rows.size(); i++)
+		delete this->rows[i];
+	for (auto head: this->heads)
+		delete head;
+	for (auto cursor: this->run_cursors)
+		delete cursor;
+	for (auto run: this->runs) {
+		run->drop();
+		delete run;
+	}
+}
+
+void ExternalSort::add(Row *row) {
+	if (!this->sorting) {
+		delete row;
+		throw DbRelationError("can't add rows to a sort once they are coming back out");
+	}
+	this->rows.push_back(row);
+	this->row_bytes += row->footprint() + sizeof(Row*);
+	if (this->row_bytes > this->memory_budget)
+		spill();
+}
+
+void ExternalSort::add(ValueDict *row) {
+	Row *full_row = new Row(*row, this->column_names);
+	delete row;
+	add(full_row);
+}
+
+bool ExternalSort::next(Row *&row) {
+	if (this->sorting) {
+		this->sorting = false;
+		if (this->runs.empty()) {
+			sort_rows();
+		} else {
+			if (!this->rows.empty())
+				spill();
+			start_merge();
+		}
+	}
+
+	// everything fit in memory
+	if (this->runs.empty()) {
+		if (this->next_row >= this->rows.size())
+			return false;
+		row = this->rows[this->next_row++];
+		return true;
+	}
+	return pop(row);
+}
+
+// Take the smallest head of the runs being merged and replace it with the next row from its run.
+bool ExternalSort::pop(Row *&row) {
+	if (this->heap.empty())
+		return false;
+	auto greater = [this](size_t a, size_t b) { return less(this->heads[b], this->heads[a]); };
+	pop_heap(this->heap.begin(), this->heap.end(), greater);
+	size_t run = this->heap.back();
+	this->heap.pop_back();
+	row = this->heads[run];
+	this->heads[run] = nullptr;
+	advance(run);
+	if (this->heads[run] != nullptr) {
+		this->heap.push_back(run);
+		push_heap(this->heap.begin(), this->heap.end(), greater);
+	}
+	return true;
+}
+
+bool ExternalSort::next(ValueDict *&row) {
+	Row *full_row;
+	if (!next(full_row))
+		return false;
+	row = full_row->to_dict(this->column_names);
+	delete full_row;
+	return true;
+}
+
+bool ExternalSort::less(const Row *a, const Row *b) const {
+	for (auto const& sort_column: this->sort_order) {
+		uint col_num = sort_column.first;
+		bool a_null = a->is_null(col_num), b_null = b->is_null(col_num);
+		int order;
+		if (a_null || b_null)
+			order = a_null == b_null ? 0 : (a_null ? -1 : 1);
+		else
+			order = (*a)[col_num] < (*b)[col_num] ? -1 : ((*b)[col_num] < (*a)[col_num] ? 1 : 0);
+		if (order != 0)
+			return sort_column.second ? order > 0 : order < 0;
+	}
+	return false;
+}
+
+void ExternalSort::sort_rows() {
+	stable_sort(this->rows.begin(), this->rows.end(),
+				[this](const Row *a, const Row *b) { return less(a, b); });
+}
+
+// Append rows to a run (with one bulk insert) and free them.
+static void write_rows(HeapTable *run, Rows &rows) {
+	if (!rows.empty()) {
+		Handles *handles = run->insert(&rows);
+		delete handles;
+	}
+	for (auto row: rows)
+		delete row;
+	rows.clear();
+}
+
+// A new (empty) run, after the others. The process id is in its name so that the files left behind by
+// a crashed run of the program don't get in the way.
+HeapTable *ExternalSort::new_run() {
+	HeapTable *run = new HeapTable("_sort_" + to_string(getpid()) + "_" + to_string(this->sort_number) + "_" +
+								   to_string(this->run_number++), this->column_names, this->column_attributes);
+	this->runs.push_back(run);
+	run->create();
+	return run;
+}
+
+// Sort what we have in memory and write it out as a new run.
+void ExternalSort::spill() {
+	sort_rows();
+	HeapTable *run = new_run();
+	this->spill_count++;
+	write_rows(run, this->rows);
+	this->row_bytes = 0;
+}
+
+size_t ExternalSort::max_fan_in() {
+	return max((size_t)BufferPool::pool().get_frame_budget() / 4, (size_t)2);
+}
+
+// Merge the runs down to no more than max_fan_in() and start merging those for next().
+void ExternalSort::start_merge() {
+	size_t fan_in = max_fan_in();
+	while (this->runs.size() > fan_in)
+		merge_runs(fan_in);
+	open_runs(this->runs.size());
+}
+
+// Merge the oldest count runs into a new one (which goes after the rest, so each pass merges runs of similar length).
+void ExternalSort::merge_runs(size_t count) {
+	open_runs(count);
+	HeapTable *merged = new_run();
+	Rows rows;
+	size_t row_bytes = 0;
+	Row *row;
+	while (pop(row)) {
+		rows.push_back(row);
+		row_bytes += row->footprint() + sizeof(Row*);
+		if (row_bytes > this->memory_budget) {
+			write_rows(merged, rows);
+			row_bytes = 0;
+		}
+	}
+	write_rows(merged, rows);
+	close_runs(count);
+}
+
+// Done with a merge of the oldest count runs: drop them.
+void ExternalSort::close_runs(size_t count) {
+	for (auto head: this->heads)
+		delete head;
+	for (auto cursor: this->run_cursors)
+		delete cursor;
+	this->heads.clear();
+	this->run_cursors.clear();
+	this->run_batches.clear();
+	this->run_positions.clear();
+	this->heap.clear();
+	for (size_t run = 0; run < count; run++) {
+		this->runs[run]->drop();
+		delete this->runs[run];
+	}
+	this->runs.erase(this->runs.begin(), this->runs.begin() + count);
+}
+
+// Start a k-way merge of the oldest count runs.
+void ExternalSort::open_runs(size_t count) {
+	this->heads.assign(count, nullptr);
+	this->run_batches.assign(count, nullptr);
+	this->run_positions.assign(count, 0);
+	for (size_t run = 0; run < count; run++) {
+		this->run_cursors.push_back(this->runs[run]->batch_cursor(nullptr));
+		advance(run);
+		if (this->heads[run] != nullptr)
+			this->heap.push_back(run);
+	}
+	make_heap(this->heap.begin(), this->heap.end(),
+			  [this](size_t a, size_t b) { return less(this->heads[b], this->heads[a]); });
+}
+
+// Read the next row of the given run into its head (or leave it null if the run is used up).
+void ExternalSort::advance(size_t run) {
+	while (true) {
+		ColumnBatch *batch = this->run_batches[run];
+		if (batch != nullptr && this->run_positions[run] < batch->selection().size()) {
+			uint16_t row = batch->selection()[this->run_positions[run]++];
+			this->heads[run] = batch->get_row(row, this->column_names.size());
+			return;
+		}
+		this->run_batches[run] = this->run_cursors[run]->next();
+		this->run_positions[run] = 0;
+		if (this->run_batches[run] == nullptr)
+			return;
+	}
+}
@@ -0,0 +1,118 @@
+/**
+ * @file external_sort.h - Sorting more rows than fit in memory.
+ * ExternalSort
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <vector>
+#include "heap_storage.h"
+
+class BatchCursor;
+class ColumnBatch;
+
+/**
+ * For each column to sort by, most significant first: (its position in the rows, descending?)
+ */
+typedef std::vector<std::pair<uint, bool>> SortOrder;
+
+/**
+ * @class ExternalSort - sorts a stream of rows by some of their columns, spilling to disk as needed
+ *
+ * Rows are collected in memory. Whenever they take up more than memory_budget bytes, they are
+ * sorted and written out (with one bulk insert) to a temporary HeapTable. Once all the rows are
+ * in, next() hands them back in order, doing a k-way merge of the runs if any had to be spilled
+ * (reading each run back a ColumnBatch at a time). Each run being merged pins a block in the buffer
+ * pool, so if there are more runs than max_fan_in() allows, the oldest are first merged into longer
+ * runs, in as many passes as it takes. The temporary tables are dropped when the sort is deleted.
+ * NULLs sort before everything else.
+ */
+class ExternalSort {
+public:
+	/**
+	 * Bytes of rows (roughly) held in memory, and so the size of each spilled run, unless told otherwise.
+	 */
+	static const size_t DEFAULT_MEMORY_BUDGET = 32 * 1024 * 1024;
+
+	/**
+	 * @param column_names       names of all the columns in the rows
+	 * @param column_attributes  their attributes (used for the spilled runs)
+	 * @param sort_columns       columns to sort by (ascending), most significant first
+	 * @param memory_budget      how much to hold in memory at once
+	 */
+	ExternalSort(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+				 const ColumnNames &sort_columns, size_t memory_budget=DEFAULT_MEMORY_BUDGET);
+
+	/**
+	 * @param column_names       names of all the columns in the rows
+	 * @param column_attributes  their attributes (used for the spilled runs)
+	 * @param sort_order         columns to sort by
+	 * @param memory_budget      how much to hold in memory at once
+	 */
+	ExternalSort(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+				 const SortOrder &sort_order, size_t memory_budget=DEFAULT_MEMORY_BUDGET);
+	virtual ~ExternalSort();
+	ExternalSort(const ExternalSort& other) = delete;
+	ExternalSort& operator=(const ExternalSort& other) = delete;
+
+	/**
+	 * Add a row to be sorted. Can't be called once next() has been.
+	 * @param row  the row, by position in column_names (the sort takes ownership of it)
+	 */
+	virtual void add(Row *row);
+	virtual void add(ValueDict *row);
+
+	/**
+	 * Get the next row in sorted order.
+	 * @param row  set to the next row (freed by caller)
+	 * @returns    false if there are no more rows
+	 */
+	virtual bool next(Row *&row);
+	virtual bool next(ValueDict *&row);
+
+	/**
+	 * @returns  how many runs were spilled to disk (0 if everything fit in memory)
+	 */
+	virtual size_t get_run_count() const { return spill_count; }
+
+	/**
+	 * @returns  how many runs are merged at once: a quarter of the buffer pool's frame budget (but at
+	 *           least 2), leaving room for another sort merging alongside and for the rest of the plan
+	 */
+	static size_t max_fan_in();
+
+	/**
+	 * Does a sort before b?
+	 */
+	virtual bool less(const Row *a, const Row *b) const;
+
+protected:
+	ColumnNames column_names;
+	ColumnAttributes column_attributes;
+	SortOrder sort_order;
+	size_t memory_budget;
+	uint sort_number;           // for naming the spilled runs
+	uint run_number;            // ditto
+	size_t spill_count;         // runs spilled from memory
+	Rows rows;                  // rows not yet spilled
+	size_t row_bytes;           // their footprint
+	size_t next_row;            // where next() is in rows (if nothing was spilled)
+	bool sorting;               // false once next() has been called
+	std::vector<HeapTable*> runs;  // oldest first
+	std::vector<BatchCursor*> run_cursors;
+	std::vector<ColumnBatch*> run_batches;  // current batch of each run
+	std::vector<size_t> run_positions;      // where each run is in its batch's selection
+	Rows heads;                 // current row of each run (nullptr when the run is used up)
+	std::vector<size_t> heap;   // runs with rows left, as a min-heap on their heads
+
+	virtual void sort_rows();
+	virtual HeapTable *new_run();
+	virtual void spill();
+	virtual void start_merge();
+	virtual void merge_runs(size_t count);
+	virtual void open_runs(size_t count);
+	virtual void close_runs(size_t count);
+	virtual bool pop(Row *&row);
+	virtual void advance(size_t run);
+};
@@ -0,0 +1,192 @@
+/**
+ * @file filter_kernels.cpp - implementation of the filter kernels:
+ * filter_int32 (AVX2, SSE2, and scalar versions, picked at startup)
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include "filter_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILTER_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+typedef void (*FilterKernel)(const int32_t *values, size_t n, FilterOp op, int32_t lo, int32_t hi, uint64_t *mask);
+
+static inline bool compare(int32_t value, FilterOp op, int32_t lo, int32_t hi) {
+	switch (op) {
+		case FilterOp::EQ:
+			return value == lo;
+		case FilterOp::LT:
+			return value < lo;
+		case FilterOp::GT:
+			return value > lo;
+		case FilterOp::BETWEEN:
+			return lo <= value && value <= hi;
+	}
+	return false;
+}
+
+// Bits for values[from..to) (at their positions within the word), plus ones past to (up to 64)
+// so that ANDing them in leaves the bits beyond the end of the values alone.
+static inline uint64_t scalar_bits(const int32_t *values, size_t from, size_t to, FilterOp op, int32_t lo, int32_t hi) {
+	uint64_t bits = to == 64 ? 0 : ~0ULL << to;
+	for (size_t j = from; j < to; j++)
+		bits |= (uint64_t)compare(values[j], op, lo, hi) << j;
+	return bits;
+}
+
+static void filter_int32_scalar(const int32_t *values, size_t n, FilterOp op, int32_t lo, int32_t hi, uint64_t *mask) {
+	for (size_t w = 0; w < filter_mask_words(n); w++) {
+		size_t base = w * 64;
+		size_t m = n - base < 64 ? n - base : 64;
+		mask[w] &= scalar_bits(values + base, 0, m, op, lo, hi);
+	}
+}
+
+#ifdef FILTER_KERNELS_X86
+
+__attribute__((target("sse2")))
+static inline __m128i compare4(__m128i v, FilterOp op, __m128i vlo, __m128i vhi) {
+	switch (op) {
+		case FilterOp::EQ:
+			return _mm_cmpeq_epi32(v, vlo);
+		case FilterOp::LT:
+			return _mm_cmpgt_epi32(vlo, v);
+		case FilterOp::GT:
+			return _mm_cmpgt_epi32(v, vlo);
+		case FilterOp::BETWEEN:
+			return _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi32(vlo, v), _mm_cmpgt_epi32(v, vhi)),
+									_mm_set1_epi32(-1));
+	}
+	return _mm_setzero_si128();
+}
+
+__attribute__((target("sse2")))
+static void filter_int32_sse2(const int32_t *values, size_t n, FilterOp op, int32_t lo, int32_t hi, uint64_t *mask) {
+	__m128i vlo = _mm_set1_epi32(lo);
+	__m128i vhi = _mm_set1_epi32(hi);
+	for (size_t w = 0; w < filter_mask_words(n); w++) {
+		const int32_t *word_values = values + w * 64;
+		size_t m = n - w * 64 < 64 ? n - w * 64 : 64;
+		size_t j = 0;
+		uint64_t bits = 0;
+		for (; j + 4 <= m; j += 4) {
+			__m128i r = compare4(_mm_loadu_si128((const __m128i*)(word_values + j)), op, vlo, vhi);
+			bits |= (uint64_t)(uint32_t)_mm_movemask_ps(_mm_castsi128_ps(r)) << j;
+		}
+		mask[w] &= bits | scalar_bits(word_values, j, m, op, lo, hi);
+	}
+}
+
+__attribute__((target("avx2")))
+static inline __m256i compare8(__m256i v, FilterOp op, __m256i vlo, __m256i vhi) {
+	switch (op) {
+		case FilterOp::EQ:
+			return _mm256_cmpeq_epi32(v, vlo);
+		case FilterOp::LT:
+			return _mm256_cmpgt_epi32(vlo, v);
+		case FilterOp::GT:
+			return _mm256_cmpgt_epi32(v, vlo);
+		case FilterOp::BETWEEN:
+			return _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(vlo, v), _mm256_cmpgt_epi32(v, vhi)),
+									   _mm256_set1_epi32(-1));
+	}
+	return _mm256_setzero_si256();
+}
+
+__attribute__((target("avx2")))
+static void filter_int32_avx2(const int32_t *values, size_t n, FilterOp op, int32_t lo, int32_t hi, uint64_t *mask) {
+	__m256i vlo = _mm256_set1_epi32(lo);
+	__m256i vhi = _mm256_set1_epi32(hi);
+	for (size_t w = 0; w < filter_mask_words(n); w++) {
+		const int32_t *word_values = values + w * 64;
+		size_t m = n - w * 64 < 64 ? n - w * 64 : 64;
+		size_t j = 0;
+		uint64_t bits = 0;
+		for (; j + 8 <= m; j += 8) {
+			__m256i r = compare8(_mm256_loadu_si256((const __m256i*)(word_values + j)), op, vlo, vhi);
+			bits |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(r)) << j;
+		}
+		mask[w] &= bits | scalar_bits(word_values, j, m, op, lo, hi);
+	}
+}
+
+#endif
+
+static const char *kernel_name = "scalar";
+
+static FilterKernel choose_kernel() {
+#ifdef FILTER_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernel_name = "avx2";
+		return filter_int32_avx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		kernel_name = "sse2";
+		return filter_int32_sse2;
+	}
+#endif
+	return filter_int32_scalar;
+}
+
+static FilterKernel kernel = choose_kernel();
+
+void filter_int32(const int32_t *values, size_t n, FilterOp op, int32_t lo, int32_t hi, uint64_t *mask) {
+	kernel(values, n, op, lo, hi, mask);
+}
+
+const char *filter_kernel_name() {
+	return kernel_name;
+}
+
+// Check each kernel the CPU can run against the scalar one.
+bool test_filter_kernels() {
+	const size_t n = 1000;  // not a multiple of 64 (or 8)
+	int32_t values[n];
+	srand(5300);
+	for (size_t i = 0; i < n; i++)
+		values[i] = i % 10 == 0 ? (i % 20 == 0 ? INT_MIN : INT_MAX) : rand() % 200 - 100;
+
+	FilterKernel kernels[3] = {filter_int32_scalar, nullptr, nullptr};
+#ifdef FILTER_KERNELS_X86
+	if (__builtin_cpu_supports("sse2"))
+		kernels[1] = filter_int32_sse2;
+	if (__builtin_cpu_supports("avx2"))
+		kernels[2] = filter_int32_avx2;
+#endif
+	FilterOp ops[] = {FilterOp::EQ, FilterOp::LT, FilterOp::GT, FilterOp::BETWEEN};
+	int32_t constants[][2] = {{0, 50}, {-100, 99}, {INT_MIN, INT_MAX}, {17, 17}, {60, -60}};
+	for (auto op: ops) {
+		for (auto const& constant: constants) {
+			uint64_t expected[filter_mask_words(n)];
+			for (size_t w = 0; w < filter_mask_words(n); w++)
+				expected[w] = ~0ULL;
+			filter_int32_scalar(values, n, op, constant[0], constant[1], expected);
+			for (size_t i = 0; i < n; i++)
+				if (((expected[i / 64] >> (i % 64)) & 1) != compare(values[i], op, constant[0], constant[1]))
+					return false;
+			if ((expected[n / 64] >> (n % 64)) != ~0ULL >> (n % 64))
+				return false;  // bits past the end changed
+			for (auto k: kernels) {
+				if (k == nullptr)
+					continue;
+				uint64_t mask[filter_mask_words(n)];
+				for (size_t w = 0; w < filter_mask_words(n); w++)
+					mask[w] = ~0ULL;
+				k(values, n, op, constant[0], constant[1], mask);
+				for (size_t w = 0; w < filter_mask_words(n); w++)
+					if (mask[w] != expected[w])
+						return false;
+			}
+		}
+	}
+	cout << "filter kernels ok (using " << filter_kernel_name() << ")" << endl;
+	return true;
+}
@@ -0,0 +1,49 @@
+/**
+ * @file filter_kernels.h - Vectorized comparisons of a column of INT (or BOOLEAN) values against constants.
+ *
+ * The kernels work on a dense array of int32_t values and AND their result into a bitmask (bit i of
+ * mask[i / 64] for values[i]), so several predicates on the same rows can be combined before anyone
+ * looks at a row. Which implementation is used (AVX2, SSE2, or plain C++) is decided once, at startup,
+ * from what the CPU supports.
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The comparisons a kernel can do: value = lo, value < lo, value > lo, or lo <= value <= hi.
+ */
+enum class FilterOp {
+	EQ,
+	LT,
+	GT,
+	BETWEEN
+};
+
+/**
+ * Number of uint64_t words needed for a bitmask over n values.
+ */
+constexpr size_t filter_mask_words(size_t n) {
+	return (n + 63) / 64;
+}
+
+/**
+ * Clear the bits of mask for the values that fail the comparison.
+ * @param values  the values to check
+ * @param n       how many there are
+ * @param op      comparison
+ * @param lo      constant to compare against (low end for BETWEEN)
+ * @param hi      high end for BETWEEN (ignored otherwise)
+ * @param mask    filter_mask_words(n) words; bits past n are left alone
+ */
+void filter_int32(const int32_t *values, size_t n, FilterOp op, int32_t lo, int32_t hi, uint64_t *mask);
+
+/**
+ * Name of the implementation filter_int32 is using ("avx2", "sse2", or "scalar").
+ */
+const char *filter_kernel_name();
+
+bool test_filter_kernels();
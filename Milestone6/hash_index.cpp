@@ -0,0 +1,607 @@
+/**
+ * @file hash_index.cpp - implementation of:
+ * HashIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <cstring>
+#include <iostream>
+#include "hash_index.h"
+using namespace std;
+
+// the records of the stat block, in order
+static const RecordID LEVEL = 1;
+static const RecordID SPLIT = 2;
+static const RecordID ENTRY_COUNT = 3;
+static const RecordID ENTRY_BYTES = 4;
+static const RecordID FREE_BLOCKS = 5;
+static const RecordID DIRECTORY = 6;
+
+static const uint SLOT_BYTES = 2 * sizeof(uint16_t);  // each record's size and location in the block header
+
+HashIndex::HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+		: DbIndex(relation, name, key_columns, unique),
+		  closed(true),
+		  file(relation.get_table_name() + "-" + name),
+		  key_profile(),
+		  level(0),
+		  split(0),
+		  entry_count(0),
+		  entry_bytes(0),
+		  free_blocks(0),
+		  buckets(),
+		  directory() {
+	ColumnAttributes *column_attributes = relation.get_column_attributes(this->key_columns);
+	for (ColumnAttribute column_attribute: *column_attributes)
+		this->key_profile.push_back(column_attribute.get_data_type());
+	delete column_attributes;
+}
+
+HashIndex::~HashIndex() {
+}
+
+// Create the index with INITIAL_BUCKETS empty buckets and then add every row of the relation.
+void HashIndex::create() {
+	this->file.create();
+	this->closed = false;
+	this->level = this->split = this->entry_count = this->entry_bytes = 0;
+	this->free_blocks = 0;
+	this->buckets.clear();
+	this->directory.clear();
+	for (uint i = 0; i < INITIAL_BUCKETS; i++) {
+		SlottedPage *block = new_block();
+		this->buckets.push_back(block->get_block_id());
+		this->file.put(block);
+		delete block;
+	}
+	save_directory(0);
+
+	DbRelationCursor *rows = this->relation.cursor();
+	Handles handles;
+	Handle handle;
+	while (rows->next(handle))
+		handles.push_back(handle);
+	delete rows;
+	insert(&handles);
+}
+
+void HashIndex::drop() {
+	this->file.drop();
+	this->closed = true;
+}
+
+// Read the stat block and the directory (which is kept in memory while the index is open).
+void HashIndex::open() {
+	if (!this->closed)
+		return;
+	this->file.open();
+	SlottedPage *block = this->file.get(STAT);
+	this->level = *(const uint32_t *)block->view(LEVEL).data();
+	this->split = *(const uint32_t *)block->view(SPLIT).data();
+	this->entry_count = *(const uint32_t *)block->view(ENTRY_COUNT).data();
+	this->entry_bytes = *(const uint32_t *)block->view(ENTRY_BYTES).data();
+	this->free_blocks = *(const BlockID *)block->view(FREE_BLOCKS).data();
+	BlockID directory_id = *(const BlockID *)block->view(DIRECTORY).data();
+	delete block;
+
+	this->buckets.clear();
+	this->directory.clear();
+	while (directory_id != 0) {
+		this->directory.push_back(directory_id);
+		block = this->file.get(directory_id);
+		RecordView ids = block->view(BUCKETS);
+		const BlockID *first = (const BlockID *)ids.data();
+		this->buckets.insert(this->buckets.end(), first, first + ids.size() / sizeof(BlockID));
+		directory_id = get_next(block);
+		delete block;
+	}
+	this->closed = false;
+}
+
+void HashIndex::close() {
+	this->file.close();
+	this->buckets.clear();
+	this->directory.clear();
+	this->closed = true;
+}
+
+// Find all the rows whose key columns are equal to key: only the key's bucket is read.
+Handles *HashIndex::lookup(ValueDict *key) const {
+	Handles *handles = new Handles();
+	find(marshal_key(key), *handles);
+	return handles;
+}
+
+// Collect the handles of the entries with the given (marshaled) key from its bucket's chain.
+void HashIndex::find(const string &key, Handles &handles) const {
+	uint32_t key_hash = hash(key);
+	BlockID block_id = this->buckets[bucket_of(key_hash)];
+	while (block_id != 0) {
+		SlottedPage *block = this->file.get(block_id);
+		RecordIDs *ids = block->ids();
+		for (auto const& record_id: *ids) {
+			if (record_id == NEXT)
+				continue;
+			RecordView entry = block->view(record_id);
+			if (entry.size() == KEY_OFFSET + key.size() &&
+				*(const uint32_t *)(entry.data() + HASH_OFFSET) == key_hash &&
+				memcmp(entry.data() + KEY_OFFSET, key.data(), key.size()) == 0)
+				handles.push_back(Handle(*(const BlockID *)(entry.data() + HANDLE_OFFSET),
+										 *(const RecordID *)(entry.data() + HANDLE_OFFSET + sizeof(BlockID))));
+		}
+		delete ids;
+		block_id = get_next(block);
+		delete block;
+	}
+}
+
+// Insert a row with the given handle. Row must exist in relation already.
+void HashIndex::insert(Handle handle) {
+	Handles handles(1, handle);
+	insert(&handles);
+}
+
+// Insert a batch of rows, writing the stat block once at the end.
+void HashIndex::insert(const Handles *handles) {
+	open();
+	try {
+		for (auto const& handle: *handles) {
+			ValueDict *row = this->relation.project(handle, &this->key_columns);
+			string key = marshal_key(row);
+			delete row;
+			if (this->unique) {
+				Handles found;
+				find(key, found);
+				if (!found.empty())
+					throw DbRelationError("Duplicate keys are not allowed in unique index");
+			}
+			add_entry(marshal_entry(key, handle));
+		}
+	} catch (...) {
+		save_stat();
+		throw;
+	}
+	save_stat();
+}
+
+// Remove the entry for a row (which must still be in the relation). An overflow block left empty
+// is taken out of the chain.
+void HashIndex::del(Handle handle) {
+	open();
+	ValueDict *row = this->relation.project(handle, &this->key_columns);
+	string entry = marshal_entry(marshal_key(row), handle);
+	delete row;
+
+	SlottedPage *prev = nullptr;
+	BlockID block_id = this->buckets[bucket_of(*(const uint32_t *)(entry.data() + HASH_OFFSET))];
+	while (block_id != 0) {
+		SlottedPage *block = this->file.get(block_id);
+		RecordIDs *ids = block->ids();
+		RecordID found = 0;
+		for (auto const& record_id: *ids) {
+			RecordView view = block->view(record_id);
+			if (record_id != NEXT && view.size() == entry.size() && memcmp(view.data(), entry.data(), entry.size()) == 0) {
+				found = record_id;
+				break;
+			}
+		}
+		delete ids;
+		if (found != 0) {
+			block->del(found);
+			if (prev != nullptr && block->size() == 1) {
+				set_next(prev, get_next(block));
+				this->file.put(prev);
+				free_block(block);
+			} else {
+				this->file.put(block);
+			}
+			delete block;
+			delete prev;
+			this->entry_count--;
+			this->entry_bytes -= (uint32_t)(entry.size() + SLOT_BYTES);
+			save_stat();
+			return;
+		}
+		block_id = get_next(block);
+		delete prev;
+		prev = block;
+	}
+	delete prev;
+	throw DbRelationError("row is not in hash index " + this->name);
+}
+
+// FNV-1a: the same on every platform and every run, since it decides where entries live on disk.
+uint32_t HashIndex::hash(const string &key) {
+	uint32_t h = 2166136261U;
+	for (unsigned char c: key) {
+		h ^= c;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+// The key columns of row as bytes, the same way a B-tree key is marshaled (INT and BOOLEAN by
+// the column's type, TEXT with a u16 length prefix), so equal keys have equal bytes.
+string HashIndex::marshal_key(const ValueDict *row) const {
+	string bytes;
+	for (uint i = 0; i < this->key_columns.size(); i++) {
+		auto found = row->find(this->key_columns[i]);
+		if (found == row->end())
+			throw DbRelationError("hash index lookup needs a value for " + this->key_columns[i]);
+		const Value &value = found->second;
+		ColumnAttribute::DataType data_type = this->key_profile[i];
+		if (data_type == ColumnAttribute::DataType::INT) {
+			int32_t n = value.n;
+			bytes.append((const char *)&n, sizeof(int32_t));
+		} else if (data_type == ColumnAttribute::DataType::TEXT) {
+			if (value.s.length() > UINT16_MAX)
+				throw DbRelationError("text field too long to marshal");
+			uint16_t size = (uint16_t)value.s.length();
+			bytes.append((const char *)&size, sizeof(uint16_t));
+			bytes.append(value.s);
+		} else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+			bytes.push_back((char)(value.n != 0));
+		} else {
+			throw DbRelationError("Only know how to marshal INT, TEXT, or BOOLEAN");
+		}
+	}
+	return bytes;
+}
+
+string HashIndex::marshal_entry(const string &key, Handle handle) const {
+	uint32_t key_hash = hash(key);
+	string entry((const char *)&key_hash, sizeof(uint32_t));
+	entry.append((const char *)&handle.first, sizeof(BlockID));
+	entry.append((const char *)&handle.second, sizeof(RecordID));
+	entry.append(key);
+	return entry;
+}
+
+// Buckets before the split pointer have already been split this round, so they go by one more bit.
+uint32_t HashIndex::bucket_of(uint32_t hash) const {
+	uint32_t n = INITIAL_BUCKETS << this->level;
+	uint32_t bucket = hash % n;
+	if (bucket < this->split)
+		bucket = hash % (2 * n);
+	return bucket;
+}
+
+// Add an entry to its bucket, then split buckets until the load is back under MAX_LOAD_PERCENT.
+// (The stat block is left to the caller.)
+void HashIndex::add_entry(const string &entry) {
+	add_to_chain(this->buckets[bucket_of(*(const uint32_t *)(entry.data() + HASH_OFFSET))], entry);
+	this->entry_count++;
+	this->entry_bytes += (uint32_t)(entry.size() + SLOT_BYTES);
+	while ((uint64_t)this->entry_bytes * 100 > (uint64_t)this->buckets.size() * DbBlock::BLOCK_SZ * MAX_LOAD_PERCENT)
+		split_next();
+}
+
+// Add an entry to the first block in a chain with room for it, adding an overflow block if none has.
+void HashIndex::add_to_chain(BlockID primary, const string &entry) {
+	Dbt dbt((void *)entry.data(), (u_int32_t)entry.size());
+	SlottedPage *block = this->file.get(primary);
+	while (true) {
+		try {
+			block->add(&dbt);
+			break;
+		} catch (DbBlockNoRoomError &e) {
+		}
+		BlockID next = get_next(block);
+		if (next == 0) {
+			SlottedPage *overflow = new_block();
+			try {
+				overflow->add(&dbt);
+			} catch (DbBlockNoRoomError &e) {
+				free_block(overflow);
+				delete overflow;
+				delete block;
+				throw DbRelationError("index key too big to fit in a block");
+			}
+			set_next(block, overflow->get_block_id());
+			this->file.put(block);
+			delete block;
+			block = overflow;
+			break;
+		}
+		delete block;
+		block = this->file.get(next);
+	}
+	this->file.put(block);
+	delete block;
+}
+
+// Take all the entries out of a chain, leaving just its (empty) primary block.
+void HashIndex::take_chain(BlockID primary, vector<string> &entries) {
+	BlockID block_id = primary;
+	while (block_id != 0) {
+		SlottedPage *block = this->file.get(block_id);
+		RecordIDs *ids = block->ids();
+		for (auto const& record_id: *ids) {
+			if (record_id == NEXT)
+				continue;
+			RecordView entry = block->view(record_id);
+			entries.push_back(string(entry.data(), entry.size()));
+		}
+		delete ids;
+		BlockID next = get_next(block);
+		if (block_id == primary) {
+			block->clear();
+			set_next(block, 0);
+			this->file.put(block);
+		} else {
+			free_block(block);
+		}
+		delete block;
+		block_id = next;
+	}
+}
+
+// Split the bucket at the split pointer: its entries stay or move to a new bucket at the end by
+// the next bit of their hash. After the last bucket of the round, the next round begins.
+void HashIndex::split_next() {
+	uint32_t n = INITIAL_BUCKETS << this->level;
+	vector<string> entries;
+	take_chain(this->buckets[this->split], entries);
+
+	SlottedPage *block = new_block();
+	this->buckets.push_back(block->get_block_id());
+	this->file.put(block);
+	delete block;
+	save_directory((this->buckets.size() - 1) / DIRECTORY_ENTRIES);
+
+	for (auto const& entry: entries)
+		add_to_chain(this->buckets[*(const uint32_t *)(entry.data() + HASH_OFFSET) % (2 * n)], entry);
+	if (++this->split == n) {
+		this->split = 0;
+		this->level++;
+	}
+}
+
+// An empty bucket block (with no next block): off the free list if there is one there.
+SlottedPage *HashIndex::new_block() {
+	SlottedPage *block;
+	if (this->free_blocks != 0) {
+		block = this->file.get(this->free_blocks);
+		this->free_blocks = get_next(block);
+		block->clear();
+	} else {
+		block = this->file.get_new();
+	}
+	BlockID next = 0;
+	Dbt dbt(&next, sizeof(BlockID));
+	block->add(&dbt);
+	return block;
+}
+
+// Put a block on the free list (and save it).
+void HashIndex::free_block(SlottedPage *block) {
+	block->clear();
+	BlockID next = this->free_blocks;
+	Dbt dbt(&next, sizeof(BlockID));
+	block->add(&dbt);
+	this->file.put(block);
+	this->free_blocks = block->get_block_id();
+}
+
+BlockID HashIndex::get_next(const SlottedPage *block) {
+	return *(const BlockID *)block->view(NEXT).data();
+}
+
+void HashIndex::set_next(SlottedPage *block, BlockID next) {
+	Dbt dbt(&next, sizeof(BlockID));
+	if (block->size() == 0)
+		block->add(&dbt);
+	else
+		block->put(NEXT, dbt);
+}
+
+void HashIndex::save_stat() {
+	uint32_t values[] = {this->level, this->split, this->entry_count, this->entry_bytes, this->free_blocks,
+						 this->directory[0]};
+	SlottedPage *block = this->file.get(STAT);
+	bool is_new = block->size() == 0;
+	for (RecordID record_id = LEVEL; record_id <= DIRECTORY; record_id++) {
+		Dbt dbt(&values[record_id - LEVEL], sizeof(uint32_t));
+		if (is_new)
+			block->add(&dbt);
+		else
+			block->put(record_id, dbt);
+	}
+	this->file.put(block);
+	delete block;
+}
+
+// Write directory block i (the bucket ids from i * DIRECTORY_ENTRIES on), adding it to the end of
+// the directory if it's new.
+void HashIndex::save_directory(size_t i) {
+	size_t first = i * DIRECTORY_ENTRIES;
+	size_t count = min(this->buckets.size() - first, (size_t)DIRECTORY_ENTRIES);
+	Dbt ids(&this->buckets[first], (u_int32_t)(count * sizeof(BlockID)));
+	SlottedPage *block;
+	if (i < this->directory.size()) {
+		block = this->file.get(this->directory[i]);
+		block->put(BUCKETS, ids);
+	} else {
+		block = this->file.get_new();
+		set_next(block, 0);
+		block->add(&ids);
+		if (i > 0) {
+			SlottedPage *prev = this->file.get(this->directory[i - 1]);
+			set_next(prev, block->get_block_id());
+			this->file.put(prev);
+			delete prev;
+		}
+		this->directory.push_back(block->get_block_id());
+	}
+	this->file.put(block);
+	delete block;
+}
+
+// Lets the test see how an index is laid out on disk.
+class TestHashIndex : public HashIndex {
+public:
+	TestHashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+			: HashIndex(relation, name, key_columns, unique) {}
+
+	size_t get_directory_size() const { return this->directory.size(); }
+	uint32_t get_entry_count() const { return this->entry_count; }
+	BlockID get_last_block_id() const { return this->file.get_last_block_id(); }
+
+	// blocks in the chain of key's bucket
+	uint chain_length(const ValueDict &key) const {
+		uint n = 0;
+		for (BlockID block_id = this->buckets[bucket_of(hash(marshal_key(&key)))]; block_id != 0; n++) {
+			SlottedPage *block = this->file.get(block_id);
+			block_id = get_next(block);
+			delete block;
+		}
+		return n;
+	}
+
+	uint free_list_length() const {
+		uint n = 0;
+		for (BlockID block_id = this->free_blocks; block_id != 0; n++) {
+			SlottedPage *block = this->file.get(block_id);
+			block_id = get_next(block);
+			delete block;
+		}
+		return n;
+	}
+};
+
+// Does each row's s look up to just that row?
+static bool test_lookups(const HashIndex &index, const Handles &handles, const ValueDicts &rows) {
+	for (size_t i = 0; i < rows.size(); i++) {
+		ValueDict key;
+		key["s"] = rows[i]->at("s");
+		Handles *found = index.lookup(&key);
+		bool ok = found->size() == 1 && (*found)[0] == handles[i];
+		delete found;
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+bool test_hash_index() {
+	ColumnNames column_names;
+	column_names.push_back("a");
+	column_names.push_back("b");
+	column_names.push_back("s");
+	ColumnAttributes column_attributes(2, ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	HeapTable table("_test_hash_index", column_names, column_attributes);
+	table.create();
+	ValueDicts rows;
+	for (int a = 0; a < 3500; a++) {
+		ValueDict *row = new ValueDict;
+		(*row)["a"] = Value(a);
+		(*row)["b"] = Value(a % 10);
+		(*row)["s"] = Value(to_string(a) + string(1000, 's'));  // a long key, so the buckets fill up fast
+		rows.push_back(row);
+	}
+	Handles *handles = table.insert(&rows);
+	bool ok = true;
+
+	// splits: enough long keys to need more buckets than one directory block holds
+	ColumnNames s_key(1, "s");
+	TestHashIndex *by_s = new TestHashIndex(table, "s", s_key, true);
+	by_s->create();
+	size_t bucket_count = by_s->get_bucket_count();
+	if (bucket_count <= HashIndex::DIRECTORY_ENTRIES || by_s->get_directory_size() < 2 ||
+		by_s->get_entry_count() != rows.size() || !test_lookups(*by_s, *handles, rows))
+		ok = false;
+	ValueDict missing;
+	missing["s"] = Value("nope");
+	Handles *found = by_s->lookup(&missing);
+	if (!found->empty())
+		ok = false;
+	delete found;
+
+	// open again from what's on disk
+	by_s->close();
+	by_s->open();
+	if (by_s->get_bucket_count() != bucket_count || by_s->get_directory_size() < 2 ||
+		by_s->get_entry_count() != rows.size() || !test_lookups(*by_s, *handles, rows))
+		ok = false;
+	by_s->drop();
+	delete by_s;
+
+	// duplicates: each value of b is in 350 entries, more than fit in a block, so their chain overflows
+	ColumnNames b_key(1, "b");
+	TestHashIndex *by_b = new TestHashIndex(table, "b", b_key, false);
+	by_b->create();
+	ValueDict three;
+	three["b"] = Value(3);
+	Handles threes;
+	for (size_t i = 3; i < handles->size(); i += 10)
+		threes.push_back((*handles)[i]);
+	found = by_b->lookup(&three);
+	uint chain = by_b->chain_length(three);
+	if (found->size() != threes.size() || chain < 2)
+		ok = false;
+	delete found;
+
+	// del: emptied overflow blocks are unlinked and go on the free list, to be used again
+	uint free_count = by_b->free_list_length();
+	BlockID last = by_b->get_last_block_id();
+	for (auto const& handle: threes)
+		by_b->del(handle);
+	found = by_b->lookup(&three);
+	if (!found->empty() || by_b->chain_length(three) != 1 || by_b->free_list_length() != free_count + chain - 1)
+		ok = false;
+	delete found;
+	try {
+		by_b->del(threes[0]);
+		ok = false;
+	} catch (DbRelationError &e) {
+	}
+	by_b->insert(&threes);
+	found = by_b->lookup(&three);
+	if (found->size() != threes.size() || by_b->get_last_block_id() != last ||
+		by_b->free_list_length() != free_count)
+		ok = false;
+	delete found;
+	by_b->drop();
+	delete by_b;
+
+	// a unique index rejects a duplicate, whether it's there from the start or comes later
+	try {
+		TestHashIndex not_unique(table, "b_unique", b_key, true);
+		try {
+			not_unique.create();
+			ok = false;
+		} catch (DbRelationError &e) {
+		}
+		not_unique.drop();
+	} catch (DbRelationError &e) {
+		ok = false;
+	}
+	ColumnNames a_key(1, "a");
+	TestHashIndex *by_a = new TestHashIndex(table, "a", a_key, true);
+	by_a->create();
+	ValueDict five;
+	five["a"] = Value(5);
+	five["b"] = Value(5);
+	five["s"] = Value("again");
+	Handle handle = table.insert(&five);
+	try {
+		by_a->insert(handle);
+		ok = false;
+	} catch (DbRelationError &e) {
+	}
+	found = by_a->lookup(&five);
+	if (found->size() != 1 || (*found)[0] != (*handles)[5] || by_a->get_entry_count() != rows.size())
+		ok = false;
+	delete found;
+	by_a->drop();
+	delete by_a;
+
+	table.drop();
+	delete handles;
+	for (auto row: rows)
+		delete row;
+	if (ok)
+		cout << "hash index ok" << endl;
+	return ok;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file hash_index.h - Disk-based hash index.
+ * HashIndex: DbIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "BTreeNode.h"
+
+/**
+ * @class HashIndex - linear hashing over the blocks of a HeapFile
+ *
+ * Each bucket is a primary block plus a chain of overflow blocks. Buckets are split one at a time,
+ * in order, whenever the entries take up more than MAX_LOAD_PERCENT of the primary blocks, so
+ * chains stay short and a point lookup reads one block (plus the odd overflow block) whatever the
+ * size of the index. Duplicate keys (when not unique) just sit side by side in their bucket's chain.
+ *
+ * On disk:
+ *   block 1 (stat): level, split pointer, entry count, entry bytes, free list, first directory block
+ *   directory blocks: record 1 is the next directory block (0 for none), record 2 is the primary
+ *                     block id of each of up to DIRECTORY_ENTRIES buckets
+ *   bucket blocks: record 1 is the next overflow block (0 for none), then an entry per record:
+ *                  key hash (u32), handle (block id, record id), key (as in a B-tree key)
+ * Blocks emptied by splits and deletes go on a free list (linked through record 1) to be reused.
+ *
+ * Only whole-key equality is supported: no range queries or cursors.
+ */
+class HashIndex : public DbIndex {
+public:
+	HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+	virtual ~HashIndex();
+	HashIndex(const HashIndex &other) = delete;
+	HashIndex &operator=(const HashIndex &other) = delete;
+
+	virtual void create();
+	virtual void drop();
+
+	virtual void open();
+	virtual void close();
+
+	virtual Handles *lookup(ValueDict *key) const;
+
+	virtual void insert(Handle handle);
+	virtual void insert(const Handles *handles);
+	virtual void del(Handle handle);
+
+	static const uint INITIAL_BUCKETS = 4;
+	static const uint MAX_LOAD_PERCENT = 75;  // of the primary blocks' bytes, before the next split
+	static const uint DIRECTORY_ENTRIES = 1000;  // bucket ids per directory block
+
+	virtual size_t get_bucket_count() const { return buckets.size(); }
+
+protected:
+	static const BlockID STAT = 1;
+	static const RecordID NEXT = 1;  // next block in a chain (in bucket, directory, and free blocks)
+	static const RecordID BUCKETS = 2;  // bucket ids in a directory block
+	static const uint HASH_OFFSET = 0;  // where things are in an entry
+	static const uint HANDLE_OFFSET = HASH_OFFSET + sizeof(uint32_t);
+	static const uint KEY_OFFSET = HANDLE_OFFSET + sizeof(BlockID) + sizeof(RecordID);
+
+	bool closed;
+	mutable HeapFile file;  // lookups read blocks through it
+	KeyProfile key_profile;
+	uint32_t level;  // there are INITIAL_BUCKETS << level buckets before this round of splits
+	uint32_t split;  // next bucket to split
+	uint32_t entry_count;
+	uint32_t entry_bytes;  // including their slots in the blocks
+	BlockID free_blocks;  // head of the free list (0 for none)
+	std::vector<BlockID> buckets;  // primary block of each bucket
+	std::vector<BlockID> directory;  // the directory blocks
+
+	static uint32_t hash(const std::string &key);
+	virtual std::string marshal_key(const ValueDict *row) const;
+	virtual void find(const std::string &key, Handles &handles) const;
+	virtual std::string marshal_entry(const std::string &key, Handle handle) const;
+	virtual uint32_t bucket_of(uint32_t hash) const;
+	virtual void add_entry(const std::string &entry);
+	virtual void add_to_chain(BlockID primary, const std::string &entry);
+	virtual void take_chain(BlockID primary, std::vector<std::string> &entries);
+	virtual void split_next();
+	virtual SlottedPage *new_block();
+	virtual void free_block(SlottedPage *block);
+	static BlockID get_next(const SlottedPage *block);
+	static void set_next(SlottedPage *block, BlockID next);
+	virtual void save_stat();
+	virtual void save_directory(size_t i);
+};
+
+bool test_hash_index();
@@ -0,0 +1,343 @@
+/**
+ * @file hash_join.cpp - implementation of:
+ * HashJoinBatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <functional>
+#include <iostream>
+#include <unistd.h>
+#include "hash_join.h"
+using namespace std;
+
+static uint join_count = 0;  // for naming the partitions
+
+// Join keys are compared as byte strings: a type tag for each column and then its value.
+static void append_key(string &key, ColumnAttribute::DataType data_type, int32_t n, const TextView &text) {
+	key += (char)data_type;
+	if (data_type == ColumnAttribute::DataType::TEXT) {
+		uint16_t len = text.size();
+		key.append((const char*)&len, sizeof(len));
+		key.append(text.data(), len);
+	} else {
+		key.append((const char*)&n, sizeof(n));
+	}
+}
+
+// Key for a row from the build side (false if a join column is NULL).
+static bool row_key(const Row *row, uint key_count, string &key) {
+	key.clear();
+	for (uint col_num = 0; col_num < key_count; col_num++) {
+		if (row->is_null(col_num))
+			return false;
+		const Value &value = (*row)[col_num];
+		append_key(key, value.data_type, value.n, TextView(value.s.data(), (uint16_t)value.s.size()));
+	}
+	return true;
+}
+
+// Key for a row of a batch (false if a join column is NULL).
+bool join_key(const ColumnBatch *batch, uint16_t row, uint key_count, string &key) {
+	key.clear();
+	for (uint col_num = 0; col_num < key_count; col_num++) {
+		const ColumnVector &column = batch->column(col_num);
+		if (column.is_null(row))
+			return false;
+		if (column.get_data_type() == ColumnAttribute::DataType::TEXT)
+			append_key(key, column.get_data_type(), 0, column.get_text(row));
+		else
+			append_key(key, column.get_data_type(), column.get_int(row), TextView());
+	}
+	return true;
+}
+
+// Which partition a key goes to. Uses the high bits of the hash, since the hash table buckets
+// come from the low ones.
+static uint partition_of(const string &key) {
+	return (uint)((hash<string>()(key) >> 20) % HashJoinBatchCursor::PARTITIONS);
+}
+
+// Rough memory footprint of a build row in the hash table.
+static size_t row_bytes(const Row *row, const string &key) {
+	return row->footprint() + key.size() + 64;  // 64 for the hash node
+}
+
+HashJoinBatchCursor::HashJoinBatchCursor(BatchCursor *build, const ColumnNames &build_columns,
+										 const ColumnAttributes &build_attributes, BatchCursor *probe,
+										 const ColumnNames &probe_columns, const ColumnAttributes &probe_attributes,
+										 uint key_count, const JoinOutput &output, const ColumnNames &column_names,
+										 const ColumnAttributes &column_attributes, size_t memory_budget)
+		: BatchCursor(), build(build), build_columns(build_columns), build_attributes(build_attributes), probe(probe),
+		  probe_columns(probe_columns), probe_attributes(probe_attributes), key_count(key_count), output(output),
+		  memory_budget(memory_budget), batch(column_names, column_attributes), build_rows(), hash_table(),
+		  build_bytes(0), built(false), join_number(++join_count), build_partitions(), probe_partitions(), pending(),
+		  next_partition(0), partition_probe(nullptr), probe_input(nullptr), probe_batch(nullptr), probe_pos(0),
+		  probe_row(0), matches(), match_pos(0) {
+}
+
+HashJoinBatchCursor::~HashJoinBatchCursor() {
+	clear_table();
+	for (auto &rows: this->pending)
+		for (auto row: rows)
+			delete row;
+	delete this->partition_probe;
+	delete this->build;
+	delete this->probe;
+	for (auto partition: this->build_partitions) {
+		partition->drop();
+		delete partition;
+	}
+	for (auto partition: this->probe_partitions) {
+		partition->drop();
+		delete partition;
+	}
+}
+
+ColumnBatch* HashJoinBatchCursor::next() {
+	if (!this->built)
+		build_table();
+	this->batch.clear();
+	string key;
+	while (!this->batch.full()) {
+		// more build rows for the current probe row?
+		if (this->match_pos < this->matches.size()) {
+			emit();
+			continue;
+		}
+
+		// next probe row
+		if (this->probe_batch != nullptr && this->probe_pos < this->probe_batch->selection().size()) {
+			this->probe_row = this->probe_batch->selection()[this->probe_pos++];
+			this->matches.clear();
+			this->match_pos = 0;
+			if (join_key(this->probe_batch, this->probe_row, this->key_count, key)) {
+				auto range = this->hash_table.equal_range(key);
+				for (auto it = range.first; it != range.second; it++)
+					this->matches.push_back(it->second);
+			}
+			continue;
+		}
+
+		// next probe batch (or partition)
+		this->probe_batch = this->probe_input == nullptr ? nullptr : this->probe_input->next();
+		this->probe_pos = 0;
+		if (this->probe_batch == nullptr && !load_next_partition())
+			break;
+	}
+	if (this->batch.size() == 0)
+		return nullptr;
+	this->batch.select_all();
+	return &this->batch;
+}
+
+// Read the whole build side. If it fits, probe straight from the probe side; otherwise
+// partition the probe side too and get ready to go through the partitions.
+void HashJoinBatchCursor::build_table() {
+	this->built = true;
+	ColumnBatch *build_batch;
+	while ((build_batch = this->build->next()) != nullptr)
+		for (uint16_t row: build_batch->selection())
+			add_build_row(build_batch->get_row(row, this->build_columns.size()));
+	if (this->build_partitions.empty()) {
+		this->probe_input = this->probe;
+		return;
+	}
+	flush(this->build_partitions);
+
+	ColumnBatch *probe_batch;
+	string key;
+	while ((probe_batch = this->probe->next()) != nullptr)
+		for (uint16_t row: probe_batch->selection())
+			if (join_key(probe_batch, row, this->key_count, key))
+				spill(this->probe_partitions, probe_batch->get_row(row, this->probe_columns.size()), key);
+	flush(this->probe_partitions);
+	this->probe_input = nullptr;  // load_next_partition will pick up the first one
+}
+
+// Put a build row in the hash table (or its partition, once we're spilling). Takes ownership of row.
+void HashJoinBatchCursor::add_build_row(Row *row) {
+	string key;
+	if (!row_key(row, this->key_count, key)) {
+		delete row;
+		return;
+	}
+	if (!this->build_partitions.empty()) {
+		spill(this->build_partitions, row, key);
+		return;
+	}
+	this->hash_table.insert(pair<string, uint>(key, (uint)this->build_rows.size()));
+	this->build_rows.push_back(row);
+	this->build_bytes += row_bytes(row, key);
+	if (this->build_bytes > this->memory_budget)
+		start_spilling();
+}
+
+void HashJoinBatchCursor::clear_table() {
+	this->hash_table.clear();
+	for (auto row: this->build_rows)
+		delete row;
+	this->build_rows.clear();
+	this->build_bytes = 0;
+}
+
+// The build side doesn't fit: make the partitions and move what we have so far into them.
+// (They're named for the process too, so that ones left behind by a crash don't get in the way.)
+void HashJoinBatchCursor::start_spilling() {
+	string prefix = "_join_" + to_string(getpid()) + "_" + to_string(this->join_number) + "_";
+	for (uint p = 0; p < PARTITIONS; p++) {
+		HeapTable *partition = new HeapTable(prefix + "b" + to_string(p), this->build_columns, this->build_attributes);
+		this->build_partitions.push_back(partition);
+		partition->create();
+		partition = new HeapTable(prefix + "p" + to_string(p), this->probe_columns, this->probe_attributes);
+		this->probe_partitions.push_back(partition);
+		partition->create();
+	}
+	this->pending.assign(PARTITIONS, Rows());
+	string key;
+	for (auto row: this->build_rows) {
+		row_key(row, this->key_count, key);
+		spill(this->build_partitions, row, key);
+	}
+	this->build_rows.clear();
+	this->hash_table.clear();
+	this->build_bytes = 0;
+}
+
+// Queue a row for its partition, writing the partition's queue out (in bulk) once it's a batch long.
+// Takes ownership of row.
+void HashJoinBatchCursor::spill(vector<HeapTable*> &partitions, Row *row, const string &key) {
+	uint p = partition_of(key);
+	this->pending[p].push_back(row);
+	if (this->pending[p].size() >= ColumnBatch::CAPACITY) {
+		Handles *handles = partitions[p]->insert(&this->pending[p]);
+		delete handles;
+		for (auto row: this->pending[p])
+			delete row;
+		this->pending[p].clear();
+	}
+}
+
+// Write out everything still queued for the partitions.
+void HashJoinBatchCursor::flush(vector<HeapTable*> &partitions) {
+	for (uint p = 0; p < PARTITIONS; p++) {
+		if (this->pending[p].empty())
+			continue;
+		Handles *handles = partitions[p]->insert(&this->pending[p]);
+		delete handles;
+		for (auto row: this->pending[p])
+			delete row;
+		this->pending[p].clear();
+	}
+}
+
+// Build the hash table from the next build partition and start probing with its probe partition.
+bool HashJoinBatchCursor::load_next_partition() {
+	if (this->next_partition >= this->build_partitions.size())
+		return false;
+	clear_table();
+	delete this->partition_probe;
+	this->partition_probe = nullptr;
+	this->probe_input = nullptr;
+
+	uint p = this->next_partition++;
+	BatchCursor *partition_build = this->build_partitions[p]->batch_cursor(nullptr);
+	ColumnBatch *build_batch;
+	string key;
+	while ((build_batch = partition_build->next()) != nullptr) {
+		for (uint16_t row: build_batch->selection()) {
+			Row *build_row = build_batch->get_row(row, this->build_columns.size());
+			row_key(build_row, this->key_count, key);
+			this->hash_table.insert(pair<string, uint>(key, (uint)this->build_rows.size()));
+			this->build_rows.push_back(build_row);
+		}
+	}
+	delete partition_build;
+	this->partition_probe = this->probe_partitions[p]->batch_cursor(nullptr);
+	this->probe_input = this->partition_probe;
+	return true;
+}
+
+// Add the output row for the current probe row and its next matching build row.
+void HashJoinBatchCursor::emit() {
+	const Row *build_row = this->build_rows[this->matches[this->match_pos++]];
+	this->batch.add_row(this->probe_batch->get_handle(this->probe_row));
+	for (uint col_num = 0; col_num < this->output.size(); col_num++) {
+		ColumnVector &column = this->batch.column(col_num);
+		uint from = this->output[col_num].second;
+		if (!this->output[col_num].first)
+			column.push_from(this->probe_batch->column(from), this->probe_row);
+		else if (build_row->is_null(from))
+			column.push_null();
+		else
+			column.push_value((*build_row)[from]);
+	}
+}
+
+// Join a 3000-row table to a 1000-row one, once in memory and once forced to spill.
+bool test_hash_join() {
+	ColumnNames a_columns, b_columns;
+	a_columns.push_back("k");
+	a_columns.push_back("id");
+	b_columns.push_back("k");
+	b_columns.push_back("s");
+	ColumnAttributes a_attributes(2, ColumnAttribute(ColumnAttribute::INT));
+	ColumnAttributes b_attributes;
+	b_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	b_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	HeapTable a("_test_join_a", a_columns, a_attributes);
+	HeapTable b("_test_join_b", b_columns, b_attributes);
+	a.create();
+	b.create();
+	ValueDicts rows;
+	for (int id = 0; id < 3000; id++) {
+		ValueDict *row = new ValueDict;
+		(*row)["k"] = Value(id % 500);
+		(*row)["id"] = Value(id);
+		rows.push_back(row);
+	}
+	delete a.insert(&rows);
+	for (auto row: rows)
+		delete row;
+	rows.clear();
+	for (int k = 0; k < 1000; k++) {
+		ValueDict *row = new ValueDict;
+		(*row)["k"] = Value(k);
+		(*row)["s"] = Value("s" + to_string(k));
+		rows.push_back(row);
+	}
+	delete b.insert(&rows);
+	for (auto row: rows)
+		delete row;
+
+	ColumnNames column_names;
+	column_names.push_back("id");
+	column_names.push_back("s");
+	ColumnAttributes column_attributes;
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	JoinOutput output;
+	output.push_back(pair<bool, uint>(false, 1));
+	output.push_back(pair<bool, uint>(true, 1));
+	bool ok = true;
+	size_t budgets[] = {HashJoinBatchCursor::DEFAULT_MEMORY_BUDGET, 1024};
+	for (auto budget: budgets) {
+		HashJoinBatchCursor join(b.batch_cursor(nullptr), b_columns, b_attributes, a.batch_cursor(nullptr), a_columns,
+								 a_attributes, 1, output, column_names, column_attributes, budget);
+		size_t n_rows = 0;
+		ColumnBatch *batch;
+		while ((batch = join.next()) != nullptr) {
+			for (uint16_t row: batch->selection()) {
+				n_rows++;
+				if (batch->column(1).get_text(row) != "s" + to_string(batch->column(0).get_int(row) % 500))
+					ok = false;
+			}
+		}
+		if (n_rows != 3000 || (join.get_partition_count() != 0) != (budget == 1024))
+			ok = false;
+	}
+	a.drop();
+	b.drop();
+	if (ok)
+		cout << "hash join ok" << endl;
+	return ok;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file hash_join.h - Equi-joins by hashing, spilling to disk as needed.
+ * HashJoinBatchCursor: BatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "column_batch.h"
+
+/**
+ * For each output column of a join: (does it come from the build side?, its position in that side's batches)
+ */
+typedef std::vector<std::pair<bool, uint>> JoinOutput;
+
+/**
+ * Encode the join columns of a row of a batch as a string, for hashing and comparing.
+ * @param batch      the batch
+ * @param row        position of the row in the batch
+ * @param key_count  how many join columns lead the batch
+ * @param key        returned by reference
+ * @returns          false if a join column is NULL (so the row can't match anything)
+ */
+bool join_key(const ColumnBatch *batch, uint16_t row, uint key_count, std::string &key);
+
+/**
+ * @class HashJoinBatchCursor - inner equi-join of two BatchCursors
+ *
+ * The build side (which should be the smaller one) is read into an in-memory hash table keyed on
+ * its join columns; then each row of the probe side is looked up in it, a batch at a time.
+ * The join columns come first in both sides' batches (key_count of them, in matching order).
+ * Rows with a NULL join column never match.
+ *
+ * If the build side turns out to need more than memory_budget bytes, the join goes Grace-style:
+ * both sides are split by a hash of their join columns into PARTITIONS temporary HeapTables each,
+ * and then each pair of partitions is joined in memory in turn. (A partition that still doesn't fit
+ * is joined in memory anyway.) The temporary tables are dropped when the cursor is deleted.
+ *
+ * The handles in the output batches are those of the probe side's rows.
+ */
+class HashJoinBatchCursor : public BatchCursor {
+public:
+	/**
+	 * Bytes of build rows held in memory (roughly) before the join spills, unless told otherwise.
+	 */
+	static const size_t DEFAULT_MEMORY_BUDGET = 32 * 1024 * 1024;
+
+	/**
+	 * How many ways each side is split when the join spills.
+	 */
+	static const uint PARTITIONS = 16;
+
+	/**
+	 * @param build              the (smaller) side to build the hash table from (owned by this cursor)
+	 * @param build_columns      names of the build side's batch columns
+	 * @param build_attributes   their attributes
+	 * @param probe              the side to look up in the hash table (owned by this cursor)
+	 * @param probe_columns      names of the probe side's batch columns
+	 * @param probe_attributes   their attributes
+	 * @param key_count          how many join columns lead each side's batches
+	 * @param output             where each output column comes from
+	 * @param column_names       names of the output columns
+	 * @param column_attributes  their attributes
+	 * @param memory_budget      how much of the build side to hold in memory before spilling
+	 */
+	HashJoinBatchCursor(BatchCursor *build, const ColumnNames &build_columns, const ColumnAttributes &build_attributes,
+						BatchCursor *probe, const ColumnNames &probe_columns, const ColumnAttributes &probe_attributes,
+						uint key_count, const JoinOutput &output, const ColumnNames &column_names,
+						const ColumnAttributes &column_attributes, size_t memory_budget=DEFAULT_MEMORY_BUDGET);
+	virtual ~HashJoinBatchCursor();
+
+	virtual ColumnBatch* next();
+
+	/**
+	 * @returns  how many partitions the join was split into (0 if the build side fit in memory)
+	 */
+	virtual size_t get_partition_count() const { return build_partitions.size(); }
+
+protected:
+	BatchCursor *build;
+	ColumnNames build_columns;
+	ColumnAttributes build_attributes;
+	BatchCursor *probe;
+	ColumnNames probe_columns;
+	ColumnAttributes probe_attributes;
+	uint key_count;
+	JoinOutput output;
+	size_t memory_budget;
+	ColumnBatch batch;
+
+	// the hash table
+	Rows build_rows;
+	std::unordered_multimap<std::string, uint> hash_table;  // key -> position in build_rows
+	size_t build_bytes;
+	bool built;
+
+	// spilling
+	uint join_number;
+	std::vector<HeapTable*> build_partitions;
+	std::vector<HeapTable*> probe_partitions;
+	std::vector<Rows> pending;  // rows on their way to each partition
+	uint next_partition;
+	BatchCursor *partition_probe;
+
+	// probing
+	BatchCursor *probe_input;  // probe or partition_probe
+	ColumnBatch *probe_batch;
+	size_t probe_pos;  // position in probe_batch's selection
+	uint16_t probe_row;
+	std::vector<uint> matches;
+	size_t match_pos;
+
+	virtual void build_table();
+	virtual void add_build_row(Row *row);
+	virtual void clear_table();
+	virtual void start_spilling();
+	virtual void spill(std::vector<HeapTable*> &partitions, Row *row, const std::string &key);
+	virtual void flush(std::vector<HeapTable*> &partitions);
+	virtual bool load_next_partition();
+	virtual void emit();
+};
+
+bool test_hash_join();
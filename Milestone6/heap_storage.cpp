@@ -2,7 +2,11 @@
  * @file heap_storage.cpp - implementation of:
  * SlottedPage
  * HeapFile
+ * HeapFileCursor
+ * FreeSpaceMap
+ * RecordView
  * HeapTable
+ * HeapTableCursor
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
@@ -10,27 +14,54 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <algorithm>
 #include "heap_storage.h"
+#include "column_batch.h"
 using namespace std;
 
 typedef uint16_t u16;
 
-SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new) {
+// The block header's end_free offset never needs more than 12 bits (DbBlock::BLOCK_SZ is 4096),
+// so the high 4 bits hold the block's record format.
+static const u16 FORMAT_SHIFT = 12;
+static const u16 END_FREE_MASK = (1U << FORMAT_SHIFT) - 1;
+
+SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new, BufferFrame *frame)
+		: DbBlock(block, block_id, is_new), format(RecordView::CURRENT_FORMAT), frame(frame) {
 	if (is_new) {
 		this->num_records = 0;
 		this->end_free = DbBlock::BLOCK_SZ - 1;
 		put_header();
 	} else {
 		get_header(this->num_records, this->end_free);
+		this->format = (uint8_t)(this->end_free >> FORMAT_SHIFT);
+		this->end_free &= END_FREE_MASK;
 	}
 }
 
+// Let go of our buffer pool frame, if we have one.
+SlottedPage::~SlottedPage() {
+	if (this->frame != nullptr)
+		BufferPool::pool().unpin(this->frame);
+}
+
 // Add a new record to the block. Return its id.
+// If there isn't room for another header, the id of a deleted record is handed out again.
 RecordID SlottedPage::add(const Dbt* data) throw(DbBlockNoRoomError) {
-	if (!has_room((u16)data->get_size()))
-		throw DbBlockNoRoomError("not enough room for new record");
-	u16 id = ++this->num_records;
 	u16 size = (u16) data->get_size();
+	u16 id = 0;
+	if (has_room(size)) {
+		id = ++this->num_records;
+	} else if (size <= this->unused_bytes()) {
+		u16 old_size, old_loc;
+		for (RecordID record_id = 1; record_id <= this->num_records && id == 0; record_id++) {
+			get_header(old_size, old_loc, record_id);
+			if (old_loc == 0)
+				id = record_id;
+		}
+	}
+	if (id == 0)
+		throw DbBlockNoRoomError("not enough room for new record");
 	this->end_free -= size;
 	u16 loc = this->end_free + 1U;
 	put_header();
@@ -48,6 +79,16 @@ Dbt* SlottedPage::get(RecordID record_id) const {
     return new Dbt(this->address(loc), size);
 }
 
+// Get a view of a record right where it sits in the block (no allocation or copying).
+// The view is null if the record has been deleted.
+RecordView SlottedPage::view(RecordID record_id) const {
+	u16 size, loc;
+	get_header(size, loc, record_id);
+	if (loc == 0)
+		return RecordView();
+	return RecordView((const char*)this->address(loc), size, this->format);
+}
+
 // Replace the record with the given data. Raises DbBlockNoRoomError if it won't fit.
 void SlottedPage::put(RecordID record_id, const Dbt &data) throw(DbBlockNoRoomError) {
 	u16 size, loc;
@@ -92,6 +133,7 @@ RecordIDs* SlottedPage::ids(void) const {
 void SlottedPage::clear() {
     this->num_records = 0;
     this->end_free = DbBlock::BLOCK_SZ - 1;
+    this->format = RecordView::CURRENT_FORMAT;
     put_header();
 }
 
@@ -117,7 +159,7 @@ void SlottedPage::get_header(u16 &size, u16 &loc, RecordID id) const {
 void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
 	if (id == 0) {
 		size = this->num_records;
-		loc = this->end_free;
+		loc = this->end_free | (u16)(this->format << FORMAT_SHIFT);
 	}
 	put_n((u16)4*id, size);
 	put_n((u16)(4*id + 2), loc);
@@ -195,8 +237,15 @@ void* SlottedPage::address(u16 offset) const {
  * *******************
  */
 
-HeapFile::HeapFile(string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {
+HeapFile::HeapFile(string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0), file_id(0) {
 	this->dbfilename = this->name + ".db";
+	this->file_id = BufferPool::pool().file_id(this->dbfilename);
+}
+
+// Make sure nothing we dirtied is left behind in the buffer pool.
+HeapFile::~HeapFile() {
+	if (!this->closed)
+		close();
 }
 
 // Create physical file.
@@ -209,6 +258,7 @@ void HeapFile::create(void) {
 // Delete the physical file.
 void HeapFile::drop(void) {
 	close();
+	BufferPool::pool().discard(this);
 	Db db(_DB_ENV, 0);
 	db.remove(this->dbfilename.c_str(), nullptr, 0);
 }
@@ -218,43 +268,62 @@ void HeapFile::open(void) {
     db_open();
 }
 
-// Close the physical file.
+// Close the physical file (after writing back anything we have pending in the buffer pool).
 void HeapFile::close(void) {
+	if (!this->closed)
+		BufferPool::pool().flush(this);
 	this->db.close(0);
 	this->closed = true;
 }
 
+// Write back what we have pending in the buffer pool without closing.
+void HeapFile::flush(void) {
+	if (this->closed)
+		return;
+	BufferPool::pool().flush(this);
+	this->db.sync(0);
+}
+
 // Allocate a new block for the database file.
 // Returns the new empty DbBlock that is managing the records in this block and its block id.
 SlottedPage* HeapFile::get_new(void) {
-	char block[DbBlock::BLOCK_SZ];
-	memset(block, 0, sizeof(block));
-	Dbt data(block, sizeof(block));
+	BlockID block_id = ++this->last;
+
+	// initialize the block right in a fresh frame and write it out so Berkeley DB knows it exists
+	BufferFrame *frame = BufferPool::pool().pin(this, block_id, false);
+	Dbt data(frame->data, DbBlock::BLOCK_SZ);
+	SlottedPage* page = new SlottedPage(data, block_id, true, frame);
+	write_block(block_id, frame->data);
+	return page;
+}
 
-	int block_id = ++this->last;
-	Dbt key(&block_id, sizeof(block_id));
+// Get a block from the database file (pinned in the buffer pool until the page is deleted).
+SlottedPage* HeapFile::get(BlockID block_id) {
+	BufferFrame *frame = BufferPool::pool().pin(this, block_id);
+	Dbt data(frame->data, DbBlock::BLOCK_SZ);
+	return new SlottedPage(data, block_id, false, frame);
+}
 
-	// write out an empty block and read it back in so Berkeley DB is managing the memory
-	SlottedPage* page = new SlottedPage(data, this->last, true);
-	this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
-	delete page;
-	this->db.get(nullptr, &key, &data, 0);
-	return new SlottedPage(data, this->last);
+// Write a block back to the database file. The actual write is deferred by the buffer pool.
+void HeapFile::put(DbBlock* block) {
+	BufferPool::pool().put(this, block->get_block_id(), block->get_data());
 }
 
-// Get a block from the database file.
-SlottedPage* HeapFile::get(BlockID block_id) {
+// Read a block from Berkeley DB straight into the given buffer.
+void HeapFile::read_block(BlockID block_id, void *buffer) {
 	Dbt key(&block_id, sizeof(block_id));
 	Dbt data;
+	data.set_data(buffer);
+	data.set_ulen(DbBlock::BLOCK_SZ);
+	data.set_flags(DB_DBT_USERMEM);
 	this->db.get(nullptr, &key, &data, 0);
-	return new SlottedPage(data, block_id, false);
 }
 
-// Write a block back to the database file.
-void HeapFile::put(DbBlock* block) {
-	int block_id = block->get_block_id();
+// Write a block from the given buffer to Berkeley DB.
+void HeapFile::write_block(BlockID block_id, const void *buffer) {
 	Dbt key(&block_id, sizeof(block_id));
-	this->db.put(nullptr, &key, block->get_block(), 0);
+	Dbt data((void*)buffer, DbBlock::BLOCK_SZ);
+	this->db.put(nullptr, &key, &data, 0);
 }
 
 // Sequence of all block ids.
@@ -265,6 +334,11 @@ BlockIDs* HeapFile::block_ids() const {
 	return vec;
 }
 
+// Cursor over all block ids.
+DbFileCursor* HeapFile::cursor() const {
+	return new HeapFileCursor(this->last);
+}
+
 uint32_t HeapFile::get_block_count() {
 	DB_BTREE_STAT* stat;
 	this->db.stat(nullptr, &stat, DB_FAST_STAT);
@@ -283,6 +357,151 @@ void HeapFile::db_open(uint flags) {
 }
 
 
+/*
+ * *******************
+ * HeapFileCursor class
+ * *******************
+ */
+
+bool HeapFileCursor::next(BlockID &block_id) {
+	if (this->block_id >= this->last)
+		return false;
+	block_id = ++this->block_id;
+	return true;
+}
+
+
+/*
+ * *******************
+ * FreeSpaceMap class
+ * *******************
+ */
+
+FreeSpaceMap::FreeSpaceMap(string name) : file(name + ".fsm"), closed(true), hint(1) {
+}
+
+// Create the map's file and fill it in for the given heap file.
+void FreeSpaceMap::create(HeapFile &heap) {
+	this->file.create();
+	this->closed = false;
+	this->hint = 1;
+	rebuild(heap);
+}
+
+// Remove the map's file (if there is one -- older tables may never have been opened with a map).
+void FreeSpaceMap::drop() {
+	try {
+		this->file.drop();
+	} catch (DbException& e) {
+		// no map to drop
+	}
+	this->closed = true;
+}
+
+// Open the map, building it if the heap file doesn't have one yet.
+void FreeSpaceMap::open(HeapFile &heap) {
+	if (!this->closed)
+		return;
+	try {
+		this->file.open();
+		this->closed = false;
+	} catch (DbException& e) {
+		create(heap);
+	}
+}
+
+void FreeSpaceMap::close() {
+	this->file.close();
+	this->closed = true;
+}
+
+// Get the map block with the given id, adding blocks (with all their entries zero) as needed.
+SlottedPage* FreeSpaceMap::get_page(BlockID block_id) {
+	while (this->file.get_last_block_id() < block_id) {
+		SlottedPage* page = this->file.get_new();
+		char zeros[ENTRIES_PER_PAGE];
+		memset(zeros, 0, ENTRIES_PER_PAGE);
+		Dbt entries(zeros, ENTRIES_PER_PAGE);
+		page->add(&entries);
+		this->file.put(page);
+		delete page;
+	}
+	SlottedPage* page = this->file.get(block_id);
+	if (page->size() == 0) {  // the first block comes from HeapFile::create without its record
+		char zeros[ENTRIES_PER_PAGE];
+		memset(zeros, 0, ENTRIES_PER_PAGE);
+		Dbt entries(zeros, ENTRIES_PER_PAGE);
+		page->add(&entries);
+		this->file.put(page);
+	}
+	return page;
+}
+
+void FreeSpaceMap::update(BlockID block_id, u16 free_bytes) {
+	uint bucket = min(free_bytes / BUCKET_BYTES, (uint)UINT8_MAX);
+	SlottedPage* page = get_page((block_id - 1) / ENTRIES_PER_PAGE + 1);
+	RecordView entries = page->view(1);
+	uint i = (block_id - 1) % ENTRIES_PER_PAGE;
+	if ((uint8_t)entries.data()[i] != bucket) {
+		char bytes[ENTRIES_PER_PAGE];
+		memcpy(bytes, entries.data(), ENTRIES_PER_PAGE);
+		bytes[i] = (char)bucket;
+		page->put(1, Dbt(bytes, ENTRIES_PER_PAGE));
+		this->file.put(page);
+		if (bucket > 0 && block_id < this->hint)
+			this->hint = block_id;  // look at newly freed space first
+	}
+	delete page;
+}
+
+// Look from the hint to the end, then wrap around to the beginning.
+BlockID FreeSpaceMap::find(u16 needed) {
+	uint bucket = (needed + BUCKET_BYTES - 1) / BUCKET_BYTES;
+	if (bucket > UINT8_MAX)
+		return 0;
+	BlockID last_page = this->file.get_last_block_id();
+	for (uint pass = 0; pass < 2; pass++) {
+		BlockID start = pass == 0 ? this->hint : 1;
+		BlockID stop = pass == 0 ? UINT32_MAX : this->hint;
+		for (BlockID page_id = (start - 1) / ENTRIES_PER_PAGE + 1; page_id <= last_page; page_id++) {
+			SlottedPage* page = get_page(page_id);
+			const uint8_t *entries = (const uint8_t*)page->view(1).data();
+			BlockID first = (page_id - 1) * ENTRIES_PER_PAGE + 1;
+			for (uint i = start > first ? start - first : 0; i < ENTRIES_PER_PAGE && first + i < stop; i++) {
+				if (entries[i] >= bucket) {
+					delete page;
+					this->hint = first + i;
+					return this->hint;
+				}
+			}
+			delete page;
+			if (first + ENTRIES_PER_PAGE >= stop)
+				break;
+		}
+	}
+	return 0;
+}
+
+void FreeSpaceMap::rebuild(HeapFile &heap) {
+	BlockID last = heap.get_last_block_id();
+	for (BlockID page_id = 1; (page_id - 1) * ENTRIES_PER_PAGE < last || page_id == 1; page_id++) {
+		char bytes[ENTRIES_PER_PAGE];
+		memset(bytes, 0, ENTRIES_PER_PAGE);
+		BlockID first = (page_id - 1) * ENTRIES_PER_PAGE + 1;
+		for (uint i = 0; i < ENTRIES_PER_PAGE && first + i <= last; i++) {
+			SlottedPage* block = heap.get(first + i);
+			bytes[i] = (char)min(block->unused_bytes() / BUCKET_BYTES, (uint)UINT8_MAX);
+			delete block;
+		}
+		SlottedPage* page = get_page(page_id);
+		page->put(1, Dbt(bytes, ENTRIES_PER_PAGE));
+		this->file.put(page);
+		delete page;
+	}
+	this->hint = 1;
+}
+
+
 /*
  * *******************
  * HeapTable class
@@ -290,13 +509,14 @@ void HeapFile::db_open(uint flags) {
  */
 
 HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes ) :
-		DbRelation(table_name, column_names, column_attributes), file(table_name) {
+		DbRelation(table_name, column_names, column_attributes), file(table_name), free_space(table_name) {
 }
 
 // Execute: CREATE TABLE <table_name> ( <columns> )
 // Is not responsible for metadata storage or validation.
 void HeapTable::create() {
 	file.create();
+	free_space.create(file);
 }
 
 // Execute: CREATE TABLE IF NOT EXISTS <table_name> ( <columns> )
@@ -312,16 +532,24 @@ void HeapTable::create_if_not_exists() {
 // Execute: DROP TABLE <table_name>
 void HeapTable::drop() {
 	file.drop();
+	free_space.drop();
 }
 
 // Open existing table. Enables: insert, update, delete, select, project
 void HeapTable::open() {
 	file.open();
+	free_space.open(file);
 }
 
 // Closes the table. Disables: insert, update, delete, select, project
 void HeapTable::close() {
 	file.close();
+	free_space.close();
+}
+
+// Write back the table's changed blocks (e.g., at the end of a statement).
+void HeapTable::flush() {
+	file.flush();
 }
 
 // Expect row to be a dictionary with column name keys.
@@ -329,12 +557,43 @@ void HeapTable::close() {
 // Return the handle of the inserted row.
 Handle HeapTable::insert(const ValueDict* row) {
     open();
-    ValueDict* full_row = validate(row);
+    Row* full_row = validate(row);
     Handle handle = append(full_row);
     delete full_row;
     return handle;
 }
 
+// Bulk version of insert(row). All the rows are validated before any are added, and each block
+// they go into is written just once.
+// Returns the handles of the inserted rows, in order.
+Handles* HeapTable::insert(const ValueDicts* rows) {
+    open();
+    Rows full_rows;
+    Handles* handles = nullptr;
+    try {
+        for (auto const& row: *rows)
+            full_rows.push_back(validate(row));
+        handles = append(&full_rows);
+    } catch (...) {
+        for (auto full_row: full_rows)
+            delete full_row;
+        throw;
+    }
+    for (auto full_row: full_rows)
+        delete full_row;
+    return handles;
+}
+
+// Bulk insert of rows that are already by column position (e.g., from a ColumnBatch of this
+// table's columns), so there is nothing to look up by name. Types are not checked.
+Handles* HeapTable::insert(const Rows* rows) {
+    open();
+    for (auto const& row: *rows)
+        if (row->size() != this->column_names.size())
+            throw DbRelationError("row doesn't have the table's columns");
+    return append(rows);
+}
+
 // Expect new_values to be a dictionary with column name keys.
 // Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
 // where handle is sufficient to identify one specific record (e.g., returned from an insert
@@ -353,6 +612,7 @@ void HeapTable::del(const Handle handle) {
 	SlottedPage* block = this->file.get(block_id);
 	block->del(record_id);
 	this->file.put(block);
+	this->free_space.update(block_id, block->unused_bytes());
 	delete block;
 }
 
@@ -365,24 +625,60 @@ Handles* HeapTable::select() {
 // Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
 // Returns a list of handles for qualifying rows.
 Handles* HeapTable::select(const ValueDict* where) {
-	open();
 	Handles* handles = new Handles();
-	BlockIDs* block_ids = file.block_ids();
-    for (auto const& block_id: *block_ids) {
-    	SlottedPage* block = file.get(block_id);
-    	RecordIDs* record_ids = block->ids();
-    	for (auto const& record_id: *record_ids) {
-			Handle handle(block_id, record_id);
-			if (selected(handle, where))
-    			handles->push_back(handle);
-		}
-    	delete record_ids;
-    	delete block;
-    }
-    delete block_ids;
+	DbRelationCursor* rows = cursor(where);
+	Handle handle;
+	while (rows->next(handle))
+		handles->push_back(handle);
+	delete rows;
 	return handles;
 }
 
+// Streaming version of select(where).
+DbRelationCursor* HeapTable::cursor(const ValueDict* where) {
+	return cursor(where, nullptr);
+}
+
+// Streaming select(where), checking the predicates in where_order
+DbRelationCursor* HeapTable::cursor(const ValueDict* where, const ColumnNames* where_order) {
+	open();
+	return new HeapTableCursor(*this, where, where_order);
+}
+
+// Streaming select(where) in column batches, decoded straight from the blocks
+BatchCursor* HeapTable::batch_cursor(const ColumnNames* column_names, const ValueDict* where,
+									 const ColumnNames* where_order) {
+	open();
+	return new HeapTableBatchCursor(*this, column_names, where, where_order);
+}
+
+// The rows an index points at in column batches, decoded straight from their blocks
+BatchCursor* HeapTable::batch_cursor(DbIndexCursor* handles, const ColumnNames* column_names, const ValueDict* where) {
+	open();
+	return new HeapTableBatchCursor(*this, handles, column_names, where);
+}
+
+// Number of blocks in the heap file
+uint32_t HeapTable::get_block_count() {
+	open();
+	return this->file.get_last_block_id();
+}
+
+// Count the records in each block's slot directory, without looking at the records themselves
+uint32_t HeapTable::count() {
+	open();
+	uint32_t n = 0;
+	DbFileCursor* blocks = this->file.cursor();
+	BlockID block_id;
+	while (blocks->next(block_id)) {
+		SlottedPage* block = this->file.get(block_id);
+		n += block->size();
+		delete block;
+	}
+	delete blocks;
+	return n;
+}
+
 // Refine another selection
 Handles* HeapTable::select(Handles *current_selection, const ValueDict* where) {
     Handles* handles = new Handles();
@@ -402,89 +698,193 @@ ValueDict* HeapTable::project(Handle handle, const ColumnNames* column_names) {
 	BlockID block_id = handle.first;
 	RecordID record_id = handle.second;
     SlottedPage* block = file.get(block_id);
-    Dbt* data = block->get(record_id);
-    ValueDict* row = unmarshal(data);
-    delete data;
+    ValueDict* row = unmarshal(block->view(record_id), column_names);
     delete block;
-    if (column_names->empty())
-    	return row;
-    ValueDict* result = new ValueDict();
-    for (auto const& column_name: *column_names) {
-		if (row->find(column_name) == row->end())
-			throw DbRelationError("table does not have column named '" + column_name + "'");
-    	(*result)[column_name] = (*row)[column_name];
-	}
-	delete row;
-    return result;
+    return row;
+}
+
+// Just the columns at col_nums, decoded from the record by position
+Row* HeapTable::project_row(Handle handle, const ColumnNumbers* col_nums) {
+    SlottedPage* block = file.get(handle.first);
+    Row* row = unmarshal_row(block->view(handle.second), col_nums);
+    delete block;
+    return row;
 }
 
 // Check if the given row is acceptable to insert. Raise ValueError if not.
-// Otherwise return the full row dictionary.
-ValueDict* HeapTable::validate(const ValueDict* row) const {
-    ValueDict* full_row = new ValueDict();
-    for (auto const& column_name: this->column_names) {
-    	Value value;
-    	ValueDict::const_iterator column = row->find(column_name);
-    	if (column == row->end())
+// Otherwise return the full row, laid out by column position (this is where the names are
+// looked up; everything from here on down goes by position).
+Row* HeapTable::validate(const ValueDict* row) const {
+    Row* full_row = new Row(this->column_names.size());
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+    	ValueDict::const_iterator column = row->find(this->column_names[col_num]);
+    	if (column == row->end()) {
+    		delete full_row;
     		throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
-    	else
-    		value = column->second;
-    	(*full_row)[column_name] = value;
+    	}
+    	full_row->set(col_num, column->second);
     }
     return full_row;
 }
 
 // Assumes row is fully fleshed-out. Appends a record to the file.
-Handle HeapTable::append(const ValueDict* row) {
-    Dbt* data = marshal(row);
-    SlottedPage* block = this->file.get(this->file.get_last_block_id());
-    RecordID record_id;
+Handle HeapTable::append(const Row* row) {
+    Rows rows(1, const_cast<Row*>(row));
+    Handles* handles = append(&rows);
+    Handle handle = (*handles)[0];
+    delete handles;
+    return handle;
+}
+
+// Assumes rows are fully fleshed-out. Appends their records to the file.
+// The free-space map picks the blocks (so space freed by deletes gets reused); if no block
+// has room, a new one is added. Each block is filled in its buffer pool frame as far as the
+// rows will go and then written (once) before moving on to the next.
+Handles* HeapTable::append(const Rows* rows) {
+    Handles* handles = new Handles();
+    SlottedPage* block = nullptr;
+    Dbt* data = nullptr;
+    try {
+        for (auto const& row: *rows) {
+            data = marshal(row);
+            uint8_t data_format = RecordView::CURRENT_FORMAT;
+            u16 needed = (u16)(data->get_size() + 4);  // record plus its slot header
+            RecordID record_id = block == nullptr ? 0 : add_record(block, row, data, data_format);
+            if (record_id == 0) {
+                if (block != nullptr)
+                    put_block(block);
+                block = nullptr;
+                BlockID block_id = this->free_space.find(needed);
+                if (block_id != 0) {
+                    block = this->file.get(block_id);
+                    record_id = add_record(block, row, data, data_format);
+                    if (record_id == 0) {
+                        put_block(block);  // map was off (or a legacy record is bigger), so fix it
+                        block = nullptr;
+                    }
+                }
+                if (block == nullptr) {
+                    // need a new block
+                    block = this->file.get_new();
+                    record_id = add_record(block, row, data, data_format);
+                    if (record_id == 0)
+                        throw DbRelationError("row too big to fit in a block");
+                }
+            }
+            handles->push_back(Handle(block->get_block_id(), record_id));
+            delete[] (char*)data->get_data();
+            delete data;
+            data = nullptr;
+        }
+    } catch (...) {
+        if (block != nullptr)
+            put_block(block);  // keep what made it in
+        if (data != nullptr) {
+            delete[] (char*)data->get_data();
+            delete data;
+        }
+        delete handles;
+        throw;
+    }
+    if (block != nullptr)
+        put_block(block);
+    return handles;
+}
+
+// Add the row's record to the block, re-marshaling data first if the block uses another format.
+// Returns the new record's id or 0 if it doesn't fit.
+RecordID HeapTable::add_record(SlottedPage* block, const Row* row, Dbt*& data, uint8_t& data_format) {
+    if (block->get_format() != data_format) {
+        delete[] (char*)data->get_data();
+        delete data;
+        data = nullptr;
+        data = marshal(row, block->get_format());
+        data_format = block->get_format();
+    }
     try {
-        record_id = block->add(data);
+        return block->add(data);
     } catch (DbBlockNoRoomError& e) {
-    	// need a new block
-    	block = this->file.get_new();
-    	record_id = block->add(data);
+        return 0;
     }
+}
+
+// Done adding to this block: write it, note its free space, and unpin it.
+void HeapTable::put_block(SlottedPage* block) {
     this->file.put(block);
-	delete block;
-    delete[] (char*)data->get_data();
-    delete data;
-    return Handle(this->file.get_last_block_id(), record_id);
+    this->free_space.update(block->get_block_id(), block->unused_bytes());
+    delete block;
+}
+
+// return the bits to go into the file (in RecordView::CURRENT_FORMAT)
+// caller responsible for freeing the returned Dbt and its enclosed ret->get_data().
+Dbt* HeapTable::marshal(const Row* row) const {
+	return marshal(row, RecordView::CURRENT_FORMAT);
 }
 
-// return the bits to go into the file
+// return the bits to go into the file in the given RecordView format
 // caller responsible for freeing the returned Dbt and its enclosed ret->get_data().
-Dbt* HeapTable::marshal(const ValueDict* row) const {
+// NULL columns (only possible in OFFSET_FORMAT) get their bit set and take no bytes.
+Dbt* HeapTable::marshal(const Row* row, uint8_t format) const {
 	char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
     uint offset = 0;
     uint col_num = 0;
-    for (auto const& column_name: this->column_names) {
-    	ColumnAttribute ca = this->column_attributes[col_num++];
-    	ValueDict::const_iterator column = row->find(column_name);
-		Value value = column->second;
+    u16 *offsets = nullptr;
+    if (format == RecordView::OFFSET_FORMAT) {
+    	u16 bitmap_size = RecordView::null_bitmap_size(this->column_names.size());
+    	offset = bitmap_size + sizeof(u16) * this->column_names.size();
+    	if (offset > DbBlock::BLOCK_SZ - 4) {
+    		delete[] bytes;
+    		throw DbRelationError("row too big to marshal");
+    	}
+    	memset(bytes, 0, bitmap_size);
+    	offsets = (u16*)(bytes + bitmap_size);
+    }
+    for (; col_num < this->column_names.size(); col_num++) {
+    	if (offsets != nullptr)
+    		offsets[col_num] = (u16)offset;
+    	ColumnAttribute ca = this->column_attributes[col_num];
+    	if (row->is_null(col_num)) {
+    		if (offsets == nullptr) {
+    			delete[] bytes;
+    			throw DbRelationError("can't marshal a NULL in the legacy record format");
+    		}
+    		bytes[col_num / 8] |= (char)(1 << (col_num % 8));
+    		continue;
+    	}
+		const Value &value = (*row)[col_num];
 
 		if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-			if (offset + 4 > DbBlock::BLOCK_SZ - 4)
+			if (offset + 4 > DbBlock::BLOCK_SZ - 4) {
+				delete[] bytes;
 				throw DbRelationError("row too big to marshal");
+			}
 			*(int32_t*) (bytes + offset) = value.n;
 			offset += sizeof(int32_t);
 		} else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
 			u_long size = value.s.length();
-			if (size > UINT16_MAX)
+			if (size > UINT16_MAX) {
+				delete[] bytes;
 				throw DbRelationError("text field too long to marshal");
-			if (offset + 2 + size > DbBlock::BLOCK_SZ)
+			}
+			if (offset + 2 + size > DbBlock::BLOCK_SZ) {
+				delete[] bytes;
 				throw DbRelationError("row too big to marshal");
-			*(u16*) (bytes + offset) = size;
-			offset += sizeof(u16);
+			}
+			if (format == RecordView::LEGACY_FORMAT) {
+				*(u16*) (bytes + offset) = size;
+				offset += sizeof(u16);
+			}
 			memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
 			offset += size;
         } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
+            if (offset + 1 > DbBlock::BLOCK_SZ - 1) {
+				delete[] bytes;
                 throw DbRelationError("row too big to marshal");
+            }
             *(uint8_t*) (bytes + offset) = (uint8_t)value.n;
             offset += sizeof(uint8_t);
 		} else {
+			delete[] bytes;
 			throw DbRelationError("Only know how to marshal INT, TEXT, and BOOLEAN");
 		}
 	}
@@ -495,34 +895,28 @@ Dbt* HeapTable::marshal(const ValueDict* row) const {
 	return data;
 }
 
-ValueDict* HeapTable::unmarshal(Dbt* data) const {
-    ValueDict *row = new ValueDict();
-    Value value;
-    char *bytes = (char*)data->get_data();
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const& column_name: this->column_names) {
-    	ColumnAttribute ca = this->column_attributes[col_num++];
-		value.data_type = ca.get_data_type(); value.s = "";
-    	if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-    		value.n = *(int32_t*)(bytes + offset);
-    		offset += sizeof(int32_t);
-    	} else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-    		u16 size = *(u16*)(bytes + offset);
-    		offset += sizeof(u16);
-    		char buffer[DbBlock::BLOCK_SZ];
-    		memcpy(buffer, bytes+offset, size);
-    		buffer[size] = '\0';
-    		value.s = string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t*)(bytes + offset);
-            offset += sizeof(uint8_t);
-    	} else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
-    	}
-		(*row)[column_name] = value;
-    }
+// ValueDict version of unmarshal_row, keyed by column_names.
+// An empty (or null) column_names means all of them. NULL columns are left out of the row.
+ValueDict* HeapTable::unmarshal(const RecordView &record, const ColumnNames* column_names) const {
+    if (column_names != nullptr && column_names->empty())
+        column_names = nullptr;
+    ColumnNumbers *col_nums = column_numbers(column_names);
+    Row *row = unmarshal_row(record, col_nums);
+    delete col_nums;
+    ValueDict *ret = row->to_dict(column_names == nullptr ? this->column_names : *column_names);
+    delete row;
+    return ret;
+}
+
+// Only the requested columns (by position in the table) are turned into Values; the others
+// aren't even looked at. Position i of the returned row is column (*col_nums)[i].
+Row* HeapTable::unmarshal_row(const RecordView &record, const ColumnNumbers* col_nums) const {
+    RecordView view(record);
+    view.set_column_attributes(&this->column_attributes);
+    Row *row = new Row(col_nums->size());
+    for (uint i = 0; i < col_nums->size(); i++)
+        if (!view.is_null_column((*col_nums)[i]))
+            row->set(i, view.get_value((*col_nums)[i]));
     return row;
 }
 
@@ -530,8 +924,196 @@ ValueDict* HeapTable::unmarshal(Dbt* data) const {
 bool HeapTable::selected(Handle handle, const ValueDict* where) {
 	if (where == nullptr)
 		return true;
-	ValueDict* row = this->project(handle, where);
-	return *row == *where;
+	SlottedPage* block = file.get(handle.first);
+	bool ret = selected(block->view(handle.second), where);
+	delete block;
+	return ret;
+}
+
+// See if the record satisfies the given where clause.
+// The predicates are tried in where_order if given (which must name every column in where).
+// Cursors resolve the where clause once and use the RowPredicates version instead.
+bool HeapTable::selected(const RecordView &record, const ValueDict* where, const ColumnNames* where_order) const {
+	if (where == nullptr)
+		return !record.is_null();
+	RowPredicates* predicates = resolve_where(where, where_order);
+	bool ret = selected(record, predicates);
+	delete predicates;
+	return ret;
+}
+
+// See if the record satisfies the (resolved) where clause.
+// Each predicate goes straight to its column in the record bytes, stopping at the first
+// one that doesn't match, so no ValueDict (or std::string) is built for the row.
+bool HeapTable::selected(const RecordView &record, const RowPredicates* predicates) const {
+	if (record.is_null())
+		return false;  // deleted record
+	if (predicates == nullptr || predicates->empty())
+		return true;
+	RecordView view(record);
+	view.set_column_attributes(&this->column_attributes);
+	for (auto const& predicate: *predicates)
+		if (!selected_column(view, predicate.first, predicate.second))
+			return false;
+	return true;
+}
+
+bool HeapTable::selected(const RecordView &record, const ValueDict* where) const {
+	return selected(record, where, nullptr);
+}
+
+// Does the column of the record (with column attributes set) equal value?
+bool HeapTable::selected_column(const RecordView &view, uint col_num, const Value &value) const {
+	ColumnAttribute ca = this->column_attributes[col_num];
+	if (value.data_type != ca.get_data_type() || view.is_null_column(col_num))
+		return false;
+	if (ca.get_data_type() == ColumnAttribute::DataType::INT)
+		return value.n == view.get_int(col_num);
+	if (ca.get_data_type() == ColumnAttribute::DataType::TEXT)
+		return view.get_text(col_num) == value.s;
+	if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN)
+		return (value.n != 0) == view.get_boolean(col_num);
+	return true;
+}
+
+
+/*
+ * *******************
+ * RecordView class
+ * *******************
+ */
+
+// Is the given column NULL? (Never, for LEGACY_FORMAT.)
+bool RecordView::is_null_column(uint col_num) const {
+	if (this->format == LEGACY_FORMAT)
+		return false;
+	return (*(const uint8_t*)(this->ptr + col_num / 8) >> (col_num % 8)) & 1;
+}
+
+// Offset of the given column from the start of the record.
+u16 RecordView::offset_of(uint col_num) const {
+	if (this->format == OFFSET_FORMAT) {
+		u16 header = null_bitmap_size(this->column_attributes->size());
+		return *(const u16*)(this->ptr + header + col_num * sizeof(u16));
+	}
+
+	// LEGACY_FORMAT: we have to walk past all the ones before it
+	if (col_num < this->walk_col) {
+		this->walk_col = 0;
+		this->walk_offset = 0;
+	}
+	while (this->walk_col < col_num) {
+		ColumnAttribute ca = (*this->column_attributes)[this->walk_col++];
+		switch (ca.get_data_type()) {
+			case ColumnAttribute::DataType::INT:
+				this->walk_offset += sizeof(int32_t);
+				break;
+			case ColumnAttribute::DataType::TEXT:
+				this->walk_offset += sizeof(u16) + *(const u16*)(this->ptr + this->walk_offset);
+				break;
+			case ColumnAttribute::DataType::BOOLEAN:
+				this->walk_offset += sizeof(uint8_t);
+				break;
+			default:
+				throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+		}
+	}
+	return this->walk_offset;
+}
+
+// TEXT column (in place).
+TextView RecordView::get_text(uint col_num) const {
+	u16 offset = offset_of(col_num);
+	if (this->format == LEGACY_FORMAT)
+		return text_at(offset);
+	u16 end = col_num + 1 < this->column_attributes->size() ? offset_of(col_num + 1) : this->len;
+	return TextView(this->ptr + offset, end - offset);
+}
+
+// Materialize a column as a Value.
+Value RecordView::get_value(uint col_num) const {
+	Value value;
+	ColumnAttribute ca = (*this->column_attributes)[col_num];
+	value.data_type = ca.get_data_type();
+	switch (value.data_type) {
+		case ColumnAttribute::DataType::INT:
+			value.n = get_int(col_num);
+			break;
+		case ColumnAttribute::DataType::TEXT:
+			value.s = get_text(col_num).str();  // assume ascii for now
+			break;
+		case ColumnAttribute::DataType::BOOLEAN:
+			value.n = get_boolean(col_num);
+			break;
+		default:
+			throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+	}
+	return value;
+}
+
+
+/*
+ * *******************
+ * HeapTableCursor class
+ * *******************
+ */
+
+HeapTableCursor::HeapTableCursor(HeapTable &table, const ValueDict* where, const ColumnNames* where_order)
+		: DbRelationCursor(table), table(table), predicates(table.resolve_where(where, where_order)),
+		  block_cursor(table.file.cursor()), block(nullptr), record_ids(nullptr), i(0), record() {
+}
+
+HeapTableCursor::~HeapTableCursor() {
+	delete this->block_cursor;
+	delete this->predicates;
+	delete this->record_ids;
+	delete this->block;
+}
+
+// Next qualifying handle. Each block is read once and each of its records is checked in place
+// through a RecordView (nothing is copied out of the block).
+// The block stays pinned in the buffer pool while we are on it.
+bool HeapTableCursor::next(Handle &handle) {
+	while (true) {
+		while (this->record_ids != nullptr && this->i < this->record_ids->size()) {
+			RecordID record_id = (*this->record_ids)[this->i++];
+			this->record = this->block->view(record_id);
+			if (this->table.selected(this->record, this->predicates)) {
+				handle = this->current = Handle(this->block->get_block_id(), record_id);
+				return true;
+			}
+		}
+		delete this->record_ids;
+		this->record_ids = nullptr;
+		this->record = RecordView();
+		delete this->block;
+		this->block = nullptr;
+
+		BlockID block_id;
+		if (!this->block_cursor->next(block_id))
+			return false;
+		this->block = this->table.file.get(block_id);
+		this->record_ids = this->block->ids();
+		this->i = 0;
+	}
+}
+
+// Project all the columns from the record we are on.
+ValueDict* HeapTableCursor::project() {
+	return project(nullptr);
+}
+
+// Project the given columns from the record we are on (without going back to the file).
+ValueDict* HeapTableCursor::project(const ColumnNames* column_names) {
+	if (this->record.is_null())
+		throw DbRelationError("cursor is not on a row");
+	return this->table.unmarshal(this->record, column_names);
+}
+
+Row* HeapTableCursor::project_row(const ColumnNumbers* col_nums) {
+	if (this->record.is_null())
+		throw DbRelationError("cursor is not on a row");
+	return this->table.unmarshal_row(this->record, col_nums);
 }
 
 void test_set_row(ValueDict &row, int a, string b) {
@@ -621,7 +1203,97 @@ bool test_heap_storage() {
         if (!test_compare(table, handle, i++, b))
             return false;
     cout << "del ok" << endl;
- 
+
+    // room freed by deletes gets used again instead of growing the file
+    Handle first_handle = (*handles)[0];
+    table.del((*handles)[1]);
+    table.del((*handles)[2]);
+    test_set_row(row, 1001, b);
+    if (table.insert(&row).first != first_handle.first)
+        return false;
+    cout << "free space reuse ok" << endl;
+
+    ValueDicts rows;
+    for (int j = 0; j < 500; j++) {
+        rows.push_back(new ValueDict());
+        test_set_row(*rows.back(), 2000 + j, b);
+    }
+    Handles* bulk_handles = table.insert(&rows);
+    for (auto row: rows)
+        delete row;
+    if (bulk_handles->size() != 500)
+        return false;
+    for (int j = 0; j < 500; j++)
+        if (!test_compare(table, (*bulk_handles)[j], 2000 + j, b))
+            return false;
+    delete bulk_handles;
+    cout << "bulk insert ok" << endl;
+
+    // the same rows a column batch at a time: 1001 - 3 + 1 + 500 of them, so more than one batch
+    BatchCursor* batches = table.batch_cursor(nullptr);
+    size_t n_rows = 0;
+    ColumnBatch* batch;
+    while ((batch = batches->next()) != nullptr)
+        n_rows += batch->selection().size();
+    delete batches;
+    if (n_rows != 1499)
+        return false;
+    ValueDict where;
+    where["a"] = Value(2010);
+    ColumnNames batch_columns;
+    batch_columns.push_back("b");
+    batches = table.batch_cursor(&batch_columns, &where);
+    batch = batches->next();
+    if (batch == nullptr || batch->selection().size() != 1 || batch->column(0).get_text(batch->selection()[0]) != b)
+        return false;
+    delete batches;
+    cout << "batch cursor ok" << endl;
+
+    // a block from before there was a record format: clear its format bits, and the rows added to it
+    // are marshaled the legacy way (the block after it gets the current format)
+    HeapTable legacy("_test_legacy_cpp", column_names, column_attributes);
+    legacy.create();
+    HeapFile legacy_file("_test_legacy_cpp");
+    legacy_file.open();
+    SlottedPage* legacy_block = legacy_file.get(1);
+    *(u16*)((char*)legacy_block->get_data() + 2) = DbBlock::BLOCK_SZ - 1;  // end_free, format 0
+    legacy_file.put(legacy_block);
+    delete legacy_block;
+    for (int j = 0; j < 100; j++) {
+        test_set_row(row, j, b);
+        legacy.insert(&row);
+    }
+    legacy_block = legacy_file.get(1);
+    bool is_legacy = legacy_block->get_format() == RecordView::LEGACY_FORMAT && legacy_block->size() > 0 &&
+                     legacy_block->size() < 100;
+    delete legacy_block;
+    legacy_file.close();
+    if (!is_legacy)
+        return false;
+    DbRelationCursor* legacy_rows = legacy.cursor();
+    Handle legacy_handle;
+    int j = 0;
+    while (legacy_rows->next(legacy_handle)) {
+        ValueDict* legacy_row = legacy_rows->project(&batch_columns);
+        bool same = (*legacy_row)["b"].s == b;
+        delete legacy_row;
+        if (!same || !test_compare(legacy, legacy_handle, j++, b)) {
+            delete legacy_rows;
+            return false;
+        }
+    }
+    delete legacy_rows;
+    if (j != 100)
+        return false;
+    where["a"] = Value(3);
+    batches = legacy.batch_cursor(&batch_columns, &where);
+    batch = batches->next();
+    if (batch == nullptr || batch->selection().size() != 1 || batch->column(0).get_text(batch->selection()[0]) != b)
+        return false;
+    delete batches;
+    legacy.drop();
+    cout << "legacy format ok" << endl;
+
     table.drop();
 	delete handles;
     return true;
@@ -1,8 +1,13 @@
 /**
  * @file heap_storage.h - Implementation of storage_engine with a heap file structure.
+ * TextView
+ * RecordView
  * SlottedPage: DbBlock
  * HeapFile: DbFile
+ * HeapFileCursor: DbFileCursor
+ * FreeSpaceMap
  * HeapTable: DbRelation
+ * HeapTableCursor: DbRelationCursor
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
@@ -11,6 +16,83 @@
 
 #include "db_cxx.h"
 #include "storage_engine.h"
+#include "buffer_pool.h"
+
+/**
+ * @class TextView - read-only view of a TEXT field where it sits in a block (a la std::string_view).
+ * Only valid while the block it points into is pinned.
+ */
+class TextView {
+public:
+	TextView() : ptr(nullptr), len(0) {}
+	TextView(const char *ptr, uint16_t len) : ptr(ptr), len(len) {}
+
+	const char *data() const { return ptr; }
+	uint16_t size() const { return len; }
+	int compare(const std::string &other) const { return -other.compare(0, std::string::npos, ptr, len); }
+	bool operator==(const std::string &other) const { return compare(other) == 0; }
+	bool operator!=(const std::string &other) const { return compare(other) != 0; }
+	std::string str() const { return std::string(ptr, len); }
+
+protected:
+	const char *ptr;
+	uint16_t len;
+};
+
+/**
+ * @class RecordView - read-only view of one marshaled HeapTable record where it sits in a block.
+ * Only valid while the block it points into is pinned. A deleted record has a null view.
+ *
+ * Records come in two formats, tagged per block (see SlottedPage::get_format):
+ *   LEGACY_FORMAT: the columns back-to-back, TEXT with an inline u16 length prefix.
+ *   OFFSET_FORMAT: a null bitmap (one bit per column, set for NULL), then a u16 offset for each
+ *                  column (from the start of the record), then the columns. TEXT has no length
+ *                  prefix; it runs to the next column's offset (or the end of the record).
+ *                  A NULL column takes no bytes.
+ * With OFFSET_FORMAT any column can be found in O(1).
+ *
+ * Column accessors take the column's position in the relation (and need the column attributes);
+ * the *_at accessors read length-prefixed fields at a byte offset (e.g., B-tree keys).
+ */
+class RecordView {
+public:
+	static const uint8_t LEGACY_FORMAT = 0;
+	static const uint8_t OFFSET_FORMAT = 1;
+	static const uint8_t CURRENT_FORMAT = OFFSET_FORMAT;
+
+	RecordView() : ptr(nullptr), len(0), format(CURRENT_FORMAT), column_attributes(nullptr), walk_col(0), walk_offset(0) {}
+	RecordView(const char *ptr, uint16_t len, uint8_t format=CURRENT_FORMAT, const ColumnAttributes *column_attributes=nullptr)
+			: ptr(ptr), len(len), format(format), column_attributes(column_attributes), walk_col(0), walk_offset(0) {}
+
+	bool is_null() const { return ptr == nullptr; }
+	const char *data() const { return ptr; }
+	uint16_t size() const { return len; }
+	uint8_t get_format() const { return format; }
+	void set_column_attributes(const ColumnAttributes *column_attributes) { this->column_attributes = column_attributes; }
+
+	// length-prefixed field accessors by byte offset
+	int32_t int_at(uint16_t offset) const { return *(const int32_t*)(ptr + offset); }
+	bool boolean_at(uint16_t offset) const { return *(const uint8_t*)(ptr + offset) != 0; }
+	TextView text_at(uint16_t offset) const { return TextView(ptr + offset + sizeof(uint16_t), *(const uint16_t*)(ptr + offset)); }
+
+	// field accessors by column number
+	bool is_null_column(uint col_num) const;
+	uint16_t offset_of(uint col_num) const;
+	int32_t get_int(uint col_num) const { return int_at(offset_of(col_num)); }
+	bool get_boolean(uint col_num) const { return boolean_at(offset_of(col_num)); }
+	TextView get_text(uint col_num) const;
+	Value get_value(uint col_num) const;
+
+	static uint16_t null_bitmap_size(size_t n_columns) { return (uint16_t)((n_columns + 7) / 8); }
+
+protected:
+	const char *ptr;
+	uint16_t len;
+	uint8_t format;
+	const ColumnAttributes *column_attributes;
+	mutable uint walk_col;          // LEGACY_FORMAT: where offset_of last stopped, so a left-to-right
+	mutable uint16_t walk_offset;   // pass over the columns is not quadratic
+};
 
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
@@ -18,10 +100,12 @@
  *      Manage a database block that contains several records.
         Modeled after slotted-page from Database Systems Concepts, 6ed, Figure 10-9.
 
-        Record id are handed out sequentially starting with 1 as records are added with add().
+        Record id are handed out sequentially starting with 1 as records are added with add(), except
+        that the id of a deleted record is reused when there is no room left for another header.
         Each record has a header which is a fixed offset from the beginning of the block:
             Bytes 0x00 - Ox01: number of records
-            Bytes 0x02 - 0x03: offset to end of free space
+            Bytes 0x02 - 0x03: offset to end of free space (low 12 bits) and record format (high 4 bits,
+                               zero for blocks written before there was a format, see RecordView)
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
@@ -29,10 +113,10 @@
  */
 class SlottedPage : public DbBlock {
 public:
-	SlottedPage(Dbt &block, BlockID block_id, bool is_new=false);
+	SlottedPage(Dbt &block, BlockID block_id, bool is_new=false, BufferFrame *frame=nullptr);
 	// Big 5 - we only need the destructor, copy-ctor, move-ctor, and op= are unnecessary
 	// but we delete them explicitly just to make sure we don't use them accidentally
-	virtual ~SlottedPage() {}
+	virtual ~SlottedPage();
 	SlottedPage(const SlottedPage& other) = delete;
 	SlottedPage(SlottedPage&& temp) = delete;
 	SlottedPage& operator=(const SlottedPage& other) = delete;
@@ -40,16 +124,21 @@ public:
 
 	virtual RecordID add(const Dbt* data) throw(DbBlockNoRoomError);
 	virtual Dbt* get(RecordID record_id) const;
+	virtual RecordView view(RecordID record_id) const;
 	virtual void put(RecordID record_id, const Dbt &data) throw(DbBlockNoRoomError);
 	virtual void del(RecordID record_id);
 	virtual RecordIDs* ids(void) const;
 	virtual void clear();
 	virtual u_int16_t size() const;
 	virtual u_int16_t unused_bytes() const;
+	virtual uint8_t get_format() const { return format; }
+	virtual RecordID last_record_id() const { return num_records; }  // highest id handed out (deleted or not)
 
 protected:
 	uint16_t num_records;
 	uint16_t end_free;
+	uint8_t format;      // RecordView format of the records in this block
+	BufferFrame *frame;  // buffer pool frame we are pinning (if any)
 
 	virtual void get_header(uint16_t &size, uint16_t &loc, RecordID id=0) const;
 	virtual void put_header(RecordID id=0, uint16_t size=0, uint16_t loc=0);
@@ -65,13 +154,15 @@ protected:
  *
  * Heap file organization. Built on top of Berkeley DB RecNo file. There is one of our
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
-        for buffer management and file management.
+        for file management. Blocks are cached in the engine's BufferPool: get() pins a frame (released
+        when the SlottedPage is deleted) and put() marks it dirty, deferring the write to Berkeley DB
+        until the frame is evicted, the file is closed, or the pool is checkpointed.
         Uses SlottedPage for storing records within blocks.
  */
 class HeapFile : public DbFile {
 public:
 	HeapFile(std::string name);
-	virtual ~HeapFile() {}
+	virtual ~HeapFile();
 	HeapFile(const HeapFile& other) = delete;
 	HeapFile(HeapFile&& temp) = delete;
 	HeapFile& operator=(const HeapFile& other) = delete;
@@ -85,6 +176,12 @@ public:
 	virtual SlottedPage* get(BlockID block_id);
 	virtual void put(DbBlock* block);
 	virtual BlockIDs* block_ids() const;
+	virtual DbFileCursor* cursor() const;
+
+	/**
+	 * Write back the file's dirty frames and have Berkeley DB sync the file, leaving it open.
+	 */
+	virtual void flush(void);
 
 	/**
 	 * Get the id of the current final block in the heap file.
@@ -92,13 +189,95 @@ public:
 	 */
 	virtual uint32_t get_last_block_id() {return last;}
 
+	/**
+	 * Get the id the buffer pool knows this file by.
+	 * @returns  buffer pool file id
+	 */
+	virtual uint32_t get_file_id() const {return file_id;}
+
 protected:
 	std::string dbfilename;
 	uint32_t last;
 	bool closed;
 	Db db;
+	uint32_t file_id;
 	virtual void db_open(uint flags=0);
 	virtual uint32_t get_block_count();
+
+	// raw block transfer to and from Berkeley DB, used by the buffer pool
+	virtual void read_block(BlockID block_id, void *buffer);
+	virtual void write_block(BlockID block_id, const void *buffer);
+	friend class BufferPool;
+};
+
+/**
+ * @class HeapFileCursor - heap file implementation of DbFileCursor
+ *
+ * Block ids in a heap file are just 1..last, so we only have to remember where we are.
+ * The last block is fixed when the cursor is created, so blocks appended during the
+ * scan are not visited.
+ */
+class HeapFileCursor : public DbFileCursor {
+public:
+	HeapFileCursor(BlockID last) : block_id(0), last(last) {}
+	virtual ~HeapFileCursor() {}
+
+	virtual bool next(BlockID &block_id);
+
+protected:
+	BlockID block_id;
+	BlockID last;
+};
+
+/**
+ * @class FreeSpaceMap - persistent record of roughly how much room each block of a heap file has
+ *
+ * Kept in its own heap file (named for the heap file plus ".fsm"). Each of its blocks holds a
+ * single record of ENTRIES_PER_PAGE bytes, one per heap block, with the block's unused bytes in
+ * units of BUCKET_BYTES (rounded down, so a bucket never promises more room than there is).
+ * Tables made before there was a map get one built from their blocks the first time they are opened.
+ */
+class FreeSpaceMap {
+public:
+	static const uint BUCKET_BYTES = 16;
+	static const uint ENTRIES_PER_PAGE = 4000;
+
+	FreeSpaceMap(std::string name);
+	virtual ~FreeSpaceMap() {}
+	FreeSpaceMap(const FreeSpaceMap& other) = delete;
+	FreeSpaceMap& operator=(const FreeSpaceMap& other) = delete;
+
+	virtual void create(HeapFile &heap);
+	virtual void drop();
+	virtual void open(HeapFile &heap);
+	virtual void close();
+
+	/**
+	 * Note how much room a heap block has now.
+	 * @param block_id    which heap block
+	 * @param free_bytes  its SlottedPage::unused_bytes()
+	 */
+	virtual void update(BlockID block_id, uint16_t free_bytes);
+
+	/**
+	 * Find a heap block with at least the given number of unused bytes.
+	 * @param needed  bytes required (record plus its slot header)
+	 * @returns       the block id, or 0 if no block has room
+	 */
+	virtual BlockID find(uint16_t needed);
+
+	/**
+	 * Recompute the whole map from the heap's blocks.
+	 * @param heap  the (open) heap file this is the map for
+	 */
+	virtual void rebuild(HeapFile &heap);
+
+protected:
+	HeapFile file;
+	bool closed;
+	BlockID hint;  // where the next find starts looking
+
+	virtual SlottedPage* get_page(BlockID block_id);
 };
 
 /**
@@ -120,25 +299,80 @@ public:
 
 	virtual void open();
 	virtual void close();
+	virtual void flush();
 
 	virtual Handle insert(const ValueDict* row);
+	virtual Handles* insert(const ValueDicts* rows);
+	virtual Handles* insert(const Rows* rows);
 	virtual void update(const Handle handle, const ValueDict* new_values);
 	virtual void del(const Handle handle);
 
 	virtual Handles* select();
 	virtual Handles* select(const ValueDict* where);
 	virtual Handles* select(Handles *current_selection, const ValueDict* where);
+	virtual DbRelationCursor* cursor(const ValueDict* where=nullptr);
+	virtual DbRelationCursor* cursor(const ValueDict* where, const ColumnNames* where_order);
+	using DbRelation::cursor;
+	virtual BatchCursor* batch_cursor(const ColumnNames* column_names, const ValueDict* where=nullptr,
+									  const ColumnNames* where_order=nullptr);
+	virtual BatchCursor* batch_cursor(DbIndexCursor* handles, const ColumnNames* column_names, const ValueDict* where);
 	virtual ValueDict* project(Handle handle);
 	virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
 	using DbRelation::project;
+	virtual Row* project_row(Handle handle, const ColumnNumbers* col_nums);
+	virtual uint32_t get_block_count();
+	virtual uint32_t count();
 
 protected:
 	HeapFile file;
-	virtual ValueDict* validate(const ValueDict* row) const;
-	virtual Handle append(const ValueDict* row);
-	virtual Dbt* marshal(const ValueDict* row) const;
-	virtual ValueDict* unmarshal(Dbt* data) const;
+	FreeSpaceMap free_space;
+	virtual Row* validate(const ValueDict* row) const;
+	virtual Handle append(const Row* row);
+	virtual Handles* append(const Rows* rows);
+	virtual RecordID add_record(SlottedPage* block, const Row* row, Dbt*& data, uint8_t& data_format);
+	virtual void put_block(SlottedPage* block);
+	virtual Dbt* marshal(const Row* row) const;
+	virtual Dbt* marshal(const Row* row, uint8_t format) const;
+	virtual ValueDict* unmarshal(const RecordView &record, const ColumnNames* column_names) const;
+	virtual Row* unmarshal_row(const RecordView &record, const ColumnNumbers* col_nums) const;
 	virtual bool selected(Handle handle, const ValueDict* where);
+	virtual bool selected(const RecordView &record, const ValueDict* where) const;
+	virtual bool selected(const RecordView &record, const ValueDict* where, const ColumnNames* where_order) const;
+	virtual bool selected(const RecordView &record, const RowPredicates* predicates) const;
+	virtual bool selected_column(const RecordView &view, uint col_num, const Value &value) const;
+
+	friend class HeapTableCursor;
+	friend class HeapTableBatchCursor;
+};
+
+/**
+ * @class HeapTableCursor - heap table implementation of DbRelationCursor
+ *
+ * Walks the blocks of the heap file one at a time, only ever holding the current block.
+ * Each block is fetched once; the where clause is evaluated against the record bytes
+ * and projections are decoded from the same record, so a qualifying row costs one
+ * block read (shared with its neighbors) and one partial unmarshal.
+ */
+class HeapTableCursor : public DbRelationCursor {
+public:
+	HeapTableCursor(HeapTable &table, const ValueDict* where, const ColumnNames* where_order=nullptr);
+	virtual ~HeapTableCursor();
+	HeapTableCursor(const HeapTableCursor& other) = delete;
+	HeapTableCursor& operator=(const HeapTableCursor& other) = delete;
+
+	virtual bool next(Handle &handle);
+	virtual ValueDict* project();
+	virtual ValueDict* project(const ColumnNames* column_names);
+	virtual Row* project_row(const ColumnNumbers* col_nums);
+
+protected:
+	HeapTable &table;
+	RowPredicates* predicates;  // the where clause, resolved to column positions and in checking order
+	DbFileCursor* block_cursor;
+	SlottedPage* block;
+	RecordIDs* record_ids;
+	size_t i;
+	RecordView record;  // current record (in the pinned block)
 };
 
 bool test_heap_storage();
@@ -0,0 +1,115 @@
+/**
+ * @file index_join.cpp - implementation of:
+ * IndexJoinBatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include "index_join.h"
+using namespace std;
+
+static const Rows no_matches;
+
+IndexJoinBatchCursor::IndexJoinBatchCursor(BatchCursor *outer, uint key_count, DbRelation &inner, DbIndex *index,
+										   const ColumnNames &inner_columns, const ValueDict *inner_where,
+										   const JoinOutput &output, const ColumnNames &column_names,
+										   const ColumnAttributes &column_attributes)
+		: BatchCursor(), outer(outer), key_count(key_count), inner(inner), index(index), inner_columns(inner_columns),
+		  inner_where(), output(output), batch(column_names, column_attributes),
+		  lookup_count(0), found(), outer_batch(nullptr), outer_pos(0), outer_row(0), matches(&no_matches),
+		  match_pos(0) {
+	if (inner_where != nullptr)
+		this->inner_where = *inner_where;
+	this->index->open();
+}
+
+IndexJoinBatchCursor::~IndexJoinBatchCursor() {
+	clear_found();
+	delete this->outer;
+}
+
+ColumnBatch* IndexJoinBatchCursor::next() {
+	this->batch.clear();
+	while (!this->batch.full()) {
+		// more inner rows for the current outer row?
+		if (this->match_pos < this->matches->size()) {
+			emit();
+			continue;
+		}
+
+		// next outer row
+		if (this->outer_batch != nullptr && this->outer_pos < this->outer_batch->selection().size()) {
+			this->outer_row = this->outer_batch->selection()[this->outer_pos++];
+			string key;
+			this->matches = &no_matches;
+			this->match_pos = 0;
+			if (join_key(this->outer_batch, this->outer_row, this->key_count, key))
+				this->matches = &this->found[key];
+			continue;
+		}
+
+		// next outer batch
+		this->outer_batch = this->outer->next();
+		this->outer_pos = 0;
+		if (this->outer_batch == nullptr)
+			break;
+		lookup_all();
+	}
+	if (this->batch.size() == 0)
+		return nullptr;
+	this->batch.select_all();
+	return &this->batch;
+}
+
+// Look up each distinct key of the outer batch.
+void IndexJoinBatchCursor::lookup_all() {
+	clear_found();
+	string key;
+	for (uint16_t row: this->outer_batch->selection())
+		if (join_key(this->outer_batch, row, this->key_count, key) && this->found.count(key) == 0)
+			this->found[key] = lookup(row);
+}
+
+// The inner rows matching one outer row (freed by caller, via clear_found), checked against inner_where
+// and copied out of their records a batch at a time.
+Rows IndexJoinBatchCursor::lookup(uint16_t row) {
+	ValueDict key;
+	const ColumnNames &key_columns = this->index->get_key_columns();
+	for (uint col_num = 0; col_num < this->key_count; col_num++)
+		key[key_columns[col_num]] = this->outer_batch->column(col_num).get_value(row);
+	BatchCursor *inner_rows = this->inner.batch_cursor(this->index->lookup_cursor(&key), &this->inner_columns,
+													   &this->inner_where);
+	this->lookup_count++;
+
+	Rows ret;
+	ColumnBatch *inner_batch;
+	while ((inner_batch = inner_rows->next()) != nullptr)
+		for (uint16_t inner_row: inner_batch->selection())
+			ret.push_back(inner_batch->get_row(inner_row, this->inner_columns.size()));
+	delete inner_rows;
+	return ret;
+}
+
+void IndexJoinBatchCursor::clear_found() {
+	for (auto &entry: this->found)
+		for (auto row: entry.second)
+			delete row;
+	this->found.clear();
+	this->matches = &no_matches;
+	this->match_pos = 0;
+}
+
+// Add the output row for the current outer row and its next matching inner row.
+void IndexJoinBatchCursor::emit() {
+	const Row *inner_row = (*this->matches)[this->match_pos++];
+	this->batch.add_row(this->outer_batch->get_handle(this->outer_row));
+	for (uint col_num = 0; col_num < this->output.size(); col_num++) {
+		ColumnVector &column = this->batch.column(col_num);
+		uint from = this->output[col_num].second;
+		if (!this->output[col_num].first)
+			column.push_from(this->outer_batch->column(from), this->outer_row);
+		else if (inner_row->is_null(from))
+			column.push_null();
+		else
+			column.push_value((*inner_row)[from]);
+	}
+}
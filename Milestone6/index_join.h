@@ -0,0 +1,72 @@
+/**
+ * @file index_join.h - Equi-joins by looking each row up in an index on the other table.
+ * IndexJoinBatchCursor: BatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include "hash_join.h"
+
+/**
+ * @class IndexJoinBatchCursor - inner equi-join of a BatchCursor (the outer side) with a table that
+ * has an index on its join columns (the inner side)
+ *
+ * The join columns come first in the outer side's batches (key_count of them, in the order of the
+ * index's key columns). For each outer batch, every distinct key is looked up in the index once
+ * and the inner rows it finds are kept for the rest of that batch, so a foreign key that shows up
+ * many times in a batch costs one probe. The work goes with the number of outer rows, however big
+ * the inner table is.
+ *
+ * The handles in the output batches are those of the outer side's rows.
+ */
+class IndexJoinBatchCursor : public BatchCursor {
+public:
+	/**
+	 * @param outer              the side to go through (owned by this cursor)
+	 * @param key_count          how many join columns lead the outer side's batches
+	 * @param inner              the indexed table
+	 * @param index              index on inner's join columns
+	 * @param inner_columns      columns of inner wanted in the output
+	 * @param inner_where        predicates the inner rows must also satisfy (nullptr for none)
+	 * @param output             where each output column comes from (true for inner_columns)
+	 * @param column_names       names of the output columns
+	 * @param column_attributes  their attributes
+	 */
+	IndexJoinBatchCursor(BatchCursor *outer, uint key_count, DbRelation &inner, DbIndex *index,
+						 const ColumnNames &inner_columns, const ValueDict *inner_where, const JoinOutput &output,
+						 const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+	virtual ~IndexJoinBatchCursor();
+
+	virtual ColumnBatch* next();
+
+	/**
+	 * @returns  how many index lookups the join has done so far
+	 */
+	virtual size_t get_lookup_count() const { return lookup_count; }
+
+protected:
+	BatchCursor *outer;
+	uint key_count;
+	DbRelation &inner;
+	DbIndex *index;
+	ColumnNames inner_columns;
+	ValueDict inner_where;
+	JoinOutput output;
+	ColumnBatch batch;
+	size_t lookup_count;
+
+	std::unordered_map<std::string, Rows> found;  // key -> matching inner rows, for the current outer batch
+	ColumnBatch *outer_batch;
+	size_t outer_pos;  // position in outer_batch's selection
+	uint16_t outer_row;
+	const Rows *matches;
+	size_t match_pos;
+
+	virtual void lookup_all();
+	virtual Rows lookup(uint16_t row);
+	virtual void clear_found();
+	virtual void emit();
+};
@@ -0,0 +1,252 @@
+/**
+ * @file merge_join.cpp - implementation of:
+ * MergeJoinBatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include "merge_join.h"
+#include "sort_batch.h"
+using namespace std;
+
+// Order of a value of a batch column against a Value (the same order ExternalSort uses).
+static int compare(const ColumnVector &column, uint16_t row, const Value &value) {
+	if (column.get_data_type() != value.data_type) {
+		Value x = column.get_value(row);
+		return x < value ? -1 : (value < x ? 1 : 0);
+	}
+	if (value.data_type == ColumnAttribute::DataType::TEXT) {
+		int order = column.get_text(row).compare(value.s);
+		return order < 0 ? -1 : (order > 0 ? 1 : 0);
+	}
+	int32_t n = column.get_int(row);
+	return n < value.n ? -1 : (value.n < n ? 1 : 0);
+}
+
+// Order of one batch row's join columns against another's.
+static int compare(const ColumnBatch *a, uint16_t a_row, const ColumnBatch *b, uint16_t b_row, uint key_count) {
+	for (uint col_num = 0; col_num < key_count; col_num++) {
+		const ColumnVector &x = a->column(col_num), &y = b->column(col_num);
+		int order;
+		if (x.get_data_type() != ColumnAttribute::DataType::TEXT && x.get_data_type() == y.get_data_type())
+			order = x.get_int(a_row) < y.get_int(b_row) ? -1 : (y.get_int(b_row) < x.get_int(a_row) ? 1 : 0);
+		else
+			order = compare(x, a_row, y.get_value(b_row));
+		if (order != 0)
+			return order;
+	}
+	return 0;
+}
+
+// Does a batch row have the same join columns as a row of the current group?
+static bool same_key(const ColumnBatch *batch, uint16_t row, const Row *key_row, uint key_count) {
+	for (uint col_num = 0; col_num < key_count; col_num++)
+		if (compare(batch->column(col_num), row, (*key_row)[col_num]) != 0)
+			return false;
+	return true;
+}
+
+static bool null_key(const ColumnBatch *batch, uint16_t row, uint key_count) {
+	for (uint col_num = 0; col_num < key_count; col_num++)
+		if (batch->column(col_num).is_null(row))
+			return true;
+	return false;
+}
+
+MergeJoinBatchCursor::MergeJoinBatchCursor(BatchCursor *left, BatchCursor *right, size_t right_column_count,
+										   uint key_count, const JoinOutput &output, const ColumnNames &column_names,
+										   const ColumnAttributes &column_attributes)
+		: BatchCursor(), left(left), right(right), right_column_count(right_column_count), key_count(key_count),
+		  output(output), batch(column_names, column_attributes), left_batch(nullptr), left_pos(0), left_done(false),
+		  right_batch(nullptr), right_pos(0), right_done(false), group(), group_pos(0) {
+}
+
+MergeJoinBatchCursor::~MergeJoinBatchCursor() {
+	clear_group();
+	delete this->left;
+	delete this->right;
+}
+
+ColumnBatch* MergeJoinBatchCursor::next() {
+	this->batch.clear();
+	uint16_t l, r;
+	while (!this->batch.full()) {
+		// more of the group for the current left row?
+		if (this->group_pos < this->group.size() && left_row(l)) {
+			emit(l);
+			continue;
+		}
+
+		// done with the current left row: the next one may have the same key
+		if (!this->group.empty()) {
+			this->left_pos++;
+			if (left_row(l) && same_key(this->left_batch, l, this->group[0], this->key_count))
+				this->group_pos = 0;
+			else
+				clear_group();
+			continue;
+		}
+
+		// move whichever side is behind, until the keys match
+		if (!left_row(l) || !right_row(r))
+			break;
+		if (null_key(this->left_batch, l, this->key_count)) {
+			this->left_pos++;
+			continue;
+		}
+		if (null_key(this->right_batch, r, this->key_count)) {
+			this->right_pos++;
+			continue;
+		}
+		int order = compare(this->left_batch, l, this->right_batch, r, this->key_count);
+		if (order < 0)
+			this->left_pos++;
+		else if (order > 0)
+			this->right_pos++;
+		else
+			fill_group(r);
+	}
+	if (this->batch.size() == 0)
+		return nullptr;
+	this->batch.select_all();
+	return &this->batch;
+}
+
+// The current left row (false at the end of the left side).
+bool MergeJoinBatchCursor::left_row(uint16_t &row) {
+	while (!this->left_done) {
+		if (this->left_batch != nullptr && this->left_pos < this->left_batch->selection().size()) {
+			row = this->left_batch->selection()[this->left_pos];
+			return true;
+		}
+		this->left_batch = this->left->next();
+		this->left_pos = 0;
+		this->left_done = this->left_batch == nullptr;
+	}
+	return false;
+}
+
+// The current right row (false at the end of the right side).
+bool MergeJoinBatchCursor::right_row(uint16_t &row) {
+	while (!this->right_done) {
+		if (this->right_batch != nullptr && this->right_pos < this->right_batch->selection().size()) {
+			row = this->right_batch->selection()[this->right_pos];
+			return true;
+		}
+		this->right_batch = this->right->next();
+		this->right_pos = 0;
+		this->right_done = this->right_batch == nullptr;
+	}
+	return false;
+}
+
+void MergeJoinBatchCursor::clear_group() {
+	for (auto row: this->group)
+		delete row;
+	this->group.clear();
+	this->group_pos = 0;
+}
+
+// Take the right rows with the key of the current right row, r (which matches the current left row's).
+void MergeJoinBatchCursor::fill_group(uint16_t r) {
+	this->group.push_back(this->right_batch->get_row(r, this->right_column_count));
+	this->right_pos++;
+	while (right_row(r) && same_key(this->right_batch, r, this->group[0], this->key_count)) {
+		this->group.push_back(this->right_batch->get_row(r, this->right_column_count));
+		this->right_pos++;
+	}
+	this->group_pos = 0;
+}
+
+// Add the output row for the current left row, l, and its next row of the group.
+void MergeJoinBatchCursor::emit(uint16_t l) {
+	const Row *group_row = this->group[this->group_pos++];
+	this->batch.add_row(this->left_batch->get_handle(l));
+	for (uint col_num = 0; col_num < this->output.size(); col_num++) {
+		ColumnVector &column = this->batch.column(col_num);
+		uint from = this->output[col_num].second;
+		if (!this->output[col_num].first)
+			column.push_from(this->left_batch->column(from), l);
+		else if (group_row->is_null(from))
+			column.push_null();
+		else
+			column.push_value((*group_row)[from]);
+	}
+}
+
+// Join two unsorted tables by sorting both sides with SortBatchCursors (with a budget small enough that
+// their ExternalSorts spill runs and merge them) and merge joining the results. Every key has two
+// rows on the right, so each left row pairs up with a group and the group is reused by the next
+// left row with the same key.
+bool test_merge_join() {
+	ColumnNames a_columns, b_columns;
+	a_columns.push_back("k");
+	a_columns.push_back("id");
+	b_columns.push_back("k");
+	b_columns.push_back("s");
+	ColumnAttributes a_attributes(2, ColumnAttribute(ColumnAttribute::INT));
+	ColumnAttributes b_attributes;
+	b_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	b_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	HeapTable a("_test_merge_a", a_columns, a_attributes);
+	HeapTable b("_test_merge_b", b_columns, b_attributes);
+	a.create();
+	b.create();
+	ValueDicts rows;
+	for (int id = 0; id < 3000; id++) {
+		ValueDict *row = new ValueDict;
+		(*row)["k"] = Value(id * 7 % 500);
+		(*row)["id"] = Value(id);
+		rows.push_back(row);
+	}
+	delete a.insert(&rows);
+	for (auto row: rows)
+		delete row;
+	rows.clear();
+	for (int k = 1399; k >= 0; k--) {
+		ValueDict *row = new ValueDict;
+		(*row)["k"] = Value(k % 700);
+		(*row)["s"] = Value("s" + to_string(k % 700));
+		rows.push_back(row);
+	}
+	delete b.insert(&rows);
+	for (auto row: rows)
+		delete row;
+
+	ColumnNames column_names;
+	column_names.push_back("k");
+	column_names.push_back("id");
+	column_names.push_back("s");
+	ColumnAttributes column_attributes(2, ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	JoinOutput output;
+	output.push_back(pair<bool, uint>(false, 0));
+	output.push_back(pair<bool, uint>(false, 1));
+	output.push_back(pair<bool, uint>(true, 1));
+	SortOrder key_order(1, pair<uint, bool>(0, false));
+	SortBatchCursor *left = new SortBatchCursor(a.batch_cursor(nullptr), a_columns, a_attributes, key_order, false,
+												4096);
+	SortBatchCursor *right = new SortBatchCursor(b.batch_cursor(nullptr), b_columns, b_attributes, key_order, false,
+												 4096);
+	MergeJoinBatchCursor join(left, right, b_columns.size(), 1, output, column_names, column_attributes);
+	bool ok = true;
+	size_t n_rows = 0;
+	int32_t last_k = -1;
+	ColumnBatch *batch;
+	while ((batch = join.next()) != nullptr) {
+		for (uint16_t row: batch->selection()) {
+			n_rows++;
+			int32_t k = batch->column(0).get_int(row);
+			if (k < last_k || k != batch->column(1).get_int(row) * 7 % 500 ||
+				batch->column(2).get_text(row) != "s" + to_string(k))
+				ok = false;
+			last_k = k;
+		}
+	}
+	if (n_rows != 6000 || left->get_run_count() < 2 || right->get_run_count() < 2)
+		ok = false;
+	a.drop();
+	b.drop();
+	if (ok)
+		cout << "merge join ok" << endl;
+	return ok;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file merge_join.h - Equi-joins of inputs sorted on their join columns.
+ * MergeJoinBatchCursor: BatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include "hash_join.h"
+
+/**
+ * @class MergeJoinBatchCursor - inner equi-join of two BatchCursors that are both sorted
+ * (ascending) on their join columns
+ *
+ * The join columns come first in both sides' batches (key_count of them, in matching order).
+ * Both sides are walked forward together; for each run of right rows with the same key, those
+ * rows are held in memory while the left rows with that key are paired up with them. So only one
+ * key's worth of the right side is ever in memory, however big the inputs are.
+ * Rows with a NULL join column never match.
+ *
+ * The handles in the output batches are those of the left side's rows.
+ */
+class MergeJoinBatchCursor : public BatchCursor {
+public:
+	/**
+	 * @param left               one side, sorted on its join columns (owned by this cursor)
+	 * @param right              the other side, sorted on its join columns (owned by this cursor)
+	 * @param right_column_count how many columns the right side's batches have
+	 * @param key_count          how many join columns lead each side's batches
+	 * @param output             where each output column comes from (true for the right side)
+	 * @param column_names       names of the output columns
+	 * @param column_attributes  their attributes
+	 */
+	MergeJoinBatchCursor(BatchCursor *left, BatchCursor *right, size_t right_column_count, uint key_count,
+						 const JoinOutput &output, const ColumnNames &column_names,
+						 const ColumnAttributes &column_attributes);
+	virtual ~MergeJoinBatchCursor();
+
+	virtual ColumnBatch* next();
+
+protected:
+	BatchCursor *left;
+	BatchCursor *right;
+	size_t right_column_count;
+	uint key_count;
+	JoinOutput output;
+	ColumnBatch batch;
+
+	ColumnBatch *left_batch;
+	size_t left_pos;  // position in left_batch's selection of the current left row
+	bool left_done;
+	ColumnBatch *right_batch;
+	size_t right_pos;  // position in right_batch's selection of the current right row
+	bool right_done;
+	Rows group;  // right rows with the current key
+	size_t group_pos;  // next of them to pair with the current left row (group.size() if not pairing)
+
+	virtual bool left_row(uint16_t &row);
+	virtual bool right_row(uint16_t &row);
+	virtual void clear_group();
+	virtual void fill_group(uint16_t r);
+	virtual void emit(uint16_t l);
+};
+
+bool test_merge_join();
@@ -0,0 +1,106 @@
+/**
+ * @file plan_cache.cpp - implementation of:
+ * CachedStatements
+ * PlanCache
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <cctype>
+#include "plan_cache.h"
+#include "ParseTreeToString.h"
+using namespace std;
+using namespace hsql;
+
+CachedStatements::CachedStatements(SQLParserResult *parse) : parse(parse), texts(), plans(parse->size(), nullptr) {
+	for (size_t i = 0; i < parse->size(); i++)
+		this->texts.push_back(ParseTreeToString::statement(parse->getStatement((int)i)));
+}
+
+CachedStatements::~CachedStatements() {
+	for (auto plan: this->plans)
+		delete plan;
+	delete this->parse;
+}
+
+QueryResult *CachedStatements::execute(size_t i) {
+	return SQLExec::execute(get_statement(i), this->plans[i]);
+}
+
+bool CachedStatements::is_pinned() const {
+	for (size_t i = 0; i < size(); i++)
+		if (get_statement(i)->type() == kStmtPrepare && SQLExec::is_prepared((const PrepareStatement*)get_statement(i)))
+			return true;
+	return false;
+}
+
+PlanCache::PlanCache(size_t capacity) : capacity(capacity), lru(), entries(), pinned() {
+}
+
+PlanCache::~PlanCache() {
+	for (auto const& entry: this->lru)
+		delete entry.second;
+	for (auto statements: this->pinned)
+		delete statements;
+}
+
+string PlanCache::normalize(const string &query) {
+	string ret;
+	char quote = '\0';
+	bool space = false;
+	for (char c: query) {
+		if (quote == '\0' && isspace((unsigned char)c)) {
+			space = true;
+			continue;
+		}
+		if (space && !ret.empty())
+			ret += ' ';
+		space = false;
+		ret += c;
+		if (quote == '\0' && (c == '"' || c == '\''))
+			quote = c;
+		else if (c == quote)
+			quote = '\0';
+	}
+	while (!ret.empty() && (ret.back() == ';' || ret.back() == ' '))
+		ret.pop_back();
+	return ret;
+}
+
+CachedStatements *PlanCache::get(const string &query, string &error) {
+	// let go of the evicted lines whose statements have since been deallocated or prepared again
+	for (auto it = this->pinned.begin(); it != this->pinned.end();) {
+		if ((*it)->is_pinned()) {
+			++it;
+		} else {
+			delete *it;
+			it = this->pinned.erase(it);
+		}
+	}
+
+	string key = normalize(query);
+	auto it = this->entries.find(key);
+	if (it != this->entries.end()) {
+		this->lru.splice(this->lru.begin(), this->lru, it->second);  // now the most recently used
+		return it->second->second;
+	}
+
+	SQLParserResult *parse = SQLParser::parseSQLString(query);
+	if (!parse->isValid()) {
+		error = parse->errorMsg();
+		delete parse;
+		return nullptr;
+	}
+	CachedStatements *statements = new CachedStatements(parse);
+	this->lru.push_front(make_pair(key, statements));
+	this->entries[key] = this->lru.begin();
+	while (this->lru.size() > this->capacity) {
+		CachedStatements *evicted = this->lru.back().second;
+		this->entries.erase(this->lru.back().first);
+		this->lru.pop_back();
+		if (evicted->is_pinned())
+			this->pinned.push_back(evicted);
+		else
+			delete evicted;
+	}
+	return statements;
+}
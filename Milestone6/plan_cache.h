@@ -0,0 +1,98 @@
+/**
+ * @file plan_cache.h - The sql5300 shell's cache of parsed statements and their plans.
+ * CachedStatements
+ * PlanCache
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SQLParser.h"
+#include "SQLExec.h"
+
+/**
+ * @class CachedStatements - a line of SQL parsed once, with what it takes to run it again
+ *
+ * Keeps the parse tree, the text echoed for each statement, and each statement's last SELECT plan
+ * (which SQLExec::execute reuses when it's still good).
+ */
+class CachedStatements {
+public:
+	/**
+	 * @param parse  a valid parse (owned by this object from now on)
+	 */
+	CachedStatements(hsql::SQLParserResult *parse);
+	virtual ~CachedStatements();
+	CachedStatements(const CachedStatements &other) = delete;
+	CachedStatements &operator=(const CachedStatements &other) = delete;
+
+	size_t size() const { return texts.size(); }
+	const hsql::SQLStatement *get_statement(size_t i) const { return parse->getStatement((int)i); }
+	const std::string &get_text(size_t i) const { return texts[i]; }
+
+	/**
+	 * Execute one of the statements, reusing its plan from last time if that's still good.
+	 * @param i  which statement
+	 * @returns  the query result (freed by caller)
+	 */
+	virtual QueryResult *execute(size_t i);
+
+	/**
+	 * Does this have a PREPARE that's still in use? If so, SQLExec refers to the parse tree.
+	 */
+	virtual bool is_pinned() const;
+
+protected:
+	hsql::SQLParserResult *parse;
+	std::vector<std::string> texts;
+	std::vector<CachedPlan*> plans;
+};
+
+/**
+ * @class PlanCache - the most recently run lines of SQL, parsed and planned, by their normalized text
+ *
+ * So a line that is sent again and again (typically an EXECUTE of a prepared statement) skips the
+ * parser, and a SELECT skips the catalog lookups, planning, and optimizing too. Plans are rebuilt
+ * as needed after a CREATE, DROP, or ANALYZE (see CachedPlan).
+ *
+ * Least recently used lines are dropped once there are more than capacity of them, except those
+ * with a PREPARE, which are kept until the statement is deallocated or another is prepared in its place.
+ */
+class PlanCache {
+public:
+	static const size_t DEFAULT_CAPACITY = 256;
+
+	explicit PlanCache(size_t capacity=DEFAULT_CAPACITY);
+	virtual ~PlanCache();
+	PlanCache(const PlanCache &other) = delete;
+	PlanCache &operator=(const PlanCache &other) = delete;
+
+	/**
+	 * The key a line of SQL is cached under: runs of white space (outside of quotes) become a single
+	 * space, and leading and trailing white space and semicolons are dropped.
+	 */
+	static std::string normalize(const std::string &query);
+
+	/**
+	 * The parsed statements of a line of SQL, parsing it if it isn't cached.
+	 * @param query  the line of SQL
+	 * @param error  returned by reference if the line isn't valid SQL
+	 * @returns      the statements (still owned by the cache, good until the next get), or nullptr if
+	 *               the line isn't valid
+	 */
+	virtual CachedStatements *get(const std::string &query, std::string &error);
+
+	size_t size() const { return lru.size(); }
+
+protected:
+	typedef std::list<std::pair<std::string, CachedStatements*>> LRUList;  // most recently used first
+
+	size_t capacity;
+	LRUList lru;
+	std::unordered_map<std::string, LRUList::iterator> entries;
+	std::vector<CachedStatements*> pinned;  // evicted, but prepared statements still refer to them
+};
@@ -0,0 +1,522 @@
+/**
+ * @file predicate.cpp - implementation of:
+ * Predicate
+ * SelectCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include "predicate.h"
+#include "filter_kernels.h"
+using namespace std;
+
+Predicate::Predicate(PredicateOp op, const Identifier &column_name, const vector<Value> &values)
+		: op(op), column_name(column_name), col_num(0), values(values), children() {
+	if (op == PredicateOp::IN || op == PredicateOp::NOT_IN)
+		sort(this->values.begin(), this->values.end());
+}
+
+Predicate::Predicate(PredicateOp op, const Predicates &children)
+		: op(op), column_name(), col_num(0), values(), children(children) {
+}
+
+Predicate::Predicate(const Predicate &other)
+		: op(other.op), column_name(other.column_name), col_num(other.col_num), values(other.values), children() {
+	for (auto child: other.children)
+		this->children.push_back(new Predicate(*child));
+}
+
+Predicate::~Predicate() {
+	for (auto child: this->children)
+		delete child;
+}
+
+Predicate *Predicate::conjunction(Predicates &predicates) {
+	Predicate *ret = nullptr;
+	if (predicates.size() == 1)
+		ret = predicates[0];
+	else if (predicates.size() > 1)
+		ret = new Predicate(PredicateOp::AND, predicates);
+	predicates.clear();
+	return ret;
+}
+
+Predicate *Predicate::negated() const {
+	switch (this->op) {
+		case PredicateOp::AND:
+		case PredicateOp::OR: {
+			Predicates negated_children;
+			for (auto child: this->children)
+				negated_children.push_back(child->negated());
+			return new Predicate(this->op == PredicateOp::AND ? PredicateOp::OR : PredicateOp::AND, negated_children);
+		}
+		case PredicateOp::BETWEEN: {
+			Predicates outside;
+			outside.push_back(new Predicate(PredicateOp::LT, this->column_name, vector<Value>(1, this->values[0])));
+			outside.push_back(new Predicate(PredicateOp::GT, this->column_name, vector<Value>(1, this->values[1])));
+			return new Predicate(PredicateOp::OR, outside);
+		}
+		case PredicateOp::EQ:
+			return new Predicate(PredicateOp::NE, this->column_name, this->values);
+		case PredicateOp::NE:
+			return new Predicate(PredicateOp::EQ, this->column_name, this->values);
+		case PredicateOp::LT:
+			return new Predicate(PredicateOp::GE, this->column_name, this->values);
+		case PredicateOp::LE:
+			return new Predicate(PredicateOp::GT, this->column_name, this->values);
+		case PredicateOp::GT:
+			return new Predicate(PredicateOp::LE, this->column_name, this->values);
+		case PredicateOp::GE:
+			return new Predicate(PredicateOp::LT, this->column_name, this->values);
+		case PredicateOp::IN:
+			return new Predicate(PredicateOp::NOT_IN, this->column_name, this->values);
+		case PredicateOp::NOT_IN:
+			return new Predicate(PredicateOp::IN, this->column_name, this->values);
+	}
+	return nullptr;
+}
+
+void Predicate::get_columns(ColumnNames &column_names) const {
+	if (is_leaf()) {
+		if (find(column_names.begin(), column_names.end(), this->column_name) == column_names.end())
+			column_names.push_back(this->column_name);
+		return;
+	}
+	for (auto child: this->children)
+		child->get_columns(column_names);
+}
+
+void Predicate::resolve(const ColumnNames &column_names) {
+	if (is_leaf()) {
+		auto it = find(column_names.begin(), column_names.end(), this->column_name);
+		if (it == column_names.end())
+			throw DbRelationError("unknown column '" + this->column_name + "'");
+		this->col_num = (uint)(it - column_names.begin());
+		return;
+	}
+	for (auto child: this->children)
+		child->resolve(column_names);
+}
+
+SelectCursor::SelectCursor(DbRelationCursor* input, const ValueDict* where, const Predicate* predicate)
+		: DbRelationCursor(input->get_relation()), input(input), col_nums(nullptr), equalities(), predicate(nullptr) {
+	ColumnNames where_columns;
+	if (where != nullptr) {
+		for (auto const& column: *where) {
+			this->equalities.push_back(make_pair((uint)where_columns.size(), column.second));
+			where_columns.push_back(column.first);
+		}
+	}
+	if (predicate != nullptr) {
+		predicate->get_columns(where_columns);
+		this->predicate = new Predicate(*predicate);
+		this->predicate->resolve(where_columns);
+	}
+	this->col_nums = this->relation.column_numbers(&where_columns);
+}
+
+SelectCursor::~SelectCursor() {
+	delete this->input;
+	delete this->col_nums;
+	delete this->predicate;
+}
+
+// Next handle from the input that satisfies the where clause
+bool SelectCursor::next(Handle &handle) {
+	while (this->input->next(handle)) {
+		this->current = handle;
+		if (this->col_nums->empty())
+			return true;
+		Row *row = this->input->project_row(this->col_nums);  // let the input decode it
+		bool selected = true;
+		for (auto const& equality: this->equalities) {
+			if (row->is_null(equality.first) || (*row)[equality.first] != equality.second) {
+				selected = false;
+				break;
+			}
+		}
+		if (selected && this->predicate != nullptr)
+			selected = this->predicate->matches(*row);
+		delete row;
+		if (selected)
+			return true;
+	}
+	return false;
+}
+
+// a NUL can't get into a string literal, so "\0" plus the placeholder's number can't be mistaken for one
+Value Predicate::placeholder(uint i) {
+	return Value(string(1, '\0') + to_string(i));
+}
+
+bool Predicate::is_placeholder(const Value &value) {
+	return value.data_type == ColumnAttribute::TEXT && !value.s.empty() && value.s[0] == '\0';
+}
+
+void Predicate::bind(Value &value, const vector<Value> &parameters) {
+	if (!is_placeholder(value))
+		return;
+	size_t i = stoul(value.s.substr(1));
+	if (i >= parameters.size())
+		throw DbRelationError("no value for placeholder " + to_string(i + 1));
+	value = parameters[i];
+}
+
+void Predicate::bind(const vector<Value> &parameters) {
+	if (is_leaf()) {
+		for (auto &value: this->values)
+			bind(value, parameters);
+		if (this->op == PredicateOp::IN || this->op == PredicateOp::NOT_IN)
+			sort(this->values.begin(), this->values.end());
+		return;
+	}
+	for (auto child: this->children)
+		child->bind(parameters);
+}
+
+bool Predicate::matches(const ValueDict &row) const {
+	switch (this->op) {
+		case PredicateOp::AND:
+			for (auto child: this->children)
+				if (!child->matches(row))
+					return false;
+			return true;
+		case PredicateOp::OR:
+			for (auto child: this->children)
+				if (child->matches(row))
+					return true;
+			return false;
+		default: {
+			auto it = row.find(this->column_name);
+			return it != row.end() && compare(it->second);
+		}
+	}
+}
+
+bool Predicate::matches(const Row &row) const {
+	switch (this->op) {
+		case PredicateOp::AND:
+			for (auto child: this->children)
+				if (!child->matches(row))
+					return false;
+			return true;
+		case PredicateOp::OR:
+			for (auto child: this->children)
+				if (child->matches(row))
+					return true;
+			return false;
+		default:
+			return !row.is_null(this->col_num) && compare(row[this->col_num]);
+	}
+}
+
+// Does a comparison hold, given the order of the value against the constant (<0, 0, >0)?
+static bool passes(PredicateOp op, int order) {
+	switch (op) {
+		case PredicateOp::EQ:
+			return order == 0;
+		case PredicateOp::NE:
+			return order != 0;
+		case PredicateOp::LT:
+			return order < 0;
+		case PredicateOp::LE:
+			return order <= 0;
+		case PredicateOp::GT:
+			return order > 0;
+		case PredicateOp::GE:
+			return order >= 0;
+		default:
+			return false;
+	}
+}
+
+// Does a (non-NULL) value pass this leaf? A value of another type than the constant never does.
+bool Predicate::compare(const Value &value) const {
+	if (this->op == PredicateOp::IN)
+		return binary_search(this->values.begin(), this->values.end(), value);
+	if (this->op == PredicateOp::NOT_IN)
+		return value.data_type == this->values[0].data_type &&
+			   !binary_search(this->values.begin(), this->values.end(), value);
+	const Value &constant = this->values[0];
+	if (value.data_type != constant.data_type)
+		return false;
+	switch (this->op) {
+		case PredicateOp::EQ:
+			return value == constant;
+		case PredicateOp::NE:
+			return value != constant;
+		case PredicateOp::LT:
+			return value < constant;
+		case PredicateOp::LE:
+			return !(constant < value);
+		case PredicateOp::GT:
+			return constant < value;
+		case PredicateOp::GE:
+			return !(value < constant);
+		case PredicateOp::BETWEEN:
+			return !(value < constant) && !(this->values[1] < value);
+		default:
+			return false;
+	}
+}
+
+// AND narrows the selection child by child. OR tries each child on the rows no earlier child has
+// kept, and keeps the union. A leaf checks one column for all the selected rows.
+void Predicate::filter(ColumnBatch *batch) const {
+	vector<uint16_t> &selection = batch->selection();
+	if (this->op == PredicateOp::AND) {
+		for (auto child: this->children) {
+			if (selection.empty())
+				return;
+			child->filter(batch);
+		}
+		return;
+	}
+	if (this->op == PredicateOp::OR) {
+		vector<uint16_t> remaining(selection), kept, merged;
+		for (auto child: this->children) {
+			if (remaining.empty())
+				break;
+			selection = remaining;
+			child->filter(batch);
+			if (selection.empty())
+				continue;
+			merged.clear();
+			set_union(kept.begin(), kept.end(), selection.begin(), selection.end(), back_inserter(merged));
+			kept.swap(merged);
+			vector<uint16_t> rest;
+			set_difference(remaining.begin(), remaining.end(), selection.begin(), selection.end(), back_inserter(rest));
+			remaining.swap(rest);
+		}
+		selection.swap(kept);
+		return;
+	}
+
+	const ColumnVector &column = batch->column(this->col_num);
+	ColumnAttribute::DataType data_type = column.get_data_type();
+	bool list = this->op == PredicateOp::IN || this->op == PredicateOp::NOT_IN;
+	if (!list && this->values[0].data_type != data_type) {
+		selection.clear();
+		return;
+	}
+	if (data_type == ColumnAttribute::DataType::INT || data_type == ColumnAttribute::DataType::BOOLEAN) {
+		filter_int(column, selection);
+		return;
+	}
+	// TEXT: compared where it sits in the batch, except for IN lists
+	size_t kept = 0;
+	for (uint16_t row: selection) {
+		if (column.is_null(row))
+			continue;
+		bool pass;
+		if (list) {
+			pass = compare(column.get_value(row));
+		} else {
+			TextView text = column.get_text(row);
+			int order = text.compare(this->values[0].s);
+			if (this->op == PredicateOp::BETWEEN)
+				pass = order >= 0 && text.compare(this->values[1].s) <= 0;
+			else
+				pass = passes(this->op, order);
+		}
+		if (pass)
+			selection[kept++] = row;
+	}
+	selection.resize(kept);
+}
+
+// A leaf on an INT or BOOLEAN column: comparisons go through a filter kernel over the whole column,
+// IN lists are binary searched.
+void Predicate::filter_int(const ColumnVector &column, vector<uint16_t> &selection) const {
+	bool boolean = column.get_data_type() == ColumnAttribute::DataType::BOOLEAN;
+	size_t kept = 0;
+	if (this->op == PredicateOp::IN || this->op == PredicateOp::NOT_IN) {
+		vector<int32_t> list;
+		for (auto const& value: this->values)
+			if (value.data_type == column.get_data_type())
+				list.push_back(boolean ? value.n != 0 : value.n);
+		sort(list.begin(), list.end());
+		bool in = this->op == PredicateOp::IN;
+		if (!in && this->values[0].data_type != column.get_data_type()) {
+			selection.clear();
+			return;
+		}
+		for (uint16_t row: selection)
+			if (!column.is_null(row) && binary_search(list.begin(), list.end(), column.get_int(row)) == in)
+				selection[kept++] = row;
+		selection.resize(kept);
+		return;
+	}
+
+	int32_t n = boolean ? this->values[0].n != 0 : this->values[0].n;
+	FilterOp filter_op = FilterOp::EQ;
+	int32_t lo = n, hi = n;
+	bool invert = false;
+	switch (this->op) {
+		case PredicateOp::NE:
+			invert = true;
+			break;
+		case PredicateOp::LT:
+			filter_op = FilterOp::LT;
+			break;
+		case PredicateOp::GT:
+			filter_op = FilterOp::GT;
+			break;
+		case PredicateOp::LE:
+			filter_op = FilterOp::BETWEEN;
+			lo = INT_MIN;
+			break;
+		case PredicateOp::GE:
+			filter_op = FilterOp::BETWEEN;
+			hi = INT_MAX;
+			break;
+		case PredicateOp::BETWEEN:
+			filter_op = FilterOp::BETWEEN;
+			hi = boolean ? this->values[1].n != 0 : this->values[1].n;
+			break;
+		default:
+			break;
+	}
+	if (filter_op == FilterOp::BETWEEN && lo > hi) {
+		selection.clear();
+		return;
+	}
+	size_t n_rows = column.size();
+	vector<uint64_t> mask(filter_mask_words(n_rows), ~0ULL);
+	filter_int32(column.int_data(), n_rows, filter_op, lo, hi, mask.data());
+	for (uint16_t row: selection)
+		if ((((mask[row / 64] >> (row % 64)) & 1) != invert) && !column.is_null(row))
+			selection[kept++] = row;
+	selection.resize(kept);
+}
+
+static Predicate *leaf(PredicateOp op, const Identifier &column_name, const Value &value) {
+	return new Predicate(op, column_name, vector<Value>(1, value));
+}
+
+static Predicate *leaf(PredicateOp op, const Identifier &column_name, const Value &low, const Value &high) {
+	vector<Value> values;
+	values.push_back(low);
+	values.push_back(high);
+	return new Predicate(op, column_name, values);
+}
+
+static Predicate *node(PredicateOp op, Predicate *a, Predicate *b) {
+	Predicates children;
+	children.push_back(a);
+	children.push_back(b);
+	return new Predicate(op, children);
+}
+
+// Filtering the batch (from all of its rows) has to keep exactly, and in order, the rows that match()
+// by position and by name. Takes ownership of predicate.
+static bool check_filter(Predicate *predicate, ColumnBatch &batch, size_t expect_count) {
+	const ColumnNames &column_names = batch.get_column_names();
+	predicate->resolve(column_names);
+	vector<uint16_t> expected;
+	bool ok = true;
+	for (uint16_t row = 0; row < batch.size(); row++) {
+		Row *values = batch.get_row(row, column_names.size());
+		ValueDict *dict = values->to_dict(column_names);
+		bool match = predicate->matches(*values);
+		if (match != predicate->matches(*dict))
+			ok = false;
+		if (match)
+			expected.push_back(row);
+		delete dict;
+		delete values;
+	}
+	batch.select_all();
+	predicate->filter(&batch);
+	delete predicate;
+	return ok && batch.selection() == expected && expected.size() == expect_count;
+}
+
+// negated() (NOT pushed down through AND, OR, BETWEEN, and IN), OR merging the rows its children keep,
+// IN and NOT IN lists with constants of the wrong type, and LE/GE going through the BETWEEN kernel
+// with the extremes of INT.
+bool test_predicate() {
+	ColumnNames column_names;
+	column_names.push_back("a");
+	column_names.push_back("s");
+	column_names.push_back("f");
+	ColumnAttributes column_attributes;
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+	ColumnBatch batch(column_names, column_attributes);
+	for (int i = 0; i < 200; i++) {
+		batch.add_row(Handle());
+		if (i % 37 == 1)
+			batch.column(0).push_null();
+		else
+			batch.column(0).push_int(i % 50 == 0 ? (i % 100 == 0 ? INT_MIN : INT_MAX) : i - 100);
+		batch.column(1).push_value(Value("s" + to_string(i % 20)));
+		batch.column(2).push_int(i % 3 == 0);
+	}
+	Value yes(1), no(0);
+	yes.data_type = no.data_type = ColumnAttribute::BOOLEAN;
+
+	// NOT (a < 5 AND (s = "s3" OR a BETWEEN 10 AND 20)) is a >= 5 OR (s <> "s3" AND (a < 10 OR a > 20))
+	Predicate *original = node(PredicateOp::AND, leaf(PredicateOp::LT, "a", Value(5)),
+							   node(PredicateOp::OR, leaf(PredicateOp::EQ, "s", Value("s3")),
+									leaf(PredicateOp::BETWEEN, "a", Value(10), Value(20))));
+	Predicate *negation = original->negated();
+	const Predicates &top = negation->get_children();
+	bool ok = negation->get_op() == PredicateOp::OR && top.size() == 2 && top[0]->get_op() == PredicateOp::GE &&
+			  top[1]->get_op() == PredicateOp::AND && top[1]->get_children()[0]->get_op() == PredicateOp::NE;
+	if (ok) {
+		const Predicate *outside = top[1]->get_children()[1];
+		ok = outside->get_op() == PredicateOp::OR && outside->get_children()[0]->get_op() == PredicateOp::LT &&
+			 outside->get_children()[0]->get_values()[0] == Value(10) &&
+			 outside->get_children()[1]->get_op() == PredicateOp::GT &&
+			 outside->get_children()[1]->get_values()[0] == Value(20);
+	}
+	for (int a = -5; a < 30 && ok; a++) {
+		ValueDict row;
+		row["a"] = Value(a);
+		row["s"] = Value(a % 2 == 0 ? "s3" : "s4");
+		ok = original->matches(row) != negation->matches(row);
+	}
+	delete original;
+	delete negation;
+	Predicate *in = leaf(PredicateOp::IN, "a", Value(7), Value(3));
+	Predicate *not_in = in->negated();
+	ok = ok && not_in->get_op() == PredicateOp::NOT_IN && not_in->get_values()[0] == Value(3);
+	Predicate *twice = not_in->negated();
+	ok = ok && twice->get_op() == PredicateOp::IN;
+	delete in;
+	delete not_in;
+	delete twice;
+
+	// OR: a < -90, a >= 90 (and INT_MAX), a BETWEEN -95 AND -80 (overlapping the first), s = "s5"
+	ok = ok && check_filter(node(PredicateOp::OR, node(PredicateOp::OR, leaf(PredicateOp::LT, "a", Value(-90)),
+														leaf(PredicateOp::GE, "a", Value(90))),
+								 node(PredicateOp::OR, leaf(PredicateOp::BETWEEN, "a", Value(-95), Value(-80)),
+									  leaf(PredicateOp::EQ, "s", Value("s5")))),
+							batch, 42);
+
+	// IN lists: wrong-typed constants never match, and NOT IN of the wrong type matches nothing
+	ok = ok && check_filter(leaf(PredicateOp::IN, "a", Value(-97), Value("-96")), batch, 1);
+	ok = ok && check_filter(leaf(PredicateOp::IN, "a", Value("x"), Value("y")), batch, 0);
+	ok = ok && check_filter(leaf(PredicateOp::NOT_IN, "a", Value("x"), Value("y")), batch, 0);
+	ok = ok && check_filter(leaf(PredicateOp::NOT_IN, "s", Value("s1"), Value("s2")), batch, 180);
+	ok = ok && check_filter(leaf(PredicateOp::IN, "s", Value(1), Value("s2")), batch, 10);
+	ok = ok && check_filter(leaf(PredicateOp::IN, "f", yes, Value(1)), batch, 67);
+	ok = ok && check_filter(leaf(PredicateOp::EQ, "f", Value(1)), batch, 0);
+
+	// LE and GE are BETWEEN with an open end, right up to INT_MIN and INT_MAX
+	ok = ok && check_filter(leaf(PredicateOp::LE, "a", Value(INT_MIN)), batch, 2);
+	ok = ok && check_filter(leaf(PredicateOp::GE, "a", Value(INT_MAX)), batch, 2);
+	ok = ok && check_filter(leaf(PredicateOp::LE, "a", Value(INT_MAX)), batch, 194);
+	ok = ok && check_filter(leaf(PredicateOp::GE, "a", Value(-3)), batch, 100);
+	ok = ok && check_filter(leaf(PredicateOp::BETWEEN, "a", Value(5), Value(3)), batch, 0);
+	ok = ok && check_filter(leaf(PredicateOp::LE, "f", no), batch, 133);
+	ok = ok && check_filter(leaf(PredicateOp::GE, "f", yes), batch, 67);
+	ok = ok && check_filter(leaf(PredicateOp::NE, "a", Value(0)), batch, 194);
+	if (ok)
+		cout << "predicates ok" << endl;
+	return ok;
+}
@@ -0,0 +1,168 @@
+/**
+ * @file predicate.h - Compiled WHERE clauses.
+ * Predicate
+ * SelectCursor: DbRelationCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include <vector>
+#include "column_batch.h"
+
+/**
+ * What a Predicate node checks. The leaves compare a column with constants; AND and OR combine
+ * their children. There is no NOT: negations are pushed down to the leaves when compiling
+ * (see Predicate::negated), so a NULL column simply fails every leaf.
+ */
+enum class PredicateOp {
+	EQ,       // column = values[0]
+	NE,       // column <> values[0]
+	LT,       // column < values[0]
+	LE,       // column <= values[0]
+	GT,       // column > values[0]
+	GE,       // column >= values[0]
+	BETWEEN,  // values[0] <= column <= values[1]
+	IN,       // column is one of values
+	NOT_IN,   // column is none of values
+	AND,
+	OR
+};
+
+class Predicate;
+typedef std::vector<Predicate*> Predicates;
+
+/**
+ * @class Predicate - a WHERE clause compiled into a tree of typed comparisons
+ *
+ * The leaves' constants are typed when the tree is built (IN lists are kept sorted) and their
+ * columns are resolved to positions once with resolve(), so checking a row involves no name
+ * lookups. A batch is filtered a node at a time, narrowing its selection vector: INT and BOOLEAN
+ * comparisons go through the filter kernels; OR keeps whatever any of its children keeps.
+ */
+class Predicate {
+public:
+	/**
+	 * A comparison.
+	 * @param op           EQ through NOT_IN
+	 * @param column_name  column to compare
+	 * @param values       constants to compare with (two for BETWEEN, any number for IN, one otherwise)
+	 */
+	Predicate(PredicateOp op, const Identifier &column_name, const std::vector<Value> &values);
+
+	/**
+	 * AND or OR of children (which the new node owns).
+	 */
+	Predicate(PredicateOp op, const Predicates &children);
+
+	Predicate(const Predicate &other);
+	Predicate& operator=(const Predicate &other) = delete;
+	virtual ~Predicate();
+
+	/**
+	 * The AND of some predicates, taking them over.
+	 * @param predicates  the predicates (emptied)
+	 * @returns           nullptr if there were none, the only one, or an AND of them (freed by caller)
+	 */
+	static Predicate *conjunction(Predicates &predicates);
+
+	/**
+	 * NOT of this predicate, with the negation pushed all the way down to the leaves (De Morgan's laws,
+	 * and e.g., NOT a < 5 is a >= 5).
+	 * @returns  the negation (freed by caller)
+	 */
+	virtual Predicate *negated() const;
+
+	PredicateOp get_op() const { return op; }
+	bool is_leaf() const { return op != PredicateOp::AND && op != PredicateOp::OR; }
+	const Identifier& get_column_name() const { return column_name; }
+	const std::vector<Value>& get_values() const { return values; }
+	const Predicates& get_children() const { return children; }
+	Predicates& get_children() { return children; }
+
+	/**
+	 * Add the columns this predicate looks at to column_names (if they aren't there already).
+	 */
+	virtual void get_columns(ColumnNames &column_names) const;
+
+	/**
+	 * Look up each leaf's column's position in column_names (the layout of the rows or batches to be
+	 * checked). Throws DbRelationError if a column isn't there.
+	 */
+	virtual void resolve(const ColumnNames &column_names);
+
+	/**
+	 * A stand-in for the i'th placeholder (?) of a prepared statement, so that its plan can be built
+	 * once and bound to the values of each EXECUTE. It's a TEXT value that no literal can spell.
+	 */
+	static Value placeholder(uint i);
+	static bool is_placeholder(const Value &value);
+
+	/**
+	 * Replace value with its parameter if it's a placeholder. Throws DbRelationError if there's no such parameter.
+	 */
+	static void bind(Value &value, const std::vector<Value> &parameters);
+
+	/**
+	 * Replace the placeholders in the leaves with their parameters (IN lists are sorted again).
+	 */
+	virtual void bind(const std::vector<Value> &parameters);
+
+	/**
+	 * Check a row by column name (a missing column is NULL).
+	 */
+	virtual bool matches(const ValueDict &row) const;
+
+	/**
+	 * Check a row by the positions from resolve().
+	 */
+	virtual bool matches(const Row &row) const;
+
+	/**
+	 * Drop the selected rows of batch that don't satisfy the predicate (columns by the positions from resolve()).
+	 */
+	virtual void filter(ColumnBatch *batch) const;
+
+protected:
+	PredicateOp op;
+	Identifier column_name;  // for leaves
+	uint col_num;  // for leaves: position of the column, once resolved
+	std::vector<Value> values;  // for leaves
+	Predicates children;  // for AND, OR
+
+	virtual bool compare(const Value &value) const;
+	virtual void filter_int(const ColumnVector &column, std::vector<uint16_t> &selection) const;
+};
+
+/**
+ * @class SelectCursor - DbRelationCursor which filters another cursor by a where-clause
+ * (equalities and/or a compiled Predicate)
+ *
+ * The where clause is resolved to column positions once, up front. Then for each row just its
+ * columns are fetched from the input, as a Row, and checked by position.
+ */
+class SelectCursor : public DbRelationCursor {
+public:
+	/**
+	 * @param input      cursor to filter (owned by this cursor)
+	 * @param where      equalities the rows must satisfy (nullptr for none)
+	 * @param predicate  the rest of the where clause (nullptr for none)
+	 */
+	SelectCursor(DbRelationCursor* input, const ValueDict* where, const Predicate* predicate=nullptr);
+	virtual ~SelectCursor();
+	SelectCursor(const SelectCursor& other) = delete;
+	SelectCursor& operator=(const SelectCursor& other) = delete;
+
+	virtual bool next(Handle &handle);
+	virtual ValueDict* project() { return input->project(); }
+	virtual ValueDict* project(const ColumnNames* column_names) { return input->project(column_names); }
+	virtual Row* project_row(const ColumnNumbers* col_nums) { return input->project_row(col_nums); }
+
+protected:
+	DbRelationCursor* input;
+	ColumnNumbers* col_nums;  // where the where clause's columns are in the relation
+	RowPredicates equalities;  // by position in the fetched rows
+	Predicate* predicate;  // resolved to positions in the fetched rows (nullptr for none)
+};
+
+bool test_predicate();
@@ -3,9 +3,12 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
  */
+#include <algorithm>
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
 #include "btree.h"
+#include "hash_index.h"
+#include "external_sort.h"
 
 
 void initialize_schema_tables() {
@@ -18,6 +21,10 @@ void initialize_schema_tables() {
 	Indices indices;
 	indices.create_if_not_exists();
 	indices.close();
+	Statistics statistics;
+	statistics.create_if_not_exists();
+	statistics.close();
+	Catalog::load();
 }
 
 // Not terribly useful since the parser weeds most of these out
@@ -86,6 +93,8 @@ void Tables::create() {
     insert(&row);
 	row["table_name"] = Value("_indices");
 	insert(&row);
+	row["table_name"] = Value("_statistics");
+	insert(&row);
 }
 
 // Manually check that table_name is unique.
@@ -113,35 +122,15 @@ void Tables::del(Handle handle) {
     HeapTable::del(handle);
 }
 
+// Write back our blocks and those of the columns table.
+void Tables::flush() {
+    HeapTable::flush();
+    Tables::columns_table->flush();
+}
+
 // Return a list of column names and column attributes for given table.
 void Tables::get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes) {
-    // SELECT * FROM _columns WHERE table_name = <table_name>
-    ValueDict where;
-    where["table_name"] = table_name;
-    Handles* handles = Tables::columns_table->select(&where);
-
-    ColumnAttribute column_attribute;
-    for (auto const& handle: *handles) {
-        ValueDict* row = Tables::columns_table->project(handle);  // get the row's values: {'column_name': <name>, 'data_type': <type>}
-
-        Identifier column_name = (*row)["column_name"].s;
-        column_names.push_back(column_name);
-
-        ColumnAttribute::DataType data_type;
-        if ((*row)["data_type"].s == "INT")
-            data_type = ColumnAttribute::INT;
-        else if ((*row)["data_type"].s == "TEXT")
-            data_type = ColumnAttribute::TEXT;
-        else if ((*row)["data_type"].s == "BOOLEAN")
-            data_type = ColumnAttribute::BOOLEAN;
-        else
-            throw DbRelationError("Unknown data type");
-        column_attribute.set_data_type(data_type);
-        column_attributes.push_back(column_attribute);
-
-        delete row;
-    }
-    delete handles;
+    Catalog::get_columns(table_name, column_names, column_attributes);
 }
 
 // Return a table for given table_name.
@@ -226,6 +215,27 @@ void Columns::create() {
     row["column_name"] = Value("is_unique");
     row["data_type"] = Value("BOOLEAN");
     insert(&row); 
+
+    row["table_name"] = Value("_statistics");
+    row["data_type"] = Value("TEXT");
+    row["column_name"] = Value("table_name");
+    insert(&row);
+    row["column_name"] = Value("column_name");
+    insert(&row);
+    row["data_type"] = Value("INT");
+    row["column_name"] = Value("row_count");
+    insert(&row);
+    row["column_name"] = Value("block_count");
+    insert(&row);
+    row["column_name"] = Value("distinct_count");
+    insert(&row);
+    row["data_type"] = Value("TEXT");
+    row["column_name"] = Value("min_value");
+    insert(&row);
+    row["column_name"] = Value("max_value");
+    insert(&row);
+    row["column_name"] = Value("histogram");
+    insert(&row);
 }
 
 // Manually check that (table_name, column_name) is unique.
@@ -335,48 +345,12 @@ void Indices::del(Handle handle) {
     HeapTable::del(handle);
 }
 
-// Return a list of column names and column attributes for given table.
+// Return the key columns of an index, and what kind of index it is.
 void Indices::get_columns(Identifier table_name, Identifier index_name,
                           ColumnNames &column_names, bool &is_hash, bool &is_unique) {
-    // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
-    ValueDict where;
-    where["table_name"] = table_name;
-    where["index_name"] = index_name;
-    Handles* handles = select(&where);
-
-    Identifier colnames[DbIndex::MAX_COMPOSITE];
-    uint size = 0;
-    for (auto const& handle: *handles) {
-        ValueDict *row = project(handle);
-
-        Identifier column_name = (*row)["column_name"].s;
-        uint which = (uint) (*row)["seq_in_index"].n;
-        colnames[which - 1] = column_name;  // seq_in_index is 1-based
-        if (which > size)
-            size = which;
-        is_unique = (*row)["is_unique"].n != 0;
-        is_hash = (*row)["index_type"].s == "HASH";
-        delete row;
-    }
-    for (uint i = 0; i < size; i++)
-        column_names.push_back(colnames[i]);
-    delete handles;
+    Catalog::get_index(table_name, index_name, column_names, is_hash, is_unique);
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-public:
-    DummyIndex(DbRelation& rel, Identifier idx, ColumnNames key, bool unq) : DbIndex(rel, idx, key, unq) {}
-    void create() {}
-    void drop() {}
-    void open() {}
-    void close() {}
-    Handles* lookup(ValueDict* key_values) const {return nullptr;}
-    void insert(Handle handle) {}
-    void del(Handle handle) {}
-};
-
-
 // Return a table for given table_name.
 DbIndex& Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just return that one
@@ -384,14 +358,14 @@ DbIndex& Indices::get_index(Identifier table_name, Identifier index_name) {
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return  *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
+    // otherwise construct it
     ColumnNames column_names;
     bool is_hash, is_unique;
     get_columns(table_name, index_name, column_names, is_hash, is_unique);
     DbRelation& table = Tables::get_table(table_name);
     DbIndex* index;
     if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+        index = new HashIndex(table, index_name, column_names, is_unique);
     } else {
         index = new BTreeIndex(table, index_name, column_names, is_unique);
     }
@@ -400,17 +374,382 @@ DbIndex& Indices::get_index(Identifier table_name, Identifier index_name) {
 }
 
 IndexNames Indices::get_index_names(Identifier table_name) {
-    IndexNames ret;
+    return Catalog::get_index_names(table_name);
+}
+
+
+/*
+ * ****************************
+ * Catalog class implementation
+ * ****************************
+ */
+std::unordered_map<Identifier, Catalog::TableEntry> Catalog::tables;
+uint64_t Catalog::version = 0;
+
+// One pass over each of _columns and _indices.
+void Catalog::load() {
+    Catalog::tables.clear();
+
+    Columns columns;
+    DbRelationCursor *cursor = columns.cursor();
+    Handle handle;
+    while (cursor->next(handle)) {
+        ValueDict *row = cursor->project();
+        TableEntry &table = Catalog::tables[row->at("table_name").s];
+        table.column_names.push_back(row->at("column_name").s);
+        const std::string &data_type = row->at("data_type").s;
+        ColumnAttribute column_attribute;
+        if (data_type == "INT")
+            column_attribute.set_data_type(ColumnAttribute::INT);
+        else if (data_type == "TEXT")
+            column_attribute.set_data_type(ColumnAttribute::TEXT);
+        else if (data_type == "BOOLEAN")
+            column_attribute.set_data_type(ColumnAttribute::BOOLEAN);
+        else
+            throw DbRelationError("Unknown data type");
+        table.column_attributes.push_back(column_attribute);
+        delete row;
+    }
+    delete cursor;
+
+    Indices indices;
+    cursor = indices.cursor();
+    while (cursor->next(handle)) {
+        ValueDict *row = cursor->project();
+        TableEntry &table = Catalog::tables[row->at("table_name").s];
+        Identifier index_name = row->at("index_name").s;
+        IndexEntry &index = table.indices[index_name];
+        uint seq = (uint) row->at("seq_in_index").n;  // 1-based
+        if (seq > index.column_names.size())
+            index.column_names.resize(seq);
+        index.column_names[seq - 1] = row->at("column_name").s;
+        index.is_hash = row->at("index_type").s == "HASH";
+        index.is_unique = row->at("is_unique").n != 0;
+        if (seq == 1)
+            table.index_names.push_back(index_name);
+        delete row;
+    }
+    delete cursor;
+    Catalog::version++;
+}
+
+void Catalog::get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes) {
+    auto it = Catalog::tables.find(table_name);
+    if (it == Catalog::tables.end())
+        return;
+    column_names.insert(column_names.end(), it->second.column_names.begin(), it->second.column_names.end());
+    column_attributes.insert(column_attributes.end(), it->second.column_attributes.begin(),
+                             it->second.column_attributes.end());
+}
+
+void Catalog::get_index(Identifier table_name, Identifier index_name, ColumnNames &column_names,
+                        bool &is_hash, bool &is_unique) {
+    auto table = Catalog::tables.find(table_name);
+    if (table == Catalog::tables.end())
+        return;
+    auto index = table->second.indices.find(index_name);
+    if (index == table->second.indices.end())
+        return;
+    column_names.insert(column_names.end(), index->second.column_names.begin(), index->second.column_names.end());
+    is_hash = index->second.is_hash;
+    is_unique = index->second.is_unique;
+}
+
+IndexNames Catalog::get_index_names(Identifier table_name) {
+    auto it = Catalog::tables.find(table_name);
+    if (it == Catalog::tables.end())
+        return IndexNames();
+    return it->second.index_names;
+}
+
+void Catalog::add_table(Identifier table_name, const ColumnNames &column_names,
+                        const ColumnAttributes &column_attributes) {
+    TableEntry &table = Catalog::tables[table_name];
+    table.column_names = column_names;
+    table.column_attributes = column_attributes;
+    Catalog::version++;
+}
+
+void Catalog::drop_table(Identifier table_name) {
+    Catalog::tables.erase(table_name);
+    Catalog::version++;
+}
+
+void Catalog::add_index(Identifier table_name, Identifier index_name, const ColumnNames &column_names,
+                        bool is_hash, bool is_unique) {
+    TableEntry &table = Catalog::tables[table_name];
+    if (table.indices.find(index_name) == table.indices.end())
+        table.index_names.push_back(index_name);
+    IndexEntry &index = table.indices[index_name];
+    index.column_names = column_names;
+    index.is_hash = is_hash;
+    index.is_unique = is_unique;
+    Catalog::version++;
+}
+
+void Catalog::drop_index(Identifier table_name, Identifier index_name) {
+    auto table = Catalog::tables.find(table_name);
+    if (table == Catalog::tables.end())
+        return;
+    table->second.indices.erase(index_name);
+    IndexNames &index_names = table->second.index_names;
+    index_names.erase(std::remove(index_names.begin(), index_names.end(), index_name), index_names.end());
+    Catalog::version++;
+}
+
+
+/*
+ * *******************************
+ * Statistics class implementation
+ * *******************************
+ */
+const Identifier Statistics::TABLE_NAME = "_statistics";
+
+// get the column names for _statistics
+ColumnNames& Statistics::COLUMN_NAMES() {
+    static ColumnNames cn;
+    if (cn.empty()) {
+        cn.push_back("table_name");
+        cn.push_back("column_name");
+        cn.push_back("row_count");
+        cn.push_back("block_count");
+        cn.push_back("distinct_count");
+        cn.push_back("min_value");
+        cn.push_back("max_value");
+        cn.push_back("histogram");
+    }
+    return cn;
+}
+
+// get the column attributes for _statistics
+ColumnAttributes& Statistics::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes cas;
+    if (cas.empty()) {
+        ColumnAttribute ca(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // table_name
+        cas.push_back(ca);  // column_name
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // row_count
+        cas.push_back(ca);  // block_count
+        cas.push_back(ca);  // distinct_count
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // min_value
+        cas.push_back(ca);  // max_value
+        cas.push_back(ca);  // histogram
+    }
+    return cas;
+}
+
+// ctor - we have a fixed table structure
+Statistics::Statistics() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()), cache() {
+}
+
+// Value as text for storing in _statistics (cut off at MAX_VALUE_CHARS)
+std::string Statistics::encode(const Value &value) {
+    if (value.data_type == ColumnAttribute::TEXT)
+        return value.s.substr(0, MAX_VALUE_CHARS);
+    return std::to_string(value.n);
+}
+
+Value Statistics::decode(const std::string &text, ColumnAttribute::DataType data_type) {
+    if (data_type == ColumnAttribute::TEXT)
+        return Value(text);
+    Value value(std::stoi(text));
+    value.data_type = data_type;
+    return value;
+}
+
+// Read through the whole table, sort each column's values, and take the statistics from that.
+// Each column goes through its own ExternalSort (they split the memory budget), so the table
+// doesn't have to fit in memory. NULLs are left out of a column's statistics.
+uint32_t Statistics::analyze(Identifier table_name) {
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    Tables::get_columns(table_name, column_names, column_attributes);
+    if (column_names.empty())
+        throw DbRelationError("unknown table " + table_name);
+    DbRelation &table = Tables::get_table(table_name);
+
+    std::vector<ExternalSort*> sorts;
+    std::vector<uint32_t> counts(column_names.size(), 0);
+    uint32_t row_count = 0;
+    ValueDicts rows;
+    try {
+        for (uint i = 0; i < column_names.size(); i++) {
+            ColumnNames column(1, column_names[i]);
+            sorts.push_back(new ExternalSort(column, ColumnAttributes(1, column_attributes[i]), column,
+                                             ExternalSort::DEFAULT_MEMORY_BUDGET / column_names.size()));
+        }
+        DbRelationCursor *cursor = table.cursor();
+        Handle handle;
+        while (cursor->next(handle)) {
+            ValueDict *row = cursor->project(&column_names);
+            for (uint i = 0; i < column_names.size(); i++) {
+                auto found = row->find(column_names[i]);
+                if (found == row->end())
+                    continue;
+                Row *value = new Row(1);
+                value->set(0, found->second);
+                sorts[i]->add(value);
+                counts[i]++;
+            }
+            delete row;
+            row_count++;
+        }
+        delete cursor;
+        uint32_t block_count = table.get_block_count();
+
+        forget(table_name);
+        for (uint i = 0; i < column_names.size(); i++) {
+            uint32_t count = counts[i];
+            uint32_t distinct_count = 0;
+            std::string histogram, min_value, max_value;
+            uint buckets = std::min((uint) count, HISTOGRAM_BUCKETS);
+            uint b = 1;  // next histogram bucket, whose bound is value number b * count / buckets - 1
+            Value previous;
+            Row *sorted;
+            for (uint32_t j = 0; sorts[i]->next(sorted); j++) {
+                const Value &value = (*sorted)[0];
+                if (j == 0) {
+                    distinct_count++;
+                    min_value = encode(value);
+                } else if (previous < value) {
+                    distinct_count++;
+                }
+                if (b <= buckets && j == (uint64_t) b * count / buckets - 1) {
+                    std::string bound = encode(value);
+                    histogram += std::to_string(bound.size()) + ":" + bound;
+                    b++;
+                }
+                previous = value;
+                delete sorted;
+            }
+            if (count > 0)
+                max_value = encode(previous);
+            delete sorts[i];
+            sorts[i] = nullptr;
+
+            ValueDict *row = new ValueDict();
+            (*row)["table_name"] = Value(table_name);
+            (*row)["column_name"] = Value(column_names[i]);
+            (*row)["row_count"] = Value((int32_t) row_count);
+            (*row)["block_count"] = Value((int32_t) block_count);
+            (*row)["distinct_count"] = Value((int32_t) distinct_count);
+            (*row)["min_value"] = Value(min_value);
+            (*row)["max_value"] = Value(max_value);
+            (*row)["histogram"] = Value(histogram);
+            rows.push_back(row);
+        }
+    } catch (...) {
+        for (auto sort: sorts)
+            delete sort;
+        for (auto row: rows)
+            delete row;
+        throw;
+    }
+    Handles *handles = insert(&rows);
+    delete handles;
+    for (auto row: rows)
+        delete row;
+    return row_count;
+}
+
+bool Statistics::get_statistics(Identifier table_name, Identifier column_name, ColumnStatistics &stats) {
+    if (this->cache.find(table_name) == this->cache.end())
+        load(table_name);
+    auto const& columns = this->cache[table_name];
+    auto found = columns.find(column_name);
+    if (found == columns.end())
+        return false;
+    stats = found->second;
+    return true;
+}
+
+// Read in what we have for the table (if anything)
+void Statistics::load(Identifier table_name) {
+    std::map<Identifier,ColumnStatistics> &columns = this->cache[table_name];
     ValueDict where;
     where["table_name"] = Value(table_name);
-    where["seq_in_index"] = Value(1);  // only get the row for the first column if composite index
     Handles* handles = select(&where);
+    if (handles->empty()) {
+        delete handles;
+        return;
+    }
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    Tables::get_columns(table_name, column_names, column_attributes);
     for (auto const& handle: *handles) {
         ValueDict* row = project(handle);
-        ret.push_back((*row)["index_name"].s);
+        Identifier column_name = row->at("column_name").s;
+        auto position = std::find(column_names.begin(), column_names.end(), column_name);
+        if (position != column_names.end()) {
+            ColumnAttribute::DataType data_type = column_attributes[position - column_names.begin()].get_data_type();
+            ColumnStatistics &stats = columns[column_name];
+            stats.row_count = (uint32_t) row->at("row_count").n;
+            stats.block_count = (uint32_t) row->at("block_count").n;
+            stats.distinct_count = (uint32_t) row->at("distinct_count").n;
+            if (stats.row_count > 0) {
+                stats.min_value = decode(row->at("min_value").s, data_type);
+                stats.max_value = decode(row->at("max_value").s, data_type);
+            }
+            const std::string &histogram = row->at("histogram").s;
+            size_t at = 0;
+            while (at < histogram.size()) {
+                size_t colon = histogram.find(':', at);
+                size_t length = std::stoul(histogram.substr(at, colon - at));
+                stats.bounds.push_back(decode(histogram.substr(colon + 1, length), data_type));
+                at = colon + 1 + length;
+            }
+        }
         delete row;
     }
     delete handles;
-    return ret;
+}
+
+void Statistics::forget(Identifier table_name) {
+    this->cache.erase(table_name);
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles* handles = select(&where);
+    for (auto const& handle: *handles)
+        del(handle);
+    delete handles;
+}
+
+double ColumnStatistics::eq_selectivity(const Value &value) const {
+    if (this->row_count == 0 || value < this->min_value || this->max_value < value)
+        return 0.0;
+    uint matching = 0;
+    for (auto const& bound: this->bounds)
+        if (!(bound < value) && !(value < bound))
+            matching++;
+    if (matching > 1)
+        return (double) matching / this->bounds.size();
+    return 1.0 / std::max(this->distinct_count, (uint32_t) 1);
+}
+
+double ColumnStatistics::range_selectivity(const Value *low, const Value *high) const {
+    if (this->row_count == 0 || (low != nullptr && high != nullptr && *high < *low))
+        return 0.0;
+    if (this->bounds.empty())
+        return 1.0;
+    double fraction = 0.0;
+    Value bucket_low = this->min_value;
+    for (auto const& bucket_high: this->bounds) {
+        if ((low == nullptr || !(bucket_high < *low)) && (high == nullptr || !(*high < bucket_low))) {
+            bool covered = (low == nullptr || !(bucket_low < *low)) && (high == nullptr || !(*high < bucket_high));
+            if (covered) {
+                fraction += 1.0;
+            } else if (bucket_low.data_type == ColumnAttribute::INT && bucket_high.n > bucket_low.n) {
+                double from = low == nullptr ? bucket_low.n : std::max(bucket_low.n, low->n);
+                double to = high == nullptr ? bucket_high.n : std::min(bucket_high.n, high->n);
+                fraction += std::max(to - from, 1.0) / (bucket_high.n - bucket_low.n);
+            } else {
+                fraction += 0.5;
+            }
+        }
+        bucket_low = bucket_high;
+    }
+    return std::min(fraction / this->bounds.size(), 1.0);
 }
 
@@ -2,11 +2,15 @@
  * @file schema_tables.h - schema table classes:
  * 		Columns
  * 		Tables
+ * 		Indices
+ * 		Catalog
+ * 		Statistics
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
  */
 #pragma once
 
+#include <unordered_map>
 #include "heap_storage.h"
 
 /**
@@ -38,7 +42,9 @@ public:
 	// HeapTable overrides
     virtual void create();
     virtual Handle insert(const ValueDict* row);
+    virtual Handles* insert(const ValueDicts* rows) { return DbRelation::insert(rows); }  // one at a time, checked
     virtual void del(Handle handle);
+    virtual void flush();  // _columns, too
 
 	/**
 	 * Get the columns and their attributes for a given table.
@@ -88,6 +94,7 @@ public:
 	// HeapTable overrides
     virtual void create();
     virtual Handle insert(const ValueDict* row);
+    virtual Handles* insert(const ValueDicts* rows) { return DbRelation::insert(rows); }  // one at a time, checked
 
 protected:
 	// hard-coded columns for the _columns table
@@ -138,6 +145,7 @@ public:
 
 	// overrides
 	virtual Handle insert(const ValueDict* row);
+	virtual Handles* insert(const ValueDicts* rows) { return DbRelation::insert(rows); }  // one at a time, checked
 	virtual void del(Handle handle);
 
 protected:
@@ -148,3 +156,176 @@ private:
 	static std::map<std::pair<Identifier,Identifier>,DbIndex*> index_cache;
 };
 
+
+/**
+ * @class Catalog - what _columns and _indices say, kept in memory
+ *
+ * Read from the schema tables once, by load() (from initialize_schema_tables), and from then on
+ * changed along with them by CREATE and DROP, one whole table or index at a time. Lookups are a
+ * hash table probe, so Tables::get_columns, Indices::get_columns, and Indices::get_index_names
+ * never scan the schema tables. Every change gets a new version number, for anything that keeps
+ * what it worked out from the catalog (like SQLExec's cached plans).
+ */
+class Catalog {
+public:
+	/**
+	 * Read all of _columns and _indices (replacing anything already known).
+	 */
+	static void load();
+
+	/**
+	 * @returns  the version of the catalog, which changes whenever anything in it does
+	 */
+	static uint64_t get_version() { return version; }
+
+	/**
+	 * The columns of a table (empty if there is no such table).
+	 */
+	static void get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes);
+
+	/**
+	 * The key columns and type of an index (column_names left empty if there is no such index).
+	 */
+	static void get_index(Identifier table_name, Identifier index_name, ColumnNames &column_names,
+						  bool &is_hash, bool &is_unique);
+
+	/**
+	 * The indices on a table, in the order they were created.
+	 */
+	static IndexNames get_index_names(Identifier table_name);
+
+	/**
+	 * Record a new table, once its rows are in _tables and _columns.
+	 */
+	static void add_table(Identifier table_name, const ColumnNames &column_names,
+						  const ColumnAttributes &column_attributes);
+
+	/**
+	 * Forget a table and its indices.
+	 */
+	static void drop_table(Identifier table_name);
+
+	/**
+	 * Record a new index, once its rows are in _indices.
+	 */
+	static void add_index(Identifier table_name, Identifier index_name, const ColumnNames &column_names,
+						  bool is_hash, bool is_unique);
+
+	/**
+	 * Forget an index.
+	 */
+	static void drop_index(Identifier table_name, Identifier index_name);
+
+protected:
+	struct IndexEntry {
+		ColumnNames column_names;
+		bool is_hash;
+		bool is_unique;
+	};
+	struct TableEntry {
+		ColumnNames column_names;
+		ColumnAttributes column_attributes;
+		IndexNames index_names;  // in the order they were created
+		std::unordered_map<Identifier, IndexEntry> indices;
+	};
+
+	static std::unordered_map<Identifier, TableEntry> tables;
+	static uint64_t version;
+};
+
+
+/**
+ * @class ColumnStatistics - what ANALYZE found out about one column of a table
+ */
+class ColumnStatistics {
+public:
+	ColumnStatistics() : row_count(0), block_count(0), distinct_count(0), min_value(), max_value(), bounds() {}
+
+	uint32_t row_count;       // rows in the table
+	uint32_t block_count;     // blocks in the table
+	uint32_t distinct_count;  // different values in the column
+	Value min_value;
+	Value max_value;
+	std::vector<Value> bounds;  // equi-depth histogram: highest value in each bucket (same number of rows in each)
+
+	/**
+	 * Estimate the fraction of the rows in which the column equals value.
+	 * A value that is the bound of several buckets is frequent enough to get its share of those
+	 * buckets; anything else in range gets an even share of the distinct values.
+	 * @param value  value to look for
+	 * @returns      fraction of rows, 0.0 to 1.0
+	 */
+	double eq_selectivity(const Value &value) const;
+
+	/**
+	 * Estimate the fraction of the rows in which the column is in a range. Each histogram bucket the
+	 * range overlaps counts in proportion to how much of it is covered (INT), or half of it (TEXT)
+	 * unless it's covered completely.
+	 * @param low   lowest value in the range (nullptr for none)
+	 * @param high  highest value in the range (nullptr for none)
+	 * @returns     fraction of rows, 0.0 to 1.0
+	 */
+	double range_selectivity(const Value *low, const Value *high) const;
+};
+
+
+/**
+ * @class Statistics - The singleton table that stores the optimizer statistics gathered by ANALYZE.
+ * One row for each column of each analyzed table. Values are kept as text, since columns of any
+ * type share the same rows, and the histogram is the list of bucket bounds, each written as
+ * <length>:<text>.
+ */
+class Statistics : public HeapTable {
+public:
+	/**
+	 * Name of the statistics table ("_statistics")
+	 */
+	static const Identifier TABLE_NAME;
+
+	/**
+	 * Number of buckets in each histogram
+	 */
+	static const uint HISTOGRAM_BUCKETS = 10;
+
+	/**
+	 * Longest text value kept (min, max, and histogram bounds are cut off there)
+	 */
+	static const uint MAX_VALUE_CHARS = 64;
+
+	// ctor/dtor
+	Statistics();
+	virtual ~Statistics() {}
+
+	/**
+	 * Scan the given table and replace its statistics.
+	 * @param table_name  table to analyze
+	 * @returns           number of rows in the table
+	 */
+	virtual uint32_t analyze(Identifier table_name);
+
+	/**
+	 * Get the statistics for a column.
+	 * @param table_name   table the column is in
+	 * @param column_name  column to get the statistics for
+	 * @param stats        returned by reference: the statistics
+	 * @returns            false if the table hasn't been analyzed
+	 */
+	virtual bool get_statistics(Identifier table_name, Identifier column_name, ColumnStatistics &stats);
+
+	/**
+	 * Throw away the statistics for a table (e.g., when it is dropped).
+	 * @param table_name  table to forget about
+	 */
+	virtual void forget(Identifier table_name);
+
+protected:
+	static ColumnNames& COLUMN_NAMES();
+	static ColumnAttributes& COLUMN_ATTRIBUTES();
+
+	static std::string encode(const Value &value);
+	static Value decode(const std::string &text, ColumnAttribute::DataType data_type);
+
+private:
+	std::map<Identifier,std::map<Identifier,ColumnStatistics>> cache;  // by table, then column
+	void load(Identifier table_name);
+};
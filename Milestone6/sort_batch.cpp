@@ -0,0 +1,111 @@
+/**
+ * @file sort_batch.cpp - implementation of:
+ * SortBatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#include <algorithm>
+#include "sort_batch.h"
+using namespace std;
+
+SortBatchCursor::SortBatchCursor(BatchCursor *input, const ColumnNames &column_names,
+								 const ColumnAttributes &column_attributes, const SortOrder &sort_order, bool distinct,
+								 size_t memory_budget, size_t top_n)
+		: BatchCursor(), input(input), sort(column_names, column_attributes, sort_order, memory_budget),
+		  distinct(distinct), batch(column_names, column_attributes), sorted(false), previous(nullptr),
+		  memory_budget(memory_budget), top_n(distinct ? 0 : top_n), use_top(false), top(), top_bytes(0), top_pos(0) {
+	// even empty rows wouldn't fit, so don't try
+	this->use_top = this->top_n > 0 && this->top_n <= memory_budget / (sizeof(Row) + sizeof(Row*));
+}
+
+SortBatchCursor::~SortBatchCursor() {
+	for (auto row: this->top)
+		delete row;
+	delete this->previous;
+	delete this->input;
+}
+
+ColumnBatch* SortBatchCursor::next() {
+	size_t n_columns = this->batch.get_column_names().size();
+	if (!this->sorted) {
+		this->sorted = true;
+		ColumnBatch *input_batch;
+		while ((input_batch = this->input->next()) != nullptr)
+			for (uint16_t row: input_batch->selection())
+				add(input_batch->get_row(row, n_columns));
+		if (this->use_top)
+			sort_heap(this->top.begin(), this->top.end(),
+					  [this](const Row *a, const Row *b) { return this->sort.less(a, b); });
+	}
+
+	this->batch.clear();
+	Row *row;
+	while (!this->batch.full() && next_row(row)) {
+		if (this->distinct && this->previous != nullptr && !this->sort.less(this->previous, row)) {
+			delete row;
+			continue;
+		}
+		this->batch.add_row(Handle());
+		for (uint col_num = 0; col_num < n_columns; col_num++) {
+			if (row->is_null(col_num))
+				this->batch.column(col_num).push_null();
+			else
+				this->batch.column(col_num).push_value((*row)[col_num]);
+		}
+		delete this->previous;
+		this->previous = row;
+	}
+	if (this->batch.size() == 0)
+		return nullptr;
+	this->batch.select_all();
+	return &this->batch;
+}
+
+// Take an input row: into the sort, or for top_n, into the heap if it's smaller than the biggest there.
+void SortBatchCursor::add(Row *row) {
+	if (!this->use_top) {
+		this->sort.add(row);
+		return;
+	}
+	auto less = [this](const Row *a, const Row *b) { return this->sort.less(a, b); };
+	if (this->top.size() < this->top_n) {
+		this->top.push_back(row);
+		push_heap(this->top.begin(), this->top.end(), less);
+		this->top_bytes += row->footprint() + sizeof(Row*);
+	} else if (less(row, this->top.front())) {
+		pop_heap(this->top.begin(), this->top.end(), less);
+		this->top_bytes -= this->top.back()->footprint();
+		delete this->top.back();
+		this->top.back() = row;
+		push_heap(this->top.begin(), this->top.end(), less);
+		this->top_bytes += row->footprint();
+	} else {
+		delete row;
+	}
+	if (this->top_bytes > this->memory_budget)
+		stop_using_top();
+}
+
+// The heap has outgrown memory_budget: sort everything (from here on) with the ExternalSort.
+void SortBatchCursor::stop_using_top() {
+	for (auto row: this->top)
+		this->sort.add(row);
+	this->top.clear();
+	this->top_bytes = 0;
+	this->use_top = false;
+}
+
+// The next row in sorted order (false at the end, or after top_n of them).
+bool SortBatchCursor::next_row(Row *&row) {
+	if (!this->use_top) {
+		if (this->top_n > 0 && this->top_pos >= this->top_n)
+			return false;
+		this->top_pos++;
+		return this->sort.next(row);
+	}
+	if (this->top_pos >= this->top.size())
+		return false;
+	row = this->top[this->top_pos];
+	this->top[this->top_pos++] = nullptr;
+	return true;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file sort_batch.h - Sorting (and de-duplicating) the output of a BatchCursor.
+ * SortBatchCursor: BatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2019"
+ */
+#pragma once
+
+#include "column_batch.h"
+#include "external_sort.h"
+
+/**
+ * @class SortBatchCursor - the rows of another BatchCursor in sorted order, for ORDER BY, DISTINCT,
+ * and the inputs of a merge join
+ *
+ * The first call to next() reads all of the input into an ExternalSort (which spills sorted runs
+ * to disk past memory_budget); after that the sorted rows are handed out a batch at a time.
+ * With distinct, rows that are equal on all of the sort columns after the first one are dropped,
+ * so for SELECT DISTINCT the sort order should cover every column.
+ *
+ * With top_n (ORDER BY ... LIMIT), only the first top_n rows are wanted, so instead of sorting
+ * everything the rows go through a bounded heap of the top_n smallest seen so far. The heap is held
+ * to memory_budget, too: if top_n rows can't fit, or the heap's rows outgrow it, its rows go into the
+ * ExternalSort instead (which spills) and only the first top_n of the sorted rows are handed out.
+ *
+ * The rows lose their handles on the way through; the output batches' handles are all (0, 0).
+ */
+class SortBatchCursor : public BatchCursor {
+public:
+	/**
+	 * @param input              batches to sort (owned by this cursor)
+	 * @param column_names       names of the input's columns
+	 * @param column_attributes  their attributes
+	 * @param sort_order         columns to sort by (by position in column_names)
+	 * @param distinct           drop rows equal on the sort columns to the one before?
+	 * @param memory_budget      how much of the input to hold in memory at once
+	 * @param top_n              how many of the first rows are wanted (0 for all; ignored with distinct)
+	 */
+	SortBatchCursor(BatchCursor *input, const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+					const SortOrder &sort_order, bool distinct=false,
+					size_t memory_budget=ExternalSort::DEFAULT_MEMORY_BUDGET, size_t top_n=0);
+	virtual ~SortBatchCursor();
+
+	virtual ColumnBatch* next();
+
+	/**
+	 * @returns  how many runs the sort spilled to disk so far
+	 */
+	virtual size_t get_run_count() const { return sort.get_run_count(); }
+
+protected:
+	BatchCursor *input;
+	ExternalSort sort;
+	bool distinct;
+	ColumnBatch batch;
+	bool sorted;
+	Row *previous;  // last row handed out (for distinct)
+	size_t memory_budget;
+	size_t top_n;
+	bool use_top;  // top_n rows are going through the heap (rather than sort)
+	Rows top;  // for top_n: a heap of the smallest rows (largest first), then those rows in order
+	size_t top_bytes;  // footprint of the rows in top
+	size_t top_pos;  // next of top to hand out (or how many of sort's rows have been handed out)
+
+	virtual void add(Row *row);
+	virtual void stop_using_top();
+	virtual bool next_row(Row *&row);
+};
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <cstring>
+#include <strings.h>
 #include <iostream>
 #include <string>
 #include <cassert>
@@ -13,7 +14,13 @@
 #include "SQLParser.h"
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
+#include "plan_cache.h"
 #include "btree.h"
+#include "hash_index.h"
+#include "filter_kernels.h"
+#include "predicate.h"
+#include "hash_join.h"
+#include "merge_join.h"
 using namespace std;
 using namespace hsql;
 
@@ -25,17 +32,23 @@ void initialize_environment(char *envHome);
 
 /**
  * Main entry point of the sql5300 program
- * @args dbenvpath  the path to the BerkeleyDB database environment
+ * @args dbenvpath      the path to the BerkeleyDB database environment
+ * @args buffer_frames  (optional) number of 4kB frames in the buffer pool
  */
 int main(int argc, char *argv[]) {
 
 	// Open/create the db enviroment
-	if (argc != 2) {
-		cerr << "Usage: cpsc5300: dbenvpath" << endl;
+	if (argc != 2 && argc != 3) {
+		cerr << "Usage: cpsc5300: dbenvpath [buffer_frames]" << endl;
 		return 1;
 	}
+	if (argc == 3)
+		BufferPool::pool().set_frame_budget((uint) atoi(argv[2]));
 	initialize_environment(argv[1]);
 
+	// Lines of SQL already parsed (and planned)
+	PlanCache plan_cache;
+
 	// Enter the SQL shell loop
 	while (true) {
 		cout << "SQL> ";
@@ -43,25 +56,46 @@ int main(int argc, char *argv[]) {
 		getline(cin, query);
 		if (query.length() == 0)
 			continue;  // blank line -- just skip
-		if (query == "quit")
+		if (query == "quit") {
+			BufferPool::pool().checkpoint();  // write back anything still pending
 			break;  // only way to get out
+		}
 		if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+            cout << "test_hash_index: " << (test_hash_index() ? "ok" : "failed") << endl;
+            cout << "test_filter_kernels: " << (test_filter_kernels() ? "ok" : "failed") << endl;
+            cout << "test_predicate: " << (test_predicate() ? "ok" : "failed") << endl;
+            cout << "test_hash_join: " << (test_hash_join() ? "ok" : "failed") << endl;
+            cout << "test_merge_join: " << (test_merge_join() ? "ok" : "failed") << endl;
+			continue;
+		}
+		if (strncasecmp(query.c_str(), "analyze ", 8) == 0) {
+			string table_name = query.substr(8);
+			table_name.erase(0, table_name.find_first_not_of(' '));
+			table_name.erase(table_name.find_last_not_of(" ;") + 1);
+			cout << "ANALYZE " << table_name << endl;
+			try {
+				QueryResult *result = SQLExec::analyze(table_name);
+				cout << *result << endl;
+				delete result;
+			} catch (SQLExecError& e) {
+				cout << "Error: " << e.what() << endl;
+			}
 			continue;
 		}
 
-		// parse and execute
-		SQLParserResult* parse = SQLParser::parseSQLString(query);
-		if (!parse->isValid()) {
+		// parse (unless it's cached) and execute
+		string error;
+		CachedStatements *statements = plan_cache.get(query, error);
+		if (statements == nullptr) {
 			cout << "invalid SQL: " << query << endl;
-			cout << parse->errorMsg() << endl;
+			cout << error << endl;
 		} else {
-			for (uint i = 0; i < parse->size(); ++i) {
-				const SQLStatement *statement = parse->getStatement(i);
+			for (uint i = 0; i < statements->size(); ++i) {
 				try {
-					cout << ParseTreeToString::statement(statement) << endl;
-					QueryResult *result = SQLExec::execute(statement);
+					cout << statements->get_text(i) << endl;
+					QueryResult *result = statements->execute(i);
 					cout << *result << endl;
 					delete result;
 				} catch (SQLExecError& e) {
@@ -69,7 +103,6 @@ int main(int argc, char *argv[]) {
 				}
 			}
 		}
-		delete parse;
 	}
 	return EXIT_SUCCESS;
 }
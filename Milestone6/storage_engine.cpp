@@ -43,6 +43,77 @@ std::ostream &operator<<(std::ostream &out, const Value &value) {
     return out;
 }
 
+Row::Row(const ValueDict &dict, const ColumnNames &column_names)
+        : values(column_names.size()), present(column_names.size(), false) {
+    for (uint col_num = 0; col_num < column_names.size(); col_num++) {
+        auto it = dict.find(column_names[col_num]);
+        if (it != dict.end())
+            set(col_num, it->second);
+    }
+}
+
+size_t Row::footprint() const {
+    size_t bytes = sizeof(Row) + size() * (sizeof(Value) + 1);
+    for (auto const& value: this->values)
+        bytes += value.s.size();
+    return bytes;
+}
+
+ValueDict* Row::to_dict(const ColumnNames &column_names) const {
+    ValueDict *ret = new ValueDict();
+    for (uint col_num = 0; col_num < column_names.size() && col_num < size(); col_num++)
+        if (!is_null(col_num))
+            (*ret)[column_names[col_num]] = this->values[col_num];
+    return ret;
+}
+
+// Position of the given column in the relation, or -1 if there isn't one.
+int DbRelation::column_number(const Identifier &column_name) const {
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++)
+        if (this->column_names[col_num] == column_name)
+            return (int)col_num;
+    return -1;
+}
+
+ColumnNumbers* DbRelation::column_numbers(const ColumnNames* column_names) const {
+    ColumnNumbers *ret = new ColumnNumbers();
+    if (column_names == nullptr) {
+        for (uint col_num = 0; col_num < this->column_names.size(); col_num++)
+            ret->push_back(col_num);
+        return ret;
+    }
+    for (auto const& column_name: *column_names) {
+        int col_num = column_number(column_name);
+        if (col_num < 0) {
+            delete ret;
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        }
+        ret->push_back((uint)col_num);
+    }
+    return ret;
+}
+
+RowPredicates* DbRelation::resolve_where(const ValueDict* where, const ColumnNames* where_order) const {
+    RowPredicates *ret = new RowPredicates();
+    if (where == nullptr)
+        return ret;
+    ColumnNames order;
+    if (where_order != nullptr)
+        order = *where_order;
+    else
+        for (auto const& column: *where)
+            order.push_back(column.first);
+    for (auto const& column_name: order) {
+        int col_num = column_number(column_name);
+        if (col_num < 0) {
+            delete ret;
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        }
+        ret->push_back(std::pair<uint, Value>((uint)col_num, where->at(column_name)));
+    }
+    return ret;
+}
+
 // Get only selected column attributes
 ColumnAttributes* DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
@@ -66,6 +137,19 @@ ValueDict* DbRelation::project(Handle handle, const ValueDict* where) {
     return this->project(handle, &t);
 }
 
+// By default, pick the columns out of the ValueDict projection
+Row* DbRelation::project_row(Handle handle, const ColumnNumbers* col_nums) {
+    ValueDict *dict = project(handle);
+    Row *row = new Row(col_nums->size());
+    for (uint i = 0; i < col_nums->size(); i++) {
+        auto it = dict->find(this->column_names[(*col_nums)[i]]);
+        if (it != dict->end())
+            row->set(i, it->second);
+    }
+    delete dict;
+    return row;
+}
+
 
 // Do a projection for each of a list of handles
 ValueDicts* DbRelation::project(Handles *handles) {
@@ -94,3 +178,88 @@ ValueDicts* DbRelation::project(Handles *handles, const ValueDict* where) {
     return ret;
 }
 
+
+// By default, insert the rows one at a time
+Handles* DbRelation::insert(const ValueDicts* rows) {
+    Handles *handles = new Handles();
+    try {
+        for (auto const& row: *rows)
+            handles->push_back(insert(row));
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    return handles;
+}
+
+// By default, insert the entries one at a time
+void DbIndex::insert(const Handles* records) {
+    for (auto const& record: *records)
+        insert(record);
+}
+
+// By default, drain a cursor over the range
+Handles* DbIndex::range(ValueDict* min_key, ValueDict* max_key) const {
+    DbIndexCursor* cursor = this->cursor(min_key, max_key);
+    Handles* handles = new Handles;
+    Handle handle;
+    while (cursor->next(handle))
+        handles->push_back(handle);
+    delete cursor;
+    return handles;
+}
+
+// By default, just walk the materialized select(where)
+DbRelationCursor* DbRelation::cursor(const ValueDict* where) {
+    return new HandlesCursor(*this, select(where));
+}
+
+// By default, count the rows a cursor goes through
+uint32_t DbRelation::count() {
+    DbRelationCursor* rows = cursor();
+    uint32_t n = 0;
+    Handle handle;
+    while (rows->next(handle))
+        n++;
+    delete rows;
+    return n;
+}
+
+// Project all the columns of the current row
+ValueDict* DbRelationCursor::project() {
+    return this->relation.project(this->current);
+}
+
+// Project the given columns of the current row
+ValueDict* DbRelationCursor::project(const ColumnNames* column_names) {
+    return this->relation.project(this->current, column_names);
+}
+
+// Project the columns at the given positions of the current row
+Row* DbRelationCursor::project_row(const ColumnNumbers* col_nums) {
+    return this->relation.project_row(this->current, col_nums);
+}
+
+// Next handle from the list
+bool HandlesCursor::next(Handle &handle) {
+    if (this->handles == nullptr || this->i >= this->handles->size())
+        return false;
+    handle = this->current = (*this->handles)[this->i++];
+    return true;
+}
+
+bool HandlesIndexCursor::next(Handle &handle) {
+    if (this->handles == nullptr || this->i >= this->handles->size())
+        return false;
+    handle = (*this->handles)[this->i++];
+    return true;
+}
+
+// Next handle from the index
+bool IndexCursor::next(Handle &handle) {
+    if (!this->input->next(handle))
+        return false;
+    this->current = handle;
+    return true;
+}
+
@@ -2,7 +2,9 @@
  * @file storage_engine.h - Storage engine abstract classes.
  * DbBlock
  * DbFile
+ * DbFileCursor
  * DbRelation
+ * DbRelationCursor
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
@@ -133,7 +135,24 @@ protected:
 };
 
 // convenience type alias
-typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<BlockID> BlockIDs;  // prefer DbFile::cursor() for scans
+
+/**
+ * @class DbFileCursor - abstract base class for iterating over the blocks of a DbFile
+ * without materializing the whole list of BlockIDs.
+ * 	next(block_id)
+ */
+class DbFileCursor {
+public:
+	virtual ~DbFileCursor() {}
+
+	/**
+	 * Advance to the next block in the file.
+	 * @param block_id  returned by reference: the id of the next block
+	 * @returns         false if there are no more blocks
+	 */
+	virtual bool next(BlockID &block_id) = 0;
+};
 
 /**
  * @class DbFile - abstract base class which represents a disk-based collection of DbBlocks
@@ -145,6 +164,7 @@ typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an
  *	get(block_id)
  *	put(block)
  *	block_ids()
+ *	cursor()
  */
 class DbFile {
 public:
@@ -193,11 +213,17 @@ public:
 
 	/**
 	 * Get a list of all the valid BlockID's in the file
-	 * FIXME - not a good long-term approach, but we'll do this until we put in iterators
+	 * Materializes the whole list; scans should use cursor() instead.
 	 * @returns  a pointer to vector of BlockIDs (freed by caller)
 	 */ 
 	virtual BlockIDs* block_ids() const = 0;
 
+	/**
+	 * Get a cursor over all the valid BlockID's in the file.
+	 * @returns  a pointer to a cursor positioned before the first block (freed by caller)
+	 */
+	virtual DbFileCursor* cursor() const = 0;
+
 protected:
 	std::string name;  // filename (or part of it)
 };
@@ -236,7 +262,7 @@ public:
 
 	Value() : n(0) {data_type = ColumnAttribute::INT;}
 	Value(int32_t n) : n(n) {data_type = ColumnAttribute::INT;}
-	Value(std::string s) : s(s) {data_type = ColumnAttribute::TEXT; }
+	Value(std::string s) : n(0), s(s) {data_type = ColumnAttribute::TEXT; }
 
 	bool operator==(const Value &other) const;
 	bool operator!=(const Value &other) const;
@@ -250,9 +276,50 @@ typedef std::string Identifier;
 typedef std::vector<Identifier> ColumnNames;
 typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
-typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<Handle> Handles;  // prefer DbRelation::cursor() for scans
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict*> ValueDicts;
+typedef std::vector<uint> ColumnNumbers;  // column positions, e.g., from DbRelation::column_numbers
+typedef std::vector<std::pair<uint, Value>> RowPredicates;  // where clause resolved to column positions
+
+
+/**
+ * @class Row - the values of a row by column position (where a ValueDict goes by column name)
+ *
+ * The positions are those of some list of column names that is resolved once up front (the
+ * relation's get_column_names(), a query's projection, etc.), so getting at a value is just an
+ * index. A column that hasn't been set is NULL.
+ */
+class Row {
+public:
+	Row() : values(), present() {}
+	explicit Row(size_t n_columns) : values(n_columns), present(n_columns, false) {}
+	Row(const ValueDict &dict, const ColumnNames &column_names);  // columns missing from dict are NULL
+
+	size_t size() const { return values.size(); }
+	bool is_null(uint col_num) const { return !present[col_num]; }
+	const Value& operator[](uint col_num) const { return values[col_num]; }
+	void set(uint col_num, const Value &value) { values[col_num] = value; present[col_num] = true; }
+	void set_null(uint col_num) { values[col_num] = Value(); present[col_num] = false; }
+
+	/**
+	 * Convert back to a ValueDict (NULL columns are left out).
+	 * @param column_names  the names of the columns, in position order
+	 * @returns             the row keyed by column name (freed by caller)
+	 */
+	ValueDict* to_dict(const ColumnNames &column_names) const;
+
+	/**
+	 * @returns  roughly how many bytes of memory the row takes up (for operators with a memory budget)
+	 */
+	size_t footprint() const;
+
+protected:
+	std::vector<Value> values;
+	std::vector<bool> present;
+};
+
+typedef std::vector<Row*> Rows;
 
 
 /**
@@ -264,6 +331,10 @@ public:
 };
 
 
+class DbRelationCursor; // forward declare
+class BatchCursor; // forward declare (see column_batch.h)
+class DbIndexCursor; // forward declare
+
 /**
  * @class DbRelation - top-level object handling a physical database relation
  * 
@@ -276,12 +347,19 @@ public:
  * 	close()
  * 	
  *	insert(row)
+ *	insert(rows)
  *	update(handle, new_values)
  *	del(handle)
  *	select()
  *	select(where)
+ *	cursor(where)
+ *	cursor(where, where_order)
+ *	count()
+ *	batch_cursor(column_names, where, where_order)
+ *	batch_cursor(handles, column_names, where)
  *	project(handle)
  *	project(handle, column_names)
+ *	project_row(handle, col_nums)
  */
 class DbRelation {
 public:
@@ -326,6 +404,14 @@ public:
 	 */
 	virtual Handle insert(const ValueDict* row) = 0;
 
+	/**
+	 * Execute: INSERT INTO <table_name> ( <row_keys> ) VALUES ( <row_values> ), ...
+	 * By default just inserts them one at a time.
+	 * @param rows  dictionaries keyed by column names
+	 * @returns     handles to the new rows, in the same order (caller frees)
+	 */
+	virtual Handles* insert(const ValueDicts* rows);
+
 	/**
 	 * Conceptually, execute: UPDATE INTO <table_name> SET <new_valus> WHERE <handle>
 	 * where handle is sufficient to identify one specific record (e.g., returned
@@ -365,6 +451,47 @@ public:
 	 */
 	virtual Handles* select(Handles* current_selection, const ValueDict* where) = 0;
 
+	/**
+	 * Streaming version of select(where): yields qualifying handles one at a time.
+	 * The default implementation just walks the materialized select(where).
+	 * @param where  where-clause predicates (nullptr for all rows)
+	 * @returns      a pointer to a cursor over qualifying rows (freed by caller)
+	 */
+	virtual DbRelationCursor* cursor(const ValueDict* where=nullptr);
+
+	/**
+	 * Same as cursor(where), but suggests an order to check the predicates in (cheapest
+	 * or most selective first). By default the order is ignored.
+	 * @param where        where-clause predicates
+	 * @param where_order  the columns of where, in the order to check them
+	 * @returns            a pointer to a cursor over qualifying rows (freed by caller)
+	 */
+	virtual DbRelationCursor* cursor(const ValueDict* where, const ColumnNames* where_order) {
+		return cursor(where);
+	}
+
+	/**
+	 * Column-at-a-time version of cursor(where, where_order): the qualifying rows come back in
+	 * ColumnBatches holding just the given columns. By default the rows of cursor(where, where_order)
+	 * are gathered up into batches (see column_batch.cpp).
+	 * @param column_names  columns to put in the batches (nullptr for all)
+	 * @param where         where-clause predicates (nullptr for all rows)
+	 * @param where_order   the columns of where, in the order to check them (nullptr for any)
+	 * @returns             a pointer to a cursor over batches of qualifying rows (freed by caller)
+	 */
+	virtual BatchCursor* batch_cursor(const ColumnNames* column_names, const ValueDict* where=nullptr,
+									  const ColumnNames* where_order=nullptr);
+
+	/**
+	 * Column-at-a-time version of cursor(IndexCursor(handles), where): the rows an index cursor points
+	 * at, in its order. By default they are fetched a row at a time and gathered up into batches.
+	 * @param handles       the rows' handles (owned by the returned cursor)
+	 * @param column_names  columns to put in the batches (nullptr for all)
+	 * @param where         where-clause predicates the rows must also satisfy (nullptr for none)
+	 * @returns             a pointer to a cursor over batches of qualifying rows (freed by caller)
+	 */
+	virtual BatchCursor* batch_cursor(DbIndexCursor* handles, const ColumnNames* column_names, const ValueDict* where);
+
 	/**
 	 * Return a sequence of all values for handle (SELECT *).
 	 * @param handle  row to get values from
@@ -390,6 +517,15 @@ public:
 	 */
 	virtual ValueDict* project(Handle handle, const ValueDict* column_names);
 
+	/**
+	 * Return the values for handle of the columns at the given positions, as a Row (position i of
+	 * the row is column (*col_nums)[i]). By default they're taken from project(handle).
+	 * @param handle    row to get values from
+	 * @param col_nums  the columns' positions (see column_numbers)
+	 * @returns         the values, NULL where the row has none (freed by caller)
+	 */
+	virtual Row* project_row(Handle handle, const ColumnNumbers* col_nums);
+
 	// additional versions of project for multiple rows
 	virtual ValueDicts* project(Handles *handles);
 	virtual ValueDicts* project(Handles *handles, const ColumnNames* column_names);
@@ -420,6 +556,29 @@ public:
 	 */
 	virtual ColumnAttributes* get_column_attributes(const ColumnNames &select_column_names) const;
 
+	/**
+	 * Position of a column in the relation.
+	 * @param column_name  column to look for
+	 * @returns            its position in get_column_names(), or -1 if there is no such column
+	 */
+	virtual int column_number(const Identifier &column_name) const;
+
+	/**
+	 * Resolve column names to positions once, so rows can be worked on by position (see Row).
+	 * @param column_names  columns to look up (nullptr for all of them, in order)
+	 * @returns             their positions (freed by caller)
+	 */
+	virtual ColumnNumbers* column_numbers(const ColumnNames* column_names) const;
+
+	/**
+	 * Resolve a where clause to column positions once, so it can be checked against each row
+	 * without looking any names up.
+	 * @param where        where-clause predicates
+	 * @param where_order  the columns of where, in the order to check them (nullptr for any)
+	 * @returns            the predicates, in the order to check them (freed by caller)
+	 */
+	virtual RowPredicates* resolve_where(const ValueDict* where, const ColumnNames* where_order=nullptr) const;
+
 	/**
 	 * Accessor method for table_name
 	 * @returns  table_name
@@ -428,12 +587,128 @@ public:
 		return table_name;
 	}
 
+	/**
+	 * How many blocks the relation takes up on disk (for costing a full scan).
+	 * @returns  number of blocks (0 if not known)
+	 */
+	virtual uint32_t get_block_count() {
+		return 0;
+	}
+
+	/**
+	 * How many rows the relation has. By default the rows are walked with a cursor.
+	 * @returns  number of rows
+	 */
+	virtual uint32_t count();
+
 protected:
 	Identifier table_name;
 	ColumnNames column_names;
 	ColumnAttributes column_attributes;
 };
 
+/**
+ * @class DbRelationCursor - abstract base class for iterating over the qualifying rows of
+ * a DbRelation one at a time.
+ * 	next(handle)
+ * 	project()
+ * 	project(column_names)
+ * 	project_row(col_nums)
+ */
+class DbRelationCursor {
+public:
+	DbRelationCursor(DbRelation &relation) : relation(relation), current() {}
+	virtual ~DbRelationCursor() {}
+
+	/**
+	 * Advance to the next qualifying row.
+	 * @param handle  returned by reference: the handle of the next row
+	 * @returns       false if there are no more rows
+	 */
+	virtual bool next(Handle &handle) = 0;
+
+	/**
+	 * Return all values of the row the cursor is currently on (SELECT *).
+	 * @returns  dictionary of values from row (freed by caller)
+	 */
+	virtual ValueDict* project();
+
+	/**
+	 * Return the given values of the row the cursor is currently on.
+	 * @param column_names  list of column names to project
+	 * @returns             dictionary of values from row (freed by caller)
+	 */
+	virtual ValueDict* project(const ColumnNames* column_names);
+
+	/**
+	 * Return the values of the columns at the given positions of the row the cursor is currently on.
+	 * @param col_nums  the columns' positions in the relation (see DbRelation::column_numbers)
+	 * @returns         the values as a Row, by position in col_nums (freed by caller)
+	 */
+	virtual Row* project_row(const ColumnNumbers* col_nums);
+
+	/**
+	 * Accessor for the relation this cursor is scanning.
+	 * @returns  the relation
+	 */
+	virtual DbRelation& get_relation() const { return relation; }
+
+protected:
+	DbRelation &relation;
+	Handle current;
+};
+
+/**
+ * @class HandlesCursor - DbRelationCursor over an already materialized list of handles
+ */
+class HandlesCursor : public DbRelationCursor {
+public:
+	HandlesCursor(DbRelation &relation, Handles* handles) : DbRelationCursor(relation), handles(handles), i(0) {}
+	virtual ~HandlesCursor() { delete handles; }
+	HandlesCursor(const HandlesCursor& other) = delete;
+	HandlesCursor& operator=(const HandlesCursor& other) = delete;
+
+	virtual bool next(Handle &handle);
+
+protected:
+	Handles* handles;
+	size_t i;
+};
+
+/**
+ * @class DbIndexCursor - abstract base class for walking the entries of a DbIndex in key order
+ * 	next(handle)
+ */
+class DbIndexCursor {
+public:
+	DbIndexCursor() {}
+	virtual ~DbIndexCursor() {}
+
+	/**
+	 * Advance to the next entry in key order.
+	 * @param handle  returned by reference: the handle (into the relation) of the next entry
+	 * @returns       false if there are no more entries
+	 */
+	virtual bool next(Handle &handle) = 0;
+};
+
+/**
+ * @class HandlesIndexCursor - DbIndexCursor over an already materialized list of handles
+ */
+class HandlesIndexCursor : public DbIndexCursor {
+public:
+	HandlesIndexCursor(Handles* handles) : DbIndexCursor(), handles(handles), i(0) {}
+	virtual ~HandlesIndexCursor() { delete handles; }
+	HandlesIndexCursor(const HandlesIndexCursor& other) = delete;
+	HandlesIndexCursor& operator=(const HandlesIndexCursor& other) = delete;
+
+	virtual bool next(Handle &handle);
+
+protected:
+	Handles* handles;
+	size_t i;
+};
+
 class DbIndex {
 public:
 	/**
@@ -473,13 +748,33 @@ public:
 	 */
     virtual Handles* lookup(ValueDict* key_values) const = 0;
 
+	/**
+	 * Walk the entries for a specific search key, so the caller can stop whenever it likes.
+	 * By default just goes through lookup(key_values).
+	 * @param key_values  dictionary of values for the search key
+	 * @returns           cursor over the entries with key_values (freed by caller, before the index)
+	 */
+    virtual DbIndexCursor* lookup_cursor(ValueDict* key_values) const {
+        return new HandlesIndexCursor(lookup(key_values));
+    }
+
 	/**
 	 * Lookup a range of search keys.
+	 * By default just collects everything from cursor(min_key, max_key).
 	 * @param min_key  dictionary of min (inclusive) search key
 	 * @param max_key  dictionary of max (inclusive) search key
 	 * @returns        list of DbFile handles for records in range
 	 */
-    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const {
+    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+
+	/**
+	 * Walk a range of search keys in key order, so the caller can stop whenever it likes.
+	 * Either key may be nullptr for no bound, or hold just the leading key columns.
+	 * @param min_key  dictionary of min (inclusive) search key
+	 * @param max_key  dictionary of max (inclusive) search key
+	 * @returns        cursor over the entries in range (freed by caller, before the index)
+	 */
+    virtual DbIndexCursor* cursor(const ValueDict* min_key, const ValueDict* max_key) const {
         throw DbRelationError("range index query not supported");
     }
 
@@ -490,6 +785,13 @@ public:
 	 */
     virtual void insert(Handle record) = 0;
 
+	/**
+	 * Insert the index entries for a batch of records.
+	 * By default just inserts them one at a time.
+	 * @param records  handles (into relation) to the records to insert
+	 */
+    virtual void insert(const Handles* records);
+
 	/**
 	 * Delete the index entry for the given record.
 	 * @param record  handle (into relation) to the record to remove
@@ -497,6 +799,18 @@ public:
 	 */
     virtual void del(Handle record) = 0;
 
+	/**
+	 * Can entries be deleted from this kind of index? If not, del() throws, so a caller changing the
+	 * relation has to check every index up front, before removing anything.
+	 */
+    virtual bool can_delete() const { return true; }
+
+	/**
+	 * Accessor for the columns in the search key.
+	 * @returns  key column names, in order
+	 */
+    virtual const ColumnNames& get_key_columns() const { return key_columns; }
+
 protected:
     DbRelation& relation;
     Identifier name;
@@ -504,3 +818,19 @@ protected:
     bool unique;
 };
 
+/**
+ * @class IndexCursor - DbRelationCursor over the rows an index cursor points at
+ */
+class IndexCursor : public DbRelationCursor {
+public:
+	IndexCursor(DbRelation &relation, DbIndexCursor* input) : DbRelationCursor(relation), input(input) {}
+	virtual ~IndexCursor() { delete input; }
+	IndexCursor(const IndexCursor& other) = delete;
+	IndexCursor& operator=(const IndexCursor& other) = delete;
+
+	virtual bool next(Handle &handle);
+
+protected:
+	DbIndexCursor* input;
+};
+